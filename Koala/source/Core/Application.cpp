@@ -4,6 +4,8 @@
 #include <stb_image/stb_image.h>
 #include <tiny_obj_loader/tiny_obj_loader.h>
 
+#include <algorithm>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <stdexcept>
@@ -78,6 +80,109 @@ static Wrap gltf_wrap_to_wrap(int wrap) {
 		return Wrap::Repeat;
 }
 
+// Components are floats or normalized integers, which EXT_mesh_gpu_instancing allows for rotation and scale
+template<typename T, int N>
+static std::vector<T> load_gltf_float_accessor(const tinygltf::Model& gltf_model, int accessor_id) {
+	const tinygltf::Accessor& accessor = gltf_model.accessors[accessor_id];
+	const tinygltf::BufferView& view = gltf_model.bufferViews[accessor.bufferView];
+	const tinygltf::Buffer& buffer = gltf_model.buffers[view.buffer];
+
+	if (accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT && !accessor.normalized)
+		throw std::runtime_error("Instancing attribute component type not supported");
+	if (tinygltf::GetNumComponentsInType(accessor.type) != N)
+		throw std::runtime_error("Instancing attribute type not supported");
+
+	int component_size = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+	int stride = accessor.ByteStride(view);
+	if (component_size <= 0 || stride <= 0)
+		throw std::runtime_error("Instancing attribute has invalid byte stride");
+
+	size_t offset = accessor.byteOffset + view.byteOffset;
+	if (accessor.count > 0 && offset + (accessor.count - 1) * stride + N * component_size > buffer.data.size())
+		throw std::runtime_error("Instancing attribute is out of buffer bounds");
+
+	// Normalized integers are decoded as in glTF spec, signed ones are clamped so both -128 and -127 map to -1
+	auto read_component = [&](const uint8_t* data) -> float {
+		switch (accessor.componentType) {
+		case TINYGLTF_COMPONENT_TYPE_FLOAT: {
+			float value;
+			memcpy(&value, data, sizeof(value));
+			return value;
+		}
+		case TINYGLTF_COMPONENT_TYPE_BYTE: {
+			int8_t value;
+			memcpy(&value, data, sizeof(value));
+			return std::max(value / 127.0f, -1.0f);
+		}
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: {
+			uint8_t value;
+			memcpy(&value, data, sizeof(value));
+			return value / 255.0f;
+		}
+		case TINYGLTF_COMPONENT_TYPE_SHORT: {
+			int16_t value;
+			memcpy(&value, data, sizeof(value));
+			return std::max(value / 32767.0f, -1.0f);
+		}
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+			uint16_t value;
+			memcpy(&value, data, sizeof(value));
+			return value / 65535.0f;
+		}
+		default:
+			throw std::runtime_error("Instancing attribute component type not supported");
+		}
+	};
+
+	std::vector<T> values;
+	values.reserve(accessor.count);
+	for (size_t i = 0; i < accessor.count; i++) {
+		const uint8_t* element = &buffer.data[offset + i * stride];
+
+		float components[N];
+		for (int j = 0; j < N; j++)
+			components[j] = read_component(element + j * component_size);
+
+		T value;
+		memcpy(&value, components, sizeof(components));
+		values.push_back(value);
+	}
+
+	return values;
+}
+
+static std::vector<glm::mat4> load_gltf_instances(const tinygltf::Value& extension, const tinygltf::Model& gltf_model) {
+	if (!extension.Has("attributes"))
+		return {};
+
+	const tinygltf::Value& attributes = extension.Get("attributes");
+
+	std::vector<glm::vec3> translations;
+	std::vector<glm::quat> rotations;
+	std::vector<glm::vec3> scales;
+
+	if (attributes.Has("TRANSLATION"))
+		translations = load_gltf_float_accessor<glm::vec3, 3>(gltf_model, attributes.Get("TRANSLATION").GetNumberAsInt());
+	if (attributes.Has("ROTATION"))
+		rotations = load_gltf_float_accessor<glm::quat, 4>(gltf_model, attributes.Get("ROTATION").GetNumberAsInt());
+	if (attributes.Has("SCALE"))
+		scales = load_gltf_float_accessor<glm::vec3, 3>(gltf_model, attributes.Get("SCALE").GetNumberAsInt());
+
+	size_t instance_count = std::max({ translations.size(), rotations.size(), scales.size() });
+
+	std::vector<glm::mat4> instances;
+	instances.reserve(instance_count);
+	for (size_t i = 0; i < instance_count; i++) {
+		glm::vec3 translation = i < translations.size() ? translations[i] : glm::vec3(0.0f);
+		glm::quat rotation = i < rotations.size() ? rotations[i] : glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+		glm::vec3 scale = i < scales.size() ? scales[i] : glm::vec3(1.0f);
+
+		instances.push_back(glm::translate(glm::mat4(1.0f), translation) * glm::toMat4(rotation) * glm::scale(glm::mat4(1.0f), scale));
+	}
+
+	return instances;
+}
+
 static std::unique_ptr<Node> load_gltf_node(Node* parent, std::vector<MaterialId>& material_ids, tinygltf::Node& gltf_node, tinygltf::Model& gltf_model, std::vector<Vertex>& vertex_buffer, std::vector<uint32_t>& index_buffer) {
 	std::unique_ptr<Node> node = std::make_unique<Node>(parent);
 
@@ -90,6 +195,10 @@ static std::unique_ptr<Node> load_gltf_node(Node* parent, std::vector<MaterialId
 	if (gltf_node.matrix.size() == 16)
 		node->matrix = glm::make_mat4(gltf_node.matrix.data());
 
+	auto instancing_it = gltf_node.extensions.find("EXT_mesh_gpu_instancing");
+	if (instancing_it != gltf_node.extensions.end())
+		node->instance_matrices = load_gltf_instances(instancing_it->second, gltf_model);
+
 	node->children.reserve(gltf_node.children.size());
 	for (size_t i = 0; i < gltf_node.children.size(); i++)
 		node->children.push_back(load_gltf_node(node.get(), material_ids, gltf_model.nodes[gltf_node.children[i]], gltf_model, vertex_buffer, index_buffer));
@@ -398,6 +507,10 @@ Model Application::load_gltf_model(const std::filesystem::path& filename) {
 		model.nodes.push_back(load_gltf_node(nullptr, model.materials, gltf_node, gltf_model, vertex_buffer, index_buffer));
 	}
 
+	// Nodes don't move after loading, so their world matrices are uploaded once
+	for (auto& node : model.nodes)
+		node_transforms_create(*node, glm::mat4(1.0f));
+
 	if (!vertex_buffer.empty())
 		model.vertex_buffer_id = m_renderer.vertex_buffer_create(vertex_buffer.data(), vertex_buffer.size());
 	if (!index_buffer.empty())
@@ -406,25 +519,51 @@ Model Application::load_gltf_model(const std::filesystem::path& filename) {
 	return model;
 }
 
-void Application::draw_node(const Node& node, const Model& model, const glm::mat4& matrix) {
-	MY_PROFILE_FUNCTION();
-
+void Application::node_transforms_create(Node& node, const glm::mat4& matrix) {
 	glm::mat4 new_matrix = matrix * node.local_matrix();
 
-	for (const Primitive& primitive : node.primitives) {
-		m_renderer.draw_primitive(
-			new_matrix,
-			model.vertex_buffer_id,
-			model.index_buffer_id,
-			primitive.first_index,
-			primitive.index_count,
-			primitive.vertex_count,
-			primitive.material_id
-		);
+	if (!node.primitives.empty()) {
+		if (node.instance_matrices.empty())
+			node.transforms.push_back(m_renderer.transform_create(new_matrix));
+		else {
+			for (const glm::mat4& instance_matrix : node.instance_matrices)
+				node.transforms.push_back(m_renderer.transform_create(new_matrix * instance_matrix));
+		}
+	}
+
+	for (auto& child : node.children)
+		node_transforms_create(*child, new_matrix);
+}
+
+void Application::node_transforms_destroy(Node& node) {
+	for (TransformId transform : node.transforms)
+		m_renderer.transform_destroy(transform);
+	node.transforms.clear();
+
+	for (auto& child : node.children)
+		node_transforms_destroy(*child);
+}
+
+void Application::draw_node(const Node& node, const Model& model) {
+	MY_PROFILE_FUNCTION();
+
+	// Renderer merges identical primitives into instanced draws, so every instance is submitted as a regular primitive
+	for (TransformId transform : node.transforms) {
+		for (const Primitive& primitive : node.primitives) {
+			m_renderer.draw_primitive(
+				transform,
+				model.vertex_buffer_id,
+				model.index_buffer_id,
+				primitive.first_index,
+				primitive.index_count,
+				primitive.vertex_count,
+				primitive.material_id
+			);
+		}
 	}
 
 	for (const auto& node : node.children)
-		draw_node(*node, model, new_matrix);
+		draw_node(*node, model);
 }
 
 Application::Application(const ApplicationProperties& props) {
@@ -440,10 +579,17 @@ Application::Application(const ApplicationProperties& props) {
 
 	m_window.initialize(window_props);
 
-	m_renderer.create(m_window.context());
+	RendererSettings renderer_settings{
+		.dynamic_resolution = true,
+		.target_gpu_time = 1000.0f / 60.0f,
+		.temporal_upscaling = true
+	};
+	m_renderer.create(m_window.context(), renderer_settings);
 
-	float resolution_coef = 1.0f;
-	m_renderer.set_resolution((uint32_t)(resolution_coef * 1280), (uint32_t)(resolution_coef * 720));
+	// Rendered at two thirds of window resolution and upscaled temporally.
+	// That is max resolution, dynamic resolution renders into part of it when GPU time goes over target
+	m_renderer.set_output_resolution(props.width, props.height);
+	m_renderer.set_resolution(props.width * 2 / 3, props.height * 2 / 3);
 
 	uint32_t shadow_map_resolution = 2048 * 1;
 	m_renderer.set_shadow_map_resolution(shadow_map_resolution, shadow_map_resolution);
@@ -506,6 +652,9 @@ Application::Application(const ApplicationProperties& props) {
 
 Application::~Application() {
 	for (auto& model : m_models) {
+		for (auto& node : model.nodes)
+			node_transforms_destroy(*node);
+
 		m_renderer.materials_destroy(model.materials.data(), model.materials.size());
 		model.materials.clear();
 	}
@@ -635,7 +784,7 @@ void Application::on_render() {
 
 	for (const auto& model : m_models) {
 		for (const auto& node : model.nodes)
-			draw_node(*node, model, glm::mat4(1.0f));
+			draw_node(*node, model);
 	}
 
 	if (m_draw_skybox)
@@ -40,6 +40,8 @@ struct Node {
 	Node* parent;
 	std::vector<std::unique_ptr<Node>> children;
 	std::vector<Primitive> primitives;
+	std::vector<glm::mat4> instance_matrices; // EXT_mesh_gpu_instancing, relative to node's world matrix
+	std::vector<TransformId> transforms; // One per instance, or a single one without instancing
 	glm::mat4 matrix = glm::mat4(1.0f);
 	glm::vec3 translation = glm::vec3(0.0f);
 	glm::vec3 scale = glm::vec3(1.0f);
@@ -73,7 +75,9 @@ private:
 	void on_render();
 
 	Model load_gltf_model(const std::filesystem::path& filename);
-	void draw_node(const Node& node, const Model& model, const glm::mat4& matrix);
+	void node_transforms_create(Node& node, const glm::mat4& matrix);
+	void node_transforms_destroy(Node& node);
+	void draw_node(const Node& node, const Model& model);
 
 private:
 	std::chrono::steady_clock::time_point m_start_time_point;
@@ -10,6 +10,8 @@ enum class Format : uint32_t {
 	RGBA8_SNorm = 38,
 	RGBA8_SRGB = 43,
 	BGRA8_UNorm = 44,
+	A2B10G10R10_UNorm = 64,
+	RG16_SFloat = 83,
 	//BGRA8_SNorm = 45,
 	RGBA16_UNorm = 90,
 	RGBA16_SFloat = 97,
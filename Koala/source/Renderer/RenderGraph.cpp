@@ -0,0 +1,400 @@
+#include "RenderGraph.h"
+#include <Profile.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+static bool format_has_depth(Format format) {
+	return format == Format::D32_SFloat || format == Format::D24_UNorm_S8_UInt || format == Format::D32_SFloat_S8_UInt;
+}
+
+static bool usage_writes(ImageUsageFlags usage) {
+	return usage & (ImageUsageColorAttachment | ImageUsageDepthStencilAttachment | ImageUsageTransferDst);
+}
+
+void RenderGraph::create(VulkanGraphicsController* controller) {
+	m_controller = controller;
+}
+
+void RenderGraph::destroy() {
+	resources_destroy();
+
+	if (m_compiled) {
+		for (const Pass& pass : m_passes) {
+			if (!pass.culled && !pass.info.to_screen)
+				m_controller->render_pass_destroy(pass.render_pass);
+		}
+	}
+
+	m_passes.clear();
+	m_images.clear();
+	m_image_indices.clear();
+	m_resolution = { 0, 0 };
+	m_compiled = false;
+}
+
+void RenderGraph::add_image(const std::string& name, const ImageInfo& info) {
+	if (m_image_indices.find(name) != m_image_indices.end())
+		throw std::runtime_error("Render graph image already exists");
+
+	Image image{
+		.name = name,
+		.info = info,
+		.follows_resolution = info.extent.width == 0 && info.extent.height == 0
+	};
+
+	m_image_indices[name] = (uint32_t)m_images.size();
+	m_images.push_back(image);
+}
+
+void RenderGraph::add_pass(const RenderGraphPassInfo& info) {
+	m_passes.push_back({ .info = info });
+}
+
+void RenderGraph::set_image_extent(const std::string& name, uint32_t width, uint32_t height) {
+	Image& image = m_images[image_index(name)];
+	if (image.follows_resolution)
+		throw std::runtime_error("Render graph image follows render resolution");
+
+	image.info.extent.width = width;
+	image.info.extent.height = height;
+}
+
+void RenderGraph::compile() {
+	MY_PROFILE_FUNCTION();
+
+	// Collect image uses of every pass, an image used several ways in one pass gets combined usage
+	for (Pass& pass : m_passes) {
+		auto add_use = [&](const std::string& name, ImageUsageFlags usage, bool reads, bool writes) {
+			uint32_t index = image_index(name);
+
+			auto it = std::find_if(pass.uses.begin(), pass.uses.end(), [&](const ImageUse& use) {
+				return use.image == index;
+			});
+
+			if (it != pass.uses.end()) {
+				it->usage |= usage;
+				it->reads |= reads;
+				it->writes |= writes;
+			} else
+				pass.uses.push_back({ index, usage, reads, writes });
+		};
+
+		for (const RenderGraphAttachment& attachment : pass.info.color_attachments)
+			add_use(attachment.image, ImageUsageColorAttachment, attachment.initial_action == InitialAction::Load, true);
+
+		if (pass.info.depth_stencil_attachment.has_value()) {
+			const RenderGraphAttachment& attachment = pass.info.depth_stencil_attachment.value();
+			bool reads = attachment.initial_action == InitialAction::Load || attachment.stencil_initial_action == InitialAction::Load;
+
+			if (attachment.read_only)
+				add_use(attachment.image, ImageUsageDepthStencilReadOnly, true, false);
+			else
+				add_use(attachment.image, ImageUsageDepthStencilAttachment, reads, true);
+		}
+
+		for (const std::string& name : pass.info.sampled_images) {
+			bool is_depth = format_has_depth(m_images[image_index(name)].info.format);
+			add_use(name, is_depth ? ImageUsageDepthSampled : ImageUsageColorSampled, true, false);
+		}
+
+		pass.follows_resolution = std::any_of(pass.uses.begin(), pass.uses.end(), [&](const ImageUse& use) {
+			return (use.usage & (ImageUsageColorAttachment | ImageUsageDepthStencilAttachment | ImageUsageDepthStencilReadOnly)) &&
+				m_images[use.image].follows_resolution;
+		});
+	}
+
+	// Walk passes backwards, a pass is kept only if something later reads what it writes
+	std::vector<bool> needed(m_images.size(), false);
+	for (auto pass_it = m_passes.rbegin(); pass_it != m_passes.rend(); ++pass_it) {
+		Pass& pass = *pass_it;
+
+		pass.culled = !pass.info.to_screen && std::none_of(pass.uses.begin(), pass.uses.end(), [&](const ImageUse& use) {
+			return use.writes && needed[use.image];
+		});
+
+		if (pass.culled)
+			continue;
+
+		// Fully overwritten images don't need earlier writers
+		for (const ImageUse& use : pass.uses) {
+			if (use.writes && !use.reads)
+				needed[use.image] = false;
+		}
+
+		for (const ImageUse& use : pass.uses) {
+			if (use.reads)
+				needed[use.image] = true;
+		}
+	}
+
+	// Lifetimes and barriers, consecutive reads in the same layout share one transition
+	for (uint32_t pass_index = 0; pass_index < (uint32_t)m_passes.size(); pass_index++) {
+		Pass& pass = m_passes[pass_index];
+		if (pass.culled)
+			continue;
+
+		for (const ImageUse& use : pass.uses) {
+			Image& image = m_images[use.image];
+			bool first_use = !image.first_pass.has_value();
+
+			if (first_use || image.last_usage != use.usage || usage_writes(use.usage)) {
+				pass.barriers.push_back({
+					.usage = use.usage,
+					.discard = first_use && !use.reads
+				});
+				pass.barrier_images.push_back(use.image);
+			}
+
+			if (first_use) {
+				image.first_pass = pass_index;
+				image.first_use_reads = use.reads;
+			}
+
+			image.last_pass = pass_index;
+			image.last_usage = use.usage;
+			image.info.usage |= use.usage;
+		}
+	}
+
+	// Render passes don't transition attachments, barriers before each pass already did
+	for (Pass& pass : m_passes) {
+		if (pass.culled || pass.info.to_screen)
+			continue;
+
+		std::vector<RenderPassAttachment> attachments;
+		auto add_attachment = [&](const RenderGraphAttachment& attachment) {
+			uint32_t index = image_index(attachment.image);
+
+			ImageUsageFlags usage = std::find_if(pass.uses.begin(), pass.uses.end(), [&](const ImageUse& use) {
+				return use.image == index;
+			})->usage;
+
+			attachments.push_back({
+				.previous_usage = usage,
+				.current_usage = usage,
+				.next_usage = usage,
+				.format = m_images[index].info.format,
+				.initial_action = attachment.initial_action,
+				.final_action = attachment.final_action,
+				.stencil_initial_action = attachment.stencil_initial_action,
+				.stencil_final_action = attachment.stencil_final_action
+			});
+
+			pass.clear_values.push_back(attachment.clear_value);
+		};
+
+		for (const RenderGraphAttachment& attachment : pass.info.color_attachments)
+			add_attachment(attachment);
+		if (pass.info.depth_stencil_attachment.has_value())
+			add_attachment(pass.info.depth_stencil_attachment.value());
+
+		pass.render_pass = m_controller->render_pass_create(attachments.data(), (uint32_t)attachments.size());
+	}
+
+	m_compiled = true;
+}
+
+void RenderGraph::set_resolution(uint32_t width, uint32_t height) {
+	MY_PROFILE_FUNCTION();
+
+	if (!m_compiled)
+		throw std::runtime_error("Render graph has to be compiled before its images are created");
+
+	resources_destroy();
+	m_resolution = { width, height };
+	m_render_area = { width, height };
+
+	std::vector<MemoryRequirements> requirements(m_images.size());
+	std::vector<uint32_t> used_images;
+	for (uint32_t i = 0; i < (uint32_t)m_images.size(); i++) {
+		Image& image = m_images[i];
+		if (!image.first_pass.has_value())
+			continue;
+
+		if (image.follows_resolution) {
+			image.info.extent.width = width;
+			image.info.extent.height = height;
+		}
+
+		requirements[i] = m_controller->image_memory_requirements(image.info);
+		used_images.push_back(i);
+	}
+
+	// Largest images first, each one goes into the first block whose images are all dead while it's alive
+	std::sort(used_images.begin(), used_images.end(), [&](uint32_t image1, uint32_t image2) {
+		return requirements[image1].size > requirements[image2].size;
+	});
+
+	auto lifetimes_overlap = [&](uint32_t image1, uint32_t image2) {
+		return m_images[image1].first_pass <= m_images[image2].last_pass && m_images[image2].first_pass <= m_images[image1].last_pass;
+	};
+
+	for (uint32_t i : used_images) {
+		// Images reading their previous contents keep memory to themselves
+		bool shareable = !m_images[i].first_use_reads;
+
+		auto block_it = std::find_if(m_memory_blocks.begin(), m_memory_blocks.end(), [&](const MemoryBlock& block) {
+			return shareable && block.shareable &&
+				(block.memory_type_bits & requirements[i].memory_type_bits) != 0 &&
+				std::none_of(block.images.begin(), block.images.end(), [&](uint32_t image) { return lifetimes_overlap(i, image); });
+		});
+
+		if (block_it == m_memory_blocks.end()) {
+			m_memory_blocks.push_back({
+				.size = 0,
+				.memory_type_bits = requirements[i].memory_type_bits,
+				.shareable = shareable
+			});
+			block_it = m_memory_blocks.end() - 1;
+		}
+
+		block_it->size = std::max(block_it->size, requirements[i].size);
+		block_it->memory_type_bits &= requirements[i].memory_type_bits;
+		block_it->images.push_back(i);
+	}
+
+	for (MemoryBlock& block : m_memory_blocks) {
+		block.memory = m_controller->memory_allocate(block.size, block.memory_type_bits);
+
+		std::sort(block.images.begin(), block.images.end(), [&](uint32_t image1, uint32_t image2) {
+			return m_images[image1].first_pass < m_images[image2].first_pass;
+		});
+
+		// Images take turns in the memory every frame, so the first one waits for the last one of the previous frame
+		for (size_t i = 0; i < block.images.size(); i++) {
+			Image& image = m_images[block.images[i]];
+			image.image = m_controller->image_create(image.info, block.memory, 0);
+
+			if (block.images.size() > 1) {
+				const Image& prev_image = m_images[block.images[(i + block.images.size() - 1) % block.images.size()]];
+				image.alias_wait_usage = prev_image.last_usage;
+			}
+		}
+	}
+
+	for (uint32_t pass_index = 0; pass_index < (uint32_t)m_passes.size(); pass_index++) {
+		Pass& pass = m_passes[pass_index];
+		if (pass.culled)
+			continue;
+
+		for (size_t i = 0; i < pass.barriers.size(); i++) {
+			const Image& image = m_images[pass.barrier_images[i]];
+
+			pass.barriers[i].image = image.image;
+			pass.barriers[i].wait_usage = image.first_pass == pass_index ? image.alias_wait_usage : ImageUsageNone;
+		}
+
+		if (pass.info.to_screen)
+			continue;
+
+		std::vector<ImageId>& attachments = pass.attachment_images;
+		attachments.clear();
+		for (const RenderGraphAttachment& attachment : pass.info.color_attachments)
+			attachments.push_back(m_images[image_index(attachment.image)].image);
+		if (pass.info.depth_stencil_attachment.has_value())
+			attachments.push_back(m_images[image_index(pass.info.depth_stencil_attachment->image)].image);
+
+		// Dynamic rendering takes the images in draw_begin, nothing has to be recreated on resize
+		if (!m_controller->dynamic_rendering_supported())
+			pass.framebuffer = m_controller->framebuffer_create(pass.render_pass, attachments.data(), (uint32_t)attachments.size());
+	}
+}
+
+void RenderGraph::execute() {
+	MY_PROFILE_FUNCTION();
+
+	for (Pass& pass : m_passes) {
+		if (pass.culled)
+			continue;
+
+		MY_PROFILE_SCOPE(pass.info.name);
+
+		m_controller->draw_image_barriers(pass.barriers.data(), (uint32_t)pass.barriers.size());
+
+		if (pass.info.condition && !pass.info.condition())
+			continue;
+
+		// Skipped passes get no GPU scope, so a missing timing means the pass didn't run
+		GPU_PROFILE_SCOPE(*m_controller, pass.info.name);
+
+		if (pass.info.to_screen) {
+			m_controller->draw_begin_for_screen(pass.info.screen_clear_color);
+			pass.info.record();
+			m_controller->draw_end_for_screen();
+		} else {
+			// Zero render area covers the whole attachments
+			ScreenResolution render_area = pass.follows_resolution ? m_render_area : ScreenResolution{ 0, 0 };
+
+			if (m_controller->dynamic_rendering_supported())
+				m_controller->draw_begin(pass.render_pass, pass.attachment_images.data(), pass.clear_values.data(), (uint32_t)pass.attachment_images.size(), render_area.width, render_area.height);
+			else
+				m_controller->draw_begin(pass.framebuffer, pass.clear_values.data(), (uint32_t)pass.clear_values.size(), render_area.width, render_area.height);
+
+			pass.info.record();
+			m_controller->draw_end();
+		}
+	}
+}
+
+RenderPassId RenderGraph::render_pass(const std::string& pass_name) const {
+	auto it = std::find_if(m_passes.begin(), m_passes.end(), [&](const Pass& pass) {
+		return pass.info.name == pass_name;
+	});
+
+	if (it == m_passes.end() || it->culled || it->info.to_screen)
+		throw std::runtime_error("Render graph pass has no render pass");
+
+	return it->render_pass;
+}
+
+ImageId RenderGraph::image(const std::string& name) const {
+	return m_images[image_index(name)].image;
+}
+
+const ImageInfo& RenderGraph::image_info(const std::string& name) const {
+	return m_images[image_index(name)].info;
+}
+
+ScreenResolution RenderGraph::resolution() const {
+	return m_resolution;
+}
+
+void RenderGraph::set_render_area(uint32_t width, uint32_t height) {
+	m_render_area = { std::min(width, m_resolution.width), std::min(height, m_resolution.height) };
+}
+
+ScreenResolution RenderGraph::render_area() const {
+	return m_render_area;
+}
+
+uint32_t RenderGraph::image_index(const std::string& name) const {
+	auto it = m_image_indices.find(name);
+	if (it == m_image_indices.end())
+		throw std::runtime_error("Render graph image doesn't exist");
+
+	return it->second;
+}
+
+void RenderGraph::resources_destroy() {
+	if (m_resolution.width == 0 && m_resolution.height == 0)
+		return;
+
+	if (!m_controller->dynamic_rendering_supported()) {
+		for (const Pass& pass : m_passes) {
+			if (!pass.culled && !pass.info.to_screen)
+				m_controller->framebuffer_destroy(pass.framebuffer);
+		}
+	}
+
+	for (Image& image : m_images) {
+		if (image.first_pass.has_value())
+			m_controller->image_destroy(image.image);
+
+		image.alias_wait_usage = ImageUsageNone;
+	}
+
+	for (const MemoryBlock& block : m_memory_blocks)
+		m_controller->memory_free(block.memory);
+	m_memory_blocks.clear();
+}
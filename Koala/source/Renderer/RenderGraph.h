@@ -0,0 +1,118 @@
+#pragma once
+
+#include "VulkanGraphicsController.h"
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct RenderGraphAttachment {
+	std::string image;
+	InitialAction initial_action = InitialAction::Clear;
+	FinalAction final_action = FinalAction::Store;
+	InitialAction stencil_initial_action = InitialAction::DontCare;
+	FinalAction stencil_final_action = FinalAction::DontCare;
+	ClearValue clear_value{};
+	bool read_only = false; // Depth-stencil attachment which is only tested against
+};
+
+struct RenderGraphPassInfo {
+	std::string name;
+	std::vector<RenderGraphAttachment> color_attachments;
+	std::optional<RenderGraphAttachment> depth_stencil_attachment;
+	std::vector<std::string> sampled_images; // Images read in shaders
+	bool to_screen = false; // Renders into the swapchain image, such passes are never culled
+	glm::vec4 screen_clear_color = glm::vec4(0.0f);
+	std::function<void()> record;
+	std::function<bool()> condition; // Render pass is skipped for the frame when it returns false, barriers still run
+};
+
+// Passes declare images they read and write, the graph derives everything else from that:
+// culls passes whose results are never used, transitions images with one batched barrier per pass
+// and places transient images with non-overlapping lifetimes in the same memory
+class RenderGraph {
+public:
+	void create(VulkanGraphicsController* controller);
+	void destroy();
+
+	// Width and height of zero follow render resolution
+	void add_image(const std::string& name, const ImageInfo& info);
+	void add_pass(const RenderGraphPassInfo& info);
+
+	// Resizes an image which doesn't follow render resolution, takes effect with the next set_resolution
+	void set_image_extent(const std::string& name, uint32_t width, uint32_t height);
+
+	// Creates render passes, so it has to be called before pipelines which use them are created
+	void compile();
+	void set_resolution(uint32_t width, uint32_t height);
+	void execute();
+
+	// Top left part of resolution sized images passes render into, images aren't recreated when it changes.
+	// Reset to the whole resolution by set_resolution
+	void set_render_area(uint32_t width, uint32_t height);
+	ScreenResolution render_area() const;
+
+	RenderPassId render_pass(const std::string& pass_name) const;
+	ImageId image(const std::string& name) const;
+	const ImageInfo& image_info(const std::string& name) const;
+	ScreenResolution resolution() const;
+
+private:
+	struct ImageUse {
+		uint32_t image;
+		ImageUsageFlags usage;
+		bool reads; // Previous contents are used
+		bool writes;
+	};
+
+	struct Image {
+		std::string name;
+		ImageInfo info;
+		bool follows_resolution = false;
+		bool first_use_reads = false; // Contents are kept between frames, so memory can't be shared
+		ImageId image;
+		std::optional<uint32_t> first_pass;
+		std::optional<uint32_t> last_pass;
+		ImageUsageFlags last_usage = ImageUsageNone;
+		ImageUsageFlags alias_wait_usage = ImageUsageNone; // Last usage of the previous image in the same memory
+	};
+
+	struct Pass {
+		RenderGraphPassInfo info;
+		std::vector<ImageUse> uses;
+		std::vector<ImageBarrier> barriers; // Image ids are resolved when images are created
+		std::vector<uint32_t> barrier_images;
+		std::vector<ClearValue> clear_values;
+		RenderPassId render_pass;
+		FramebufferId framebuffer; // Only without dynamic rendering
+		std::vector<ImageId> attachment_images; // Given to draw_begin under dynamic rendering
+		bool culled = false;
+		bool follows_resolution = false; // Renders into images following resolution, so only into render area
+	};
+
+	// Memory shared by transient images, sized for the largest of them
+	struct MemoryBlock {
+		MemoryId memory;
+		size_t size;
+		uint32_t memory_type_bits;
+		bool shareable;
+		std::vector<uint32_t> images; // Sorted by first pass
+	};
+
+	uint32_t image_index(const std::string& name) const;
+	void resources_destroy();
+
+private:
+	VulkanGraphicsController* m_controller;
+
+	std::vector<Image> m_images;
+	std::unordered_map<std::string, uint32_t> m_image_indices;
+	std::vector<Pass> m_passes;
+	std::vector<MemoryBlock> m_memory_blocks;
+
+	ScreenResolution m_resolution = { 0, 0 };
+	ScreenResolution m_render_area = { 0, 0 };
+	bool m_compiled = false;
+};
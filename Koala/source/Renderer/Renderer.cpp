@@ -3,27 +3,179 @@
 
 // TODO: Logging
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <execution>
 #include <filesystem>
-#include <fstream>
+#include <limits>
+#include <numeric>
+#include <tuple>
 
 #include <stb_image/stb_image.h>
 
-static std::vector<uint8_t> load_spv(const std::filesystem::path& path) {
-	if (!std::filesystem::exists(path))
-		throw std::runtime_error("Shader doesn't exist");
+static size_t hash_combine(size_t seed, size_t hash) {
+	return seed ^ (hash + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
+// Element of the low discrepancy Halton sequence, index starts from one
+static float halton(uint32_t index, uint32_t base) {
+	float result = 0.0f;
+	float fraction = 1.0f;
+	while (index > 0) {
+		fraction /= base;
+		result += fraction * (index % base);
+		index /= base;
+	}
+
+	return result;
+}
+
+// Radiance projected onto the 9 L2 spherical harmonics basis functions
+struct SphericalHarmonics {
+	std::array<glm::vec3, 9> coefficients{};
+	float total_weight = 0.0f;
+
+	SphericalHarmonics operator+(const SphericalHarmonics& other) const {
+		SphericalHarmonics sum;
+		for (size_t i = 0; i < coefficients.size(); i++)
+			sum.coefficients[i] = coefficients[i] + other.coefficients[i];
+		sum.total_weight = total_weight + other.total_weight;
+
+		return sum;
+	}
+
+	void add_sample(const glm::vec3& dir, const glm::vec3& radiance, float solid_angle) {
+		const float basis[9] = {
+			0.282095f,
+			0.488603f * dir.y,
+			0.488603f * dir.z,
+			0.488603f * dir.x,
+			1.092548f * dir.x * dir.y,
+			1.092548f * dir.y * dir.z,
+			0.315392f * (3.0f * dir.z * dir.z - 1.0f),
+			1.092548f * dir.x * dir.z,
+			0.546274f * (dir.x * dir.x - dir.y * dir.y)
+		};
+
+		glm::vec3 weighted = radiance * solid_angle;
+		for (size_t i = 0; i < coefficients.size(); i++)
+			coefficients[i] += weighted * basis[i];
+		total_weight += solid_angle;
+	}
+};
+
+// Ambient which is the same from every direction, used when no skybox is drawn
+static std::array<glm::vec4, 9> constant_irradiance_sh(float value) {
+	std::array<glm::vec4, 9> sh{};
+	sh[0] = glm::vec4(glm::vec3(value), 0.0f);
+
+	return sh;
+}
+
+// Convolves radiance with the clamped cosine lobe, divides by PI and folds basis constants,
+// what is left for shaders is c0 + c1 y + c2 z + c3 x + c4 xy + c5 yz + c6 (3z^2 - 1) + c7 xz + c8 (x^2 - y^2)
+static std::array<glm::vec4, 9> irradiance_sh_from_radiance(const SphericalHarmonics& radiance) {
+	constexpr float basis_constants[9] = { 0.282095f, 0.488603f, 0.488603f, 0.488603f, 1.092548f, 1.092548f, 0.315392f, 1.092548f, 0.546274f };
+	constexpr float band_factors[9] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+
+	// Discretized solid angles don't sum to exactly 4 PI
+	float normalization = radiance.total_weight > 0.0f ? 4.0f * glm::pi<float>() / radiance.total_weight : 0.0f;
+
+	std::array<glm::vec4, 9> sh;
+	for (size_t i = 0; i < sh.size(); i++)
+		sh[i] = glm::vec4(radiance.coefficients[i] * normalization * band_factors[i] * basis_constants[i], 0.0f);
+
+	return sh;
+}
+
+// Faces are in +X, -X, +Y, -Y, +Z, -Z order with uv from -1 to 1, as in the cubemap compute shaders
+static glm::vec3 cube_face_direction(uint32_t face, float u, float v) {
+	switch (face) {
+	case 0: return glm::vec3(1.0f, -v, -u);
+	case 1: return glm::vec3(-1.0f, -v, u);
+	case 2: return glm::vec3(u, 1.0f, v);
+	case 3: return glm::vec3(u, -1.0f, -v);
+	case 4: return glm::vec3(u, -v, 1.0f);
+	default: return glm::vec3(-u, -v, -1.0f);
+	}
+}
+
+// Projects the environment on the CPU from a box filtered copy of at most a few hundred texels across,
+// rows of the copy are projected in parallel and summed
+static std::array<glm::vec4, 9> environment_irradiance_sh(const ImageSpecs& texture, uint32_t cubemap_resolution, SkyboxType type) {
+	MY_PROFILE_FUNCTION();
+
+	constexpr uint32_t EQUIRECT_SH_WIDTH = 256;
+	constexpr uint32_t CUBE_FACE_SH_RESOLUTION = 64;
+
+	// Only float environments are read on the CPU, others keep the constant ambient
+	if (texture.data_format != Format::RGBA32_SFloat)
+		return constant_irradiance_sh(0.35f);
+
+	bool is_cube = type == SkyboxType::Cubemap;
+	uint32_t width = is_cube ? cubemap_resolution : texture.width;
+	uint32_t height = is_cube ? 6 * cubemap_resolution : texture.height;
+
+	uint32_t factor = std::max(1u, width / (is_cube ? CUBE_FACE_SH_RESOLUTION : EQUIRECT_SH_WIDTH));
+	while (is_cube && cubemap_resolution % factor != 0) // Blocks must not cross faces
+		factor--;
+
+	uint32_t small_width = width / factor;
+	uint32_t small_height = height / factor;
+	const glm::vec4* pixels = (const glm::vec4*)texture.data;
+
+	std::vector<glm::vec3> small(small_width * small_height);
+	std::vector<uint32_t> rows(small_height);
+	std::iota(rows.begin(), rows.end(), 0);
 
-	size_t code_size = std::filesystem::file_size(path);
-	size_t zeros_count = (4 - (code_size % 4)) % 4;
+	std::for_each(std::execution::par, rows.begin(), rows.end(), [&](uint32_t y) {
+		float inv_block_size = 1.0f / (factor * factor);
 
-	std::vector<uint8_t> spv_code;
-	spv_code.reserve(code_size + zeros_count);
+		for (uint32_t x = 0; x < small_width; x++) {
+			glm::vec3 sum(0.0f);
+			for (uint32_t by = 0; by < factor; by++) {
+				const glm::vec4* row = pixels + (size_t)(y * factor + by) * width + x * factor;
+				for (uint32_t bx = 0; bx < factor; bx++)
+					sum += glm::vec3(row[bx]);
+			}
+
+			small[y * small_width + x] = sum * inv_block_size;
+		}
+	});
+
+	uint32_t face_size = cubemap_resolution / factor;
+
+	SphericalHarmonics radiance = std::transform_reduce(std::execution::par_unseq, rows.begin(), rows.end(), SphericalHarmonics{}, std::plus<>(), [&](uint32_t y) {
+		SphericalHarmonics row_sh;
+
+		for (uint32_t x = 0; x < small_width; x++) {
+			glm::vec3 dir;
+			float solid_angle;
+
+			if (is_cube) {
+				float u = ((float)x + 0.5f) / face_size * 2.0f - 1.0f;
+				float v = ((float)(y % face_size) + 0.5f) / face_size * 2.0f - 1.0f;
+				glm::vec3 cube_dir = cube_face_direction(y / face_size, u, v);
+
+				// Skybox samples the cube with the world direction swizzled to xzy
+				dir = glm::normalize(glm::vec3(cube_dir.x, cube_dir.z, cube_dir.y));
+				solid_angle = 4.0f / (face_size * face_size) / std::pow(1.0f + u * u + v * v, 1.5f);
+			} else {
+				float phi = (((float)x + 0.5f) / small_width - 0.5f) * 2.0f * glm::pi<float>();
+				float latitude = (((float)y + 0.5f) / small_height - 0.5f) * glm::pi<float>();
 
-	std::basic_ifstream<uint8_t> spv_file(path, std::ios::binary);
+				// Top row of the map is world up, as the cubemap conversion samples it
+				dir = glm::vec3(std::cos(latitude) * std::cos(phi), -std::sin(latitude), std::cos(latitude) * std::sin(phi));
+				solid_angle = std::cos(latitude) * (2.0f * glm::pi<float>() / small_width) * (glm::pi<float>() / small_height);
+			}
+
+			row_sh.add_sample(dir, small[y * small_width + x], solid_angle);
+		}
 
-	spv_code.insert(spv_code.end(), std::istreambuf_iterator<uint8_t>(spv_file), std::istreambuf_iterator<uint8_t>());
-	spv_code.insert(spv_code.end(), zeros_count, 0);
+		return row_sh;
+	});
 
-	return spv_code;
+	return irradiance_sh_from_radiance(radiance);
 }
 
 static Filter mag_filter_to_filter(MagFilter filter) {
@@ -72,10 +224,19 @@ static SamplerAddressMode wrap_to_sampler_address_mode(Wrap wrap) {
 		return SamplerAddressMode::Repeat;
 }
 
-void Renderer::create(VulkanContext* context) {
+void Renderer::create(VulkanContext* context, const RendererSettings& settings) {
 	MY_PROFILE_FUNCTION();
 
-	m_graphics_controller.create(context);
+	m_create_time = CPUProfiler::now();
+
+	m_settings = settings;
+	m_graphics_controller.create(context, m_settings.pipeline_cache_path);
+
+	bool packed_g_buffer = m_settings.g_buffer_layout == GBufferLayout::Packed;
+	// Packed writes 12 bytes of targets and depth and 8 of emissive into composition, which lightning reads, adds to
+	// and writes back. Wide writes 20 bytes of targets and depth, lightning reads them and writes composition.
+	m_stats.g_pass_bytes_per_pixel = 20;
+	m_stats.lightning_bytes_per_pixel = packed_g_buffer ? 12 + 8 + 8 : 20 + 8;
 
 	// Create empty texture
 	{
@@ -109,128 +270,230 @@ void Renderer::create(VulkanContext* context) {
 
 	// Setup scene resources
 	m_scene_info.gpu.view_pos = m_graphics_controller.uniform_buffer_create(nullptr, sizeof(glm::vec3));
-	m_scene_info.gpu.projview_matrix = m_graphics_controller.uniform_buffer_create(nullptr, sizeof(glm::mat4));
+	m_scene_info.gpu.projview_matrix = m_graphics_controller.uniform_buffer_create(nullptr, sizeof(WorldMatrices));
 	m_scene_info.gpu.projview_matrix_no_translation = m_graphics_controller.uniform_buffer_create(nullptr, sizeof(glm::mat4));
 
-	// Create deferred render targets
+	m_temporal.output_resolution = m_graphics_controller.screen_resolution();
+
+	// Load shader bundle, it's baked offline by compile.bat after the shaders are compiled
+	ShaderBundle shader_bundle;
+	{
+		std::filesystem::path bundle_path = m_settings.shader_bundle_path;
+		if (ShaderBundle::out_of_date(bundle_path.parent_path(), bundle_path))
+			throw std::runtime_error("Shader bundle " + bundle_path.string() + " is missing or older than the shaders, run compile.bat to bake it");
+
+		shader_bundle.load(bundle_path);
+	}
+
+	// Create render graph
 	{
-		m_deferred.albedo_info.usage = ImageUsageColorAttachment | ImageUsageColorSampled;
-		m_deferred.albedo_info.view_type = ImageViewType::TwoD;
-		m_deferred.albedo_info.format = Format::BGRA8_UNorm;
-		m_deferred.albedo_info.extent.depth = 1;
-		m_deferred.albedo_info.array_layers = 1;
-
-		m_deferred.ao_rough_met_info.usage = ImageUsageColorAttachment | ImageUsageColorSampled;
-		m_deferred.ao_rough_met_info.view_type = ImageViewType::TwoD;
-		m_deferred.ao_rough_met_info.format = Format::BGRA8_UNorm;
-		m_deferred.ao_rough_met_info.extent.depth = 1;
-		m_deferred.ao_rough_met_info.array_layers = 1;
-
-		m_deferred.normals_info.usage = ImageUsageColorAttachment | ImageUsageColorSampled;
-		m_deferred.normals_info.view_type = ImageViewType::TwoD;
-		m_deferred.normals_info.format = Format::RGBA8_SNorm;
-		m_deferred.normals_info.extent.depth = 1;
-		m_deferred.normals_info.array_layers = 1;
-
-		m_deferred.emissive_info.usage = ImageUsageColorAttachment | ImageUsageColorSampled;
-		m_deferred.emissive_info.view_type = ImageViewType::TwoD;
-		m_deferred.emissive_info.format = Format::RGBA8_UNorm;
-		m_deferred.emissive_info.extent.depth = 1;
-		m_deferred.emissive_info.array_layers = 1;
-
-		m_deferred.depth_stencil_info.usage = ImageUsageDepthStencilAttachment | ImageUsageDepthStencilReadOnly | ImageUsageDepthSampled;
-		m_deferred.depth_stencil_info.view_type = ImageViewType::TwoD;
-		m_deferred.depth_stencil_info.format = Format::D24_UNorm_S8_UInt;
-		m_deferred.depth_stencil_info.extent.depth = 1;
-		m_deferred.depth_stencil_info.array_layers = 1;
-
-		m_deferred.composition_info.usage = ImageUsageColorAttachment | ImageUsageColorSampled;
-		m_deferred.composition_info.view_type = ImageViewType::TwoD;
-		m_deferred.composition_info.format = Format::RGBA16_SFloat;
-		m_deferred.composition_info.extent.depth = 1;
-		m_deferred.composition_info.array_layers = 1;
+		m_render_graph.create(&m_graphics_controller);
+
+		// Render targets follow render resolution, usage is derived from passes
+		auto add_render_target = [&](const std::string& name, Format format) {
+			ImageInfo info{
+				.usage = ImageUsageNone,
+				.view_type = ImageViewType::TwoD,
+				.format = format,
+				.extent = { 0, 0, 1 }
+			};
+
+			m_render_graph.add_image(name, info);
+		};
+
+		RenderGraphAttachment composition_attachment{
+			.image = "composition",
+			.clear_value = { .color = { 0.0f, 1.0f, 1.0f, 1.0f } }
+		};
+
+		// Directional light shadow cascades, the atlas has fixed size set by set_shadow_map_resolution
+		ImageInfo shadow_map_info{
+			.usage = ImageUsageNone,
+			.view_type = ImageViewType::TwoD,
+			.format = Format::D32_SFloat,
+			.extent = { Shadows::ATLAS_TILES * m_shadows.cascade_resolution, Shadows::ATLAS_TILES * m_shadows.cascade_resolution, 1 }
+		};
+		m_render_graph.add_image("shadow_map", shadow_map_info);
+		m_render_graph.add_image("static_shadow_map", shadow_map_info);
+
+		// Kept between frames, only cascades whose cache is invalid are redrawn
+		RenderGraphPassInfo static_shadow_pass{
+			.name = "static_shadow",
+			.depth_stencil_attachment = RenderGraphAttachment{
+				.image = "static_shadow_map",
+				.initial_action = InitialAction::Load
+			},
+			.record = [this]() { record_static_shadow_pass(); },
+			.condition = [this]() {
+				return std::any_of(m_shadows.cascades.begin(), m_shadows.cascades.end(), [](const ShadowCascade& cascade) {
+					return cascade.cache_redraw;
+				});
+			}
+		};
+		m_render_graph.add_pass(static_shadow_pass);
+
+		RenderGraphPassInfo shadow_pass{
+			.name = "shadow",
+			.depth_stencil_attachment = RenderGraphAttachment{
+				.image = "shadow_map",
+				.clear_value = { .depth_stencil = { 1.0f, 0 } }
+			},
+			.sampled_images = { "static_shadow_map" },
+			.record = [this]() { record_shadow_pass(); }
+		};
+		m_render_graph.add_pass(shadow_pass);
+
+		// Depth of opaque primitives, G pass then tests for equal depth
+		if (m_settings.depth_prepass) {
+			RenderGraphPassInfo depth_prepass{
+				.name = "depth_prepass",
+				.depth_stencil_attachment = RenderGraphAttachment{
+					.image = "depth_stencil",
+					.stencil_initial_action = InitialAction::Clear,
+					.stencil_final_action = FinalAction::Store,
+					.clear_value = { .depth_stencil = { 1.0f, 0 } }
+				},
+				.record = [this]() { record_depth_prepass(); }
+			};
+			m_render_graph.add_pass(depth_prepass);
+		}
 
 		// G pass
-		std::array<RenderPassAttachment, 5> g_pass_attachments{};
-		// Albedo
-		g_pass_attachments[0].previous_usage = ImageUsageColorSampled;
-		g_pass_attachments[0].current_usage = ImageUsageColorAttachment;
-		g_pass_attachments[0].next_usage = ImageUsageColorSampled;
-		g_pass_attachments[0].format = m_deferred.albedo_info.format;
-		g_pass_attachments[0].initial_action = InitialAction::Clear;
-		g_pass_attachments[0].final_action = FinalAction::Store;
-		// AO-Rough-Met
-		g_pass_attachments[1].previous_usage = ImageUsageColorSampled;
-		g_pass_attachments[1].current_usage = ImageUsageColorAttachment;
-		g_pass_attachments[1].next_usage = ImageUsageColorSampled;
-		g_pass_attachments[1].format = m_deferred.ao_rough_met_info.format;
-		g_pass_attachments[1].initial_action = InitialAction::Clear;
-		g_pass_attachments[1].final_action = FinalAction::Store;
-		// Normals
-		g_pass_attachments[2].previous_usage = ImageUsageColorSampled;
-		g_pass_attachments[2].current_usage = ImageUsageColorAttachment;
-		g_pass_attachments[2].next_usage = ImageUsageColorSampled;
-		g_pass_attachments[2].format = m_deferred.normals_info.format;
-		g_pass_attachments[2].initial_action = InitialAction::Clear;
-		g_pass_attachments[2].final_action = FinalAction::Store;
-		// Emissive
-		g_pass_attachments[3].previous_usage = ImageUsageColorSampled;
-		g_pass_attachments[3].current_usage = ImageUsageColorAttachment;
-		g_pass_attachments[3].next_usage = ImageUsageColorSampled;
-		g_pass_attachments[3].format = m_deferred.emissive_info.format;
-		g_pass_attachments[3].initial_action = InitialAction::Clear;
-		g_pass_attachments[3].final_action = FinalAction::Store;
-		// Depth-Stencil
-		g_pass_attachments[4].previous_usage = ImageUsageDepthStencilReadOnly;
-		g_pass_attachments[4].current_usage = ImageUsageDepthStencilAttachment;
-		g_pass_attachments[4].next_usage = ImageUsageDepthStencilReadOnly;
-		g_pass_attachments[4].format = m_deferred.depth_stencil_info.format;
-		g_pass_attachments[4].initial_action = InitialAction::Clear;
-		g_pass_attachments[4].final_action = FinalAction::Store;
-		g_pass_attachments[4].stencil_initial_action = InitialAction::Clear;
-		g_pass_attachments[4].stencil_final_action = FinalAction::Store;
-
-		m_deferred.g_pass = m_graphics_controller.render_pass_create(g_pass_attachments.data(), (uint32_t)g_pass_attachments.size());
-
-		std::array<RenderPassAttachment, 2> composition_attachments{};
-		composition_attachments[0].previous_usage = ImageUsageColorSampled;
-		composition_attachments[0].current_usage = ImageUsageColorAttachment;
-		composition_attachments[0].next_usage = ImageUsageColorSampled;
-		composition_attachments[0].format = m_deferred.composition_info.format;
-		composition_attachments[0].initial_action = InitialAction::Clear;
-		composition_attachments[0].final_action = FinalAction::Store;
-		composition_attachments[1].previous_usage = ImageUsageDepthStencilReadOnly;
-		composition_attachments[1].current_usage = ImageUsageDepthStencilReadOnly | ImageUsageDepthSampled;
-		composition_attachments[1].next_usage = ImageUsageDepthStencilAttachment;
-		composition_attachments[1].format = m_deferred.depth_stencil_info.format;
-		composition_attachments[1].initial_action = InitialAction::Load;
-		composition_attachments[1].final_action = FinalAction::Store;
-
-		m_deferred.composition_pass = m_graphics_controller.render_pass_create(composition_attachments.data(), (uint32_t)composition_attachments.size());
-	}
-
-	// Create G pipeline
+		InitialAction g_pass_depth_action = m_settings.depth_prepass ? InitialAction::Load : InitialAction::Clear;
+		RenderGraphPassInfo g_pass{
+			.name = "g_pass",
+			.depth_stencil_attachment = RenderGraphAttachment{
+				.image = "depth_stencil",
+				.initial_action = g_pass_depth_action,
+				.stencil_initial_action = g_pass_depth_action,
+				.stencil_final_action = FinalAction::Store,
+				.clear_value = { .depth_stencil = { 1.0f, 0 } }
+			},
+			.record = [this]() { record_g_pass(); }
+		};
+
+		// Lightning, skybox and transparent primitives
+		RenderGraphPassInfo composition_pass{
+			.name = "composition",
+			.depth_stencil_attachment = RenderGraphAttachment{
+				.image = "depth_stencil",
+				.initial_action = InitialAction::Load,
+				.stencil_initial_action = InitialAction::Load,
+				.stencil_final_action = FinalAction::Store,
+				.read_only = true
+			},
+			.record = [this]() { record_composition_pass(); }
+		};
+
+		add_render_target("albedo", Format::BGRA8_UNorm);
+		add_render_target("depth_stencil", Format::D24_UNorm_S8_UInt);
+		add_render_target("composition", Format::RGBA16_SFloat);
+
+		g_pass.color_attachments.push_back({ .image = "albedo", .clear_value = { .color = { 0.8f, 0.3f, 0.4f, 1.0f } } });
+
+		if (packed_g_buffer) {
+			// Targets take 12 bytes per pixel with depth. Emissive goes straight into the RGBA16F composition target,
+			// 8 more bytes written here which lightning reads and writes again when it adds to them
+			add_render_target("normal_rough", Format::A2B10G10R10_UNorm);
+
+			g_pass.color_attachments.push_back({ .image = "normal_rough" });
+			g_pass.color_attachments.push_back(composition_attachment);
+
+			composition_attachment.initial_action = InitialAction::Load;
+			composition_pass.sampled_images = { "albedo", "normal_rough", "depth_stencil", "shadow_map" };
+		} else {
+			add_render_target("ao_rough_met", Format::BGRA8_UNorm);
+			add_render_target("normals", Format::RGBA8_SNorm);
+			add_render_target("emissive", Format::RGBA8_UNorm);
+
+			g_pass.color_attachments.push_back({ .image = "ao_rough_met" });
+			g_pass.color_attachments.push_back({ .image = "normals" });
+			g_pass.color_attachments.push_back({ .image = "emissive" });
+
+			composition_pass.sampled_images = { "albedo", "ao_rough_met", "normals", "emissive", "depth_stencil", "shadow_map" };
+		}
+
+		// Screen UV motion since previous frame, background isn't drawn and keeps zero
+		if (m_settings.temporal_upscaling) {
+			add_render_target("velocity", Format::RG16_SFloat);
+
+			g_pass.color_attachments.push_back({ .image = "velocity", .clear_value = { .color = { 0.0f, 0.0f, 0.0f, 0.0f } } });
+		}
+
+		composition_pass.color_attachments.push_back(composition_attachment);
+
+		m_render_graph.add_pass(g_pass);
+		m_render_graph.add_pass(composition_pass);
+
+		std::vector<std::string> present_images = { "composition" };
+		if (m_settings.temporal_upscaling) {
+			// Output resolution, set by set_output_resolution
+			ImageInfo history_info{
+				.usage = ImageUsageNone,
+				.view_type = ImageViewType::TwoD,
+				.format = Format::RGBA16_SFloat,
+				.extent = { m_temporal.output_resolution.width, m_temporal.output_resolution.height, 1 }
+			};
+			m_render_graph.add_image("history_0", history_info);
+			m_render_graph.add_image("history_1", history_info);
+
+			// Passes alternate every frame, history is loaded so barriers of the skipped one don't discard it
+			for (uint32_t i = 0; i < 2; i++) {
+				RenderGraphPassInfo temporal_resolve_pass{
+					.name = "temporal_resolve_" + std::to_string(i),
+					.color_attachments = { { .image = "history_" + std::to_string(i), .initial_action = InitialAction::Load } },
+					.sampled_images = { "composition", "velocity", "depth_stencil", "history_" + std::to_string(1 - i) },
+					.record = [this]() { record_temporal_resolve_pass(); },
+					.condition = [this, i]() { return m_frame_number % 2 == i; }
+				};
+				m_render_graph.add_pass(temporal_resolve_pass);
+			}
+
+			present_images = { "history_0", "history_1" };
+		}
+
+		// Present to screen
+		RenderGraphPassInfo present_pass{
+			.name = "present",
+			.sampled_images = present_images,
+			.to_screen = true,
+			.screen_clear_color = glm::vec4(1.0f, 0.0f, 1.0f, 1.0f),
+			.record = [this]() { record_present_pass(); }
+		};
+		m_render_graph.add_pass(present_pass);
+
+		m_render_graph.compile();
+	}
+
+	// Create G pipelines
 	{
-		auto vert_spv = load_spv("../assets/shaders/g_pass.vert.spv");
-		auto frag_spv = load_spv("../assets/shaders/g_pass.frag.spv");
-
-		std::array<ShaderStage, 2> shader_stages;
-		shader_stages[0] = {
-			.stage = ShaderStageVertex,
-			.spv = vert_spv.data(),
-			.spv_size = vert_spv.size()
+		// Variants are named after their defines in compile.bat
+		auto g_pass_spv_path = [&](bool packed, bool masked, const std::string& extension) {
+			std::string path = "g_pass";
+			if (packed)
+				path += "_packed";
+			if (masked)
+				path += "_masked";
+			if (m_settings.temporal_upscaling)
+				path += "_motion";
+
+			return path + extension;
 		};
-		shader_stages[1] = {
-			.stage = ShaderStageFragment,
-			.spv = frag_spv.data(),
-			.spv_size = frag_spv.size()
+
+		std::array<ShaderStage, 2> shader_stages = {
+			shader_bundle.stage(g_pass_spv_path(false, false, ".vert.spv")),
+			shader_bundle.stage(g_pass_spv_path(packed_g_buffer, false, ".frag.spv"))
 		};
 
 		m_g_pipeline.shader = m_graphics_controller.shader_create(shader_stages.data(), (uint32_t)shader_stages.size());
 
+		shader_stages[1] = shader_bundle.stage(g_pass_spv_path(packed_g_buffer, true, ".frag.spv"));
+
+		m_g_pipeline.masked_shader = m_graphics_controller.shader_create(shader_stages.data(), (uint32_t)shader_stages.size());
+
 		std::array<PipelineDynamicStateFlags, 3> dynamic_states = { DYNAMIC_STATE_VIEWPORT, DYNAMIC_STATE_SCISSOR, DYNAMIC_STATE_STENCIL_REFERENCE };
 
-		std::array<ColorBlendAttachmentState, 4> blend_attachments{};
+		std::array<ColorBlendAttachmentState, 5> blend_attachments{};
 		blend_attachments[0].blend_enable = false;
 		blend_attachments[0].color_write_mask = ColorComponentR | ColorComponentG | ColorComponentB | ColorComponentA;
 		blend_attachments[1].blend_enable = false;
@@ -239,45 +502,144 @@ void Renderer::create(VulkanContext* context) {
 		blend_attachments[2].color_write_mask = ColorComponentR | ColorComponentG | ColorComponentB | ColorComponentA;
 		blend_attachments[3].blend_enable = false;
 		blend_attachments[3].color_write_mask = ColorComponentR | ColorComponentG | ColorComponentB | ColorComponentA;
+		blend_attachments[4].blend_enable = false;
+		blend_attachments[4].color_write_mask = ColorComponentR | ColorComponentG | ColorComponentB | ColorComponentA;
 
+		// Velocity follows the G buffer targets
+		uint32_t g_attachment_count = (packed_g_buffer ? 3 : 4) + (m_settings.temporal_upscaling ? 1 : 0);
+
+		// Masked primitives aren't in depth prepass, so they always test and write depth themselves
 		PipelineInfo g_pipeline_info{};
-		g_pipeline_info.shader_id = m_g_pipeline.shader;
+		g_pipeline_info.shader_id = m_g_pipeline.masked_shader;
 		g_pipeline_info.dynamic_states.dynamic_state_count = (uint32_t)dynamic_states.size();
 		g_pipeline_info.dynamic_states.dynamic_states = dynamic_states.data();
 		g_pipeline_info.depth_stencil.depth_test_enable = true;
 		g_pipeline_info.depth_stencil.depth_write_enable = true;
 		g_pipeline_info.depth_stencil.stencil_test_enable = true;
 		g_pipeline_info.depth_stencil.depth_compare_op = CompareOp::Less;
-		g_pipeline_info.color_blend.attachment_count = (uint32_t)blend_attachments.size();
+		g_pipeline_info.color_blend.attachment_count = g_attachment_count;
 		g_pipeline_info.color_blend.attachments = blend_attachments.data();
-		g_pipeline_info.render_pass_id = m_deferred.g_pass;
+		g_pipeline_info.render_pass_id = m_render_graph.render_pass("g_pass");
+
+		m_g_pipeline.masked_pipeline = m_graphics_controller.pipeline_create(g_pipeline_info);
+
+		// Without the split opaque primitives go through the shader with discard too
+		g_pipeline_info.shader_id = m_settings.split_masked_pipeline ? m_g_pipeline.shader : m_g_pipeline.masked_shader;
+		if (m_settings.depth_prepass) {
+			g_pipeline_info.depth_stencil.depth_write_enable = false;
+			g_pipeline_info.depth_stencil.depth_compare_op = CompareOp::Equal;
+		}
 
 		m_g_pipeline.pipeline = m_graphics_controller.pipeline_create(g_pipeline_info);
+	}
+
+	// Create depth prepass pipeline
+	if (m_settings.depth_prepass) {
+		ShaderStage shader_stage = shader_bundle.stage("depth_prepass.vert.spv");
 
-		UniformInfo g_pipeline_uniform_set_0;
-		g_pipeline_uniform_set_0.type = UniformType::UniformBuffer;
-		g_pipeline_uniform_set_0.binding = 0;
-		g_pipeline_uniform_set_0.ids = &m_scene_info.gpu.projview_matrix;
-		g_pipeline_uniform_set_0.id_count = 1;
+		m_depth_prepass_pipeline.shader = m_graphics_controller.shader_create(&shader_stage, 1);
 
-		m_g_pipeline.uniform_set_0 = m_graphics_controller.uniform_set_create(m_g_pipeline.shader, 0, &g_pipeline_uniform_set_0, 1);
+		std::array<PipelineDynamicStateFlags, 2> dynamic_states = { DYNAMIC_STATE_VIEWPORT, DYNAMIC_STATE_SCISSOR };
+
+		PipelineInfo depth_prepass_pipeline_info{};
+		depth_prepass_pipeline_info.shader_id = m_depth_prepass_pipeline.shader;
+		depth_prepass_pipeline_info.dynamic_states.dynamic_state_count = (uint32_t)dynamic_states.size();
+		depth_prepass_pipeline_info.dynamic_states.dynamic_states = dynamic_states.data();
+		depth_prepass_pipeline_info.depth_stencil.depth_test_enable = true;
+		depth_prepass_pipeline_info.depth_stencil.depth_write_enable = true;
+		depth_prepass_pipeline_info.depth_stencil.depth_compare_op = CompareOp::Less;
+		depth_prepass_pipeline_info.color_blend.attachment_count = 0;
+		depth_prepass_pipeline_info.render_pass_id = m_render_graph.render_pass("depth_prepass");
+
+		m_depth_prepass_pipeline.pipeline = m_graphics_controller.pipeline_create(depth_prepass_pipeline_info);
 	}
 
-	// Create light pipeline
+	// Create shadow pipelines, depth only with position-only vertex stream. Masked casters need the whole vertex for UVs
+	// and a fragment shader with discard, like the masked G pass
+	{
+		ShaderStage shader_stage = shader_bundle.stage("shadow_map.vert.spv");
+
+		m_shadows.shader = m_graphics_controller.shader_create(&shader_stage, 1);
+
+		std::array<ShaderStage, 2> masked_shader_stages = {
+			shader_bundle.stage("shadow_map_masked.vert.spv"),
+			shader_bundle.stage("shadow_map_masked.frag.spv")
+		};
+
+		m_shadows.masked_shader = m_graphics_controller.shader_create(masked_shader_stages.data(), (uint32_t)masked_shader_stages.size());
+
+		std::array<PipelineDynamicStateFlags, 2> dynamic_states = { DYNAMIC_STATE_VIEWPORT, DYNAMIC_STATE_SCISSOR };
+
+		PipelineInfo shadow_pipeline_info{};
+		shadow_pipeline_info.shader_id = m_shadows.shader;
+		shadow_pipeline_info.dynamic_states.dynamic_state_count = (uint32_t)dynamic_states.size();
+		shadow_pipeline_info.dynamic_states.dynamic_states = dynamic_states.data();
+		shadow_pipeline_info.raster.depth_bias_enable = true;
+		shadow_pipeline_info.raster.depth_bias_constant_factor = 1.25f;
+		shadow_pipeline_info.raster.depth_bias_clamp = 0.0f;
+		shadow_pipeline_info.raster.detpth_bias_slope_factor = 1.75f;
+		shadow_pipeline_info.depth_stencil.depth_test_enable = true;
+		shadow_pipeline_info.depth_stencil.depth_write_enable = true;
+		shadow_pipeline_info.depth_stencil.depth_compare_op = CompareOp::Less;
+		shadow_pipeline_info.color_blend.attachment_count = 0;
+		shadow_pipeline_info.render_pass_id = m_render_graph.render_pass("shadow");
+
+		m_shadows.pipeline = m_graphics_controller.pipeline_create(shadow_pipeline_info);
+
+		shadow_pipeline_info.shader_id = m_shadows.masked_shader;
+
+		m_shadows.masked_pipeline = m_graphics_controller.pipeline_create(shadow_pipeline_info);
+
+		// Hardware 2x2 PCF on every tap
+		SamplerInfo sampler_info{
+			.mag_filter = Filter::Linear,
+			.min_filter = Filter::Linear,
+			.mip_map_mode = MipMapMode::Nearest,
+			.compare_enable = true,
+			.comapare_op = CompareOp::LessOrEqual
+		};
+
+		m_shadows.sampler = m_graphics_controller.sampler_create(sampler_info);
+		m_shadows.info_buffer = m_graphics_controller.uniform_buffer_create(nullptr, sizeof(CascadeInfo));
+	}
+
+	// Create shadow copy pipeline, writes depth of cached static casters before dynamic ones are drawn
 	{
-		auto vert_spv = load_spv("../assets/shaders/present.vert.spv");
-		auto frag_spv = load_spv("../assets/shaders/lightning.frag.spv");
-
-		std::array<ShaderStage, 2> shader_stages;
-		shader_stages[0] = {
-			.stage = ShaderStageVertex,
-			.spv = vert_spv.data(),
-			.spv_size = vert_spv.size()
+		std::array<ShaderStage, 2> shader_stages = {
+			shader_bundle.stage("present.vert.spv"),
+			shader_bundle.stage("depth_copy.frag.spv")
+		};
+
+		m_shadows.copy_shader = m_graphics_controller.shader_create(shader_stages.data(), (uint32_t)shader_stages.size());
+
+		std::array<PipelineDynamicStateFlags, 2> dynamic_states = { DYNAMIC_STATE_VIEWPORT, DYNAMIC_STATE_SCISSOR };
+
+		PipelineInfo copy_pipeline_info{};
+		copy_pipeline_info.shader_id = m_shadows.copy_shader;
+		copy_pipeline_info.dynamic_states.dynamic_state_count = (uint32_t)dynamic_states.size();
+		copy_pipeline_info.dynamic_states.dynamic_states = dynamic_states.data();
+		copy_pipeline_info.depth_stencil.depth_test_enable = true;
+		copy_pipeline_info.depth_stencil.depth_write_enable = true;
+		copy_pipeline_info.depth_stencil.depth_compare_op = CompareOp::Always;
+		copy_pipeline_info.color_blend.attachment_count = 0;
+		copy_pipeline_info.render_pass_id = m_render_graph.render_pass("shadow");
+
+		m_shadows.copy_pipeline = m_graphics_controller.pipeline_create(copy_pipeline_info);
+
+		SamplerInfo sampler_info{
+			.mag_filter = Filter::Nearest,
+			.min_filter = Filter::Nearest,
+			.mip_map_mode = MipMapMode::Nearest
 		};
-		shader_stages[1] = {
-			.stage = ShaderStageFragment,
-			.spv = frag_spv.data(),
-			.spv_size = frag_spv.size()
+
+		m_shadows.copy_sampler = m_graphics_controller.sampler_create(sampler_info);
+	}
+
+	// Create light pipeline
+	{
+		std::array<ShaderStage, 2> shader_stages = {
+			shader_bundle.stage("present.vert.spv"),
+			shader_bundle.stage(packed_g_buffer ? "lightning_packed.frag.spv" : "lightning.frag.spv")
 		};
 
 		m_light_pipeline.shader = m_graphics_controller.shader_create(shader_stages.data(), (uint32_t)shader_stages.size());
@@ -287,6 +649,17 @@ void Renderer::create(VulkanContext* context) {
 		light_attachments[0].blend_enable = false;
 		light_attachments[0].color_write_mask = ColorComponentR | ColorComponentG | ColorComponentB | ColorComponentA;
 
+		// Emissive is already in composition target
+		if (packed_g_buffer) {
+			light_attachments[0].blend_enable = true;
+			light_attachments[0].src_color_blend_factor = BlendFactor::One;
+			light_attachments[0].dst_color_blend_factor = BlendFactor::One;
+			light_attachments[0].color_blend_op = BlendOp::Add;
+			light_attachments[0].src_alpha_blend_factor = BlendFactor::Zero;
+			light_attachments[0].dst_alpha_blend_factor = BlendFactor::One;
+			light_attachments[0].alpha_blend_op = BlendOp::Add;
+		}
+
 		PipelineInfo light_pipeline_info{};
 		light_pipeline_info.shader_id = m_light_pipeline.shader;
 		light_pipeline_info.dynamic_states.dynamic_state_count = (uint32_t)dynamic_states.size();
@@ -300,7 +673,7 @@ void Renderer::create(VulkanContext* context) {
 		light_pipeline_info.depth_stencil.back.compare_op = CompareOp::Equal;
 		light_pipeline_info.color_blend.attachment_count = (uint32_t)light_attachments.size();
 		light_pipeline_info.color_blend.attachments = light_attachments.data();
-		light_pipeline_info.render_pass_id = m_deferred.composition_pass;
+		light_pipeline_info.render_pass_id = m_render_graph.render_pass("composition");
 
 		m_light_pipeline.pipeline = m_graphics_controller.pipeline_create(light_pipeline_info);
 
@@ -315,19 +688,9 @@ void Renderer::create(VulkanContext* context) {
 
 	// Create blend pipeline
 	{
-		auto vert_spv = load_spv("../assets/shaders/blend.vert.spv");
-		auto frag_spv = load_spv("../assets/shaders/blend.frag.spv");
-
-		std::array<ShaderStage, 2> shader_stages;
-		shader_stages[0] = {
-			.stage = ShaderStageVertex,
-			.spv = vert_spv.data(),
-			.spv_size = vert_spv.size()
-		};
-		shader_stages[1] = {
-			.stage = ShaderStageFragment,
-			.spv = frag_spv.data(),
-			.spv_size = frag_spv.size()
+		std::array<ShaderStage, 2> shader_stages = {
+			shader_bundle.stage("blend.vert.spv"),
+			shader_bundle.stage("blend.frag.spv")
 		};
 
 		m_blend_pipeline.shader = m_graphics_controller.shader_create(shader_stages.data(), (uint32_t)shader_stages.size());
@@ -351,40 +714,55 @@ void Renderer::create(VulkanContext* context) {
 		blend_pipeline_info.color_blend.attachments = blend_attachments.data();
 		blend_pipeline_info.depth_stencil.depth_test_enable = true;
 		blend_pipeline_info.depth_stencil.depth_write_enable = false;
-		blend_pipeline_info.render_pass_id = m_deferred.composition_pass;
+		blend_pipeline_info.render_pass_id = m_render_graph.render_pass("composition");
 
 		m_blend_pipeline.pipeline = m_graphics_controller.pipeline_create(blend_pipeline_info);
 
 		m_blend_pipeline.uniform_buffer = m_graphics_controller.uniform_buffer_create(nullptr, sizeof(LightInfo));
+	}
 
-		std::array<UniformInfo, 2> blend_pipeline_uniform_set_0;
-		blend_pipeline_uniform_set_0[0].type = UniformType::UniformBuffer;
-		blend_pipeline_uniform_set_0[0].binding = 0;
-		blend_pipeline_uniform_set_0[0].ids = &m_scene_info.gpu.projview_matrix;
-		blend_pipeline_uniform_set_0[0].id_count = 1;
-		blend_pipeline_uniform_set_0[1].type = UniformType::UniformBuffer;
-		blend_pipeline_uniform_set_0[1].binding = 1;
-		blend_pipeline_uniform_set_0[1].ids = &m_blend_pipeline.uniform_buffer;
-		blend_pipeline_uniform_set_0[1].id_count = 1;
+	// Create instance and transform buffers and uniform sets of G and blend pipelines which reference them
+	instance_buffer_reserve(InstanceBuffer::INITIAL_CAPACITY);
+	transform_buffer_reserve(Transforms::INITIAL_CAPACITY);
+	object_uniform_sets_create();
+
+	// Create light cluster buffers and uniform sets of lightning and blend pipelines which reference them
+	{
+		m_light_clusters.info_buffer = m_graphics_controller.uniform_buffer_create(nullptr, sizeof(ClusterInfo));
+		m_light_clusters.cluster_buffer = m_graphics_controller.storage_buffer_create(nullptr, LightClusters::CLUSTER_COUNT * sizeof(glm::uvec2));
+		m_light_clusters.clusters.resize(LightClusters::CLUSTER_COUNT);
+		m_light_clusters.cluster_lights.resize(LightClusters::CLUSTER_COUNT);
 
-		m_blend_pipeline.uniform_set_0 = m_graphics_controller.uniform_set_create(m_blend_pipeline.shader, 0, blend_pipeline_uniform_set_0.data(), (uint32_t)blend_pipeline_uniform_set_0.size());
+		light_buffers_reserve(LightClusters::INITIAL_LIGHT_CAPACITY, LightClusters::INITIAL_LIGHT_INDEX_CAPACITY);
+		light_uniform_sets_create();
 	}
 
-	// Create skybox pipeline
+	// Create material buffer and bindless texture arrays
 	{
-		auto vert_spv = load_spv("../assets/shaders/skybox.vert.spv");
-		auto frag_spv = load_spv("../assets/shaders/skybox.frag.spv");
-
-		std::array<ShaderStage, 2> shader_stages;
-		shader_stages[0] = {
-			.stage = ShaderStageVertex,
-			.spv = vert_spv.data(),
-			.spv_size = vert_spv.size()
+		m_bindless.material_data.resize(Bindless::MAX_MATERIALS);
+		m_bindless.material_buffer = m_graphics_controller.storage_buffer_create(nullptr, Bindless::MAX_MATERIALS * sizeof(MaterialData));
+
+		UniformInfo material_buffer_uniform{
+			.type = UniformType::StorageBuffer,
+			.binding = 0,
+			.ids = &m_bindless.material_buffer,
+			.id_count = 1
 		};
-		shader_stages[1] = {
-			.stage = ShaderStageFragment,
-			.spv = frag_spv.data(),
-			.spv_size = frag_spv.size()
+
+		m_bindless.g_uniform_set_1 = m_graphics_controller.uniform_set_create(m_g_pipeline.shader, 1, &material_buffer_uniform, 1);
+		m_bindless.blend_uniform_set_1 = m_graphics_controller.uniform_set_create(m_blend_pipeline.shader, 1, &material_buffer_uniform, 1);
+		m_bindless.shadow_uniform_set_1 = m_graphics_controller.uniform_set_create(m_shadows.masked_shader, 1, &material_buffer_uniform, 1);
+
+		// Slot 0 is used by materials without a texture
+		m_bindless.texture_slot_count = 1;
+		texture_slot_write(Bindless::EMPTY_TEXTURE_SLOT, m_defaults.empty_texture);
+	}
+
+	// Create skybox pipeline, compiled once a skybox is drawn
+	{
+		std::array<ShaderStage, 2> shader_stages = {
+			shader_bundle.stage("skybox.vert.spv"),
+			shader_bundle.stage("skybox.frag.spv")
 		};
 
 		m_skybox_pipeline.shader = m_graphics_controller.shader_create(shader_stages.data(), (uint32_t)shader_stages.size());
@@ -403,16 +781,17 @@ void Renderer::create(VulkanContext* context) {
 		skybox_pipeline_info.color_blend.attachment_count = (uint32_t)skybox_attachments.size();
 		skybox_pipeline_info.dynamic_states.dynamic_states = dynamic_states.data();
 		skybox_pipeline_info.dynamic_states.dynamic_state_count = (uint32_t)dynamic_states.size();
-		skybox_pipeline_info.render_pass_id = m_deferred.composition_pass;
+		skybox_pipeline_info.render_pass_id = m_render_graph.render_pass("composition");
 
-		m_skybox_pipeline.pipeline = m_graphics_controller.pipeline_create(skybox_pipeline_info);
+		m_skybox_pipeline.pipeline = m_graphics_controller.pipeline_create(skybox_pipeline_info, PipelineCompile::Lazy);
 
 		SamplerInfo sampler_info{
 			.mag_filter = Filter::Linear,
 			.min_filter = Filter::Linear,
 			.mip_map_mode = MipMapMode::Linear,
 			.anisotropy_enable = true,
-			.max_anisotropy = 4.0f
+			.max_anisotropy = 4.0f,
+			.max_lod = 16.0f
 		};
 
 		m_skybox_pipeline.sampler = m_graphics_controller.sampler_create(sampler_info);
@@ -427,21 +806,11 @@ void Renderer::create(VulkanContext* context) {
 		m_skybox_pipeline.uniform_set_0 = m_graphics_controller.uniform_set_create(m_skybox_pipeline.shader, 0, &skybox_uniform, 1);
 	}
 
-	// Create coord system pipeline
+	// Create coord system pipeline, compiled only if it gets drawn
 	{
-		auto vert_spv = load_spv("../assets/shaders/coord_system.vert.spv");
-		auto frag_spv = load_spv("../assets/shaders/coord_system.frag.spv");
-
-		std::array<ShaderStage, 2> shader_stages;
-		shader_stages[0] = {
-			.stage = ShaderStageVertex,
-			.spv = vert_spv.data(),
-			.spv_size = vert_spv.size()
-		};
-		shader_stages[1] = {
-			.stage = ShaderStageFragment,
-			.spv = frag_spv.data(),
-			.spv_size = frag_spv.size()
+		std::array<ShaderStage, 2> shader_stages = {
+			shader_bundle.stage("coord_system.vert.spv"),
+			shader_bundle.stage("coord_system.frag.spv")
 		};
 
 		m_coord_system_pipeline.shader = m_graphics_controller.shader_create(shader_stages.data(), (uint32_t)shader_stages.size());
@@ -461,9 +830,9 @@ void Renderer::create(VulkanContext* context) {
 		coord_system_pipeline_info.dynamic_states.dynamic_states = dynamic_states.data();
 		coord_system_pipeline_info.color_blend.attachment_count = (uint32_t)coord_system_attachments.size();
 		coord_system_pipeline_info.color_blend.attachments = coord_system_attachments.data();
-		coord_system_pipeline_info.render_pass_id = m_deferred.composition_pass;
+		coord_system_pipeline_info.render_pass_id = m_render_graph.render_pass("composition");
 
-		m_coord_system_pipeline.pipeline = m_graphics_controller.pipeline_create(coord_system_pipeline_info);
+		m_coord_system_pipeline.pipeline = m_graphics_controller.pipeline_create(coord_system_pipeline_info, PipelineCompile::Lazy);
 
 		float offset = 1000.0f;
 		float vertices[] = {
@@ -489,19 +858,9 @@ void Renderer::create(VulkanContext* context) {
 
 	// Create present pipeline
 	{
-		auto vert_spv = load_spv("../assets/shaders/present.vert.spv");
-		auto frag_spv = load_spv("../assets/shaders/present.frag.spv");
-
-		std::array<ShaderStage, 2> shader_stages;
-		shader_stages[0] = {
-			.stage = ShaderStageVertex,
-			.spv = vert_spv.data(),
-			.spv_size = vert_spv.size()
-		};
-		shader_stages[1] = {
-			.stage = ShaderStageFragment,
-			.spv = frag_spv.data(),
-			.spv_size = frag_spv.size()
+		std::array<ShaderStage, 2> shader_stages = {
+			shader_bundle.stage("present.vert.spv"),
+			shader_bundle.stage("present.frag.spv")
 		};
 
 		m_present_pipeline.shader = m_graphics_controller.shader_create(shader_stages.data(), (uint32_t)shader_stages.size());
@@ -536,55 +895,61 @@ void Renderer::create(VulkanContext* context) {
 		m_present_pipeline.pipeline = m_graphics_controller.pipeline_create(present_pipeline_info);
 	}
 
-	// Create generate cubemap pipeline
-	{
-		RenderPassAttachment gen_cubemap_attachment{
-			.previous_usage = ImageUsageTransferSrc,
-			.current_usage = ImageUsageColorAttachment,
-			.next_usage = ImageUsageTransferSrc,
-			.format = Format::RGBA16_SFloat,
-			.initial_action = InitialAction::Clear,
-			.final_action = FinalAction::Store
+	// Create temporal resolve pipeline
+	if (m_settings.temporal_upscaling) {
+		std::array<ShaderStage, 2> shader_stages = {
+			shader_bundle.stage("present.vert.spv"),
+			shader_bundle.stage("temporal_resolve.frag.spv")
 		};
 
-		m_gen_cubemap_pipeline.render_pass = m_graphics_controller.render_pass_create(&gen_cubemap_attachment, 1);
+		m_temporal.shader = m_graphics_controller.shader_create(shader_stages.data(), (uint32_t)shader_stages.size());
 
-		auto vert_spv = load_spv("../assets/shaders/equirect_to_cubemap.vert.spv");
-		auto frag_spv = load_spv("../assets/shaders/equirect_to_cubemap.frag.spv");
+		std::array<PipelineDynamicStateFlags, 2> dynamic_states = { DYNAMIC_STATE_VIEWPORT, DYNAMIC_STATE_SCISSOR };
 
-		std::array<ShaderStage, 2> shader_stages;
-		shader_stages[0] = {
-			.stage = ShaderStageVertex,
-			.spv = vert_spv.data(),
-			.spv_size = vert_spv.size()
-		};
-		shader_stages[1] = {
-			.stage = ShaderStageFragment,
-			.spv = frag_spv.data(),
-			.spv_size = frag_spv.size()
-		};
+		ColorBlendAttachmentState resolve_attachment{};
+		resolve_attachment.blend_enable = false;
+		resolve_attachment.color_write_mask = ColorComponentR | ColorComponentG | ColorComponentB | ColorComponentA;
 
-		m_gen_cubemap_pipeline.shader = m_graphics_controller.shader_create(shader_stages.data(), (uint32_t)shader_stages.size());
+		// Both resolve passes have the same attachment, so the pipeline is compatible with either
+		PipelineInfo resolve_pipeline_info{};
+		resolve_pipeline_info.shader_id = m_temporal.shader;
+		resolve_pipeline_info.dynamic_states.dynamic_state_count = (uint32_t)dynamic_states.size();
+		resolve_pipeline_info.dynamic_states.dynamic_states = dynamic_states.data();
+		resolve_pipeline_info.depth_stencil.depth_test_enable = false;
+		resolve_pipeline_info.depth_stencil.depth_write_enable = false;
+		resolve_pipeline_info.color_blend.attachment_count = 1;
+		resolve_pipeline_info.color_blend.attachments = &resolve_attachment;
+		resolve_pipeline_info.render_pass_id = m_render_graph.render_pass("temporal_resolve_0");
 
-		ColorBlendAttachmentState blend_attachment{};
-		blend_attachment.blend_enable = false;
-		blend_attachment.color_write_mask = ColorComponentR | ColorComponentG | ColorComponentB | ColorComponentA;
+		m_temporal.pipeline = m_graphics_controller.pipeline_create(resolve_pipeline_info);
 
-		std::array<PipelineDynamicStateFlags, 2> dynamic_states = { DYNAMIC_STATE_VIEWPORT, DYNAMIC_STATE_SCISSOR };
+		SamplerInfo sampler_info{
+			.mag_filter = Filter::Linear,
+			.min_filter = Filter::Linear
+		};
+
+		m_temporal.sampler = m_graphics_controller.sampler_create(sampler_info);
+	}
+
+	// Create generate cubemap pipelines
+	{
+		auto compute_pipeline_create = [&](const char* name, ShaderId& shader, PipelineId& pipeline, PipelineCompile compile) {
+			ShaderStage shader_stage = shader_bundle.stage(name);
 
-		PipelineInfo gen_cubemap_pi{};
-		gen_cubemap_pi.shader_id = m_gen_cubemap_pipeline.shader;
-		gen_cubemap_pi.dynamic_states.dynamic_state_count = (uint32_t)dynamic_states.size();
-		gen_cubemap_pi.dynamic_states.dynamic_states = dynamic_states.data();
-		gen_cubemap_pi.color_blend.attachments = &blend_attachment;
-		gen_cubemap_pi.color_blend.attachment_count = 1;
-		gen_cubemap_pi.render_pass_id = m_gen_cubemap_pipeline.render_pass;
+			shader = m_graphics_controller.shader_create(&shader_stage, 1);
+			pipeline = m_graphics_controller.compute_pipeline_create(shader, compile);
+		};
 
-		m_gen_cubemap_pipeline.pipeline = m_graphics_controller.pipeline_create(gen_cubemap_pi);
+		// Prefiltering is optional, so its pipelines are compiled only once a skybox needs them
+		compute_pipeline_create("equirect_to_cubemap.comp.spv", m_gen_cubemap_pipeline.equirect_shader, m_gen_cubemap_pipeline.equirect_pipeline, PipelineCompile::Async);
+		compute_pipeline_create("cubemap_downsample.comp.spv", m_gen_cubemap_pipeline.downsample_shader, m_gen_cubemap_pipeline.downsample_pipeline, PipelineCompile::Async);
+		compute_pipeline_create("cubemap_prefilter.comp.spv", m_gen_cubemap_pipeline.prefilter_shader, m_gen_cubemap_pipeline.prefilter_pipeline, PipelineCompile::Lazy);
+		compute_pipeline_create("brdf_lut.comp.spv", m_gen_cubemap_pipeline.brdf_lut_shader, m_gen_cubemap_pipeline.brdf_lut_pipeline, PipelineCompile::Lazy);
 
+		// Samples the equirectangular map and mips of the environment while prefiltering
 		SamplerInfo sampler_info{
-			.anisotropy_enable = true,
-			.max_anisotropy = 16.0f
+			.mip_map_mode = MipMapMode::Linear,
+			.max_lod = 16.0f
 		};
 
 		m_gen_cubemap_pipeline.sampler = m_graphics_controller.sampler_create(sampler_info);
@@ -681,11 +1046,7 @@ void Renderer::destroy() {
 				m_image_usage_counts.erase(texture->image);
 			}
 
-			m_sampler_usage_counts[texture->sampler]--;
-			if (m_sampler_usage_counts[texture->sampler] == 0) {
-				m_graphics_controller.sampler_destroy(texture->sampler);
-				m_image_usage_counts.erase(texture->sampler);
-			}
+			m_graphics_controller.sampler_destroy(texture->sampler);
 		}
 	};
 
@@ -702,104 +1063,109 @@ void Renderer::destroy() {
 	for (auto& skybox : m_skyboxes) {
 		m_graphics_controller.image_destroy(skybox.second.image);
 		m_graphics_controller.uniform_set_destroy(skybox.second.uniform_set_1);
+		if (skybox.second.prefiltered_image.has_value())
+			m_graphics_controller.image_destroy(skybox.second.prefiltered_image.value());
 	}
 	m_skyboxes.clear();
 
+	if (m_gen_cubemap_pipeline.brdf_lut.has_value()) {
+		m_graphics_controller.image_destroy(m_gen_cubemap_pipeline.brdf_lut.value());
+		m_gen_cubemap_pipeline.brdf_lut.reset();
+	}
+
 	m_image_usage_counts.clear();
-	m_sampler_usage_counts.clear();
 
-	for (auto& vertex_buffer : m_vertex_buffers)
-		m_graphics_controller.buffer_destroy(vertex_buffer.second);
+	for (auto& vertex_buffer : m_vertex_buffers) {
+		m_graphics_controller.buffer_destroy(vertex_buffer.second.buffer);
+		m_graphics_controller.buffer_destroy(vertex_buffer.second.position_buffer);
+	}
 	m_vertex_buffers.clear();
 
 	for (auto& index_buffer : m_index_buffers)
 		m_graphics_controller.buffer_destroy(index_buffer.second);
 	m_index_buffers.clear();
 
+	m_render_graph.destroy();
+
 	m_graphics_controller.destroy();
 }
 
 void Renderer::set_resolution(uint32_t width, uint32_t height) {
-	// Albedo
-	m_deferred.albedo_info.extent.width = width;
-	m_deferred.albedo_info.extent.height = height;
-	m_deferred.albedo = m_graphics_controller.image_create(m_deferred.albedo_info);
-
-	// Ao-rough-met
-	m_deferred.ao_rough_met_info.extent.width = width;
-	m_deferred.ao_rough_met_info.extent.height = height;
-	m_deferred.ao_rough_met = m_graphics_controller.image_create(m_deferred.ao_rough_met_info);
-
-	// Normals
-	m_deferred.normals_info.extent.width = width;
-	m_deferred.normals_info.extent.height = height;
-	m_deferred.normals = m_graphics_controller.image_create(m_deferred.normals_info);
-
-	m_deferred.emissive_info.extent.width = width;
-	m_deferred.emissive_info.extent.height = height;
-	m_deferred.emissive = m_graphics_controller.image_create(m_deferred.emissive_info);
-
-	// Depth/stencil
-	m_deferred.depth_stencil_info.extent.width = width;
-	m_deferred.depth_stencil_info.extent.height = height;
-	m_deferred.depth_stencil = m_graphics_controller.image_create(m_deferred.depth_stencil_info);
-
-	// G framebuffer
-	std::array<ImageId, 5> g_fb_ids = { m_deferred.albedo, m_deferred.ao_rough_met, m_deferred.normals, m_deferred.emissive, m_deferred.depth_stencil };
-	m_deferred.g_framebuffer = m_graphics_controller.framebuffer_create(m_deferred.g_pass, g_fb_ids.data(), (uint32_t)g_fb_ids.size());
-
-	// Composition
-	m_deferred.composition_info.extent.width = width;
-	m_deferred.composition_info.extent.height = height;
-	m_deferred.composition = m_graphics_controller.image_create(m_deferred.composition_info);
-
-	RenderId albedo_ids[2] = { m_deferred.albedo, m_light_pipeline.sampler };
-	RenderId ao_rough_met_ids[2] = { m_deferred.ao_rough_met, m_light_pipeline.sampler };
-	RenderId normal_ids[2] = { m_deferred.normals, m_light_pipeline.sampler };
-	RenderId emissive_ids[2] = { m_deferred.emissive, m_light_pipeline.sampler };
-	RenderId depth_ids[2] = { m_deferred.depth_stencil, m_light_pipeline.sampler };
-
-	std::array<UniformInfo, 5> light_set_0_bindings{};
-	light_set_0_bindings[0].type = UniformType::CombinedImageSampler;
-	light_set_0_bindings[0].subresource_range = { ImageAspectColor };
-	light_set_0_bindings[0].binding = 0;
-	light_set_0_bindings[0].ids = albedo_ids;
-	light_set_0_bindings[0].id_count = 2;
-	light_set_0_bindings[1].type = UniformType::CombinedImageSampler;
-	light_set_0_bindings[1].subresource_range = { ImageAspectColor };
-	light_set_0_bindings[1].binding = 1;
-	light_set_0_bindings[1].ids = ao_rough_met_ids;
-	light_set_0_bindings[1].id_count = 2;
-	light_set_0_bindings[2].type = UniformType::CombinedImageSampler;
-	light_set_0_bindings[2].subresource_range = { ImageAspectColor };
-	light_set_0_bindings[2].binding = 2;
-	light_set_0_bindings[2].ids = normal_ids;
-	light_set_0_bindings[2].id_count = 2;
-	light_set_0_bindings[3].type = UniformType::CombinedImageSampler;
-	light_set_0_bindings[3].subresource_range = { ImageAspectColor };
-	light_set_0_bindings[3].binding = 3;
-	light_set_0_bindings[3].ids = emissive_ids;
-	light_set_0_bindings[3].id_count = 2;
-	light_set_0_bindings[4].type = UniformType::CombinedImageSampler;
-	light_set_0_bindings[4].subresource_range = { ImageAspectDepth };
-	light_set_0_bindings[4].binding = 4;
-	light_set_0_bindings[4].ids = depth_ids;
-	light_set_0_bindings[4].id_count = 2;
-
-	m_light_pipeline.uniform_set_0 = m_graphics_controller.uniform_set_create(m_light_pipeline.shader, 0, light_set_0_bindings.data(), (uint32_t)light_set_0_bindings.size());
-
-	// Composition
-	std::array<ImageId, 2> composition_fb_ids = { m_deferred.composition, m_deferred.depth_stencil };
-	m_deferred.composition_framebuffer = m_graphics_controller.framebuffer_create(m_deferred.composition_pass, composition_fb_ids.data(), (uint32_t)composition_fb_ids.size());
+	// Render targets are recreated, uniform sets sampling them are rewritten in place once they exist
+	bool update_sets = m_render_graph.resolution().width != 0 || m_render_graph.resolution().height != 0;
+
+	// Cached static shadows and accumulated history are lost with the old images
+	for (ShadowCascade& cascade : m_shadows.cascades)
+		cascade.cache_valid = false;
+	m_temporal.history_valid = false;
+
+	m_render_graph.set_resolution(width, height);
+
+	// Binding order matches lightning.frag
+	std::vector<std::string> g_buffer_images;
+	if (m_settings.g_buffer_layout == GBufferLayout::Packed)
+		g_buffer_images = { "albedo", "normal_rough", "depth_stencil" };
+	else
+		g_buffer_images = { "albedo", "ao_rough_met", "normals", "emissive", "depth_stencil" };
+
+	std::vector<std::array<RenderId, 2>> g_buffer_ids(g_buffer_images.size());
+	std::vector<UniformInfo> light_set_0_bindings(g_buffer_images.size());
+	for (uint32_t i = 0; i < (uint32_t)g_buffer_images.size(); i++) {
+		g_buffer_ids[i] = { m_render_graph.image(g_buffer_images[i]), m_light_pipeline.sampler };
+
+		light_set_0_bindings[i].type = UniformType::CombinedImageSampler;
+		light_set_0_bindings[i].subresource_range = { g_buffer_images[i] == "depth_stencil" ? ImageAspectDepth : ImageAspectColor };
+		light_set_0_bindings[i].binding = i;
+		light_set_0_bindings[i].ids = g_buffer_ids[i].data();
+		light_set_0_bindings[i].id_count = 2;
+	}
+
+	uniform_set_write(m_light_pipeline.uniform_set_0, m_light_pipeline.shader, 0, light_set_0_bindings.data(), (uint32_t)light_set_0_bindings.size(), update_sets);
+
+	RenderId shadow_map_ids[2] = { m_render_graph.image("shadow_map"), m_shadows.sampler };
+
+	std::array<UniformInfo, 2> light_set_2_bindings;
+	light_set_2_bindings[0].type = UniformType::UniformBuffer;
+	light_set_2_bindings[0].binding = 0;
+	light_set_2_bindings[0].ids = &m_shadows.info_buffer;
+	light_set_2_bindings[0].id_count = 1;
+	light_set_2_bindings[1].type = UniformType::CombinedImageSampler;
+	light_set_2_bindings[1].subresource_range = { ImageAspectDepth };
+	light_set_2_bindings[1].binding = 1;
+	light_set_2_bindings[1].ids = shadow_map_ids;
+	light_set_2_bindings[1].id_count = 2;
 
+	uniform_set_write(m_shadows.light_uniform_set_2, m_light_pipeline.shader, 2, light_set_2_bindings.data(), (uint32_t)light_set_2_bindings.size(), update_sets);
+
+	RenderId static_shadow_map_ids[2] = { m_render_graph.image("static_shadow_map"), m_shadows.copy_sampler };
+
+	UniformInfo copy_set_0_binding{
+		.type = UniformType::CombinedImageSampler,
+		.subresource_range = { ImageAspectDepth },
+		.binding = 0,
+		.ids = static_shadow_map_ids,
+		.id_count = 2
+	};
+
+	uniform_set_write(m_shadows.copy_uniform_set_0, m_shadows.copy_shader, 0, &copy_set_0_binding, 1, update_sets);
+
+	if (m_settings.temporal_upscaling) {
+		temporal_uniform_sets_write(update_sets);
+		return;
+	}
+
+	const ImageInfo& composition_info = m_render_graph.image_info("composition");
+
+	// Render area of dynamic resolution is scaled to screen
 	SamplerId sampler;
-	if (m_deferred.composition_info.extent.width == m_graphics_controller.screen_resolution().width &&
-		m_deferred.composition_info.extent.height == m_graphics_controller.screen_resolution().height)
+	if (!m_settings.dynamic_resolution &&
+		composition_info.extent.width == m_graphics_controller.screen_resolution().width &&
+		composition_info.extent.height == m_graphics_controller.screen_resolution().height)
 		sampler = m_present_pipeline.same_res_sampler;
 	else
 		sampler = m_present_pipeline.diff_res_sampler;
 
-	RenderId present_set_0_bindind_0[2] = { m_deferred.composition, sampler };
+	RenderId present_set_0_bindind_0[2] = { m_render_graph.image("composition"), sampler };
 
 	UniformInfo present_uniform_set_0{
 		.type = UniformType::CombinedImageSampler,
@@ -809,17 +1175,108 @@ void Renderer::set_resolution(uint32_t width, uint32_t height) {
 		.id_count = 2
 	};
 
-	m_present_pipeline.uniform_set_0 = m_graphics_controller.uniform_set_create(m_present_pipeline.shader, 0, &present_uniform_set_0, 1);
+	uniform_set_write(m_present_pipeline.uniform_set_0, m_present_pipeline.shader, 0, &present_uniform_set_0, 1, update_sets);
 }
 
 void Renderer::set_shadow_map_resolution(uint32_t width, uint32_t height) {
-	//m_deferred.shadow_map_info.width = width;
-	//m_deferred.shadow_map_info.height = height;
-	//
-	//m_deferred.shadow_map = m_graphics_controller.image_create(nullptr, m_deferred.shadow_map_info);
+	// Resolution of the whole atlas, cascades get one quadrant each
+	m_shadows.cascade_resolution = std::min(width, height) / Shadows::ATLAS_TILES;
+	m_render_graph.set_image_extent("shadow_map", Shadows::ATLAS_TILES * m_shadows.cascade_resolution, Shadows::ATLAS_TILES * m_shadows.cascade_resolution);
+	m_render_graph.set_image_extent("static_shadow_map", Shadows::ATLAS_TILES * m_shadows.cascade_resolution, Shadows::ATLAS_TILES * m_shadows.cascade_resolution);
+
+	// Graph images are recreated together
+	ScreenResolution resolution = m_render_graph.resolution();
+	if (resolution.width != 0 || resolution.height != 0)
+		set_resolution(resolution.width, resolution.height);
+}
+
+void Renderer::set_output_resolution(uint32_t width, uint32_t height) {
+	m_temporal.output_resolution = { width, height };
+	if (!m_settings.temporal_upscaling)
+		return;
+
+	m_render_graph.set_image_extent("history_0", width, height);
+	m_render_graph.set_image_extent("history_1", width, height);
 
-	//ImageId shadow_map_framebuffer_ids[1] = { m_deferred.shadow_map };
-	//m_deferred.shadow_map_framebuffer = m_graphics_controller.framebuffer_create(m_deferred.shadow_map_pass, shadow_map_framebuffer_ids, 1);
+	// Graph images are recreated together
+	ScreenResolution resolution = m_render_graph.resolution();
+	if (resolution.width != 0 || resolution.height != 0)
+		set_resolution(resolution.width, resolution.height);
+}
+
+void Renderer::temporal_uniform_sets_write(bool update) {
+	RenderId composition_ids[2] = { m_render_graph.image("composition"), m_temporal.sampler };
+	RenderId velocity_ids[2] = { m_render_graph.image("velocity"), m_temporal.sampler };
+	RenderId depth_ids[2] = { m_render_graph.image("depth_stencil"), m_temporal.sampler };
+
+	// History at screen resolution is presented pixel for pixel
+	SamplerId present_sampler;
+	if (m_temporal.output_resolution.width == m_graphics_controller.screen_resolution().width &&
+		m_temporal.output_resolution.height == m_graphics_controller.screen_resolution().height)
+		present_sampler = m_present_pipeline.same_res_sampler;
+	else
+		present_sampler = m_present_pipeline.diff_res_sampler;
+
+	// Sets of both histories are written together, so each layout is created with one allocation
+	RenderId prev_history_ids[2][2];
+	RenderId history_ids[2][2];
+	std::array<UniformInfo, 8> resolve_set_0_bindings;
+	std::array<UniformInfo, 2> present_set_0_bindings;
+
+	for (uint32_t i = 0; i < 2; i++) {
+		prev_history_ids[i][0] = m_render_graph.image("history_" + std::to_string(1 - i));
+		prev_history_ids[i][1] = m_temporal.sampler;
+
+		UniformInfo* resolve_bindings = &resolve_set_0_bindings[4 * i];
+		resolve_bindings[0].type = UniformType::CombinedImageSampler;
+		resolve_bindings[0].subresource_range = { ImageAspectColor };
+		resolve_bindings[0].binding = 0;
+		resolve_bindings[0].ids = composition_ids;
+		resolve_bindings[0].id_count = 2;
+		resolve_bindings[1].type = UniformType::CombinedImageSampler;
+		resolve_bindings[1].subresource_range = { ImageAspectColor };
+		resolve_bindings[1].binding = 1;
+		resolve_bindings[1].ids = velocity_ids;
+		resolve_bindings[1].id_count = 2;
+		resolve_bindings[2].type = UniformType::CombinedImageSampler;
+		resolve_bindings[2].subresource_range = { ImageAspectDepth };
+		resolve_bindings[2].binding = 2;
+		resolve_bindings[2].ids = depth_ids;
+		resolve_bindings[2].id_count = 2;
+		resolve_bindings[3].type = UniformType::CombinedImageSampler;
+		resolve_bindings[3].subresource_range = { ImageAspectColor };
+		resolve_bindings[3].binding = 3;
+		resolve_bindings[3].ids = prev_history_ids[i];
+		resolve_bindings[3].id_count = 2;
+
+		history_ids[i][0] = m_render_graph.image("history_" + std::to_string(i));
+		history_ids[i][1] = present_sampler;
+
+		present_set_0_bindings[i] = {
+			.type = UniformType::CombinedImageSampler,
+			.subresource_range = { ImageAspectColor },
+			.binding = 0,
+			.ids = history_ids[i],
+			.id_count = 2
+		};
+	}
+
+	if (update) {
+		for (uint32_t i = 0; i < 2; i++) {
+			m_graphics_controller.uniform_set_update(m_temporal.uniform_sets_0[i], &resolve_set_0_bindings[4 * i], 4);
+			m_graphics_controller.uniform_set_update(m_temporal.present_uniform_sets_0[i], &present_set_0_bindings[i], 1);
+		}
+	} else {
+		m_graphics_controller.uniform_sets_create(m_temporal.shader, 0, resolve_set_0_bindings.data(), 4, 2, m_temporal.uniform_sets_0.data());
+		m_graphics_controller.uniform_sets_create(m_present_pipeline.shader, 0, present_set_0_bindings.data(), 1, 2, m_temporal.present_uniform_sets_0.data());
+	}
+}
+
+void Renderer::uniform_set_write(UniformSetId& uniform_set, ShaderId shader, uint32_t set_idx, const UniformInfo* uniforms, uint32_t count, bool update) {
+	if (update)
+		m_graphics_controller.uniform_set_update(uniform_set, uniforms, count);
+	else
+		uniform_set = m_graphics_controller.uniform_set_create(shader, set_idx, uniforms, count);
 }
 
 void Renderer::set_post_effect_constants(float exposure, float gamma) {
@@ -827,6 +1284,19 @@ void Renderer::set_post_effect_constants(float exposure, float gamma) {
 	m_scene_info.data.gamma = gamma;
 }
 
+void Renderer::dynamic_resolution_update(float gpu_time) {
+	float ratio = gpu_time / m_settings.target_gpu_time;
+	if (std::abs(ratio - 1.0f) < DynamicResolution::TOLERANCE)
+		return;
+
+	// GPU time mostly follows pixel count, which is the square of scale
+	float area = m_dynamic_resolution.scale * m_dynamic_resolution.scale;
+	float target_area = area / ratio;
+	area += (target_area - area) * DynamicResolution::SMOOTHING;
+
+	m_dynamic_resolution.scale = std::clamp(std::sqrt(area), m_settings.min_resolution_scale, 1.0f);
+}
+
 void Renderer::begin_frame(const Camera& camera, Light dir_light, Light* lights, uint32_t light_count) {
 	MY_PROFILE_FUNCTION();
 
@@ -834,130 +1304,397 @@ void Renderer::begin_frame(const Camera& camera, Light dir_light, Light* lights,
 	m_scene_info.data.light_info.light_dir = dir_light.dir;
 	m_scene_info.data.light_info.light_color = dir_light.color;
 
+	// Sub-pixel offsets of render area pixels cycle, so accumulated frames cover the pixel
+	if (m_settings.temporal_upscaling) {
+		uint32_t phase = (uint32_t)(m_frame_number % TemporalUpscaling::JITTER_PHASE_COUNT) + 1;
+		glm::vec2 offset = glm::vec2(halton(phase, 2), halton(phase, 3)) - 0.5f;
+
+		ScreenResolution render_area = m_render_graph.render_area();
+		m_scene_info.data.camera.jitter = offset * 2.0f / glm::vec2(render_area.width, render_area.height);
+	}
+
 	// Update camera
 	{
+		const Camera& jittered_camera = m_scene_info.data.camera;
 		m_scene_info.data.light_info.camera_pos = camera.eye;
 		m_graphics_controller.buffer_update(m_scene_info.gpu.view_pos, &camera.eye);
 
-		glm::mat4 view = camera.view_matrix();
-		glm::mat4 proj = camera.proj_matrix();
+		glm::mat4 view = jittered_camera.view_matrix();
+		glm::mat4 proj = jittered_camera.proj_matrix();
 		glm::mat4 proj_view = proj * view;
 		glm::mat4 view_no_translation = glm::mat4(glm::mat3(view));
 		glm::mat4 skybox_view_proj = proj * view_no_translation;
 
-		m_graphics_controller.buffer_update(m_scene_info.gpu.projview_matrix, &proj_view);
+		glm::mat4 unjittered_proj_view = jittered_camera.unjittered_proj_matrix() * view;
+		m_temporal.prev_unjittered_proj_view = m_temporal.history_valid ? m_temporal.unjittered_proj_view : unjittered_proj_view;
+		m_temporal.unjittered_proj_view = unjittered_proj_view;
+
+		WorldMatrices world_matrices{
+			.proj_view = proj_view,
+			.unjittered_proj_view = unjittered_proj_view,
+			.prev_unjittered_proj_view = m_temporal.prev_unjittered_proj_view
+		};
+
+		m_graphics_controller.buffer_update(m_scene_info.gpu.projview_matrix, &world_matrices);
 		m_graphics_controller.buffer_update(m_scene_info.gpu.projview_matrix_no_translation, &skybox_view_proj);
 	}
 
-	// setup dir light
+	// Uptade blend uniform buffer
+	m_graphics_controller.buffer_update(m_blend_pipeline.uniform_buffer, &m_scene_info.data.light_info);
+
+	// Released texture slots can be reused once no frame in flight samples them
 	{
-		glm::mat4 view = glm::lookAt(dir_light.pos, dir_light.pos + dir_light.dir, glm::vec3(0.0f, 1.0f, 0.0f));
-		float x = 3.0f;
-		float y = 3.0f;
-		glm::mat4 proj = glm::ortho(-x, x, -y, y, 0.1f, 10.0f);
+		auto& released = m_bindless.released_texture_slots;
 
-		glm::mat4 proj_view = proj * view;
+		auto recycled_it = std::partition(released.begin(), released.end(), [&](const auto& released_slot) {
+			return released_slot.second + FRAMES_IN_FLIGHT > m_frame_number;
+		});
 
-		//m_graphics_controller.buffer_update(m_scene_info.dir_light_projview_matrix, &proj_view);
-	}
+		for (auto it = recycled_it; it != released.end(); ++it) {
+			texture_slot_write(it->first, m_defaults.empty_texture);
+			m_bindless.free_texture_slots.push_back(it->first);
+		}
 
-	// Uptade blend uniform buffer
-	m_graphics_controller.buffer_update(m_blend_pipeline.uniform_buffer, &m_scene_info.data.light_info);
+		released.erase(recycled_it, released.end());
+	}
 
-	// Save lights
+	// Transform buffer is updated in-stream, so slots released in previous frames can be reused right away
 	{
-		for (uint32_t i = 0; i < light_count; i++)
-			m_lights.push_back(lights[i]);
+		auto& released = m_transforms.released_slots;
+
+		auto recycled_it = std::partition(released.begin(), released.end(), [&](const auto& released_slot) {
+			return released_slot.second >= m_frame_number;
+		});
+
+		for (auto it = recycled_it; it != released.end(); ++it)
+			m_transforms.free_slots.push_back(it->first);
+
+		released.erase(recycled_it, released.end());
 	}
 
 	m_draw_list.clear();
+	m_draw_list.dir_light = dir_light;
+	m_draw_list.lights.assign(lights, lights + light_count);
 }
 
 void Renderer::end_frame(uint32_t width, uint32_t height) {
 	MY_PROFILE_FUNCTION();
 
-	{
-		MY_PROFILE_SCOPE("Render list sorting");
+	// Scopes of the last frame recorded in this frame slot, per pass timings are in the trace
+	const std::vector<GPUScopeTiming>& gpu_timings = m_graphics_controller.gpu_scope_timings();
+	auto gpu_timing = [&](std::string_view name) -> const GPUScopeTiming* {
+		auto it = std::find_if(gpu_timings.begin(), gpu_timings.end(), [&](const GPUScopeTiming& timing) { return timing.name == name; });
+		return it != gpu_timings.end() ? &*it : nullptr;
+	};
 
-		std::sort(m_draw_list.opaque_primitives.begin(), m_draw_list.opaque_primitives.end(), [](const auto& primitive1, const auto& primitive2) {
-			return primitive1.material < primitive2.material;
-		});
+	const GPUScopeTiming* frame_timing = gpu_timing("frame");
+	const GPUScopeTiming* g_pass_timing = gpu_timing("g_pass");
+	bool timestamps_are_available = frame_timing && g_pass_timing;
+	if (timestamps_are_available) {
+		float gpu_time = (float)frame_timing->duration;
 
-		std::sort(m_draw_list.blend_primitives.begin(), m_draw_list.blend_primitives.end(), [](const auto& primitive1, const auto& primitive2) {
-			return primitive1.material < primitive2.material;
-		});
-	}
+		m_stats.gpu_time = gpu_time;
+		m_stats.g_pass_time = (float)g_pass_timing->duration;
+		if (const GPUScopeTiming* lightning_timing = gpu_timing("lightning"))
+			m_stats.lightning_time = (float)lightning_timing->duration;
 
-	uint64_t timestamps[2] = { 0 };
-	bool timestamps_are_available = m_graphics_controller.timestamp_query_get_results(timestamps, 2);
-	if (timestamps_are_available)
-		std::cout << "GPU time: " << (float)(timestamps[1] - timestamps[0]) / 1'000'000 << "ms\n";
+		// Geometry passes begin with the depth prepass when it's on and end with the G pass
+		const GPUScopeTiming* depth_prepass_timing = gpu_timing("depth_prepass");
+		double geometry_begin = depth_prepass_timing ? depth_prepass_timing->start : g_pass_timing->start;
+		double geometry_end = g_pass_timing->start + g_pass_timing->duration;
 
-	m_graphics_controller.timestamp_query_begin();
-	m_graphics_controller.timestamp_query_write_timestamp();
+		m_stats.geometry_time = (float)(geometry_end - geometry_begin);
 
-	uint32_t stencil_reference = 0x28;
-	{
-		MY_PROFILE_SCOPE("G pass recording");
+		if (m_settings.dynamic_resolution)
+			dynamic_resolution_update(gpu_time);
+	}
 
-		// G pass
-		std::array<ClearValue, 5> g_buffer_clear_values{};
-		g_buffer_clear_values[0].color = { 0.8f, 0.3f, 0.4f, 1.0f }; // albedo
-		g_buffer_clear_values[1].color = { 0.0f, 0.0f, 0.0f, 0.0f }; // ao-rough-met
-		g_buffer_clear_values[2].color = { 0.0f, 0.0f, 0.0f, 0.0f }; // normals
-		g_buffer_clear_values[3].color = { 0.0f, 0.0f, 0.0f, 0.0f };
-		g_buffer_clear_values[4].depth_stencil = { 1.0f, 0 }; // depth-stencil
-
-		m_graphics_controller.draw_begin(m_deferred.g_framebuffer, g_buffer_clear_values.data(), (uint32_t)g_buffer_clear_values.size());
-		m_graphics_controller.draw_set_viewport(0.0f, 0.0f, (float)m_deferred.albedo_info.extent.width, (float)m_deferred.albedo_info.extent.height, 0.0f, 1.0f);
-		m_graphics_controller.draw_set_scissor(0, 0, m_deferred.albedo_info.extent.width, m_deferred.albedo_info.extent.height);
-
-		m_graphics_controller.draw_bind_pipeline(m_g_pipeline.pipeline);
-		m_graphics_controller.draw_bind_uniform_sets(m_g_pipeline.pipeline, 0, &m_g_pipeline.uniform_set_0, 1);
-		m_graphics_controller.draw_set_stencil_reference(StencilFaces::FrontAndBack, stencil_reference);
-
-		MaterialId prev_material = -1;
-		BufferId prev_vertex_buffer = -1;
-		BufferId prev_index_buffer = -1;
-		for (const Primitive& primitive : m_draw_list.opaque_primitives) {
-			// If material changed, bind new material
-			if (primitive.material != prev_material) {
-				const Material& material = m_materials[primitive.material];
+	const PipelineLookupStats& pipeline_stats = m_graphics_controller.pipeline_lookup_stats();
+	m_stats.pipelines_created = pipeline_stats.misses;
+	m_stats.pipeline_requests_reused = pipeline_stats.hits;
+	const SamplerLookupStats& sampler_stats = m_graphics_controller.sampler_lookup_stats();
+	m_stats.sampler_count = (uint32_t)m_graphics_controller.sampler_count();
+	m_stats.sampler_requests_reused = sampler_stats.hits;
+	const BarrierStats& barrier_stats = m_graphics_controller.barrier_stats();
+	m_stats.barriers = barrier_stats.barriers;
+	m_stats.barrier_batches = barrier_stats.batches;
+
+	// Render area is chosen before anything depending on it is recorded or uploaded
+	if (m_settings.dynamic_resolution) {
+		ScreenResolution resolution = m_render_graph.resolution();
+		m_render_graph.set_render_area(
+			std::max(1u, (uint32_t)std::round(resolution.width * m_dynamic_resolution.scale)),
+			std::max(1u, (uint32_t)std::round(resolution.height * m_dynamic_resolution.scale))
+		);
+	}
 
-				m_graphics_controller.draw_push_constants(m_g_pipeline.shader, ShaderStageFragment, sizeof(glm::mat4), sizeof(MaterialInfo), &material.info);
-				m_graphics_controller.draw_bind_uniform_sets(m_g_pipeline.pipeline, 1, &material.uniform_set, 1);
-			}
-			// If vertex buffer changed, bind new vertex buffer
-			if (primitive.vertex_buffer != prev_vertex_buffer)
-				m_graphics_controller.draw_bind_vertex_buffer(m_vertex_buffers[primitive.vertex_buffer]);
-			// If index buffer changed, bind new index buffer
-			if (primitive.index_buffer != prev_index_buffer)
-				m_graphics_controller.draw_bind_index_buffer(m_index_buffers[primitive.index_buffer], IndexType::Uint32);
+	m_stats.render_area = m_render_graph.render_area();
+	m_stats.resolution_scale = m_settings.dynamic_resolution ? m_dynamic_resolution.scale : 1.0f;
+
+	uint64_t g_pass_fragments = 0;
+	if (m_graphics_controller.pipeline_statistics_query_get_results(&g_pass_fragments, 1)) {
+		ScreenResolution render_area = m_render_graph.render_area();
+		m_stats.g_pass_fragments_per_pixel = (float)g_pass_fragments / (render_area.width * render_area.height);
+	}
 
-			m_graphics_controller.draw_push_constants(m_g_pipeline.shader, ShaderStageVertex, 0, sizeof(glm::mat4), &primitive.model);
+	bool use_indirect_draws = m_graphics_controller.draw_indirect_supported();
+	{
+		MY_PROFILE_SCOPE("Render list batching");
 
-			if (primitive.index_buffer != -1 && primitive.index_count != 0) {
-				m_graphics_controller.draw_draw_indexed((uint32_t)primitive.index_count, (uint32_t)primitive.first_index);
-				prev_index_buffer = primitive.index_buffer;
-			}
+		build_draw_batches(m_draw_list.opaque_primitives, m_draw_list.opaque_batches, true);
+		build_draw_batches(m_draw_list.masked_primitives, m_draw_list.masked_batches, true);
+		build_draw_batches(m_draw_list.blend_primitives, m_draw_list.blend_batches, false);
 
-			prev_material = primitive.material;
-			prev_vertex_buffer = primitive.vertex_buffer;
+		if (use_indirect_draws) {
+			build_indirect_draws(m_draw_list.opaque_batches, m_draw_list.opaque_indirect_draws);
+			build_indirect_draws(m_draw_list.masked_batches, m_draw_list.masked_indirect_draws);
 		}
 
-		m_graphics_controller.draw_end();
+		build_shadow_cascades();
 	}
 
-	// Composision pass
-	std::array<ClearValue, 1> composition_clear_values{};
-	composition_clear_values[0].color = { 0.0f, 1.0f, 1.0f, 1.0f };
+	// Upload instance data and changed transforms before any render pass begins
+	{
+		MY_PROFILE_SCOPE("Object data upload");
+
+		bool instance_buffer_recreated = instance_buffer_reserve(m_draw_list.instances.size());
+		bool transform_buffer_recreated = transform_buffer_reserve(m_transforms.data.size());
+		if (instance_buffer_recreated || transform_buffer_recreated) {
+			m_graphics_controller.uniform_set_destroy(m_g_pipeline.uniform_set_0);
+			m_graphics_controller.uniform_set_destroy(m_blend_pipeline.uniform_set_0);
+			m_graphics_controller.uniform_set_destroy(m_shadows.uniform_set_0);
+			m_graphics_controller.uniform_set_destroy(m_shadows.masked_uniform_set_0);
+			if (m_settings.depth_prepass)
+				m_graphics_controller.uniform_set_destroy(m_depth_prepass_pipeline.uniform_set_0);
+			object_uniform_sets_create();
+		}
 
-	m_graphics_controller.draw_begin(m_deferred.composition_framebuffer, composition_clear_values.data(), (uint32_t)composition_clear_values.size());
-	m_graphics_controller.draw_set_viewport(0.0f, 0.0f, (float)m_deferred.composition_info.extent.width, (float)m_deferred.composition_info.extent.height, 0.0f, 1.0f);
-	m_graphics_controller.draw_set_scissor(0, 0, m_deferred.composition_info.extent.width, m_deferred.composition_info.extent.height);
+		transforms_upload();
 
-	{
-		MY_PROFILE_SCOPE("Lightning recording");
+		if (!m_draw_list.instances.empty())
+			m_graphics_controller.buffer_update(m_instances.buffer, m_draw_list.instances.data(), 0, m_draw_list.instances.size() * sizeof(InstanceData));
+	}
+
+	light_clusters_build();
+
+	m_graphics_controller.buffer_update(m_shadows.info_buffer, &m_shadows.info);
+
+	if (!m_draw_list.indirect_commands.empty()) {
+		MY_PROFILE_SCOPE("Indirect buffer upload");
+
+		indirect_buffer_reserve(m_draw_list.indirect_commands.size());
+		m_graphics_controller.buffer_update(m_indirect.buffer, m_draw_list.indirect_commands.data(), 0, m_draw_list.indirect_commands.size() * sizeof(DrawIndexedIndirectCommand));
+	}
+
+	m_draw_list.screen_width = width;
+	m_draw_list.screen_height = height;
+
+	{
+		GPU_PROFILE_SCOPE(m_graphics_controller, "frame");
+
+		m_render_graph.execute();
+	}
+
+	m_graphics_controller.end_frame();
+
+	if (m_frame_number == 0)
+		m_stats.time_to_first_frame = (float)(CPUProfiler::now() - m_create_time) / 1000.0f;
+
+	m_frame_number++;
+}
+
+void Renderer::record_static_shadow_pass() {
+	MY_PROFILE_FUNCTION();
+
+	uint32_t resolution = m_shadows.cascade_resolution;
+	for (uint32_t cascade = 0; cascade < m_shadows.info.cascade_count; cascade++) {
+		const ShadowCascade& shadow_cascade = m_shadows.cascades[cascade];
+		if (!shadow_cascade.cache_redraw)
+			continue;
+
+		int x = (int)(cascade % Shadows::ATLAS_TILES * resolution);
+		int y = (int)(cascade / Shadows::ATLAS_TILES * resolution);
+
+		m_graphics_controller.draw_set_viewport((float)x, (float)y, (float)resolution, (float)resolution, 0.0f, 1.0f);
+		m_graphics_controller.draw_set_scissor(x, y, resolution, resolution);
+		m_graphics_controller.draw_clear_depth(x, y, resolution, resolution, 1.0f);
+
+		draw_shadow_cascade(cascade, shadow_cascade.static_batches, shadow_cascade.static_masked_batches);
+	}
+}
+
+void Renderer::record_shadow_pass() {
+	MY_PROFILE_FUNCTION();
+
+	uint32_t resolution = m_shadows.cascade_resolution;
+	float tile_size = 1.0f / Shadows::ATLAS_TILES;
+
+	for (uint32_t cascade = 0; cascade < m_shadows.info.cascade_count; cascade++) {
+		int x = (int)(cascade % Shadows::ATLAS_TILES * resolution);
+		int y = (int)(cascade / Shadows::ATLAS_TILES * resolution);
+
+		m_graphics_controller.draw_set_viewport((float)x, (float)y, (float)resolution, (float)resolution, 0.0f, 1.0f);
+		m_graphics_controller.draw_set_scissor(x, y, resolution, resolution);
+
+		// Cached static casters
+		float region[4] = { (cascade % Shadows::ATLAS_TILES) * tile_size, (cascade / Shadows::ATLAS_TILES) * tile_size, tile_size, tile_size };
+
+		m_graphics_controller.draw_bind_pipeline(m_shadows.copy_pipeline);
+		m_graphics_controller.draw_bind_vertex_buffer(m_square.vertex_buffer);
+		m_graphics_controller.draw_bind_index_buffer(m_square.index_buffer, m_square.index_type);
+		m_graphics_controller.draw_bind_uniform_sets(m_shadows.copy_pipeline, 0, &m_shadows.copy_uniform_set_0, 1);
+		m_graphics_controller.draw_push_constants(m_shadows.copy_shader, ShaderStageFragment, 0, sizeof(region), region);
+		m_graphics_controller.draw_draw_indexed(m_square.index_count, 0);
+
+		// Dynamic casters on top
+		const ShadowCascade& shadow_cascade = m_shadows.cascades[cascade];
+		draw_shadow_cascade(cascade, shadow_cascade.dynamic_batches, shadow_cascade.dynamic_masked_batches);
+	}
+}
+
+void Renderer::draw_shadow_cascade(uint32_t cascade, const std::vector<DrawBatch>& batches, const std::vector<DrawBatch>& masked_batches) {
+	m_graphics_controller.draw_bind_pipeline(m_shadows.pipeline);
+	m_graphics_controller.draw_bind_uniform_sets(m_shadows.pipeline, 0, &m_shadows.uniform_set_0, 1);
+	m_graphics_controller.draw_push_constants(m_shadows.shader, ShaderStageVertex, 0, sizeof(glm::mat4), &m_shadows.info.view_proj[cascade]);
+
+	draw_shadow_casters(batches);
+
+	if (masked_batches.empty())
+		return;
+
+	std::array<UniformSetId, 2> masked_uniform_sets = { m_shadows.masked_uniform_set_0, m_bindless.shadow_uniform_set_1 };
+
+	m_graphics_controller.draw_bind_pipeline(m_shadows.masked_pipeline);
+	m_graphics_controller.draw_bind_uniform_sets(m_shadows.masked_pipeline, 0, masked_uniform_sets.data(), (uint32_t)masked_uniform_sets.size());
+	m_graphics_controller.draw_push_constants(m_shadows.masked_shader, ShaderStageVertex, 0, sizeof(glm::mat4), &m_shadows.info.view_proj[cascade]);
+
+	draw_shadow_casters(masked_batches, true);
+}
+
+void Renderer::draw_shadow_casters(const std::vector<DrawBatch>& batches, bool full_vertices) {
+	size_t prev_vertex_buffer = -1;
+	size_t prev_index_buffer = -1;
+	for (const DrawBatch& batch : batches) {
+		if (batch.vertex_buffer != prev_vertex_buffer) {
+			const VertexBuffer& vertex_buffer = m_vertex_buffers[batch.vertex_buffer];
+			m_graphics_controller.draw_bind_vertex_buffer(full_vertices ? vertex_buffer.buffer : vertex_buffer.position_buffer);
+		}
+		if (batch.index_buffer != prev_index_buffer)
+			m_graphics_controller.draw_bind_index_buffer(m_index_buffers[batch.index_buffer], IndexType::Uint32);
+
+		m_graphics_controller.draw_draw_indexed((uint32_t)batch.index_count, (uint32_t)batch.first_index, batch.instance_count, batch.first_instance);
+
+		prev_vertex_buffer = batch.vertex_buffer;
+		prev_index_buffer = batch.index_buffer;
+	}
+}
+
+void Renderer::record_depth_prepass() {
+	MY_PROFILE_FUNCTION();
+
+	ScreenResolution render_area = m_render_graph.render_area();
+	m_graphics_controller.draw_set_viewport(0.0f, 0.0f, (float)render_area.width, (float)render_area.height, 0.0f, 1.0f);
+	m_graphics_controller.draw_set_scissor(0, 0, render_area.width, render_area.height);
+
+	m_graphics_controller.draw_bind_pipeline(m_depth_prepass_pipeline.pipeline);
+	m_graphics_controller.draw_bind_uniform_sets(m_depth_prepass_pipeline.pipeline, 0, &m_depth_prepass_pipeline.uniform_set_0, 1);
+
+	if (m_graphics_controller.draw_indirect_supported()) {
+		size_t prev_vertex_buffer = -1;
+		size_t prev_index_buffer = -1;
+		for (const IndirectDraw& draw : m_draw_list.opaque_indirect_draws) {
+			if (draw.vertex_buffer != prev_vertex_buffer)
+				m_graphics_controller.draw_bind_vertex_buffer(m_vertex_buffers[draw.vertex_buffer].position_buffer);
+			if (draw.index_buffer != prev_index_buffer)
+				m_graphics_controller.draw_bind_index_buffer(m_index_buffers[draw.index_buffer], IndexType::Uint32);
+
+			m_graphics_controller.draw_draw_indexed_indirect(m_indirect.buffer, draw.first_command * sizeof(DrawIndexedIndirectCommand), draw.command_count);
+
+			prev_vertex_buffer = draw.vertex_buffer;
+			prev_index_buffer = draw.index_buffer;
+		}
+	} else {
+		draw_shadow_casters(m_draw_list.opaque_batches);
+	}
+}
+
+void Renderer::record_g_pass() {
+	MY_PROFILE_FUNCTION();
+
+	m_graphics_controller.pipeline_statistics_query_begin(G_PASS_STATISTICS_QUERY);
+
+	ScreenResolution render_area = m_render_graph.render_area();
+	m_graphics_controller.draw_set_viewport(0.0f, 0.0f, (float)render_area.width, (float)render_area.height, 0.0f, 1.0f);
+	m_graphics_controller.draw_set_scissor(0, 0, render_area.width, render_area.height);
+
+	std::array<UniformSetId, 2> g_uniform_sets = { m_g_pipeline.uniform_set_0, m_bindless.g_uniform_set_1 };
+
+	BufferId prev_vertex_buffer = -1;
+	BufferId prev_index_buffer = -1;
+	auto bind_draw_state = [&](size_t vertex_buffer, size_t index_buffer) {
+		// If vertex buffer changed, bind new vertex buffer
+		if (vertex_buffer != prev_vertex_buffer)
+			m_graphics_controller.draw_bind_vertex_buffer(m_vertex_buffers[vertex_buffer].buffer);
+		// If index buffer changed, bind new index buffer
+		if (index_buffer != prev_index_buffer)
+			m_graphics_controller.draw_bind_index_buffer(m_index_buffers[index_buffer], IndexType::Uint32);
+
+		prev_vertex_buffer = vertex_buffer;
+		prev_index_buffer = index_buffer;
+	};
+
+	auto draw = [&](PipelineId pipeline, const std::vector<DrawBatch>& batches, const std::vector<IndirectDraw>& indirect_draws) {
+		// Variants share the layout, so uniform sets and dynamic state stay bound across them
+		std::optional<PipelineId> bound_pipeline;
+		auto bind_permutation = [&](MaterialPermutation permutation) {
+			PipelineId permutation_pipeline = g_pipeline_permutation(pipeline, permutation);
+			if (bound_pipeline == permutation_pipeline)
+				return;
+
+			m_graphics_controller.draw_bind_pipeline(permutation_pipeline);
+			if (!bound_pipeline.has_value()) {
+				m_graphics_controller.draw_bind_uniform_sets(permutation_pipeline, 0, g_uniform_sets.data(), (uint32_t)g_uniform_sets.size());
+				m_graphics_controller.draw_set_stencil_reference(StencilFaces::FrontAndBack, STENCIL_REFERENCE);
+			}
+
+			bound_pipeline = permutation_pipeline;
+		};
+
+		if (m_graphics_controller.draw_indirect_supported()) {
+			for (const IndirectDraw& draw : indirect_draws) {
+				bind_permutation(draw.permutation);
+				bind_draw_state(draw.vertex_buffer, draw.index_buffer);
+
+				m_graphics_controller.draw_draw_indexed_indirect(m_indirect.buffer, draw.first_command * sizeof(DrawIndexedIndirectCommand), draw.command_count);
+			}
+		} else {
+			for (const DrawBatch& batch : batches) {
+				bind_permutation(batch.permutation);
+				bind_draw_state(batch.vertex_buffer, batch.index_buffer);
+
+				m_graphics_controller.draw_draw_indexed((uint32_t)batch.index_count, (uint32_t)batch.first_index, batch.instance_count, batch.first_instance);
+			}
+		}
+	};
+
+	// Opaque first, so masked primitives behind them are rejected before alpha testing
+	draw(m_g_pipeline.pipeline, m_draw_list.opaque_batches, m_draw_list.opaque_indirect_draws);
+	if (!m_draw_list.masked_batches.empty())
+		draw(m_g_pipeline.masked_pipeline, m_draw_list.masked_batches, m_draw_list.masked_indirect_draws);
+
+	m_graphics_controller.pipeline_statistics_query_end(G_PASS_STATISTICS_QUERY);
+}
+
+void Renderer::record_composition_pass() {
+	MY_PROFILE_FUNCTION();
+
+	ScreenResolution render_area = m_render_graph.render_area();
+	m_graphics_controller.draw_set_viewport(0.0f, 0.0f, (float)render_area.width, (float)render_area.height, 0.0f, 1.0f);
+	m_graphics_controller.draw_set_scissor(0, 0, render_area.width, render_area.height);
+
+	{
+		MY_PROFILE_SCOPE("Lightning recording");
+		GPU_PROFILE_SCOPE(m_graphics_controller, "lightning");
 
 		// Lightning
 		glm::mat4 view = m_scene_info.data.camera.view_matrix();
@@ -974,13 +1711,14 @@ void Renderer::end_frame(uint32_t width, uint32_t height) {
 		m_graphics_controller.draw_bind_vertex_buffer(m_square.vertex_buffer);
 		m_graphics_controller.draw_bind_index_buffer(m_square.index_buffer, m_square.index_type);
 		m_graphics_controller.draw_push_constants(m_light_pipeline.shader, ShaderStageFragment, 0, sizeof(push_constants_data), push_constants_data);
-		m_graphics_controller.draw_bind_uniform_sets(m_light_pipeline.pipeline, 0, &m_light_pipeline.uniform_set_0, 1);
-		m_graphics_controller.draw_set_stencil_reference(StencilFaces::FrontAndBack, stencil_reference);
+		std::array<UniformSetId, 3> light_uniform_sets = { m_light_pipeline.uniform_set_0, m_light_clusters.light_uniform_set_1, m_shadows.light_uniform_set_2 };
+		m_graphics_controller.draw_bind_uniform_sets(m_light_pipeline.pipeline, 0, light_uniform_sets.data(), (uint32_t)light_uniform_sets.size());
+		m_graphics_controller.draw_set_stencil_reference(StencilFaces::FrontAndBack, STENCIL_REFERENCE);
 		m_graphics_controller.draw_draw_indexed(m_square.index_count, 0);
 	}
 
-	// Draw skybox
-	if (m_draw_list.skybox.has_value()) {
+	// Draw skybox, skipped until its pipeline is compiled
+	if (m_draw_list.skybox.has_value() && m_graphics_controller.pipeline_ready(m_skybox_pipeline.pipeline)) {
 		const Skybox& skybox = m_skyboxes[m_draw_list.skybox.value()];
 
 		std::array<UniformSetId, 2> uniform_sets = { m_skybox_pipeline.uniform_set_0, skybox.uniform_set_1 };
@@ -999,82 +1737,141 @@ void Renderer::end_frame(uint32_t width, uint32_t height) {
 	//m_graphics_controller.draw_set_line_width(3.0f);
 	//m_graphics_controller.draw_draw(6, 0);
 
-	{
+	// Binding waits for the blend pipeline, transparent primitives popping in frames later would show more than the stall
+	if (!m_draw_list.blend_batches.empty()) {
 		MY_PROFILE_SCOPE("Transparent pass recording");
 
 		// Blend primitives
+		std::array<UniformSetId, 3> blend_uniform_sets = { m_blend_pipeline.uniform_set_0, m_bindless.blend_uniform_set_1, m_light_clusters.blend_uniform_set_2 };
+
 		m_graphics_controller.draw_bind_pipeline(m_blend_pipeline.pipeline);
-		m_graphics_controller.draw_bind_uniform_sets(m_blend_pipeline.pipeline, 0, &m_blend_pipeline.uniform_set_0, 1);
+		m_graphics_controller.draw_bind_uniform_sets(m_blend_pipeline.pipeline, 0, blend_uniform_sets.data(), (uint32_t)blend_uniform_sets.size());
 
-		MaterialId prev_material = -1;
 		BufferId prev_vertex_buffer = -1;
 		BufferId prev_index_buffer = -1;
-		for (const Primitive& primitive : m_draw_list.blend_primitives) {
-			// If material changed, bind new material
-			if (primitive.material != prev_material) {
-				const Material& material = m_materials[primitive.material];
-
-				m_graphics_controller.draw_push_constants(m_blend_pipeline.shader, ShaderStageFragment, sizeof(glm::mat4), sizeof(MaterialInfo), &material.info);
-				m_graphics_controller.draw_bind_uniform_sets(m_blend_pipeline.pipeline, 1, &material.uniform_set, 1);
-			}
+		for (const DrawBatch& batch : m_draw_list.blend_batches) {
 			// If vertex buffer changed, bind new vertex buffer
-			if (primitive.vertex_buffer != prev_vertex_buffer)
-				m_graphics_controller.draw_bind_vertex_buffer(m_vertex_buffers[primitive.vertex_buffer]);
+			if (batch.vertex_buffer != prev_vertex_buffer)
+				m_graphics_controller.draw_bind_vertex_buffer(m_vertex_buffers[batch.vertex_buffer].buffer);
 			// If index buffer changed, bind new index buffer
-			if (primitive.index_buffer != prev_index_buffer)
-				m_graphics_controller.draw_bind_index_buffer(m_index_buffers[primitive.index_buffer], IndexType::Uint32);
+			if (batch.index_buffer != prev_index_buffer)
+				m_graphics_controller.draw_bind_index_buffer(m_index_buffers[batch.index_buffer], IndexType::Uint32);
 
-			m_graphics_controller.draw_push_constants(m_blend_pipeline.shader, ShaderStageVertex, 0, sizeof(glm::mat4), &primitive.model);
+			m_graphics_controller.draw_draw_indexed((uint32_t)batch.index_count, (uint32_t)batch.first_index, batch.instance_count, batch.first_instance);
 
-			if (primitive.index_buffer != -1 && primitive.index_count != 0) {
-				m_graphics_controller.draw_draw_indexed((uint32_t)primitive.index_count, (uint32_t)primitive.first_index);
-				prev_index_buffer = primitive.index_buffer;
-			}
-
-			prev_material = primitive.material;
-			prev_vertex_buffer = primitive.vertex_buffer;
+			prev_vertex_buffer = batch.vertex_buffer;
+			prev_index_buffer = batch.index_buffer;
 		}
 	}
+}
+
+void Renderer::record_temporal_resolve_pass() {
+	MY_PROFILE_FUNCTION();
+
+	ScreenResolution output_resolution = m_temporal.output_resolution;
+	m_graphics_controller.draw_set_viewport(0.0f, 0.0f, (float)output_resolution.width, (float)output_resolution.height, 0.0f, 1.0f);
+	m_graphics_controller.draw_set_scissor(0, 0, output_resolution.width, output_resolution.height);
+
+	ScreenResolution resolution = m_render_graph.resolution();
+	ScreenResolution render_area = m_render_graph.render_area();
+
+	TemporalResolveConstants constants{
+		.reprojection = m_temporal.prev_unjittered_proj_view * glm::inverse(m_temporal.unjittered_proj_view),
+		.render_scale = glm::vec2((float)render_area.width / resolution.width, (float)render_area.height / resolution.height),
+		.jitter = m_scene_info.data.camera.jitter * 0.5f,
+		.current_weight = m_temporal.history_valid ? TemporalUpscaling::CURRENT_FRAME_WEIGHT : 1.0f
+	};
+
+	m_graphics_controller.draw_bind_pipeline(m_temporal.pipeline);
+	m_graphics_controller.draw_bind_vertex_buffer(m_square.vertex_buffer);
+	m_graphics_controller.draw_bind_index_buffer(m_square.index_buffer, m_square.index_type);
+	m_graphics_controller.draw_bind_uniform_sets(m_temporal.pipeline, 0, &m_temporal.uniform_sets_0[m_frame_number % 2], 1);
+	m_graphics_controller.draw_push_constants(m_temporal.shader, ShaderStageFragment, 0, sizeof(constants), &constants);
+	m_graphics_controller.draw_draw_indexed(m_square.index_count, 0);
 
-	m_graphics_controller.draw_end();
+	m_temporal.history_valid = true;
+}
 
-	// Present to screen pass
-	glm::vec4 clear_color{ 1.0f, 0.0f, 1.0f, 1.0f };
-	m_graphics_controller.draw_begin_for_screen(clear_color);
+void Renderer::record_present_pass() {
+	MY_PROFILE_FUNCTION();
 
-	m_graphics_controller.draw_set_viewport(0.0f, 0.0f, (float)width, (float)height, 0.0f, 1.0f);
-	m_graphics_controller.draw_set_scissor(0, 0, width, height);
+	m_graphics_controller.draw_set_viewport(0.0f, 0.0f, (float)m_draw_list.screen_width, (float)m_draw_list.screen_height, 0.0f, 1.0f);
+	m_graphics_controller.draw_set_scissor(0, 0, m_draw_list.screen_width, m_draw_list.screen_height);
+
+	// Only render area of composition image is sampled, history is always whole
+	ScreenResolution resolution = m_render_graph.resolution();
+	ScreenResolution render_area = m_render_graph.render_area();
+	UniformSetId present_uniform_set = m_present_pipeline.uniform_set_0;
+	if (m_settings.temporal_upscaling) {
+		resolution = m_temporal.output_resolution;
+		render_area = m_temporal.output_resolution;
+		present_uniform_set = m_temporal.present_uniform_sets_0[m_frame_number % 2];
+	}
 
-	float constants[2] = { m_scene_info.data.exposure, m_scene_info.data.gamma };
+	float constants[6] = {
+		m_scene_info.data.exposure,
+		m_scene_info.data.gamma,
+		(float)render_area.width / resolution.width,
+		(float)render_area.height / resolution.height,
+		(render_area.width - 0.5f) / resolution.width,
+		(render_area.height - 0.5f) / resolution.height
+	};
 
 	m_graphics_controller.draw_bind_pipeline(m_present_pipeline.pipeline);
 	m_graphics_controller.draw_bind_vertex_buffer(m_square.vertex_buffer);
 	m_graphics_controller.draw_bind_index_buffer(m_square.index_buffer, m_square.index_type);
-	m_graphics_controller.draw_bind_uniform_sets(m_present_pipeline.pipeline, 0, &m_present_pipeline.uniform_set_0, 1);
+	m_graphics_controller.draw_bind_uniform_sets(m_present_pipeline.pipeline, 0, &present_uniform_set, 1);
 	m_graphics_controller.draw_push_constants(m_present_pipeline.shader, ShaderStageFragment, 0, sizeof(constants), constants);
 	m_graphics_controller.draw_draw_indexed(m_square.index_count, 0);
+}
 
-	m_graphics_controller.draw_end_for_screen();
+void Renderer::draw_primitive(const glm::mat4& model, size_t vertex_buffer, size_t index_buffer, size_t first_index, size_t index_count, size_t vertex_count, MaterialId material) {
+	// Transform lives for this frame only, without motion
+	uint32_t slot = transform_slot_acquire();
+	m_transforms.data[slot].prev_model = model;
+	transform_slot_write(slot, model);
+	m_transforms.released_slots.push_back({ slot, m_frame_number });
 
-	m_graphics_controller.timestamp_query_write_timestamp();
-	m_graphics_controller.timestamp_query_end();
+	Primitive primitive{
+		.transform_index = slot,
+		.vertex_buffer = vertex_buffer,
+		.index_buffer = index_buffer,
+		.first_index = first_index,
+		.index_count = index_count,
+		.vertex_count = vertex_count,
+		.material = material,
+		.is_dynamic = true
+	};
 
-	m_graphics_controller.end_frame();
+	AlphaMode alpha_mode = m_materials[material].alpha_mode;
+	if (alpha_mode == AlphaMode::Blend)
+		m_draw_list.blend_primitives.push_back(primitive);
+	else if (alpha_mode == AlphaMode::Mask)
+		m_draw_list.masked_primitives.push_back(primitive);
+	else
+		m_draw_list.opaque_primitives.push_back(primitive);
 }
 
-void Renderer::draw_primitive(const glm::mat4& model, size_t vertex_buffer, size_t index_buffer, size_t first_index, size_t index_count, size_t vertex_count, MaterialId material) {
+void Renderer::draw_primitive(TransformId transform_id, size_t vertex_buffer, size_t index_buffer, size_t first_index, size_t index_count, size_t vertex_count, MaterialId material) {
+	uint32_t slot = m_transforms.slots.at(transform_id);
+	uint64_t update_frame = m_transforms.update_frames[slot];
+
 	Primitive primitive{
-		.model = model,
+		.transform_index = slot,
 		.vertex_buffer = vertex_buffer,
 		.index_buffer = index_buffer,
 		.first_index = first_index,
 		.index_count = index_count,
 		.vertex_count = vertex_count,
-		.material = material
+		.material = material,
+		.is_dynamic = update_frame != UINT64_MAX && update_frame + Shadows::STATIC_FRAME_COUNT > m_frame_number
 	};
 
-	if (m_materials[material].alpha_mode == AlphaMode::Blend)
+	AlphaMode alpha_mode = m_materials[material].alpha_mode;
+	if (alpha_mode == AlphaMode::Blend)
 		m_draw_list.blend_primitives.push_back(primitive);
+	else if (alpha_mode == AlphaMode::Mask)
+		m_draw_list.masked_primitives.push_back(primitive);
 	else
 		m_draw_list.opaque_primitives.push_back(primitive);
 }
@@ -1083,6 +1880,674 @@ void Renderer::draw_skybox(SkyboxId skybox_id) {
 	m_draw_list.skybox = skybox_id;
 }
 
+const LightClusterStats& Renderer::light_cluster_stats() const {
+	return m_light_clusters.stats;
+}
+
+const RendererStats& Renderer::stats() const {
+	return m_stats;
+}
+
+void Renderer::build_draw_batches(std::vector<Primitive>& primitives, std::vector<DrawBatch>& batches, bool split_permutations) {
+	auto permutation = [&](const Primitive& primitive) -> MaterialPermutation {
+		if (!split_permutations)
+			return 0;
+
+		return m_materials.at(primitive.material).permutation |
+			(m_vertex_buffers.at(primitive.vertex_buffer).has_tangents ? PermutationTangents : 0);
+	};
+
+	// Permutation goes first, so every specialized pipeline is bound once
+	std::vector<std::pair<MaterialPermutation, Primitive>> keyed_primitives;
+	keyed_primitives.reserve(primitives.size());
+	for (const Primitive& primitive : primitives)
+		keyed_primitives.emplace_back(permutation(primitive), primitive);
+
+	auto batch_key = [](MaterialPermutation key_permutation, const auto& primitive) {
+		return std::make_tuple(key_permutation, primitive.vertex_buffer, primitive.index_buffer, primitive.first_index, primitive.index_count);
+	};
+
+	std::sort(keyed_primitives.begin(), keyed_primitives.end(), [&](const auto& primitive1, const auto& primitive2) {
+		return batch_key(primitive1.first, primitive1.second) < batch_key(primitive2.first, primitive2.second);
+	});
+
+	for (size_t i = 0; i < primitives.size(); i++)
+		primitives[i] = keyed_primitives[i].second;
+
+	// Identical primitives are adjacent after sorting, so their instance data ends up contiguous in the instance buffer
+	for (const auto& [primitive_permutation, primitive] : keyed_primitives) {
+		if (primitive.index_buffer == -1 || primitive.index_count == 0)
+			continue;
+
+		if (!batches.empty() && batch_key(batches.back().permutation, batches.back()) == batch_key(primitive_permutation, primitive)) {
+			batches.back().instance_count++;
+		} else {
+			DrawBatch batch{
+				.permutation = primitive_permutation,
+				.vertex_buffer = primitive.vertex_buffer,
+				.index_buffer = primitive.index_buffer,
+				.first_index = primitive.first_index,
+				.index_count = primitive.index_count,
+				.first_instance = (uint32_t)m_draw_list.instances.size(),
+				.instance_count = 1
+			};
+
+			batches.push_back(batch);
+		}
+
+		InstanceData instance{
+			.transform_index = primitive.transform_index,
+			.material_index = m_materials.at(primitive.material).index
+		};
+
+		m_draw_list.instances.push_back(instance);
+	}
+}
+
+void Renderer::build_indirect_draws(const std::vector<DrawBatch>& batches, std::vector<IndirectDraw>& draws) {
+	// Batches are sorted by permutation and geometry buffers, so the ones sharing an indirect draw are adjacent
+	for (const DrawBatch& batch : batches) {
+		if (!draws.empty() &&
+			draws.back().permutation == batch.permutation &&
+			draws.back().vertex_buffer == batch.vertex_buffer &&
+			draws.back().index_buffer == batch.index_buffer) {
+			draws.back().command_count++;
+		} else {
+			IndirectDraw draw{
+				.permutation = batch.permutation,
+				.vertex_buffer = batch.vertex_buffer,
+				.index_buffer = batch.index_buffer,
+				.first_command = (uint32_t)m_draw_list.indirect_commands.size(),
+				.command_count = 1
+			};
+
+			draws.push_back(draw);
+		}
+
+		DrawIndexedIndirectCommand command{
+			.index_count = (uint32_t)batch.index_count,
+			.instance_count = batch.instance_count,
+			.first_index = (uint32_t)batch.first_index,
+			.vertex_offset = 0,
+			.first_instance = batch.first_instance
+		};
+
+		m_draw_list.indirect_commands.push_back(command);
+	}
+}
+
+PipelineId Renderer::g_pipeline_permutation(PipelineId pipeline, MaterialPermutation permutation) {
+	// UV set of a map, 2 skips it
+	auto map_uv_set = [permutation](MaterialPermutation map_bit, MaterialPermutation uv1_bit) -> uint32_t {
+		if (!(permutation & map_bit))
+			return 2;
+
+		return (permutation & uv1_bit) ? 1 : 0;
+	};
+
+	// Specialization constants of g_pass.frag in constant_id order
+	std::array<uint32_t, 6> constants = {
+		map_uv_set(PermutationAlbedoMap, PermutationAlbedoUv1),
+		map_uv_set(PermutationAoRoughMetMap, PermutationAoRoughMetUv1),
+		map_uv_set(PermutationNormalMap, PermutationNormalUv1),
+		map_uv_set(PermutationEmissiveMap, PermutationEmissiveUv1),
+		(permutation & PermutationAlphaTest) ? 1u : 0u,
+		(permutation & PermutationTangents) ? 1u : 0u
+	};
+
+	PipelineId variant = m_graphics_controller.pipeline_variant(pipeline, constants.data(), (uint32_t)constants.size());
+
+	// Unspecialized pipeline handles every permutation, it draws until the variant is compiled
+	return m_graphics_controller.pipeline_ready(variant) ? variant : pipeline;
+}
+
+void Renderer::build_shadow_cascades() {
+	MY_PROFILE_FUNCTION();
+
+	const Camera& camera = m_scene_info.data.camera;
+	uint32_t cascade_count = std::clamp(m_settings.shadow_cascade_count, 1u, Shadows::MAX_CASCADES);
+	glm::vec3 light_dir = glm::normalize(m_draw_list.dir_light.dir); // Points towards the light
+
+	// World space bounding spheres of opaque and alpha masked primitives
+	std::vector<Primitive> primitives;
+	primitives.reserve(m_draw_list.opaque_primitives.size() + m_draw_list.masked_primitives.size());
+	primitives.insert(primitives.end(), m_draw_list.opaque_primitives.begin(), m_draw_list.opaque_primitives.end());
+	primitives.insert(primitives.end(), m_draw_list.masked_primitives.begin(), m_draw_list.masked_primitives.end());
+	std::vector<glm::vec4> caster_spheres(primitives.size());
+	for (size_t i = 0; i < primitives.size(); i++) {
+		const VertexBuffer& vertex_buffer = m_vertex_buffers.at(primitives[i].vertex_buffer);
+		const glm::mat4& model = m_transforms.data[primitives[i].transform_index].model;
+
+		glm::vec3 center = model * glm::vec4((vertex_buffer.bounds_min + vertex_buffer.bounds_max) * 0.5f, 1.0f);
+		float scale = std::max({ glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2])) });
+		float radius = glm::length(vertex_buffer.bounds_max - vertex_buffer.bounds_min) * 0.5f * scale;
+
+		caster_spheres[i] = glm::vec4(center, radius);
+	}
+
+	glm::mat4 proj = camera.unjittered_proj_matrix();
+	float tan_half_fov_x = 1.0f / proj[0][0];
+	float tan_half_fov_y = 1.0f / std::abs(proj[1][1]);
+
+	glm::vec3 front = glm::normalize(camera.front);
+	glm::vec3 right = glm::normalize(glm::cross(front, camera.up));
+	glm::vec3 up = glm::cross(right, front);
+
+	float near_plane = camera.near;
+	float far_plane = std::min(camera.far, m_settings.shadow_distance);
+	float split_near = near_plane;
+
+	glm::vec3 light_up = std::abs(light_dir.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+
+	m_shadows.info.cascade_count = cascade_count;
+	m_shadows.info.texel_size = glm::vec2(1.0f / (Shadows::ATLAS_TILES * m_shadows.cascade_resolution));
+
+	for (uint32_t cascade = 0; cascade < Shadows::MAX_CASCADES; cascade++) {
+		ShadowCascade& shadow_cascade = m_shadows.cascades[cascade];
+		shadow_cascade.static_casters.clear();
+		shadow_cascade.dynamic_casters.clear();
+		shadow_cascade.static_masked_casters.clear();
+		shadow_cascade.dynamic_masked_casters.clear();
+		shadow_cascade.static_batches.clear();
+		shadow_cascade.dynamic_batches.clear();
+		shadow_cascade.static_masked_batches.clear();
+		shadow_cascade.dynamic_masked_batches.clear();
+		shadow_cascade.cache_redraw = false;
+
+		if (cascade >= cascade_count)
+			continue;
+
+		float ratio = (float)(cascade + 1) / cascade_count;
+		float log_split = near_plane * std::pow(far_plane / near_plane, ratio);
+		float uniform_split = near_plane + (far_plane - near_plane) * ratio;
+		float split_far = glm::mix(uniform_split, log_split, Shadows::SPLIT_LAMBDA);
+
+		// Bounding sphere of frustum slice, unlike a tight box its size doesn't change as the camera turns
+		std::array<glm::vec3, 8> corners;
+		for (uint32_t i = 0; i < 8; i++) {
+			float depth = i < 4 ? split_near : split_far;
+			float x = (i & 1 ? 1.0f : -1.0f) * depth * tan_half_fov_x;
+			float y = (i & 2 ? 1.0f : -1.0f) * depth * tan_half_fov_y;
+
+			corners[i] = camera.eye + front * depth + right * x + up * y;
+		}
+
+		glm::vec3 center(0.0f);
+		for (const glm::vec3& corner : corners)
+			center += corner / 8.0f;
+
+		float radius = 0.0f;
+		for (const glm::vec3& corner : corners)
+			radius = std::max(radius, glm::length(corner - center));
+		radius = std::ceil(radius * 16.0f) / 16.0f;
+
+		// Light space cascade center moves in steps, so the cached map stays valid while the camera moves within one.
+		// Cascade is extended by a step to still cover the frustum slice
+		float snap = radius * Shadows::CACHE_SNAP;
+		float extent = radius + snap;
+
+		glm::mat4 light_rotation = glm::lookAt(glm::vec3(0.0f), -light_dir, light_up);
+		glm::vec3 light_space_center = glm::round(glm::vec3(light_rotation * glm::vec4(center, 1.0f)) / snap) * snap;
+		glm::mat4 light_view = glm::translate(glm::mat4(1.0f), -light_space_center) * light_rotation; // Points towards the light have positive z
+
+		// Casters overlapping the cascade or between it and the light
+		float max_static_z = extent;
+		float max_dynamic_z = extent;
+		size_t static_hash = 0;
+
+		for (size_t i = 0; i < primitives.size(); i++) {
+			glm::vec3 caster_center = light_view * glm::vec4(glm::vec3(caster_spheres[i]), 1.0f);
+			float caster_radius = caster_spheres[i].w;
+
+			if (std::abs(caster_center.x) > extent + caster_radius ||
+				std::abs(caster_center.y) > extent + caster_radius ||
+				caster_center.z + caster_radius < -extent)
+				continue;
+
+			// Masked primitives follow the opaque ones
+			const Primitive& primitive = primitives[i];
+			bool is_masked = i >= m_draw_list.opaque_primitives.size();
+			if (primitive.is_dynamic) {
+				max_dynamic_z = std::max(max_dynamic_z, caster_center.z + caster_radius);
+				(is_masked ? shadow_cascade.dynamic_masked_casters : shadow_cascade.dynamic_casters).push_back(primitive);
+			} else {
+				max_static_z = std::max(max_static_z, caster_center.z + caster_radius);
+				(is_masked ? shadow_cascade.static_masked_casters : shadow_cascade.static_casters).push_back(primitive);
+
+				// Order independent, so draw order doesn't invalidate the cache
+				size_t hash = std::hash<glm::mat4>()(m_transforms.data[primitive.transform_index].model);
+				hash = hash_combine(hash, primitive.vertex_buffer);
+				hash = hash_combine(hash, primitive.index_buffer);
+				hash = hash_combine(hash, primitive.first_index);
+				hash = hash_combine(hash, primitive.index_count);
+				static_hash += hash;
+			}
+		}
+
+		// Cached map is kept until the cascade or light moves, static casters change or a dynamic one comes closer to the light than the near plane
+		shadow_cascade.cache_redraw = !shadow_cascade.cache_valid ||
+			shadow_cascade.light_view != light_view ||
+			shadow_cascade.static_hash != static_hash ||
+			max_dynamic_z > shadow_cascade.near_z;
+
+		if (shadow_cascade.cache_redraw) {
+			shadow_cascade.light_view = light_view;
+			shadow_cascade.near_z = std::max(max_static_z, max_dynamic_z);
+			shadow_cascade.static_hash = static_hash;
+			shadow_cascade.cache_valid = true;
+
+			glm::mat4 light_proj = glm::ortho(-extent, extent, -extent, extent, -shadow_cascade.near_z, extent);
+
+			// Snap to whole texels, so shadow edges don't shimmer when the cascade moves
+			float half_resolution = m_shadows.cascade_resolution * 0.5f;
+			glm::vec4 origin = light_proj * light_view * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+			glm::vec2 origin_texels = glm::vec2(origin) * half_resolution;
+			glm::vec2 offset = (glm::round(origin_texels) - origin_texels) / half_resolution;
+			light_proj[3][0] += offset.x;
+			light_proj[3][1] += offset.y;
+
+			m_shadows.info.view_proj[cascade] = light_proj * light_view;
+
+			build_draw_batches(shadow_cascade.static_casters, shadow_cascade.static_batches, false);
+			build_draw_batches(shadow_cascade.static_masked_casters, shadow_cascade.static_masked_batches, false);
+		}
+
+		m_shadows.info.split_depths[cascade] = split_far;
+
+		build_draw_batches(shadow_cascade.dynamic_casters, shadow_cascade.dynamic_batches, false);
+		build_draw_batches(shadow_cascade.dynamic_masked_casters, shadow_cascade.dynamic_masked_batches, false);
+
+		split_near = split_far;
+	}
+}
+
+void Renderer::indirect_buffer_reserve(size_t command_count) {
+	if (command_count <= m_indirect.capacity)
+		return;
+
+	size_t capacity = std::max(m_indirect.capacity, IndirectBuffer::INITIAL_CAPACITY);
+	while (capacity < command_count)
+		capacity *= 2;
+
+	if (m_indirect.capacity != 0)
+		m_graphics_controller.buffer_destroy(m_indirect.buffer);
+
+	m_indirect.buffer = m_graphics_controller.indirect_buffer_create(nullptr, capacity * sizeof(DrawIndexedIndirectCommand));
+	m_indirect.capacity = capacity;
+}
+
+bool Renderer::instance_buffer_reserve(size_t instance_count) {
+	if (instance_count <= m_instances.capacity)
+		return false;
+
+	size_t capacity = std::max(m_instances.capacity, InstanceBuffer::INITIAL_CAPACITY);
+	while (capacity < instance_count)
+		capacity *= 2;
+
+	if (m_instances.capacity != 0)
+		m_graphics_controller.buffer_destroy(m_instances.buffer);
+
+	m_instances.buffer = m_graphics_controller.storage_buffer_create(nullptr, capacity * sizeof(InstanceData));
+	m_instances.capacity = capacity;
+
+	return true;
+}
+
+bool Renderer::transform_buffer_reserve(size_t transform_count) {
+	if (transform_count <= m_transforms.capacity)
+		return false;
+
+	size_t capacity = std::max(m_transforms.capacity, Transforms::INITIAL_CAPACITY);
+	while (capacity < transform_count)
+		capacity *= 2;
+
+	if (m_transforms.capacity != 0)
+		m_graphics_controller.buffer_destroy(m_transforms.buffer);
+
+	m_transforms.buffer = m_graphics_controller.storage_buffer_create(nullptr, capacity * sizeof(TransformData));
+	m_transforms.capacity = capacity;
+
+	// New buffer is empty, so every slot in use has to be uploaded again
+	for (uint32_t slot = 0; slot < (uint32_t)m_transforms.data.size(); slot++)
+		m_transforms.dirty_slots.push_back(slot);
+
+	return true;
+}
+
+void Renderer::object_uniform_sets_create() {
+	std::array<UniformInfo, 3> g_pipeline_uniform_set_0;
+	g_pipeline_uniform_set_0[0].type = UniformType::UniformBuffer;
+	g_pipeline_uniform_set_0[0].binding = 0;
+	g_pipeline_uniform_set_0[0].ids = &m_scene_info.gpu.projview_matrix;
+	g_pipeline_uniform_set_0[0].id_count = 1;
+	g_pipeline_uniform_set_0[1].type = UniformType::StorageBuffer;
+	g_pipeline_uniform_set_0[1].binding = 1;
+	g_pipeline_uniform_set_0[1].ids = &m_instances.buffer;
+	g_pipeline_uniform_set_0[1].id_count = 1;
+	g_pipeline_uniform_set_0[2].type = UniformType::StorageBuffer;
+	g_pipeline_uniform_set_0[2].binding = 2;
+	g_pipeline_uniform_set_0[2].ids = &m_transforms.buffer;
+	g_pipeline_uniform_set_0[2].id_count = 1;
+
+	m_g_pipeline.uniform_set_0 = m_graphics_controller.uniform_set_create(m_g_pipeline.shader, 0, g_pipeline_uniform_set_0.data(), (uint32_t)g_pipeline_uniform_set_0.size());
+
+	std::array<UniformInfo, 4> blend_pipeline_uniform_set_0;
+	blend_pipeline_uniform_set_0[0].type = UniformType::UniformBuffer;
+	blend_pipeline_uniform_set_0[0].binding = 0;
+	blend_pipeline_uniform_set_0[0].ids = &m_scene_info.gpu.projview_matrix;
+	blend_pipeline_uniform_set_0[0].id_count = 1;
+	blend_pipeline_uniform_set_0[1].type = UniformType::UniformBuffer;
+	blend_pipeline_uniform_set_0[1].binding = 1;
+	blend_pipeline_uniform_set_0[1].ids = &m_blend_pipeline.uniform_buffer;
+	blend_pipeline_uniform_set_0[1].id_count = 1;
+	blend_pipeline_uniform_set_0[2].type = UniformType::StorageBuffer;
+	blend_pipeline_uniform_set_0[2].binding = 2;
+	blend_pipeline_uniform_set_0[2].ids = &m_instances.buffer;
+	blend_pipeline_uniform_set_0[2].id_count = 1;
+	blend_pipeline_uniform_set_0[3].type = UniformType::StorageBuffer;
+	blend_pipeline_uniform_set_0[3].binding = 3;
+	blend_pipeline_uniform_set_0[3].ids = &m_transforms.buffer;
+	blend_pipeline_uniform_set_0[3].id_count = 1;
+
+	m_blend_pipeline.uniform_set_0 = m_graphics_controller.uniform_set_create(m_blend_pipeline.shader, 0, blend_pipeline_uniform_set_0.data(), (uint32_t)blend_pipeline_uniform_set_0.size());
+
+	std::array<UniformInfo, 2> shadow_pipeline_uniform_set_0;
+	shadow_pipeline_uniform_set_0[0].type = UniformType::StorageBuffer;
+	shadow_pipeline_uniform_set_0[0].binding = 0;
+	shadow_pipeline_uniform_set_0[0].ids = &m_instances.buffer;
+	shadow_pipeline_uniform_set_0[0].id_count = 1;
+	shadow_pipeline_uniform_set_0[1].type = UniformType::StorageBuffer;
+	shadow_pipeline_uniform_set_0[1].binding = 1;
+	shadow_pipeline_uniform_set_0[1].ids = &m_transforms.buffer;
+	shadow_pipeline_uniform_set_0[1].id_count = 1;
+
+	m_shadows.uniform_set_0 = m_graphics_controller.uniform_set_create(m_shadows.shader, 0, shadow_pipeline_uniform_set_0.data(), (uint32_t)shadow_pipeline_uniform_set_0.size());
+	m_shadows.masked_uniform_set_0 = m_graphics_controller.uniform_set_create(m_shadows.masked_shader, 0, shadow_pipeline_uniform_set_0.data(), (uint32_t)shadow_pipeline_uniform_set_0.size());
+
+	// Same bindings as G pipeline
+	if (m_settings.depth_prepass)
+		m_depth_prepass_pipeline.uniform_set_0 = m_graphics_controller.uniform_set_create(m_depth_prepass_pipeline.shader, 0, g_pipeline_uniform_set_0.data(), (uint32_t)g_pipeline_uniform_set_0.size());
+}
+
+void Renderer::light_clusters_build() {
+	MY_PROFILE_FUNCTION();
+
+	constexpr uint32_t GRID_X = LightClusters::GRID_X;
+	constexpr uint32_t GRID_Y = LightClusters::GRID_Y;
+	constexpr uint32_t GRID_Z = LightClusters::GRID_Z;
+
+	const Camera& camera = m_scene_info.data.camera;
+	glm::mat4 view = camera.view_matrix();
+	glm::mat4 proj = camera.unjittered_proj_matrix();
+
+	float near_plane = camera.near;
+	float far_plane = camera.far;
+	float slice_scale = (float)GRID_Z / std::log(far_plane / near_plane);
+	float slice_bias = -slice_scale * std::log(near_plane);
+
+	auto depth_to_slice = [&](float depth) {
+		return (uint32_t)std::clamp((int)std::floor(std::log(depth) * slice_scale + slice_bias), 0, (int)GRID_Z - 1);
+	};
+
+	auto slice_near_depth = [&](uint32_t slice) {
+		return near_plane * std::pow(far_plane / near_plane, (float)slice / GRID_Z);
+	};
+
+	// View space bounding spheres, spot lights are bounded by their range too
+	struct LightBounds {
+		glm::vec3 center;
+		float radius;
+		uint32_t first_slice;
+		uint32_t last_slice;
+	};
+
+	std::vector<LightBounds> bounds;
+	m_light_clusters.lights.clear();
+
+	for (const Light& light : m_draw_list.lights) {
+		if (light.type == LightType::Directional)
+			continue;
+
+		glm::vec3 center = view * glm::vec4(light.pos, 1.0f);
+		float depth = -center.z;
+		if (depth + light.range <= near_plane || depth - light.range >= far_plane)
+			continue;
+
+		bounds.push_back({
+			.center = center,
+			.radius = light.range,
+			.first_slice = depth_to_slice(std::max(depth - light.range, near_plane)),
+			.last_slice = depth_to_slice(std::min(depth + light.range, far_plane))
+		});
+
+		m_light_clusters.lights.push_back({
+			.pos = light.pos,
+			.range = light.range,
+			.color = light.color,
+			.type = (uint32_t)light.type,
+			.dir = glm::normalize(light.dir),
+			.cos_outer_cone = std::cos(light.outer_cone_angle),
+			.cos_inner_cone = std::cos(light.inner_cone_angle)
+		});
+	}
+
+	// Slices write to their own clusters only, so they are binned in parallel
+	std::array<uint32_t, GRID_Z> slices;
+	for (uint32_t z = 0; z < GRID_Z; z++)
+		slices[z] = z;
+
+	std::for_each(std::execution::par, slices.begin(), slices.end(), [&](uint32_t z) {
+		float slice_near = slice_near_depth(z);
+		float slice_far = slice_near_depth(z + 1);
+
+		for (uint32_t i = 0; i < GRID_X * GRID_Y; i++)
+			m_light_clusters.cluster_lights[z * GRID_X * GRID_Y + i].clear();
+
+		for (uint32_t light_index = 0; light_index < (uint32_t)bounds.size(); light_index++) {
+			const LightBounds& light = bounds[light_index];
+			if (z < light.first_slice || z > light.last_slice)
+				continue;
+
+			// Screen extents of light's bounding box cut by the slice, projection is extreme at its corners
+			float min_depth = std::max(-light.center.z - light.radius, slice_near);
+			float max_depth = std::min(-light.center.z + light.radius, slice_far);
+
+			auto uv_range = [&](float center, float scale) {
+				float values[4] = {
+					scale * (center - light.radius) / min_depth,
+					scale * (center - light.radius) / max_depth,
+					scale * (center + light.radius) / min_depth,
+					scale * (center + light.radius) / max_depth
+				};
+
+				auto [min_it, max_it] = std::minmax_element(std::begin(values), std::end(values));
+				return glm::vec2(*min_it, *max_it) * 0.5f + 0.5f;
+			};
+
+			glm::vec2 x_range = uv_range(light.center.x, proj[0][0]);
+			glm::vec2 y_range = uv_range(light.center.y, proj[1][1]);
+			if (x_range.y < 0.0f || x_range.x > 1.0f || y_range.y < 0.0f || y_range.x > 1.0f)
+				continue;
+
+			uint32_t first_x = (uint32_t)std::clamp((int)(x_range.x * GRID_X), 0, (int)GRID_X - 1);
+			uint32_t last_x = (uint32_t)std::clamp((int)(x_range.y * GRID_X), 0, (int)GRID_X - 1);
+			uint32_t first_y = (uint32_t)std::clamp((int)(y_range.x * GRID_Y), 0, (int)GRID_Y - 1);
+			uint32_t last_y = (uint32_t)std::clamp((int)(y_range.y * GRID_Y), 0, (int)GRID_Y - 1);
+
+			for (uint32_t y = first_y; y <= last_y; y++) {
+				for (uint32_t x = first_x; x <= last_x; x++)
+					m_light_clusters.cluster_lights[(z * GRID_Y + y) * GRID_X + x].push_back(light_index);
+			}
+		}
+	});
+
+	// Flatten light lists into one index buffer
+	LightClusterStats& stats = m_light_clusters.stats;
+	stats = {
+		.light_count = (uint32_t)m_light_clusters.lights.size(),
+		.cluster_count = LightClusters::CLUSTER_COUNT
+	};
+
+	m_light_clusters.light_indices.clear();
+	for (uint32_t i = 0; i < LightClusters::CLUSTER_COUNT; i++) {
+		const std::vector<uint32_t>& cluster_lights = m_light_clusters.cluster_lights[i];
+
+		m_light_clusters.clusters[i] = glm::uvec2((uint32_t)m_light_clusters.light_indices.size(), (uint32_t)cluster_lights.size());
+		m_light_clusters.light_indices.insert(m_light_clusters.light_indices.end(), cluster_lights.begin(), cluster_lights.end());
+
+		if (!cluster_lights.empty())
+			stats.occupied_cluster_count++;
+		stats.max_cluster_light_count = std::max(stats.max_cluster_light_count, (uint32_t)cluster_lights.size());
+	}
+	stats.light_index_count = (uint32_t)m_light_clusters.light_indices.size();
+
+	// Upload
+	{
+		MY_PROFILE_SCOPE("Light clusters upload");
+
+		if (light_buffers_reserve(m_light_clusters.lights.size(), m_light_clusters.light_indices.size())) {
+			m_graphics_controller.uniform_set_destroy(m_light_clusters.light_uniform_set_1);
+			m_graphics_controller.uniform_set_destroy(m_light_clusters.blend_uniform_set_2);
+			light_uniform_sets_create();
+		}
+
+		ScreenResolution render_area = m_render_graph.render_area();
+		glm::vec2 target_size = glm::vec2(render_area.width, render_area.height);
+
+		ClusterInfo info{
+			.view = view,
+			.grid_size = glm::uvec4(GRID_X, GRID_Y, GRID_Z, 0),
+			.depth_params = glm::vec4(near_plane, far_plane, slice_scale, slice_bias),
+			.target_size = glm::vec4(target_size, 1.0f / target_size),
+			.irradiance_sh = m_draw_list.skybox.has_value() ? m_skyboxes.at(m_draw_list.skybox.value()).irradiance_sh : constant_irradiance_sh(0.35f)
+		};
+
+		m_graphics_controller.buffer_update(m_light_clusters.info_buffer, &info);
+		m_graphics_controller.buffer_update(m_light_clusters.cluster_buffer, m_light_clusters.clusters.data(), 0, m_light_clusters.clusters.size() * sizeof(glm::uvec2));
+		if (!m_light_clusters.lights.empty()) {
+			m_graphics_controller.buffer_update(m_light_clusters.light_buffer, m_light_clusters.lights.data(), 0, m_light_clusters.lights.size() * sizeof(LightData));
+			m_graphics_controller.buffer_update(m_light_clusters.light_index_buffer, m_light_clusters.light_indices.data(), 0, m_light_clusters.light_indices.size() * sizeof(uint32_t));
+		}
+	}
+}
+
+bool Renderer::light_buffers_reserve(size_t light_count, size_t light_index_count) {
+	bool recreated = false;
+
+	if (light_count > m_light_clusters.light_capacity) {
+		size_t capacity = std::max(m_light_clusters.light_capacity, LightClusters::INITIAL_LIGHT_CAPACITY);
+		while (capacity < light_count)
+			capacity *= 2;
+
+		if (m_light_clusters.light_capacity != 0)
+			m_graphics_controller.buffer_destroy(m_light_clusters.light_buffer);
+
+		m_light_clusters.light_buffer = m_graphics_controller.storage_buffer_create(nullptr, capacity * sizeof(LightData));
+		m_light_clusters.light_capacity = capacity;
+		recreated = true;
+	}
+
+	if (light_index_count > m_light_clusters.light_index_capacity) {
+		size_t capacity = std::max(m_light_clusters.light_index_capacity, LightClusters::INITIAL_LIGHT_INDEX_CAPACITY);
+		while (capacity < light_index_count)
+			capacity *= 2;
+
+		if (m_light_clusters.light_index_capacity != 0)
+			m_graphics_controller.buffer_destroy(m_light_clusters.light_index_buffer);
+
+		m_light_clusters.light_index_buffer = m_graphics_controller.storage_buffer_create(nullptr, capacity * sizeof(uint32_t));
+		m_light_clusters.light_index_capacity = capacity;
+		recreated = true;
+	}
+
+	return recreated;
+}
+
+void Renderer::light_uniform_sets_create() {
+	// Same layout in lightning.frag and blend.frag
+	std::array<UniformInfo, 4> cluster_uniforms;
+	cluster_uniforms[0].type = UniformType::UniformBuffer;
+	cluster_uniforms[0].binding = 0;
+	cluster_uniforms[0].ids = &m_light_clusters.info_buffer;
+	cluster_uniforms[0].id_count = 1;
+	cluster_uniforms[1].type = UniformType::StorageBuffer;
+	cluster_uniforms[1].binding = 1;
+	cluster_uniforms[1].ids = &m_light_clusters.light_buffer;
+	cluster_uniforms[1].id_count = 1;
+	cluster_uniforms[2].type = UniformType::StorageBuffer;
+	cluster_uniforms[2].binding = 2;
+	cluster_uniforms[2].ids = &m_light_clusters.cluster_buffer;
+	cluster_uniforms[2].id_count = 1;
+	cluster_uniforms[3].type = UniformType::StorageBuffer;
+	cluster_uniforms[3].binding = 3;
+	cluster_uniforms[3].ids = &m_light_clusters.light_index_buffer;
+	cluster_uniforms[3].id_count = 1;
+
+	m_light_clusters.light_uniform_set_1 = m_graphics_controller.uniform_set_create(m_light_pipeline.shader, 1, cluster_uniforms.data(), (uint32_t)cluster_uniforms.size());
+	m_light_clusters.blend_uniform_set_2 = m_graphics_controller.uniform_set_create(m_blend_pipeline.shader, 2, cluster_uniforms.data(), (uint32_t)cluster_uniforms.size());
+}
+
+uint32_t Renderer::transform_slot_acquire() {
+	if (!m_transforms.free_slots.empty()) {
+		uint32_t slot = m_transforms.free_slots.back();
+		m_transforms.free_slots.pop_back();
+
+		return slot;
+	}
+
+	m_transforms.data.emplace_back();
+	m_transforms.update_frames.push_back(UINT64_MAX);
+
+	return (uint32_t)m_transforms.data.size() - 1;
+}
+
+void Renderer::transform_slot_write(uint32_t slot, const glm::mat4& model) {
+	glm::mat3 normal = glm::transpose(glm::inverse(glm::mat3(model)));
+
+	TransformData& data = m_transforms.data[slot];
+	data.model = model;
+	data.normal = glm::mat3x4(glm::vec4(normal[0], 0.0f), glm::vec4(normal[1], 0.0f), glm::vec4(normal[2], 0.0f));
+
+	m_transforms.dirty_slots.push_back(slot);
+}
+
+void Renderer::transforms_upload() {
+	MY_PROFILE_FUNCTION();
+
+	// Objects which stopped moving still carry last frame's motion in their previous model
+	for (uint32_t slot : m_transforms.prev_moved_slots) {
+		if (m_transforms.update_frames[slot] != m_frame_number) {
+			m_transforms.data[slot].prev_model = m_transforms.data[slot].model;
+			m_transforms.dirty_slots.push_back(slot);
+		}
+	}
+
+	std::swap(m_transforms.prev_moved_slots, m_transforms.moved_slots);
+	m_transforms.moved_slots.clear();
+
+	std::vector<uint32_t>& dirty_slots = m_transforms.dirty_slots;
+	if (dirty_slots.empty())
+		return;
+
+	std::sort(dirty_slots.begin(), dirty_slots.end());
+	dirty_slots.erase(std::unique(dirty_slots.begin(), dirty_slots.end()), dirty_slots.end());
+
+	// Adjacent slots are merged, so the upload is proportional to the number of changed transforms
+	std::vector<BufferRegion> regions;
+	for (uint32_t slot : dirty_slots) {
+		size_t offset = slot * sizeof(TransformData);
+
+		if (!regions.empty() && regions.back().offset + regions.back().size == offset)
+			regions.back().size += sizeof(TransformData);
+		else
+			regions.push_back({ .offset = offset, .size = sizeof(TransformData) });
+	}
+
+	m_graphics_controller.buffer_update(m_transforms.buffer, m_transforms.data.data(), regions.data(), (uint32_t)regions.size());
+
+	dirty_slots.clear();
+}
+
 void Renderer::materials_create(ImageSpecs* images, uint32_t image_count, SamplerSpecs* samplers, uint32_t sampler_count, TextureSpecs* textures, uint32_t texture_count, MaterialSpecs* materials, uint32_t material_count, MaterialId* material_ids) {
 	MY_PROFILE_FUNCTION();
 
@@ -1113,8 +2578,8 @@ void Renderer::materials_create(ImageSpecs* images, uint32_t image_count, Sample
 		image_ids.push_back(id);
 	}
 
-	std::vector<SamplerId> sampler_ids;
-	sampler_ids.reserve(sampler_count);
+	std::vector<SamplerInfo> sampler_infos;
+	sampler_infos.reserve(sampler_count);
 
 	for (uint32_t i = 0; i < sampler_count; i++) {
 		SamplerInfo info{
@@ -1127,106 +2592,96 @@ void Renderer::materials_create(ImageSpecs* images, uint32_t image_count, Sample
 			.max_anisotropy = 16.0f
 		};
 
-		SamplerId id = m_graphics_controller.sampler_create(info);
-		m_sampler_usage_counts[id] = 0;
-
-		sampler_ids.push_back(id);
+		sampler_infos.push_back(info);
 	}
 
+	uint32_t first_updated_index = Bindless::MAX_MATERIALS;
+	uint32_t last_updated_index = 0;
+
 	for (uint32_t i = 0; i < material_count; i++) {
 		Material material{
 			.info = materials[i].info,
 			.alpha_mode = materials[i].alpha_mode
 		};
 
-		Texture albedo_map_texture = { m_defaults.empty_texture.image, m_defaults.empty_texture.sampler };
-		Texture ao_rough_met_map_texture = { m_defaults.empty_texture.image, m_defaults.empty_texture.sampler };
-		Texture normal_map_texture = { m_defaults.empty_texture.image, m_defaults.empty_texture.sampler };
-		Texture emissive_map_texture = { m_defaults.empty_texture.image, m_defaults.empty_texture.sampler };
-
-		std::array<UniformInfo, 4> uniforms;
-		uniforms[0].ids = (RenderId*)&albedo_map_texture;
-		uniforms[1].ids = (RenderId*)&ao_rough_met_map_texture;
-		uniforms[2].ids = (RenderId*)&normal_map_texture;
-		uniforms[3].ids = (RenderId*)&emissive_map_texture;
-
-		for (uint32_t j = 0; j < 4; j++) {
-			uniforms[j].binding = j;
-			uniforms[j].subresource_range = { ImageAspectColor };
-			uniforms[j].type = UniformType::CombinedImageSampler;
-			uniforms[j].id_count = 2;
-		}
-
-		if (materials[i].albedo_id.has_value()) {
-			uint32_t texture_id = materials[i].albedo_id.value();
-			const TextureSpecs& tex_specs = textures[texture_id];
+		auto load_texture = [&](std::optional<uint32_t> texture_id) -> std::optional<Texture> {
+			if (!texture_id.has_value())
+				return std::nullopt;
 
-			ImageId image_id = image_ids[tex_specs.image_id];
-			SamplerId sampler_id = sampler_ids[tex_specs.sampler_id];
+			const TextureSpecs& tex_specs = textures[texture_id.value()];
 
-			albedo_map_texture.image = image_id;
-			albedo_map_texture.sampler = sampler_id;
+			// Every texture holds a reference of its sampler, identical samplers of all models are shared by the controller
+			Texture texture{
+				.image = image_ids[tex_specs.image_id],
+				.sampler = m_graphics_controller.sampler_create(sampler_infos[tex_specs.sampler_id])
+			};
 
-			m_image_usage_counts[image_id]++;
-			m_sampler_usage_counts[sampler_id]++;
+			m_image_usage_counts[texture.image]++;
 
-			material.albedo = albedo_map_texture;
+			return texture;
 		};
-		if (materials[i].ao_rough_met_id.has_value()) {
-			uint32_t texture_id = materials[i].ao_rough_met_id.value();
-			const TextureSpecs& tex_specs = textures[texture_id];
-
-			ImageId image_id = image_ids[tex_specs.image_id];
-			SamplerId sampler_id = sampler_ids[tex_specs.sampler_id];
 
-			ao_rough_met_map_texture.image = image_id;
-			ao_rough_met_map_texture.sampler = sampler_id;
-
-			m_image_usage_counts[image_id]++;
-			m_sampler_usage_counts[sampler_id]++;
-
-			material.ao_rough_met = ao_rough_met_map_texture;
-		}
-		if (materials[i].normals_id.has_value()) {
-			uint32_t texture_id = materials[i].normals_id.value();
-			const TextureSpecs& tex_specs = textures[texture_id];
+		material.albedo = load_texture(materials[i].albedo_id);
+		material.ao_rough_met = load_texture(materials[i].ao_rough_met_id);
+		material.normal = load_texture(materials[i].normals_id);
+		material.emissive = load_texture(materials[i].emissive_id);
 
-			ImageId image_id = image_ids[tex_specs.image_id];
-			SamplerId sampler_id = sampler_ids[tex_specs.sampler_id];
+		// Map is sampled only with a valid UV set, as in the unspecialized G pass
+		auto map_permutation = [](int uv_set, MaterialPermutation map_bit, MaterialPermutation uv1_bit) -> MaterialPermutation {
+			if (uv_set == 0)
+				return map_bit;
+			if (uv_set == 1)
+				return map_bit | uv1_bit;
 
-			normal_map_texture.image = image_id;
-			normal_map_texture.sampler = sampler_id;
-
-			m_image_usage_counts[image_id]++;
-			m_sampler_usage_counts[sampler_id]++;
+			return 0;
+		};
 
-			material.normal = normal_map_texture;
+		material.permutation =
+			map_permutation(material.info.base_color_uv_set, PermutationAlbedoMap, PermutationAlbedoUv1) |
+			map_permutation(material.info.ao_rough_met_uv_set, PermutationAoRoughMetMap, PermutationAoRoughMetUv1) |
+			map_permutation(material.info.normals_uv_set, PermutationNormalMap, PermutationNormalUv1) |
+			map_permutation(material.info.emissive_uv_set, PermutationEmissiveMap, PermutationEmissiveUv1) |
+			(material.alpha_mode == AlphaMode::Mask ? PermutationAlphaTest : 0);
+
+		if (!m_bindless.free_material_indices.empty()) {
+			material.index = m_bindless.free_material_indices.back();
+			m_bindless.free_material_indices.pop_back();
+		} else {
+			if (m_bindless.material_count == Bindless::MAX_MATERIALS)
+				throw std::runtime_error("Material limit exceeded");
+
+			material.index = m_bindless.material_count++;
 		}
-		if (materials[i].emissive_id.has_value()) {
-			uint32_t texture_id = materials[i].emissive_id.value();
-			const TextureSpecs& tex_specs = textures[texture_id];
-
-			ImageId image_id = image_ids[tex_specs.image_id];
-			SamplerId sampler_id = sampler_ids[tex_specs.sampler_id];
 
-			emissive_map_texture.image = image_id;
-			emissive_map_texture.sampler = sampler_id;
-
-			m_image_usage_counts[image_id]++;
-			m_sampler_usage_counts[sampler_id]++;
-
-			material.emissive = emissive_map_texture;
-		}
+		auto texture_slot = [&](const std::optional<Texture>& texture) {
+			return texture.has_value() ? texture_slot_acquire(texture.value()) : Bindless::EMPTY_TEXTURE_SLOT;
+		};
 
-		ShaderId shader_id = materials[i].alpha_mode == AlphaMode::Blend ? m_blend_pipeline.shader : m_g_pipeline.shader;
+		MaterialData& material_data = m_bindless.material_data[material.index];
+		material_data.info = material.info;
+		material_data.texture_indices[0] = texture_slot(material.albedo);
+		material_data.texture_indices[1] = texture_slot(material.ao_rough_met);
+		material_data.texture_indices[2] = texture_slot(material.normal);
+		material_data.texture_indices[3] = texture_slot(material.emissive);
 
-		material.uniform_set = m_graphics_controller.uniform_set_create(shader_id, 1, uniforms.data(), (uint32_t)uniforms.size());
+		first_updated_index = std::min(first_updated_index, material.index);
+		last_updated_index = std::max(last_updated_index, material.index);
 
 		m_materials[m_render_id] = std::move(material);
 		material_ids[i] = m_render_id;
 
 		m_render_id++;
 	}
+
+	// New materials are uploaded with one copy covering all of them
+	if (material_count) {
+		m_graphics_controller.buffer_update(
+			m_bindless.material_buffer,
+			&m_bindless.material_data[first_updated_index],
+			first_updated_index * sizeof(MaterialData),
+			(last_updated_index - first_updated_index + 1) * sizeof(MaterialData)
+		);
+	}
 }
 
 void Renderer::materials_destroy(MaterialId* material_ids, size_t count) {
@@ -1239,19 +2694,66 @@ void Renderer::materials_destroy(MaterialId* material_ids, size_t count) {
 	}
 }
 
+TransformId Renderer::transform_create(const glm::mat4& model) {
+	uint32_t slot = transform_slot_acquire();
+	m_transforms.data[slot].prev_model = model;
+	m_transforms.update_frames[slot] = UINT64_MAX;
+	transform_slot_write(slot, model);
+
+	m_transforms.slots[m_render_id] = slot;
+	return m_render_id++;
+}
+
+void Renderer::transform_update(TransformId transform_id, const glm::mat4& model) {
+	uint32_t slot = m_transforms.slots.at(transform_id);
+	TransformData& data = m_transforms.data[slot];
+
+	// Previous model is the one rendered last frame, so it is kept on repeated updates within a frame
+	if (m_transforms.update_frames[slot] != m_frame_number) {
+		data.prev_model = data.model;
+		m_transforms.update_frames[slot] = m_frame_number;
+		m_transforms.moved_slots.push_back(slot);
+	}
+
+	transform_slot_write(slot, model);
+}
+
+void Renderer::transform_destroy(TransformId transform_id) {
+	// Primitives of the current frame may still reference the slot
+	m_transforms.released_slots.push_back({ m_transforms.slots.at(transform_id), m_frame_number });
+	m_transforms.slots.erase(transform_id);
+}
+
 SkyboxId Renderer::skybox_create(uint32_t cubemap_resolution, const ImageSpecs& texture, SkyboxType type) {
+	MY_PROFILE_FUNCTION();
+
+	// Cubemap shaders write rgba16f storage images
+	if (texture.desired_format != Format::RGBA16_SFloat)
+		throw std::runtime_error("Skybox has to be created with RGBA16_SFloat desired format");
+
 	Extent3D cubemap_extent{ cubemap_resolution, cubemap_resolution, 1 };
+	uint32_t mip_levels = (uint32_t)std::floor(std::log2((float)cubemap_resolution)) + 1;
 	
 	ImageInfo skybox_texture_info = {
-		.usage = ImageUsageColorSampled | ImageUsageTransferDst,
+		.usage = ImageUsageColorSampled | ImageUsageStorage | ImageUsageTransferDst,
 		.view_type = ImageViewType::Cube,
 		.format = texture.desired_format,
 		.extent = cubemap_extent,
+		.mip_levels = mip_levels,
 		.array_layers = 6
 	};
 
 	ImageId id = m_graphics_controller.image_create(skybox_texture_info);
 	m_image_usage_counts[id]++;
+
+	// Every mip gets written, so the whole image starts in storage layout
+	ImageBarrier skybox_barrier{
+		.image = id,
+		.usage = ImageUsageStorage,
+		.discard = true
+	};
+
+	m_graphics_controller.draw_image_barriers(&skybox_barrier, 1);
 	
 	if (type == SkyboxType::Cubemap) {
 		ImageSubresourceLayers subresource{
@@ -1266,7 +2768,7 @@ SkyboxId Renderer::skybox_create(uint32_t cubemap_resolution, const ImageSpecs&
 		Extent3D equirect_image_extent{ texture.width, texture.height, 1 };
 		
 		ImageInfo equirect_image_info{
-			.usage = ImageUsageColorAttachment | ImageUsageColorSampled | ImageUsageTransferSrc | ImageUsageTransferDst,
+			.usage = ImageUsageColorSampled | ImageUsageTransferDst,
 			.format = texture.data_format,
 			.extent = equirect_image_extent
 		};
@@ -1287,87 +2789,68 @@ SkyboxId Renderer::skybox_create(uint32_t cubemap_resolution, const ImageSpecs&
 
 		m_graphics_controller.image_update(equirect_image, equirect_image_subres, { 0, 0, 0 }, equirect_image_extent, image_data_info);
 
-		ImageInfo equirectangular_image_info{
-			.usage = ImageUsageColorAttachment | ImageUsageTransferSrc,
-			.format = texture.desired_format,
-			.extent = cubemap_extent,
-			.array_layers = 1
-		};
-
-		ImageId cubemap_plane = m_graphics_controller.image_create(equirectangular_image_info);
-
-		ImageCopy image_copy{
-			.src_subresource = {.aspect = ImageAspectColor, .mip_level = 0, .base_array_layer = 0, .layer_count = 1 },
-			.src_offset = { 0, 0, 0 },
-			.dst_subresource = {.aspect = ImageAspectColor, .mip_level = 0, .layer_count = 1 },
-			.dst_offset = { 0, 0, 0 },
-			.extent = cubemap_extent
-		};
-
-		FramebufferId skybox_framebuffer = m_graphics_controller.framebuffer_create(m_gen_cubemap_pipeline.render_pass, &cubemap_plane, 1);
+		RenderId equirect_ids[2] = { equirect_image, m_gen_cubemap_pipeline.sampler };
 
-		glm::mat4 views[6] =
-		{
-		   glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)),
-		   glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)),
-		   glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3( 0.0f,  1.0f,  0.0f), glm::vec3(0.0f,  0.0f,  1.0f)),
-		   glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3( 0.0f, -1.0f,  0.0f), glm::vec3(0.0f,  0.0f, -1.0f)),
-		   glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec3(0.0f, -1.0f,  0.0f)),
-		   glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3( 0.0f,  0.0f, -1.0f), glm::vec3(0.0f, -1.0f,  0.0f))
-		};
-
-		glm::mat4 proj = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 10.0f);
-
-		RenderId ids[2] = { equirect_image, m_gen_cubemap_pipeline.sampler };
-
-		UniformInfo uniform_info{
+		// All six faces are written by one dispatch, face is the Z of the group
+		std::array<UniformInfo, 2> uniforms;
+		uniforms[0] = {
 			.type = UniformType::CombinedImageSampler,
 			.subresource_range = { ImageAspectColor },
 			.binding = 0,
-			.ids = ids,
+			.ids = equirect_ids,
 			.id_count = 2
 		};
+		uniforms[1] = {
+			.type = UniformType::StorageImage,
+			.subresource_range = { .aspect = ImageAspectColor, .base_mip_level = 0, .level_count = 1, .layer_count = 6 },
+			.binding = 1,
+			.ids = &id,
+			.id_count = 1
+		};
 
-		UniformSetId uniform_set = m_graphics_controller.uniform_set_create(m_gen_cubemap_pipeline.shader, 0, &uniform_info, 1);
+		UniformSetId uniform_set = m_graphics_controller.uniform_set_create_transient(m_gen_cubemap_pipeline.equirect_shader, 0, uniforms.data(), uniforms.size());
 
-		for (int i = 0; i < 6; i++) {
-			ClearValue clear_value{ .color = { 0.0f, 0.0f, 0.0f, 0.0f } };
-			m_graphics_controller.draw_begin(skybox_framebuffer, &clear_value, 1);
-			m_graphics_controller.draw_set_viewport(0.0f, 0.0f, (float)cubemap_resolution, (float)cubemap_resolution, 0.0f, 1.0f);
-			m_graphics_controller.draw_set_scissor(0, 0, cubemap_resolution, cubemap_resolution);
+		uint32_t group_count = (cubemap_resolution + GenerateCubemapPipeline::GROUP_SIZE - 1) / GenerateCubemapPipeline::GROUP_SIZE;
 
-			char buffers[128];
-			memcpy(buffers, &proj, sizeof(glm::mat4));
-			memcpy(buffers + sizeof(glm::mat4), &views[i], sizeof(glm::mat4));
+		m_graphics_controller.draw_bind_pipeline(m_gen_cubemap_pipeline.equirect_pipeline);
+		m_graphics_controller.draw_bind_uniform_sets(m_gen_cubemap_pipeline.equirect_pipeline, 0, &uniform_set, 1);
+		m_graphics_controller.draw_dispatch(group_count, group_count, 6);
 
-			m_graphics_controller.draw_bind_vertex_buffer(m_box.vertex_buffer);
-			m_graphics_controller.draw_bind_index_buffer(m_box.index_buffer, m_box.index_type);
-			m_graphics_controller.draw_bind_pipeline(m_gen_cubemap_pipeline.pipeline);
-			m_graphics_controller.draw_push_constants(m_gen_cubemap_pipeline.shader, ShaderStageVertex, 0, 2 * sizeof(glm::mat4), buffers);
-			m_graphics_controller.draw_bind_uniform_sets(m_gen_cubemap_pipeline.pipeline, 0, &uniform_set, 1);
-			m_graphics_controller.draw_draw_indexed(m_box.index_count, 0);
+		m_graphics_controller.image_destroy(equirect_image);
+	}
 
-			m_graphics_controller.draw_end();
+	m_graphics_controller.draw_compute_barrier();
+	cubemap_generate_mips(id, cubemap_resolution, mip_levels);
 
-			image_copy.dst_subresource.base_array_layer = i;
+	std::array<glm::vec4, 9> irradiance_sh = environment_irradiance_sh(texture, cubemap_resolution, type);
 
-			m_graphics_controller.image_copy(cubemap_plane, id, image_copy);
-		}
+	std::optional<ImageId> prefiltered_image;
+	if (m_settings.prefilter_environment) {
+		prefiltered_image = cubemap_prefilter(id, cubemap_resolution);
 
-		m_graphics_controller.framebuffer_destroy(skybox_framebuffer);
+		if (!m_gen_cubemap_pipeline.brdf_lut.has_value())
+			brdf_lut_create();
 	}
+
+	// Skybox is sampled inside a render pass, where its layout can't change anymore
+	ImageBarrier sampled_barrier{
+		.image = id,
+		.usage = ImageUsageColorSampled
+	};
+
+	m_graphics_controller.draw_image_barriers(&sampled_barrier, 1);
 	
 	RenderId texture_ids[2] = { id, m_skybox_pipeline.sampler };
 
 	UniformInfo skybox_texture_uniform{
 		.type = UniformType::CombinedImageSampler,
-		.subresource_range = { .aspect = ImageAspectColor, .layer_count = 6 },
+		.subresource_range = { .aspect = ImageAspectColor, .level_count = mip_levels, .layer_count = 6 },
 		.binding = 0,
 		.ids = texture_ids,
 		.id_count = 2
 	};
 
-	Skybox skybox{ id, m_graphics_controller.uniform_set_create(m_skybox_pipeline.shader, 1, &skybox_texture_uniform, 1) };
+	Skybox skybox{ id, m_graphics_controller.uniform_set_create(m_skybox_pipeline.shader, 1, &skybox_texture_uniform, 1), prefiltered_image, irradiance_sh };
 
 	m_skyboxes[m_render_id] = std::move(skybox);
 	return m_render_id++;
@@ -1378,16 +2861,170 @@ void Renderer::skybox_destroy(SkyboxId skybox_id) {
 
 	clear_image(skybox.image);
 	m_graphics_controller.uniform_set_destroy(skybox.uniform_set_1);
+	if (skybox.prefiltered_image.has_value())
+		m_graphics_controller.image_destroy(skybox.prefiltered_image.value());
 
 	m_skyboxes.erase(skybox_id);
 }
 
+void Renderer::cubemap_generate_mips(ImageId image_id, uint32_t resolution, uint32_t mip_levels) {
+	MY_PROFILE_FUNCTION();
+
+	m_graphics_controller.draw_bind_pipeline(m_gen_cubemap_pipeline.downsample_pipeline);
+
+	// Each mip is read back by the next dispatch, so they are generated one after another
+	for (uint32_t mip = 1; mip < mip_levels; mip++) {
+		std::array<UniformInfo, 2> uniforms;
+		uniforms[0] = {
+			.type = UniformType::StorageImage,
+			.subresource_range = { .aspect = ImageAspectColor, .base_mip_level = mip - 1, .level_count = 1, .layer_count = 6 },
+			.binding = 0,
+			.ids = &image_id,
+			.id_count = 1
+		};
+		uniforms[1] = {
+			.type = UniformType::StorageImage,
+			.subresource_range = { .aspect = ImageAspectColor, .base_mip_level = mip, .level_count = 1, .layer_count = 6 },
+			.binding = 1,
+			.ids = &image_id,
+			.id_count = 1
+		};
+
+		UniformSetId uniform_set = m_graphics_controller.uniform_set_create_transient(m_gen_cubemap_pipeline.downsample_shader, 0, uniforms.data(), uniforms.size());
+
+		uint32_t mip_resolution = std::max(resolution >> mip, 1u);
+		uint32_t group_count = (mip_resolution + GenerateCubemapPipeline::GROUP_SIZE - 1) / GenerateCubemapPipeline::GROUP_SIZE;
+
+		m_graphics_controller.draw_bind_uniform_sets(m_gen_cubemap_pipeline.downsample_pipeline, 0, &uniform_set, 1);
+		m_graphics_controller.draw_dispatch(group_count, group_count, 6);
+		m_graphics_controller.draw_compute_barrier();
+	}
+}
+
+ImageId Renderer::cubemap_prefilter(ImageId image_id, uint32_t resolution) {
+	MY_PROFILE_FUNCTION();
+
+	constexpr uint32_t prefiltered_resolution = GenerateCubemapPipeline::PREFILTERED_RESOLUTION;
+	constexpr uint32_t prefiltered_mip_levels = GenerateCubemapPipeline::PREFILTERED_MIP_LEVELS;
+
+	ImageInfo prefiltered_info{
+		.usage = ImageUsageColorSampled | ImageUsageStorage,
+		.view_type = ImageViewType::Cube,
+		.format = Format::RGBA16_SFloat,
+		.extent = { prefiltered_resolution, prefiltered_resolution, 1 },
+		.mip_levels = prefiltered_mip_levels,
+		.array_layers = 6
+	};
+
+	ImageId prefiltered_image = m_graphics_controller.image_create(prefiltered_info);
+
+	RenderId environment_ids[2] = { image_id, m_gen_cubemap_pipeline.sampler };
+	uint32_t environment_mip_levels = (uint32_t)std::floor(std::log2((float)resolution)) + 1;
+
+	m_graphics_controller.draw_bind_pipeline(m_gen_cubemap_pipeline.prefilter_pipeline);
+
+	// Levels only read the environment, so no barriers are needed between them
+	for (uint32_t mip = 0; mip < prefiltered_mip_levels; mip++) {
+		std::array<UniformInfo, 2> uniforms;
+		uniforms[0] = {
+			.type = UniformType::CombinedImageSampler,
+			.subresource_range = { .aspect = ImageAspectColor, .level_count = environment_mip_levels, .layer_count = 6 },
+			.binding = 0,
+			.ids = environment_ids,
+			.id_count = 2
+		};
+		uniforms[1] = {
+			.type = UniformType::StorageImage,
+			.subresource_range = { .aspect = ImageAspectColor, .base_mip_level = mip, .level_count = 1, .layer_count = 6 },
+			.binding = 1,
+			.ids = &prefiltered_image,
+			.id_count = 1
+		};
+
+		UniformSetId uniform_set = m_graphics_controller.uniform_set_create_transient(m_gen_cubemap_pipeline.prefilter_shader, 0, uniforms.data(), uniforms.size());
+
+		float constants[2] = {
+			(float)mip / (float)(prefiltered_mip_levels - 1),
+			(float)resolution
+		};
+
+		uint32_t mip_resolution = prefiltered_resolution >> mip;
+		uint32_t group_count = (mip_resolution + GenerateCubemapPipeline::GROUP_SIZE - 1) / GenerateCubemapPipeline::GROUP_SIZE;
+
+		m_graphics_controller.draw_bind_uniform_sets(m_gen_cubemap_pipeline.prefilter_pipeline, 0, &uniform_set, 1);
+		m_graphics_controller.draw_push_constants(m_gen_cubemap_pipeline.prefilter_shader, ShaderStageCompute, 0, sizeof(constants), constants);
+		m_graphics_controller.draw_dispatch(group_count, group_count, 6);
+	}
+
+	ImageBarrier sampled_barrier{
+		.image = prefiltered_image,
+		.usage = ImageUsageColorSampled
+	};
+
+	m_graphics_controller.draw_image_barriers(&sampled_barrier, 1);
+
+	return prefiltered_image;
+}
+
+void Renderer::brdf_lut_create() {
+	MY_PROFILE_FUNCTION();
+
+	constexpr uint32_t lut_resolution = GenerateCubemapPipeline::BRDF_LUT_RESOLUTION;
+
+	ImageInfo lut_info{
+		.usage = ImageUsageColorSampled | ImageUsageStorage,
+		.format = Format::RG16_SFloat,
+		.extent = { lut_resolution, lut_resolution, 1 }
+	};
+
+	ImageId lut = m_graphics_controller.image_create(lut_info);
+
+	UniformInfo lut_uniform{
+		.type = UniformType::StorageImage,
+		.subresource_range = { ImageAspectColor },
+		.binding = 0,
+		.ids = &lut,
+		.id_count = 1
+	};
+
+	UniformSetId uniform_set = m_graphics_controller.uniform_set_create_transient(m_gen_cubemap_pipeline.brdf_lut_shader, 0, &lut_uniform, 1);
+
+	uint32_t group_count = (lut_resolution + GenerateCubemapPipeline::GROUP_SIZE - 1) / GenerateCubemapPipeline::GROUP_SIZE;
+
+	m_graphics_controller.draw_bind_pipeline(m_gen_cubemap_pipeline.brdf_lut_pipeline);
+	m_graphics_controller.draw_bind_uniform_sets(m_gen_cubemap_pipeline.brdf_lut_pipeline, 0, &uniform_set, 1);
+	m_graphics_controller.draw_dispatch(group_count, group_count, 1);
+
+	ImageBarrier sampled_barrier{
+		.image = lut,
+		.usage = ImageUsageColorSampled
+	};
+
+	m_graphics_controller.draw_image_barriers(&sampled_barrier, 1);
+
+	m_gen_cubemap_pipeline.brdf_lut = lut;
+}
+
 VertexBufferId Renderer::vertex_buffer_create(const Vertex* data, size_t count) {
 	MY_PROFILE_FUNCTION();
 
-	BufferId buffer_id = m_graphics_controller.vertex_buffer_create(data, count * sizeof(Vertex));
+	VertexBuffer vertex_buffer{
+		.buffer = m_graphics_controller.vertex_buffer_create(data, count * sizeof(Vertex)),
+		.bounds_min = glm::vec3(std::numeric_limits<float>::max()),
+		.bounds_max = glm::vec3(std::numeric_limits<float>::lowest()),
+		.has_tangents = count > 0 && !std::isnan(data[0].tangent.x)
+	};
 
-	m_vertex_buffers[m_render_id] = buffer_id;
+	std::vector<glm::vec3> positions(count);
+	for (size_t i = 0; i < count; i++) {
+		positions[i] = data[i].pos;
+		vertex_buffer.bounds_min = glm::min(vertex_buffer.bounds_min, data[i].pos);
+		vertex_buffer.bounds_max = glm::max(vertex_buffer.bounds_max, data[i].pos);
+	}
+
+	vertex_buffer.position_buffer = m_graphics_controller.vertex_buffer_create(positions.data(), count * sizeof(glm::vec3));
+
+	m_vertex_buffers[m_render_id] = vertex_buffer;
 
 	return m_render_id++;
 }
@@ -1405,21 +3042,78 @@ IndexBufferId Renderer::index_buffer_create(const uint32_t* data, size_t count)
 void Renderer::material_destroy(MaterialId material_id) {
 	Material& material = m_materials.at(material_id);
 
+	for (const std::optional<Texture>& texture : { material.albedo, material.ao_rough_met, material.normal, material.emissive }) {
+		if (texture.has_value())
+			texture_slot_release(texture.value());
+	}
+
+	m_bindless.free_material_indices.push_back(material.index);
+
 	if (material.albedo.has_value()) {
 		clear_image(material.albedo->image);
-		clear_sampler(material.albedo->sampler);
+		m_graphics_controller.sampler_destroy(material.albedo->sampler);
 	} if (material.ao_rough_met.has_value()) {
 		clear_image(material.ao_rough_met->image);
-		clear_sampler(material.ao_rough_met->sampler);
+		m_graphics_controller.sampler_destroy(material.ao_rough_met->sampler);
 	} if (material.normal.has_value()) {
 		clear_image(material.normal->image);
-		clear_sampler(material.normal->sampler);
+		m_graphics_controller.sampler_destroy(material.normal->sampler);
 	} if (material.emissive.has_value()) {
 		clear_image(material.emissive->image);
-		clear_sampler(material.emissive->sampler);
+		m_graphics_controller.sampler_destroy(material.emissive->sampler);
+	}
+}
+
+uint32_t Renderer::texture_slot_acquire(const Texture& texture) {
+	auto slot_it = m_bindless.texture_slots.find({ texture.image, texture.sampler });
+	if (slot_it != m_bindless.texture_slots.end()) {
+		slot_it->second.usage_count++;
+		return slot_it->second.index;
+	}
+
+	uint32_t index;
+	if (!m_bindless.free_texture_slots.empty()) {
+		index = m_bindless.free_texture_slots.back();
+		m_bindless.free_texture_slots.pop_back();
+	} else {
+		if (m_bindless.texture_slot_count == VulkanGraphicsController::MAX_BINDLESS_DESCRIPTORS)
+			throw std::runtime_error("Texture limit exceeded");
+
+		index = m_bindless.texture_slot_count++;
+	}
+
+	texture_slot_write(index, texture);
+	m_bindless.texture_slots[{ texture.image, texture.sampler }] = { .index = index, .usage_count = 1 };
+
+	return index;
+}
+
+void Renderer::texture_slot_release(const Texture& texture) {
+	TextureSlot& slot = m_bindless.texture_slots.at({ texture.image, texture.sampler });
+
+	slot.usage_count--;
+	if (slot.usage_count == 0) {
+		m_bindless.released_texture_slots.emplace_back(slot.index, m_frame_number);
+		m_bindless.texture_slots.erase({ texture.image, texture.sampler });
 	}
 }
 
+void Renderer::texture_slot_write(uint32_t slot, const Texture& texture) {
+	RenderId ids[2] = { texture.image, texture.sampler };
+
+	UniformInfo texture_uniform{
+		.type = UniformType::CombinedImageSampler,
+		.subresource_range = { ImageAspectColor },
+		.binding = 1,
+		.ids = ids,
+		.id_count = 2
+	};
+
+	m_graphics_controller.uniform_set_update_array(m_bindless.g_uniform_set_1, texture_uniform, slot);
+	m_graphics_controller.uniform_set_update_array(m_bindless.blend_uniform_set_1, texture_uniform, slot);
+	m_graphics_controller.uniform_set_update_array(m_bindless.shadow_uniform_set_1, texture_uniform, slot);
+}
+
 void Renderer::clear_image(ImageId image_id) {
 	size_t& image_count = m_image_usage_counts.at(image_id);
 
@@ -1431,17 +3125,4 @@ void Renderer::clear_image(ImageId image_id) {
 		m_image_usage_counts.erase(image_id);
 	} else
 		image_count--;
-}
-
-void Renderer::clear_sampler(SamplerId sampler_id) {
-	size_t& sampler_count = m_sampler_usage_counts.at(sampler_id);
-
-	if (sampler_count == 0)
-		return;
-	if (sampler_count == 1) {
-		sampler_count = 0;
-		m_graphics_controller.sampler_destroy(sampler_id);
-		m_sampler_usage_counts.erase(sampler_id);
-	} else
-		sampler_count--;
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "Common.h"
+#include "RenderGraph.h"
+#include "ShaderBundle.h"
 #include "VulkanContext.h"
 #include "VulkanGraphicsController.h"
 
@@ -15,6 +17,8 @@
 #define TINYGLTF_NO_STB_IMAGE_WRITE
 #include <tinygltf/tiny_gltf.h>
 
+#include <array>
+#include <map>
 #include <optional>
 
 using VertexBufferId = RenderId;
@@ -22,6 +26,7 @@ using IndexBufferId = RenderId;
 using MaterialId = RenderId;
 using PrimitiveId = RenderId;
 using SkyboxId = RenderId;
+using TransformId = RenderId;
 
 enum class MagFilter : uint32_t {
 	Nearest,
@@ -69,6 +74,7 @@ struct Camera {
 	float aspect_ratio;
 	float near;
 	float far;
+	glm::vec2 jitter = glm::vec2(0.0f); // Sub-pixel offset of the projection in NDC
 
 	void move_forward(float movement) {
 		eye += front * movement;
@@ -95,7 +101,13 @@ struct Camera {
 		return glm::lookAt(eye, eye + front, up);
 	}
 
+	// Rasterizing passes only, light clusters and shadow cascades are fitted to the unjittered frustum
 	glm::mat4 proj_matrix() const {
+		// Offset in clip space moves the whole image, independent of depth
+		return glm::translate(glm::mat4(1.0f), glm::vec3(jitter, 0.0f)) * unjittered_proj_matrix();
+	}
+
+	glm::mat4 unjittered_proj_matrix() const {
 		glm::mat4 proj = glm::perspective(glm::radians(45.0f), aspect_ratio, near, far);
 		proj[1][1] *= -1;
 
@@ -105,7 +117,8 @@ struct Camera {
 
 enum class LightType : uint8_t {
 	Directional = 1,
-	Spot = 2
+	Spot = 2,
+	Point = 3
 };
 
 struct Light {
@@ -113,6 +126,39 @@ struct Light {
 	glm::vec3 color;
 	glm::vec3 pos;
 	glm::vec3 dir;
+	float range = 10.0f; // Point and spot lights have no effect further than that
+	float inner_cone_angle = 0.0f; // Spot lights, half angles in radians
+	float outer_cone_angle = 0.7853982f;
+};
+
+// Occupancy of light clusters in the last built frame
+struct LightClusterStats {
+	uint32_t light_count = 0;
+	uint32_t cluster_count = 0;
+	uint32_t occupied_cluster_count = 0;
+	uint32_t max_cluster_light_count = 0;
+	uint32_t light_index_count = 0; // Sum of light list lengths of all clusters
+};
+
+// Last frame whose GPU timestamps were read, times are in milliseconds. G buffer layouts are compared by the
+// G pass and lightning times at the same resolution, the byte counts are estimates before compression
+struct RendererStats {
+	uint32_t g_pass_bytes_per_pixel = 0; // Written, with depth and emissive, without velocity
+	uint32_t lightning_bytes_per_pixel = 0; // Read and written, with the composition target
+	float gpu_time = 0.0f; // Frame scope, dynamic resolution compares it with target_gpu_time
+	float g_pass_time = 0.0f;
+	float lightning_time = 0.0f;
+	float geometry_time = 0.0f; // Depth prepass when it's on and G pass
+	float g_pass_fragments_per_pixel = 0.0f; // Overdraw, 0 without pipeline statistics queries
+	ScreenResolution render_area{}; // Chosen by dynamic resolution for the frame being recorded
+	float resolution_scale = 1.0f;
+	float time_to_first_frame = 0.0f; // From the start of create until the first frame is submitted, pipeline compilation is most of it
+	uint32_t pipelines_created = 0; // Since create
+	uint32_t pipeline_requests_reused = 0; // Since create, create requests and variants given an existing pipeline
+	uint32_t sampler_count = 0; // Unique samplers alive now
+	uint32_t sampler_requests_reused = 0; // Since create
+	uint32_t barriers = 0; // Of the last recorded frame
+	uint32_t barrier_batches = 0;
 };
 
 struct MaterialInfo {
@@ -152,6 +198,26 @@ struct Vertex {
 	glm::vec2 uv1;
 };
 
+enum class GBufferLayout : uint32_t {
+	Wide, // Albedo, ao-rough-met, normals and emissive in separate targets
+	Packed // Albedo-metallic and octahedral normal-rough, emissive is written into composition target by G pass
+};
+
+struct RendererSettings {
+	GBufferLayout g_buffer_layout = GBufferLayout::Packed;
+	uint32_t shadow_cascade_count = 4; // 1 to 4
+	float shadow_distance = 50.0f; // View depth covered by shadow cascades
+	bool depth_prepass = true; // Opaque primitives lay down depth first, G pass shades them at equal depth only
+	bool split_masked_pipeline = true; // Only alpha masked primitives use G pass shader with discard
+	bool dynamic_resolution = false; // Renders into part of set_resolution sized targets, the part follows GPU time
+	float target_gpu_time = 16.0f; // Milliseconds
+	float min_resolution_scale = 0.5f;
+	bool temporal_upscaling = false; // Jittered frames at render resolution are accumulated at output resolution
+	std::string pipeline_cache_path = "pipeline_cache.bin"; // Empty compiles every pipeline from SPIR-V on each launch
+	std::string shader_bundle_path = "../assets/shaders/shaders.bundle"; // Baked from .spv files beside it by compile.bat
+	bool prefilter_environment = false; // Skyboxes get GGX prefiltered specular levels and the BRDF LUT is generated, lighting doesn't sample them yet
+};
+
 enum class SkyboxType : uint32_t {
 	Cubemap,
 	Equirectangular
@@ -159,22 +225,33 @@ enum class SkyboxType : uint32_t {
 
 class Renderer {
 public:
-	void create(VulkanContext* context);
+	void create(VulkanContext* context, const RendererSettings& settings = {});
 	void destroy();
 
 	void set_resolution(uint32_t width, uint32_t height);
 	void set_shadow_map_resolution(uint32_t width, uint32_t height);
+	// Resolution temporal upscaling outputs, defaults to screen resolution
+	void set_output_resolution(uint32_t width, uint32_t height);
 	void set_post_effect_constants(float exposure, float gamma);
 
 	void begin_frame(const Camera& camera, Light dir_light, Light* lights, uint32_t light_count);
 	void end_frame(uint32_t width, uint32_t height);
 
 	void draw_primitive(const glm::mat4& model, size_t vertex_buffer, size_t index_buffer, size_t first_index, size_t index_count, size_t vertex_count, MaterialId material);
+	void draw_primitive(TransformId transform_id, size_t vertex_buffer, size_t index_buffer, size_t first_index, size_t index_count, size_t vertex_count, MaterialId material);
 	void draw_skybox(SkyboxId skybox_id);
 
+	const LightClusterStats& light_cluster_stats() const;
+	const RendererStats& stats() const;
+
 	void materials_create(ImageSpecs* images, uint32_t image_count, SamplerSpecs* samplers, uint32_t sampler_count, TextureSpecs* textures, uint32_t texture_count, MaterialSpecs* materials, uint32_t material_count, MaterialId* material_ids);
 	void materials_destroy(MaterialId* material_ids, size_t count);
 	
+	// Persistent transforms are uploaded only when they change, prefer them over per-frame matrices for static objects
+	TransformId transform_create(const glm::mat4& model);
+	void transform_update(TransformId transform_id, const glm::mat4& model);
+	void transform_destroy(TransformId transform_id);
+
 	SkyboxId skybox_create(uint32_t cubemap_resolution, const ImageSpecs& texture, SkyboxType type);
 	void skybox_destroy(SkyboxId skybox_id);
 	
@@ -182,9 +259,54 @@ public:
 	IndexBufferId index_buffer_create(const uint32_t* data, size_t count);
 
 private:
+	struct Primitive;
+	struct DrawBatch;
+	struct IndirectDraw;
+	struct Texture;
+	using MaterialPermutation = uint32_t; // MaterialPermutationBits
+
+	void record_static_shadow_pass();
+	void record_shadow_pass();
+	void draw_shadow_cascade(uint32_t cascade, const std::vector<DrawBatch>& batches, const std::vector<DrawBatch>& masked_batches);
+	void draw_shadow_casters(const std::vector<DrawBatch>& batches, bool full_vertices = false);
+	void record_depth_prepass();
+	void record_g_pass();
+	void record_composition_pass();
+	void record_temporal_resolve_pass();
+	void record_present_pass();
+
+	// G pass batches are split by material permutation, other passes don't specialize
+	void build_draw_batches(std::vector<Primitive>& primitives, std::vector<DrawBatch>& batches, bool split_permutations);
+	void build_indirect_draws(const std::vector<DrawBatch>& batches, std::vector<IndirectDraw>& draws);
+	// Specialized variant of a G pipeline, the pipeline itself until the variant is compiled
+	PipelineId g_pipeline_permutation(PipelineId pipeline, MaterialPermutation permutation);
+	void build_shadow_cascades();
+	void dynamic_resolution_update(float gpu_time);
+	void temporal_uniform_sets_write(bool update);
+	// Creates the set or rewrites bindings of the existing one
+	void uniform_set_write(UniformSetId& uniform_set, ShaderId shader, uint32_t set_idx, const UniformInfo* uniforms, uint32_t count, bool update);
+	void cubemap_generate_mips(ImageId image_id, uint32_t resolution, uint32_t mip_levels);
+	ImageId cubemap_prefilter(ImageId image_id, uint32_t resolution);
+	void brdf_lut_create();
+	bool instance_buffer_reserve(size_t instance_count);
+	bool transform_buffer_reserve(size_t transform_count);
+	void indirect_buffer_reserve(size_t command_count);
+	void object_uniform_sets_create();
+
+	void light_clusters_build();
+	bool light_buffers_reserve(size_t light_count, size_t light_index_count);
+	void light_uniform_sets_create();
+
+	uint32_t transform_slot_acquire();
+	void transform_slot_write(uint32_t slot, const glm::mat4& model);
+	void transforms_upload();
+
+	uint32_t texture_slot_acquire(const Texture& texture);
+	void texture_slot_release(const Texture& texture);
+	void texture_slot_write(uint32_t slot, const Texture& texture);
+
 	void material_destroy(MaterialId material_id);
 	void clear_image(ImageId image_id);
-	void clear_sampler(SamplerId sampler_id);
 
 private:
 	// Defalut shapes
@@ -212,42 +334,209 @@ private:
 		
 		struct GPU {
 			BufferId view_pos; // vec3
-			BufferId projview_matrix; // mat4
+			BufferId projview_matrix; // WorldMatrices
 			BufferId projview_matrix_no_translation; // mat4
 		} gpu;
 	} m_scene_info;
 
-	struct Deferred {
-		ImageInfo albedo_info;
-		ImageInfo ao_rough_met_info;
-		ImageInfo normals_info;
-		ImageInfo emissive_info;
-		ImageInfo depth_stencil_info;
-		ImageInfo composition_info;
-
-		ImageId albedo;
-		ImageId ao_rough_met;
-		ImageId normals;
-		ImageId emissive;
-		ImageId depth_stencil;
-		ImageId composition;
-
-		RenderPassId g_pass;
-		FramebufferId g_framebuffer;
-		RenderPassId depth_copy_pass;
-		FramebufferId depth_copy_framebuffer;
-		RenderPassId composition_pass;
-		FramebufferId composition_framebuffer;
-		RenderPassId present_pass;
-		FramebufferId present_framebuffer;
-	} m_deferred;
+	// Layout of WorldMatrix in g_pass.vert, unjittered matrices give motion vectors
+	struct WorldMatrices {
+		glm::mat4 proj_view;
+		glm::mat4 unjittered_proj_view;
+		glm::mat4 prev_unjittered_proj_view;
+	};
 
+	// Stencil value of pixels covered by opaque geometry, lightning is applied only to them
+	static constexpr uint32_t STENCIL_REFERENCE = 0x28;
+
+	RenderGraph m_render_graph;
+
+	// Shader features a primitive needs in the G pass, every permutation gets a specialized pipeline
+	enum MaterialPermutationBits : uint32_t {
+		PermutationAlbedoMap = 1,
+		PermutationAlbedoUv1 = 2,
+		PermutationAoRoughMetMap = 4,
+		PermutationAoRoughMetUv1 = 8,
+		PermutationNormalMap = 16,
+		PermutationNormalUv1 = 32,
+		PermutationEmissiveMap = 64,
+		PermutationEmissiveUv1 = 128,
+		PermutationAlphaTest = 256,
+		PermutationTangents = 512
+	};
+
+	// Opaque pipeline has no discard, so early depth test isn't disabled for it
 	struct GPipeline {
 		ShaderId shader;
 		PipelineId pipeline;
+		ShaderId masked_shader;
+		PipelineId masked_pipeline;
 		UniformSetId uniform_set_0;
 	} m_g_pipeline;
 
+	// Position-only depth of opaque primitives before the G pass
+	struct DepthPrepassPipeline {
+		ShaderId shader;
+		PipelineId pipeline;
+		UniformSetId uniform_set_0;
+	} m_depth_prepass_pipeline;
+
+	// Scale of render area on both axes, render targets stay at render resolution
+	struct DynamicResolution {
+		static constexpr float TOLERANCE = 0.05f; // Relative distance from target GPU time which is left alone
+		static constexpr float SMOOTHING = 0.25f; // Timestamps are frames in flight old, so scale moves only part of the way
+		float scale = 1.0f;
+	} m_dynamic_resolution;
+
+	// Jittered frames accumulate into two output resolution history images, each frame reads one and writes the other
+	struct TemporalUpscaling {
+		static constexpr uint32_t JITTER_PHASE_COUNT = 8;
+		static constexpr float CURRENT_FRAME_WEIGHT = 0.1f;
+
+		ShaderId shader;
+		PipelineId pipeline;
+		SamplerId sampler;
+		std::array<UniformSetId, 2> uniform_sets_0; // Writing history_0 and history_1
+		std::array<UniformSetId, 2> present_uniform_sets_0; // Presenting history_0 and history_1
+		ScreenResolution output_resolution;
+		glm::mat4 unjittered_proj_view = glm::mat4(1.0f);
+		glm::mat4 prev_unjittered_proj_view = glm::mat4(1.0f);
+		bool history_valid = false;
+	} m_temporal;
+
+	// Layout of Info in temporal_resolve.frag
+	struct TemporalResolveConstants {
+		glm::mat4 reprojection;
+		glm::vec2 render_scale;
+		glm::vec2 jitter;
+		float current_weight;
+	};
+
+	// Fragment shader invocations per pixel of the G pass, shows overdraw of each G pass variant
+	static constexpr uint32_t G_PASS_STATISTICS_QUERY = 0;
+
+	// Per-instance data, indexed by gl_InstanceIndex in g_pass.vert and blend.vert
+	struct InstanceData {
+		uint32_t transform_index;
+		uint32_t material_index;
+	};
+
+	struct InstanceBuffer {
+		static constexpr size_t INITIAL_CAPACITY = 1024;
+
+		BufferId buffer;
+		size_t capacity = 0;
+	} m_instances;
+
+	// Layout of Transform in g_pass.vert and blend.vert, normal matrix columns are padded to vec4 as mat3 in std430
+	struct alignas(16) TransformData {
+		glm::mat4 model;
+		glm::mat4 prev_model;
+		glm::mat3x4 normal;
+	};
+
+	// Object transforms, persistent between frames and uploaded only where they changed
+	struct Transforms {
+		static constexpr size_t INITIAL_CAPACITY = 1024;
+
+		BufferId buffer;
+		size_t capacity = 0;
+
+		std::vector<TransformData> data; // CPU copy of transform buffer
+		std::vector<uint64_t> update_frames; // Frame each slot was last moved in
+		std::vector<uint32_t> free_slots;
+		std::vector<std::pair<uint32_t, uint64_t>> released_slots; // Slot and frame it was released in
+		std::vector<uint32_t> dirty_slots;
+		std::vector<uint32_t> moved_slots; // Moved during this frame
+		std::vector<uint32_t> prev_moved_slots; // Moved during previous frame, their previous model has to catch up
+		std::unordered_map<TransformId, uint32_t> slots;
+	} m_transforms;
+
+	// Indirect commands of the G pass, rewritten every frame
+	struct IndirectBuffer {
+		static constexpr size_t INITIAL_CAPACITY = 1024;
+
+		BufferId buffer;
+		size_t capacity = 0;
+	} m_indirect;
+
+	// Layout of Material in g_pass.frag and blend.frag
+	struct alignas(16) MaterialData {
+		MaterialInfo info;
+		uint32_t texture_indices[4]; // albedo, ao-rough-met, normal, emissive
+	};
+
+	struct TextureSlot {
+		uint32_t index;
+		size_t usage_count;
+	};
+
+	// Materials and textures of G and blend pipelines, indexed by material index in shaders
+	struct Bindless {
+		static constexpr uint32_t MAX_MATERIALS = 4096;
+		static constexpr uint32_t EMPTY_TEXTURE_SLOT = 0;
+
+		BufferId material_buffer;
+		UniformSetId g_uniform_set_1;
+		UniformSetId blend_uniform_set_1;
+		UniformSetId shadow_uniform_set_1;
+
+		std::vector<MaterialData> material_data; // CPU copy of material buffer
+		std::vector<uint32_t> free_material_indices;
+		uint32_t material_count = 0;
+
+		std::map<std::pair<ImageId, SamplerId>, TextureSlot> texture_slots;
+		std::vector<uint32_t> free_texture_slots;
+		std::vector<std::pair<uint32_t, uint64_t>> released_texture_slots; // Slot and frame it was released in
+		uint32_t texture_slot_count = 0;
+	} m_bindless;
+
+	// Layout of Light in lightning.frag and blend.frag
+	struct alignas(16) LightData {
+		glm::vec3 pos;
+		float range;
+		glm::vec3 color;
+		uint32_t type;
+		glm::vec3 dir;
+		float cos_outer_cone;
+		float cos_inner_cone;
+	};
+
+	// Layout of ClusterInfo in lightning.frag and blend.frag
+	struct ClusterInfo {
+		glm::mat4 view;
+		glm::uvec4 grid_size; // w is unused
+		glm::vec4 depth_params; // Near, far, slice scale and slice bias, slice = log(depth) * scale + bias
+		glm::vec4 target_size; // Render resolution and its reciprocal
+		std::array<glm::vec4, 9> irradiance_sh; // Ambient of the drawn skybox, see Skybox::irradiance_sh
+	};
+
+	// Point and spot lights binned into view space froxels with exponential depth slices, rebuilt every frame.
+	// Shaders find their cluster from screen uv and view depth and loop over its light list only
+	struct LightClusters {
+		static constexpr uint32_t GRID_X = 16;
+		static constexpr uint32_t GRID_Y = 9;
+		static constexpr uint32_t GRID_Z = 24;
+		static constexpr uint32_t CLUSTER_COUNT = GRID_X * GRID_Y * GRID_Z;
+		static constexpr size_t INITIAL_LIGHT_CAPACITY = 256;
+		static constexpr size_t INITIAL_LIGHT_INDEX_CAPACITY = 4096;
+
+		BufferId info_buffer;
+		BufferId light_buffer;
+		BufferId cluster_buffer; // Offset and count of light list of every cluster
+		BufferId light_index_buffer;
+		size_t light_capacity = 0;
+		size_t light_index_capacity = 0;
+		UniformSetId light_uniform_set_1;
+		UniformSetId blend_uniform_set_2;
+
+		std::vector<LightData> lights;
+		std::vector<glm::uvec2> clusters;
+		std::vector<uint32_t> light_indices;
+		std::vector<std::vector<uint32_t>> cluster_lights; // Per cluster scratch, depth slices are filled in parallel
+		LightClusterStats stats;
+	} m_light_clusters;
+
 	struct LightningPipeline {
 		ShaderId shader;
 		PipelineId pipeline;
@@ -269,11 +558,23 @@ private:
 		UniformSetId uniform_set_0;
 	} m_skybox_pipeline;
 
+	// Compute pipelines which build skybox cubemaps, recorded into the frame like any other pass
 	struct GenerateCubemapPipeline {
-		RenderPassId render_pass;
-		ShaderId shader;
-		PipelineId pipeline;
+		static constexpr uint32_t GROUP_SIZE = 8; // Local size of every cubemap shader
+		static constexpr uint32_t PREFILTERED_RESOLUTION = 256;
+		static constexpr uint32_t PREFILTERED_MIP_LEVELS = 6; // Roughness from 0 to 1
+		static constexpr uint32_t BRDF_LUT_RESOLUTION = 512;
+
+		ShaderId equirect_shader;
+		PipelineId equirect_pipeline;
+		ShaderId downsample_shader;
+		PipelineId downsample_pipeline;
+		ShaderId prefilter_shader;
+		PipelineId prefilter_pipeline;
+		ShaderId brdf_lut_shader;
+		PipelineId brdf_lut_pipeline;
 		SamplerId sampler;
+		std::optional<ImageId> brdf_lut; // Doesn't depend on the environment, generated with the first prefiltered skybox
 	} m_gen_cubemap_pipeline;
 
 	struct CoordSystemPipeline {
@@ -296,6 +597,10 @@ private:
 	struct Skybox {
 		ImageId image;
 		UniformSetId uniform_set_1;
+		std::optional<ImageId> prefiltered_image;
+		// L2 spherical harmonics of irradiance divided by PI with basis constants folded in,
+		// so shaders get Lambertian ambient as albedo times a second order polynomial of the normal
+		std::array<glm::vec4, 9> irradiance_sh;
 	};
 
 	struct Texture {
@@ -310,19 +615,103 @@ private:
 		std::optional<Texture> ao_rough_met;
 		std::optional<Texture> normal;
 		std::optional<Texture> emissive;
-		UniformSetId uniform_set;
+		uint32_t index; // Index in material buffer
+		MaterialPermutation permutation; // Without vertex data bits
+	};
+
+	// Positions are also kept in a separate buffer for depth-only passes, bounds are in model space
+	struct VertexBuffer {
+		BufferId buffer;
+		BufferId position_buffer;
+		glm::vec3 bounds_min;
+		glm::vec3 bounds_max;
+		bool has_tangents; // Missing tangents are NaN
 	};
 
 	struct Primitive {
-		glm::mat4 model;
+		uint32_t transform_index;
 		size_t vertex_buffer;
 		size_t index_buffer;
 		size_t first_index;
 		size_t index_count;
 		size_t vertex_count;
 		MaterialId material;
+		bool is_dynamic; // Moved recently or drawn with a per-frame matrix
 	};
 
+	// Primitives sharing geometry and permutation, drawn with one instanced draw call
+	struct DrawBatch {
+		MaterialPermutation permutation;
+		size_t vertex_buffer;
+		size_t index_buffer;
+		size_t first_index;
+		size_t index_count;
+		uint32_t first_instance;
+		uint32_t instance_count;
+	};
+
+	// Draw batches sharing geometry buffers and permutation, submitted with one indirect draw call
+	struct IndirectDraw {
+		MaterialPermutation permutation;
+		size_t vertex_buffer;
+		size_t index_buffer;
+		uint32_t first_command;
+		uint32_t command_count;
+	};
+
+	// Layout of CascadeInfo in lightning.frag
+	struct CascadeInfo {
+		glm::mat4 view_proj[4];
+		glm::vec4 split_depths; // View depth every cascade ends at
+		glm::vec2 texel_size; // Of the whole atlas
+		uint32_t cascade_count;
+	};
+
+	struct ShadowCascade {
+		glm::mat4 light_view;
+		float near_z; // Light space z of near plane
+		size_t static_hash; // Of static casters in the cached map
+		bool cache_valid = false;
+		bool cache_redraw = false; // Static casters are rendered into the cached map this frame
+		std::vector<Primitive> static_casters;
+		std::vector<Primitive> dynamic_casters;
+		std::vector<Primitive> static_masked_casters;
+		std::vector<Primitive> dynamic_masked_casters;
+		std::vector<DrawBatch> static_batches;
+		std::vector<DrawBatch> dynamic_batches;
+		std::vector<DrawBatch> static_masked_batches; // Alpha tested with the masked pipeline
+		std::vector<DrawBatch> dynamic_masked_batches;
+	};
+
+	// Directional light shadows, cascades are fitted to slices of view frustum and rendered into quadrants of one depth atlas.
+	// Static casters are cached in a second atlas, which is copied into the first one every frame before dynamic casters are drawn
+	struct Shadows {
+		static constexpr uint32_t MAX_CASCADES = 4;
+		static constexpr uint32_t ATLAS_TILES = 2; // Per side
+		static constexpr float SPLIT_LAMBDA = 0.75f; // Blend of logarithmic and uniform splits
+		static constexpr float CACHE_SNAP = 0.25f; // Step cascade centers move in, relative to cascade radius
+		static constexpr uint64_t STATIC_FRAME_COUNT = 60; // Frames a moved transform stays dynamic
+
+		ShaderId shader;
+		PipelineId pipeline;
+		UniformSetId uniform_set_0; // Instances and transforms
+		ShaderId masked_shader;
+		PipelineId masked_pipeline;
+		UniformSetId masked_uniform_set_0;
+		SamplerId sampler;
+		BufferId info_buffer;
+		UniformSetId light_uniform_set_2;
+		uint32_t cascade_resolution = 1024;
+
+		ShaderId copy_shader;
+		PipelineId copy_pipeline;
+		SamplerId copy_sampler;
+		UniformSetId copy_uniform_set_0;
+
+		CascadeInfo info;
+		std::array<ShadowCascade, MAX_CASCADES> cascades;
+	} m_shadows;
+
 	struct Defaults {
 		Texture empty_texture;
 	} m_defaults;
@@ -330,30 +719,50 @@ private:
 	// Draw list
 	struct DrawList {
 		Light dir_light;
-		std::vector<Light> point_lights;
+		std::vector<Light> lights;
 		std::vector<Primitive> opaque_primitives;
+		std::vector<Primitive> masked_primitives;
 		std::vector<Primitive> blend_primitives;
+		std::vector<DrawBatch> opaque_batches;
+		std::vector<DrawBatch> masked_batches;
+		std::vector<DrawBatch> blend_batches;
+		std::vector<IndirectDraw> opaque_indirect_draws;
+		std::vector<IndirectDraw> masked_indirect_draws;
+		std::vector<DrawIndexedIndirectCommand> indirect_commands;
+		std::vector<InstanceData> instances;
 		std::optional<SkyboxId> skybox;
+		uint32_t screen_width = 0;
+		uint32_t screen_height = 0;
 
 		void clear() {
 			opaque_primitives.clear();
+			masked_primitives.clear();
 			blend_primitives.clear();
-			point_lights.clear();
+			opaque_batches.clear();
+			masked_batches.clear();
+			blend_batches.clear();
+			opaque_indirect_draws.clear();
+			masked_indirect_draws.clear();
+			indirect_commands.clear();
+			instances.clear();
+			lights.clear();
 			skybox.reset();
 		}
 	};
 
 private:
 	VulkanGraphicsController m_graphics_controller;
+	RendererSettings m_settings;
 
 	RenderId m_render_id = 0;
 	std::unordered_map<ImageId, size_t> m_image_usage_counts;
-	std::unordered_map<SamplerId, size_t> m_sampler_usage_counts;
 	std::unordered_map<MaterialId, Material> m_materials;
-	std::unordered_map<VertexBufferId, BufferId> m_vertex_buffers;
+	std::unordered_map<VertexBufferId, VertexBuffer> m_vertex_buffers;
 	std::unordered_map<IndexBufferId, BufferId> m_index_buffers;
 	std::unordered_map<SkyboxId, Skybox> m_skyboxes;
 
 	DrawList m_draw_list;
-	std::vector<Light> m_lights;
+	uint64_t m_frame_number = 0;
+	RendererStats m_stats;
+	long long m_create_time = 0; // Microseconds of CPUProfiler::now()
 };
\ No newline at end of file
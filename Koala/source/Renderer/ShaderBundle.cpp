@@ -0,0 +1,222 @@
+#include "ShaderBundle.h"
+#include <Profile.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+// Walks the 4 byte aligned fields of a bundle, throws instead of reading past its end
+struct BundleReader {
+	const std::vector<uint32_t>& data;
+	size_t offset = 0;
+
+	uint32_t read_u32() {
+		if (offset >= data.size())
+			throw std::runtime_error("Shader bundle is truncated");
+
+		return data[offset++];
+	}
+
+	std::string read_string() {
+		uint32_t size = read_u32();
+		size_t word_count = (size + 3) / 4;
+		if (offset + word_count > data.size())
+			throw std::runtime_error("Shader bundle is truncated");
+
+		std::string string((const char*)(data.data() + offset), size);
+		offset += word_count;
+
+		return string;
+	}
+
+	// Returns offset of the first word, the bytes stay in the bundle
+	size_t skip_bytes(size_t size) {
+		size_t word_count = (size + 3) / 4;
+		if (offset + word_count > data.size())
+			throw std::runtime_error("Shader bundle is truncated");
+
+		size_t start = offset;
+		offset += word_count;
+
+		return start;
+	}
+};
+
+struct BundleWriter {
+	std::vector<uint32_t> data;
+
+	void write_u32(uint32_t value) {
+		data.push_back(value);
+	}
+
+	void write_bytes(const void* bytes, size_t size) {
+		size_t start = data.size();
+		data.resize(start + (size + 3) / 4, 0);
+		memcpy(data.data() + start, bytes, size);
+	}
+
+	void write_string(const std::string& string) {
+		write_u32((uint32_t)string.size());
+		write_bytes(string.data(), string.size());
+	}
+};
+
+void ShaderBundle::load(const std::filesystem::path& path) {
+	MY_PROFILE_FUNCTION();
+
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+		throw std::runtime_error("Shader bundle doesn't exist");
+
+	size_t file_size = (size_t)file.tellg();
+	if (file_size % 4 != 0)
+		throw std::runtime_error("Shader bundle is corrupted");
+	file.seekg(0);
+
+	m_data.resize(file_size / 4);
+	if (!file.read((char*)m_data.data(), file_size))
+		throw std::runtime_error("Failed to read shader bundle");
+
+	m_entries.clear();
+
+	BundleReader reader{ .data = m_data };
+	if (reader.read_u32() != MAGIC)
+		throw std::runtime_error("File isn't a shader bundle");
+	if (reader.read_u32() != VERSION)
+		throw std::runtime_error("Shader bundle was written by a different version");
+
+	uint32_t shader_count = reader.read_u32();
+	for (uint32_t i = 0; i < shader_count; i++) {
+		std::string name = reader.read_string();
+
+		Entry entry;
+		entry.reflection.stage = reader.read_u32();
+		entry.reflection.entry = reader.read_string();
+
+		entry.reflection.vertex_inputs.resize(reader.read_u32());
+		for (ShaderVertexInputReflection& input : entry.reflection.vertex_inputs) {
+			input.location = reader.read_u32();
+			input.format = reader.read_u32();
+		}
+
+		entry.reflection.bindings.resize(reader.read_u32());
+		for (ShaderBindingReflection& binding : entry.reflection.bindings) {
+			binding.set = reader.read_u32();
+			binding.binding = reader.read_u32();
+			binding.descriptor_type = reader.read_u32();
+			binding.count = reader.read_u32();
+		}
+
+		entry.reflection.push_constant_offset = reader.read_u32();
+		entry.reflection.push_constant_size = reader.read_u32();
+
+		entry.spv_size = reader.read_u32();
+		entry.spv_offset = reader.skip_bytes(entry.spv_size);
+
+		m_entries[name] = std::move(entry);
+	}
+}
+
+ShaderStage ShaderBundle::stage(const std::string& name) const {
+	auto it = m_entries.find(name);
+	if (it == m_entries.end())
+		throw std::runtime_error("Shader " + name + " isn't in the shader bundle");
+
+	const Entry& entry = it->second;
+
+	return {
+		.stage = entry.reflection.stage,
+		.spv = m_data.data() + entry.spv_offset,
+		.spv_size = entry.spv_size,
+		.reflection = &entry.reflection
+	};
+}
+
+static std::vector<std::filesystem::path> spv_files(const std::filesystem::path& shader_dir) {
+	std::vector<std::filesystem::path> paths;
+	for (const auto& dir_entry : std::filesystem::directory_iterator(shader_dir)) {
+		if (dir_entry.is_regular_file() && dir_entry.path().extension() == ".spv")
+			paths.push_back(dir_entry.path());
+	}
+
+	// Same shaders always give the same bundle
+	std::sort(paths.begin(), paths.end());
+
+	return paths;
+}
+
+bool ShaderBundle::out_of_date(const std::filesystem::path& shader_dir, const std::filesystem::path& path) {
+	if (!std::filesystem::exists(path))
+		return true;
+
+	auto bundle_time = std::filesystem::last_write_time(path);
+	for (const std::filesystem::path& spv_path : spv_files(shader_dir)) {
+		if (std::filesystem::last_write_time(spv_path) > bundle_time)
+			return true;
+	}
+
+	return false;
+}
+
+#if defined(SHADER_REFLECTION_ENABLE)
+void ShaderBundle::build(const std::filesystem::path& shader_dir, const std::filesystem::path& path) {
+	MY_PROFILE_FUNCTION();
+
+	std::vector<std::filesystem::path> paths = spv_files(shader_dir);
+
+	BundleWriter writer;
+	writer.write_u32(MAGIC);
+	writer.write_u32(VERSION);
+	writer.write_u32((uint32_t)paths.size());
+
+	for (const std::filesystem::path& spv_path : paths) {
+		size_t code_size = std::filesystem::file_size(spv_path);
+
+		std::vector<uint32_t> spv((code_size + 3) / 4, 0);
+		std::ifstream spv_file(spv_path, std::ios::binary);
+		if (!spv_file.read((char*)spv.data(), code_size))
+			throw std::runtime_error("Failed to read shader " + spv_path.string());
+
+		ShaderStageReflection reflection = VulkanGraphicsController::shader_stage_reflect(spv.data(), code_size);
+
+		writer.write_string(spv_path.filename().string());
+		writer.write_u32(reflection.stage);
+		writer.write_string(reflection.entry);
+
+		writer.write_u32((uint32_t)reflection.vertex_inputs.size());
+		for (const ShaderVertexInputReflection& input : reflection.vertex_inputs) {
+			writer.write_u32(input.location);
+			writer.write_u32(input.format);
+		}
+
+		writer.write_u32((uint32_t)reflection.bindings.size());
+		for (const ShaderBindingReflection& binding : reflection.bindings) {
+			writer.write_u32(binding.set);
+			writer.write_u32(binding.binding);
+			writer.write_u32(binding.descriptor_type);
+			writer.write_u32(binding.count);
+		}
+
+		writer.write_u32(reflection.push_constant_offset);
+		writer.write_u32(reflection.push_constant_size);
+
+		writer.write_u32((uint32_t)code_size);
+		writer.write_bytes(spv.data(), code_size);
+	}
+
+	// Written beside and renamed over, so an interrupted build never leaves a half written bundle
+	std::filesystem::path temp_path = path;
+	temp_path += ".tmp";
+
+	{
+		std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+		file.write((const char*)writer.data.data(), writer.data.size() * sizeof(uint32_t));
+
+		if (!file)
+			throw std::runtime_error("Failed to write shader bundle");
+	}
+
+	std::filesystem::rename(temp_path, path);
+}
+#endif
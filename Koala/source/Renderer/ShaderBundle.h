@@ -0,0 +1,40 @@
+#pragma once
+
+#include "VulkanGraphicsController.h"
+
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// SPIR-V of every shader with its reflection baked, read with one call at startup, so shader_create doesn't reflect.
+// File is a header followed by one entry per .spv file: name, stage reflection and code, every field 4 byte aligned
+class ShaderBundle {
+public:
+	void load(const std::filesystem::path& path);
+
+	// Code and reflection point into the bundle, it has to outlive shader_create
+	ShaderStage stage(const std::string& name) const;
+
+	// Bundle is missing or some .spv in the directory was compiled after it
+	static bool out_of_date(const std::filesystem::path& shader_dir, const std::filesystem::path& path);
+
+#if defined(SHADER_REFLECTION_ENABLE)
+	// Reflects every .spv in the directory and writes them into the bundle
+	static void build(const std::filesystem::path& shader_dir, const std::filesystem::path& path);
+#endif
+
+private:
+	static constexpr uint32_t MAGIC = 0x4C444E42; // "BNDL"
+	static constexpr uint32_t VERSION = 1;
+
+	struct Entry {
+		size_t spv_offset; // In words
+		size_t spv_size; // In bytes
+		ShaderStageReflection reflection;
+	};
+
+private:
+	std::vector<uint32_t> m_data;
+	std::unordered_map<std::string, Entry> m_entries;
+};
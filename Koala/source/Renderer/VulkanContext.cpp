@@ -1,6 +1,13 @@
 #include "VulkanContext.h"
 #include <Profile.h>
 
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#include <algorithm>
 #include <array>
 // TODO: Delete this line
 #include <iostream>
@@ -114,6 +121,15 @@ void VulkanContext::swap_buffers(VkCommandBuffer setup_buffer, VkCommandBuffer d
 	prepare_rendering();
 }
 
+double VulkanContext::host_timestamp_to_us(uint64_t timestamp) const {
+#ifdef _WIN32
+	return (double)timestamp * 1'000'000 / (double)m_host_ticks_per_second;
+#else
+	// Nanoseconds
+	return (double)timestamp / 1'000;
+#endif
+}
+
 void VulkanContext::init_extensions() {
 	uint32_t extension_count = 0;
 	vkEnumerateInstanceExtensionProperties(nullptr, &extension_count, nullptr);
@@ -148,7 +164,7 @@ void VulkanContext::create_instance() {
 		.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
 		.pEngineName = "Koala",
 		.engineVersion = VK_MAKE_VERSION(1, 0, 0),
-		.apiVersion = VK_API_VERSION_1_1
+		.apiVersion = VK_API_VERSION_1_2
 	};
 
 	std::array<const char*, 1> validation_layers = {
@@ -280,6 +296,10 @@ void VulkanContext::pick_physical_device() {
 		VkPhysicalDeviceProperties properties;
 		vkGetPhysicalDeviceProperties(device, &properties);
 
+		// Descriptor indexing is a part of Vulkan 1.2
+		if (properties.apiVersion < VK_API_VERSION_1_2)
+			return 0;
+
 		uint32_t priority = 0;
 		if (properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
 			priority += 1000;
@@ -310,6 +330,74 @@ void VulkanContext::pick_physical_device() {
 	vkGetPhysicalDeviceMemoryProperties(m_physical_device, &m_gpu_info->memory_properties);
 	vkGetPhysicalDeviceFeatures(m_physical_device, &m_gpu_info->features);
 
+	m_gpu_info->features_12 = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES
+	};
+
+	VkPhysicalDeviceFeatures2 features_2{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+		.pNext = &m_gpu_info->features_12
+	};
+
+	vkGetPhysicalDeviceFeatures2(m_physical_device, &features_2);
+	m_gpu_info->features_12.pNext = nullptr;
+
+	// Optional extensions, the renderer falls back to Vulkan 1.2 paths without them:
+	// render pass and framebuffer objects instead of dynamic rendering, vkCmdPipelineBarrier instead of synchronization2,
+	// GPU timestamps aligned with frame submission instead of calibrated against the CPU clock
+	uint32_t extensions_count = 0;
+	vkEnumerateDeviceExtensionProperties(m_physical_device, "", &extensions_count, nullptr);
+	std::vector<VkExtensionProperties> available_extensions(extensions_count);
+	vkEnumerateDeviceExtensionProperties(m_physical_device, "", &extensions_count, available_extensions.data());
+
+	auto has_extension = [&](const char* extension_name) {
+		return std::any_of(available_extensions.begin(), available_extensions.end(), [&](const VkExtensionProperties& available_extension) {
+			return !strcmp(extension_name, available_extension.extensionName);
+		});
+	};
+
+	m_gpu_info->dynamic_rendering_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR
+	};
+	m_gpu_info->synchronization2_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR
+	};
+
+	VkPhysicalDeviceFeatures2 optional_features_2{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2
+	};
+
+	if (has_extension(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)) {
+		m_gpu_info->dynamic_rendering_features.pNext = optional_features_2.pNext;
+		optional_features_2.pNext = &m_gpu_info->dynamic_rendering_features;
+	}
+	if (has_extension(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME)) {
+		m_gpu_info->synchronization2_features.pNext = optional_features_2.pNext;
+		optional_features_2.pNext = &m_gpu_info->synchronization2_features;
+	}
+
+	if (optional_features_2.pNext)
+		vkGetPhysicalDeviceFeatures2(m_physical_device, &optional_features_2);
+	m_gpu_info->dynamic_rendering_features.pNext = nullptr;
+	m_gpu_info->synchronization2_features.pNext = nullptr;
+
+	// GPU timestamps are calibrated against the clock of CPU trace events
+	m_gpu_info->calibrateable_time_domains = false;
+	if (has_extension(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME)) {
+		auto get_time_domains = (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)vkGetInstanceProcAddr(m_instance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+
+		uint32_t time_domain_count = 0;
+		if (get_time_domains && get_time_domains(m_physical_device, &time_domain_count, nullptr) == VK_SUCCESS) {
+			std::vector<VkTimeDomainEXT> time_domains(time_domain_count);
+			get_time_domains(m_physical_device, &time_domain_count, time_domains.data());
+
+			auto has_time_domain = [&](VkTimeDomainEXT time_domain) {
+				return std::find(time_domains.begin(), time_domains.end(), time_domain) != time_domains.end();
+			};
+			m_gpu_info->calibrateable_time_domains = has_time_domain(VK_TIME_DOMAIN_DEVICE_EXT) && has_time_domain(HOST_TIME_DOMAIN);
+		}
+	}
+
 	// Retrieve queues indices
 	uint32_t family_properties_count = 0;
 	vkGetPhysicalDeviceQueueFamilyProperties(m_physical_device, &family_properties_count, nullptr);
@@ -357,18 +445,63 @@ void VulkanContext::create_device() {
 	uint32_t queue_count = (m_graphics_queue_index == m_present_queue_index ? 1 : 2);
 
 	VkPhysicalDeviceFeatures features{
+		.multiDrawIndirect = m_gpu_info->features.multiDrawIndirect,
+		.drawIndirectFirstInstance = m_gpu_info->features.drawIndirectFirstInstance,
 		.wideLines = VK_TRUE,
-		.samplerAnisotropy = VK_TRUE
+		.samplerAnisotropy = VK_TRUE,
+		.pipelineStatisticsQuery = m_gpu_info->features.pipelineStatisticsQuery
 	};
 
-	VkPhysicalDeviceHostQueryResetFeatures host_query_reset_feature{
-		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_QUERY_RESET_FEATURES,
+	// Bindless textures need partially bound, update-after-bind sampler arrays
+	const VkPhysicalDeviceVulkan12Features& supported_12 = m_gpu_info->features_12;
+	if (!supported_12.runtimeDescriptorArray ||
+		!supported_12.shaderSampledImageArrayNonUniformIndexing ||
+		!supported_12.descriptorBindingPartiallyBound ||
+		!supported_12.descriptorBindingSampledImageUpdateAfterBind ||
+		!supported_12.descriptorBindingUpdateUnusedWhilePending)
+		throw std::runtime_error("Descriptor indexing is not supported");
+
+	VkPhysicalDeviceVulkan12Features features_12{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+		.shaderSampledImageArrayNonUniformIndexing = VK_TRUE,
+		.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+		.descriptorBindingUpdateUnusedWhilePending = VK_TRUE,
+		.descriptorBindingPartiallyBound = VK_TRUE,
+		.runtimeDescriptorArray = VK_TRUE,
 		.hostQueryReset = VK_TRUE
 	};
 
+	VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering_features{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR,
+		.dynamicRendering = VK_TRUE
+	};
+
+	VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2_features{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR,
+		.synchronization2 = VK_TRUE
+	};
+
+	m_dynamic_rendering = m_gpu_info->dynamic_rendering_features.dynamicRendering;
+	if (m_dynamic_rendering) {
+		m_physical_device_extensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+		dynamic_rendering_features.pNext = features_12.pNext;
+		features_12.pNext = &dynamic_rendering_features;
+	}
+
+	m_synchronization2 = m_gpu_info->synchronization2_features.synchronization2;
+	if (m_synchronization2) {
+		m_physical_device_extensions.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+		synchronization2_features.pNext = features_12.pNext;
+		features_12.pNext = &synchronization2_features;
+	}
+
+	m_calibrated_timestamps = m_gpu_info->calibrateable_time_domains;
+	if (m_calibrated_timestamps)
+		m_physical_device_extensions.push_back(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+
 	VkDeviceCreateInfo device_info{
 		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-		.pNext = &host_query_reset_feature,
+		.pNext = &features_12,
 		.queueCreateInfoCount = queue_count,
 		.pQueueCreateInfos = queue_infos.data(),
 		.enabledExtensionCount = (uint32_t)m_physical_device_extensions.size(),
@@ -379,6 +512,36 @@ void VulkanContext::create_device() {
 	if (vkCreateDevice(m_physical_device, &device_info, nullptr, &m_device) != VK_SUCCESS)
 		throw std::runtime_error("Failed to create Vulkan Device");
 
+	m_gpu_info->enabled_features = features;
+
+	if (m_dynamic_rendering) {
+		m_cmd_begin_rendering = (PFN_vkCmdBeginRenderingKHR)vkGetDeviceProcAddr(m_device, "vkCmdBeginRenderingKHR");
+		m_cmd_end_rendering = (PFN_vkCmdEndRenderingKHR)vkGetDeviceProcAddr(m_device, "vkCmdEndRenderingKHR");
+
+		if (!m_cmd_begin_rendering || !m_cmd_end_rendering)
+			throw std::runtime_error("Failed to load dynamic rendering functions");
+	}
+
+	if (m_synchronization2) {
+		m_cmd_pipeline_barrier_2 = (PFN_vkCmdPipelineBarrier2KHR)vkGetDeviceProcAddr(m_device, "vkCmdPipelineBarrier2KHR");
+
+		if (!m_cmd_pipeline_barrier_2)
+			throw std::runtime_error("Failed to load synchronization2 functions");
+	}
+
+	if (m_calibrated_timestamps) {
+		m_get_calibrated_timestamps = (PFN_vkGetCalibratedTimestampsEXT)vkGetDeviceProcAddr(m_device, "vkGetCalibratedTimestampsEXT");
+
+		if (!m_get_calibrated_timestamps)
+			throw std::runtime_error("Failed to load calibrated timestamps functions");
+
+#ifdef _WIN32
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		m_host_ticks_per_second = (uint64_t)frequency.QuadPart;
+#endif
+	}
+
 	vkGetDeviceQueue(m_device, m_graphics_queue_index, 0, &m_graphics_queue);
 
 	if (m_graphics_queue_index == m_present_queue_index)
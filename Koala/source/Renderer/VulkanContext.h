@@ -32,6 +32,26 @@ public:
 
 	const VkPhysicalDeviceProperties& physical_device_props() const { return m_gpu_info->properties; }
 	const VkPhysicalDeviceMemoryProperties physical_device_mem_props() const { return m_gpu_info->memory_properties; }
+	const VkPhysicalDeviceFeatures& enabled_features() const { return m_gpu_info->enabled_features; }
+
+	// VK_KHR_dynamic_rendering is enabled, render passes may begin without render pass and framebuffer objects
+	bool dynamic_rendering() const { return m_dynamic_rendering; }
+	PFN_vkCmdBeginRenderingKHR cmd_begin_rendering() const { return m_cmd_begin_rendering; }
+	PFN_vkCmdEndRenderingKHR cmd_end_rendering() const { return m_cmd_end_rendering; }
+	// VK_KHR_synchronization2 is enabled, barriers carry their own stage masks
+	bool synchronization2() const { return m_synchronization2; }
+	PFN_vkCmdPipelineBarrier2KHR cmd_pipeline_barrier_2() const { return m_cmd_pipeline_barrier_2; }
+	// VK_EXT_calibrated_timestamps is enabled with the device time domain and HOST_TIME_DOMAIN
+	bool calibrated_timestamps() const { return m_calibrated_timestamps; }
+	PFN_vkGetCalibratedTimestampsEXT get_calibrated_timestamps() const { return m_get_calibrated_timestamps; }
+	// Clock of std::chrono::steady_clock, which CPUProfiler::now reads
+#ifdef _WIN32
+	static constexpr VkTimeDomainEXT HOST_TIME_DOMAIN = VK_TIME_DOMAIN_QUERY_PERFORMANCE_COUNTER_EXT;
+#else
+	static constexpr VkTimeDomainEXT HOST_TIME_DOMAIN = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+#endif
+	// Timestamp of HOST_TIME_DOMAIN in microseconds, same as CPUProfiler::now
+	double host_timestamp_to_us(uint64_t timestamp) const;
 
 	VkExtent2D swapchain_extent() const { return m_swapchain_extent; }
 	VkFormat swapchain_format() const { return m_surface_format.format; }
@@ -61,6 +81,11 @@ private:
 		VkPhysicalDeviceProperties properties;
 		VkPhysicalDeviceMemoryProperties memory_properties;
 		VkPhysicalDeviceFeatures features;
+		VkPhysicalDeviceVulkan12Features features_12;
+		VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering_features;
+		VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2_features;
+		bool calibrateable_time_domains; // Device and host time domains can be calibrated together
+		VkPhysicalDeviceFeatures enabled_features;
 	};
 
 	struct SwapchainImageResource {
@@ -92,6 +117,15 @@ private:
 	VkQueue m_graphics_queue;
 	VkQueue m_present_queue;
 
+	bool m_dynamic_rendering = false;
+	PFN_vkCmdBeginRenderingKHR m_cmd_begin_rendering = nullptr;
+	PFN_vkCmdEndRenderingKHR m_cmd_end_rendering = nullptr;
+	bool m_synchronization2 = false;
+	PFN_vkCmdPipelineBarrier2KHR m_cmd_pipeline_barrier_2 = nullptr;
+	bool m_calibrated_timestamps = false;
+	PFN_vkGetCalibratedTimestampsEXT m_get_calibrated_timestamps = nullptr;
+	uint64_t m_host_ticks_per_second = 0; // QueryPerformanceFrequency, Windows only
+
 	VkSwapchainKHR m_swapchain;
 	uint32_t m_image_count;
 	VkExtent2D m_swapchain_extent;
@@ -1,13 +1,20 @@
 #include "VulkanGraphicsController.h"
 #include <Profile.h>
 
+#if defined(SHADER_REFLECTION_ENABLE)
 #include <spirv_reflect.h>
+#endif
 
 #include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
 // TODO: Logging
 #include <iostream>
 #include <utility>
 #include <stdexcept>
+#include <type_traits>
 
 static std::vector<char> const_char_to_vector(const char* data) {
 	size_t size = strlen(data);
@@ -22,12 +29,25 @@ static std::vector<char> const_char_to_vector(const char* data) {
 	return v;
 }
 
+// FNV-1a, catches truncated and corrupted pipeline cache files
+static uint64_t hash_bytes(const uint8_t* data, size_t size) {
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 0x100000001b3;
+	}
+
+	return hash;
+}
+
 static uint32_t vk_format_to_size(VkFormat format) {
 	switch (format) {
 	case VK_FORMAT_R8G8B8A8_UNORM:		return 4 * 1;
 	case VK_FORMAT_R8G8B8A8_SNORM:		return 4 * 1;
 	case VK_FORMAT_R8G8B8A8_SRGB:		return 4 * 1;
 	case VK_FORMAT_B8G8R8A8_UNORM:		return 4 * 1;
+	case VK_FORMAT_A2B10G10R10_UNORM_PACK32: return 4;
+	case VK_FORMAT_R16G16_SFLOAT:		return 2 * 2;
 	case VK_FORMAT_R16G16B16A16_SFLOAT:	return 4 * 2;
 	case VK_FORMAT_R32_UINT:			return 1 * 4;
 	case VK_FORMAT_R32_SINT:			return 1 * 4;
@@ -110,6 +130,11 @@ static std::tuple<VkImageLayout, VkPipelineStageFlags, VkAccessFlags> image_usag
 
 		stages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
 		access = VK_ACCESS_SHADER_READ_BIT;
+	} else if (usage & ImageUsageStorage) {
+		layout = VK_IMAGE_LAYOUT_GENERAL;
+
+		stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+		access = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
 	} else if (usage & ImageUsageTransferSrc) {
 		layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
 
@@ -137,26 +162,27 @@ static std::pair<VkPipelineStageFlags, VkAccessFlags> image_layout_to_pipeline_s
 			VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
 			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
 			VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT |
-			VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_WRITE_BIT |
+			VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT |
 			VK_ACCESS_HOST_READ_BIT;
 	} else if (layout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL) {
 		stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 		access = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 	} else if (layout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
-		stages = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
 		access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 	} else if (layout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL) {
-		stages = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
-		access = VK_ACCESS_MEMORY_READ_BIT;
-	} else if (layout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL) {
-		stages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-		access = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+		// Tested against and sampled in the same pass
+		stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
 	} else if (layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-		stages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-		access = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
-	} else if (layout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL || layout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
+		stages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+		access = VK_ACCESS_SHADER_READ_BIT;
+	} else if (layout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) {
+		stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		access = VK_ACCESS_TRANSFER_READ_BIT;
+	} else if (layout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
 		stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
-		access = VK_ACCESS_MEMORY_READ_BIT;
+		access = VK_ACCESS_TRANSFER_WRITE_BIT;
 	} else if (layout == VK_IMAGE_LAYOUT_PREINITIALIZED) {
 		throw std::runtime_error("Image layout not supported");
 	} else {
@@ -179,9 +205,13 @@ static std::pair<VkPipelineStageFlags, VkAccessFlags> buffer_usage_to_pipeline_s
 		access |= VK_ACCESS_TRANSFER_WRITE_BIT;
 	}
 	if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) {
-		stages |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		stages |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
 		access |= VK_ACCESS_UNIFORM_READ_BIT;
 	}
+	if (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) {
+		stages |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+		access |= VK_ACCESS_SHADER_READ_BIT;
+	}
 	if (usage & VK_BUFFER_USAGE_INDEX_BUFFER_BIT) {
 		stages |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
 		access |= VK_ACCESS_INDEX_READ_BIT;
@@ -190,6 +220,26 @@ static std::pair<VkPipelineStageFlags, VkAccessFlags> buffer_usage_to_pipeline_s
 		stages |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
 		access |= VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
 	}
+	if (usage & VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT) {
+		stages |= VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+		access |= VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+	}
+
+	return std::make_pair(stages, access);
+}
+
+// Stages and access of every usage in the flags, unlike image_usage_to_layout_stage_access which picks one
+static std::pair<VkPipelineStageFlags, VkAccessFlags> image_usage_to_pipeline_stages_and_access(ImageUsageFlags usage) {
+	VkPipelineStageFlags stages = 0;
+	VkAccessFlags access = 0;
+
+	for (ImageUsageFlags bit = 1; bit != 0 && bit <= usage; bit <<= 1) {
+		if (usage & bit) {
+			auto [bit_layout, bit_stages, bit_access] = image_usage_to_layout_stage_access(bit);
+			stages |= bit_stages;
+			access |= bit_access;
+		}
+	}
 
 	return std::make_pair(stages, access);
 }
@@ -207,6 +257,8 @@ static VkImageLayout image_usage_to_optimal_image_layout(ImageUsageFlags usage)
 		return VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 	if (usage & ImageUsageDepthSampled)
 		return VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	if (usage & ImageUsageStorage)
+		return VK_IMAGE_LAYOUT_GENERAL;
 	if (usage & ImageUsageTransferSrc)
 		return VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
 	if (usage & ImageUsageTransferDst)
@@ -239,6 +291,8 @@ static VkImageUsageFlags image_usage_to_vk_image_usage(ImageUsageFlags usage) {
 		vk_usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
 	if (usage & ImageUsageDepthStencilReadOnly)
 		vk_usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	if (usage & ImageUsageStorage)
+		vk_usage |= VK_IMAGE_USAGE_STORAGE_BIT;
 	if (usage & ImageUsageTransferDst)
 		vk_usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 	if (usage & ImageUsageTransferSrc)
@@ -282,10 +336,14 @@ static VkExtent3D Extent3D_to_VkExtent3D(const Extent3D& extent) {
 	};
 }
 
-void VulkanGraphicsController::create(VulkanContext* context) {
+void VulkanGraphicsController::create(VulkanContext* context, const std::string& pipeline_cache_path) {
 	MY_PROFILE_FUNCTION();
 
 	m_context = context;
+	m_pipeline_cache_path = pipeline_cache_path;
+
+	pipeline_cache_create();
+	compile_workers_start();
 
 	uint32_t frame_count = 2;
 	m_frames.resize(frame_count);
@@ -321,16 +379,25 @@ void VulkanGraphicsController::create(VulkanContext* context) {
 			throw std::runtime_error("Failed to allocate command buffers");
 	}
 
-	VkQueryPoolCreateInfo query_pool_create_info{
-		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
-		.queryType = VK_QUERY_TYPE_TIMESTAMP,
-		.queryCount = 64
-	};
-
 	for (uint32_t i = 0; i < frame_count; i++) {
-		if (vkCreateQueryPool(device, &query_pool_create_info, nullptr, &m_frames[i].timestamp_query_pool.pool) != VK_SUCCESS)
-			throw std::runtime_error("Failed to create timestamp query pool");
-}
+		m_frames[i].timestamp_query_pool.pool = timestamp_query_pool_create(TimestampQueryPool::MIN_QUERY_COUNT);
+		m_frames[i].timestamp_query_pool.capacity = TimestampQueryPool::MIN_QUERY_COUNT;
+		staging_ring_create(m_frames[i].staging_ring, StagingRing::MIN_SIZE);
+	}
+
+	if (pipeline_statistics_supported()) {
+		VkQueryPoolCreateInfo statistics_pool_create_info{
+			.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+			.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+			.queryCount = StatisticsQueryPool::QUERY_COUNT,
+			.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT
+		};
+
+		for (uint32_t i = 0; i < frame_count; i++) {
+			if (vkCreateQueryPool(device, &statistics_pool_create_info, nullptr, &m_frames[i].statistics_query_pool.pool) != VK_SUCCESS)
+				throw std::runtime_error("Failed to create pipeline statistics query pool");
+		}
+	}
 
 	m_frame_index = 0;
 	VkCommandBufferBeginInfo begin_info{
@@ -340,6 +407,9 @@ void VulkanGraphicsController::create(VulkanContext* context) {
 
 	vkBeginCommandBuffer(m_frames[m_frame_index].setup_buffer, &begin_info);
 	vkBeginCommandBuffer(m_frames[m_frame_index].draw_buffer, &begin_info);
+
+	// Later frames reset their pool when its timestamps are read
+	vkCmdResetQueryPool(m_frames[m_frame_index].setup_buffer, m_frames[m_frame_index].timestamp_query_pool.pool, 0, m_frames[m_frame_index].timestamp_query_pool.capacity);
 }
 
 void VulkanGraphicsController::destroy() {
@@ -361,17 +431,24 @@ void VulkanGraphicsController::destroy() {
 	VkDevice device = m_context->device();
 
 	for (auto& uniform_set : m_uniform_sets) {
+		// Transient pools are destroyed with the frames
+		if (uniform_set.second.transient)
+			continue;
+
+		if (uniform_set.second.update_after_bind_pool != VK_NULL_HANDLE) {
+			vkDestroyDescriptorPool(device, uniform_set.second.update_after_bind_pool, nullptr);
+			continue;
+		}
+
 		VkDescriptorPool descriptor_pool =
-			m_descriptor_pools.at(uniform_set.second.pool_key).at(uniform_set.second.pool_idx).pool;
+			m_descriptor_pools.at(uniform_set.second.pool_key).pools.at(uniform_set.second.pool_idx).pool;
 
-		for (VkImageView image_view : uniform_set.second.image_views)
-			vkDestroyImageView(device, image_view, nullptr);
 		vkFreeDescriptorSets(device, descriptor_pool, 1, &uniform_set.second.descriptor_set);
 	}
 	m_uniform_sets.clear();
 	
 	for (auto& descriptor_pools : m_descriptor_pools) {
-		for (auto& pool : descriptor_pools.second)
+		for (auto& pool : descriptor_pools.second.pools)
 			vkDestroyDescriptorPool(device, pool.second.pool, nullptr);
 	}
 	m_descriptor_pools.clear();
@@ -384,13 +461,30 @@ void VulkanGraphicsController::destroy() {
 
 	for (auto& image : m_images) {
 		vkDestroyImage(device, image.second.image, nullptr);
-		vkFreeMemory(device, image.second.memory, nullptr);
+		if (image.second.owns_memory)
+			vkFreeMemory(device, image.second.memory, nullptr);
 	}
 	m_images.clear();
 
+	for (auto& memory : m_memories)
+		vkFreeMemory(device, memory.second, nullptr);
+	m_memories.clear();
+
 	for (auto& sampler : m_samplers)
 		vkDestroySampler(device, sampler.second.sampler, nullptr);
 	m_samplers.clear();
+	m_sampler_lookup.clear();
+
+	// Pending compilations read shader modules, so pipelines go first
+	for (auto& pipeline : m_pipelines) {
+		if (pipeline.second.compiled.valid())
+			pipeline_wait(pipeline.second);
+
+		vkDestroyPipeline(device, pipeline.second.pipeline, nullptr);
+	}
+	m_pipelines.clear();
+	m_pipeline_lookup.clear();
+	compile_workers_stop();
 
 	for (auto& shader : m_shaders) {
 		for (VkDescriptorSetLayout set_layout : shader.second.set_layouts)
@@ -403,32 +497,46 @@ void VulkanGraphicsController::destroy() {
 	}
 	m_shaders.clear();
 
-	for (auto& pipeline : m_pipelines)
-		vkDestroyPipeline(device, pipeline.second.pipeline, nullptr);
-	m_pipelines.clear();
+	pipeline_cache_save();
+	vkDestroyPipelineCache(device, m_pipeline_cache, nullptr);
+	m_pipeline_cache = VK_NULL_HANDLE;
 
 	for (Frame& frame : m_frames) {
 		vkDestroyQueryPool(device, frame.timestamp_query_pool.pool, nullptr);
+		if (frame.statistics_query_pool.pool != VK_NULL_HANDLE)
+			vkDestroyQueryPool(device, frame.statistics_query_pool.pool, nullptr);
+
+		staging_ring_destroy(frame.staging_ring);
+
+		for (VkDescriptorPool pool : frame.transient_pools)
+			vkDestroyDescriptorPool(device, pool, nullptr);
 
 		vkDestroyCommandPool(device, frame.command_pool, nullptr);
 	}
 	m_frames.clear();
 
-	for (auto& framebuffer : m_framebuffers) {
-		for (VkImageView view : framebuffer.second.image_views)
-			vkDestroyImageView(device, view, nullptr);
+	for (auto& framebuffer : m_framebuffers)
 		vkDestroyFramebuffer(device, framebuffer.second.framebuffer, nullptr);
-	}
 	m_framebuffers.clear();
 
-	for (auto& render_pass : m_render_passes)
-		vkDestroyRenderPass(device, render_pass.second.render_pass, nullptr);
+	// Views of uniform sets and framebuffers, whoever released them last
+	for (auto& image_view : m_image_views)
+		vkDestroyImageView(device, image_view.second.view, nullptr);
+	m_image_views.clear();
+
+	// Pipelines are gone, so these are the last owners
 	m_render_passes.clear();
 }
 
 void VulkanGraphicsController::end_frame() {
 	MY_PROFILE_FUNCTION();
 
+	barriers_flush();
+	m_barrier_stats = m_frame_barrier_stats;
+	m_frame_barrier_stats = {};
+
+	m_frames[m_frame_index].timestamp_query_pool.submit_time = CPUProfiler::now();
+
 	vkEndCommandBuffer(m_frames[m_frame_index].setup_buffer);
 	vkEndCommandBuffer(m_frames[m_frame_index].draw_buffer);
 
@@ -445,6 +553,16 @@ void VulkanGraphicsController::end_frame() {
 	vkBeginCommandBuffer(m_frames[m_frame_index].setup_buffer, &begin_info);
 	vkBeginCommandBuffer(m_frames[m_frame_index].draw_buffer, &begin_info);
 
+	// Fence of the frame slot was waited for in swap_buffers, nothing reads its transient sets and staging ring anymore
+	// and its timestamps are written
+	transient_sets_reset(m_frames[m_frame_index]);
+	staging_ring_reset(m_frames[m_frame_index]);
+	timestamp_queries_read(m_frames[m_frame_index]);
+
+	for (const ImageViewKey& view_key : m_frames[m_frame_index].rendering_views)
+		image_view_release(view_key);
+	m_frames[m_frame_index].rendering_views.clear();
+
 	for (auto& func : *m_actions_after_current_frame)
 		func();
 	m_actions_after_current_frame->clear();
@@ -452,7 +570,7 @@ void VulkanGraphicsController::end_frame() {
 	std::swap(m_actions_after_current_frame, m_actions_after_next_frame);
 }
 
-void VulkanGraphicsController::draw_begin(FramebufferId framebuffer_id, const ClearValue* clear_values, uint32_t count) {
+void VulkanGraphicsController::draw_begin(FramebufferId framebuffer_id, const ClearValue* clear_values, uint32_t count, uint32_t render_width, uint32_t render_height) {
 	const Framebuffer& framebuffer = m_framebuffers.at(framebuffer_id);
 	const RenderPass& render_pass = m_render_passes.at(framebuffer.render_pass_id);
 
@@ -465,20 +583,111 @@ void VulkanGraphicsController::draw_begin(FramebufferId framebuffer_id, const Cl
 		attachment_image.current_layout = render_pass.attachments[i].final_layout;
 	}
 
+	VkExtent2D render_extent = framebuffer.extent;
+	if (render_width != 0 && render_height != 0)
+		render_extent = { std::min(render_width, framebuffer.extent.width), std::min(render_height, framebuffer.extent.height) };
+
 	VkRenderPassBeginInfo render_pass_begin_info{
 		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
 		.renderPass = framebuffer.render_pass,
 		.framebuffer = framebuffer.framebuffer,
-		.renderArea = { { 0, 0 }, framebuffer.extent },
+		.renderArea = { { 0, 0 }, render_extent },
 		.clearValueCount = count,
 		.pClearValues = (VkClearValue*)clear_values
 	};
 	
+	barriers_flush();
 	vkCmdBeginRenderPass(m_frames[m_frame_index].draw_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
 }
 
+void VulkanGraphicsController::draw_begin(RenderPassId render_pass_id, const ImageId* attachments, const ClearValue* clear_values, uint32_t count, uint32_t render_width, uint32_t render_height) {
+	if (!m_context->dynamic_rendering())
+		throw std::runtime_error("Dynamic rendering isn't supported, render pass needs a framebuffer");
+
+	const RenderPass& render_pass = m_render_passes.at(render_pass_id);
+	if (count != render_pass.attachments.size())
+		throw std::runtime_error("Attachment count doesn't match the render pass");
+
+	Frame& frame = m_frames[m_frame_index];
+
+	std::vector<VkRenderingAttachmentInfoKHR> color_attachments;
+	color_attachments.reserve(count);
+	std::optional<VkRenderingAttachmentInfoKHR> depth_attachment;
+	std::optional<VkRenderingAttachmentInfoKHR> stencil_attachment;
+
+	for (uint32_t i = 0; i < count; i++) {
+		const RenderPassAttachmentInfo& attachment_info = render_pass.attachments[i];
+		const RenderPassAttachment& attachment = attachment_info.attachment;
+
+		// Nothing transitions attachments on the way in, so they go straight to the layout of the pass
+		image_should_have_layout(m_images.at(attachments[i]), attachment_info.layout);
+
+		ImageViewKey view_key = attachment_view_key(attachments[i]);
+		VkImageView view = image_view_acquire(view_key);
+		frame.rendering_views.push_back(view_key);
+
+		VkRenderingAttachmentInfoKHR rendering_attachment{
+			.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR,
+			.imageView = view,
+			.imageLayout = attachment_info.layout,
+			.resolveMode = VK_RESOLVE_MODE_NONE,
+			.loadOp = (VkAttachmentLoadOp)attachment.initial_action,
+			.storeOp = (VkAttachmentStoreOp)attachment.final_action,
+			.clearValue = ((const VkClearValue*)clear_values)[i]
+		};
+
+		VkFormat format = (VkFormat)attachment.format;
+		if (!format_has_depth(format)) {
+			color_attachments.push_back(rendering_attachment);
+			continue;
+		}
+
+		depth_attachment = rendering_attachment;
+
+		if (format_has_stencil(format)) {
+			rendering_attachment.loadOp = (VkAttachmentLoadOp)attachment.stencil_initial_action;
+			rendering_attachment.storeOp = (VkAttachmentStoreOp)attachment.stencil_final_action;
+			stencil_attachment = rendering_attachment;
+		}
+	}
+
+	m_rendering_render_pass = render_pass_id;
+	m_rendering_attachments.assign(attachments, attachments + count);
+
+	const VkExtent3D& extent = m_images.at(attachments[0]).info.extent;
+	VkExtent2D render_extent = { extent.width, extent.height };
+	if (render_width != 0 && render_height != 0)
+		render_extent = { std::min(render_width, extent.width), std::min(render_height, extent.height) };
+
+	VkRenderingInfoKHR rendering_info{
+		.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR,
+		.renderArea = { { 0, 0 }, render_extent },
+		.layerCount = 1,
+		.colorAttachmentCount = (uint32_t)color_attachments.size(),
+		.pColorAttachments = color_attachments.data(),
+		.pDepthAttachment = depth_attachment.has_value() ? &depth_attachment.value() : nullptr,
+		.pStencilAttachment = stencil_attachment.has_value() ? &stencil_attachment.value() : nullptr
+	};
+
+	barriers_flush();
+	m_context->cmd_begin_rendering()(frame.draw_buffer, &rendering_info);
+}
+
 void VulkanGraphicsController::draw_end() {
-	vkCmdEndRenderPass(m_frames[m_frame_index].draw_buffer);
+	if (!m_rendering_render_pass.has_value()) {
+		vkCmdEndRenderPass(m_frames[m_frame_index].draw_buffer);
+		return;
+	}
+
+	m_context->cmd_end_rendering()(m_frames[m_frame_index].draw_buffer);
+
+	// Does what the final layouts of a render pass would
+	const RenderPass& render_pass = m_render_passes.at(m_rendering_render_pass.value());
+	for (size_t i = 0; i < m_rendering_attachments.size(); i++)
+		image_should_have_layout(m_images.at(m_rendering_attachments[i]), render_pass.attachments[i].final_layout);
+
+	m_rendering_render_pass.reset();
+	m_rendering_attachments.clear();
 }
 
 void VulkanGraphicsController::draw_begin_for_screen(const glm::vec4& clear_color) {
@@ -493,6 +702,7 @@ void VulkanGraphicsController::draw_begin_for_screen(const glm::vec4& clear_colo
 		.pClearValues = &clear_value
 	};
 	
+	barriers_flush();
 	vkCmdBeginRenderPass(m_frames[m_frame_index].draw_buffer, &begin_info, VK_SUBPASS_CONTENTS_INLINE);
 }
 
@@ -526,6 +736,24 @@ void VulkanGraphicsController::draw_set_line_width(float width) {
 	vkCmdSetLineWidth(m_frames[m_frame_index].draw_buffer, width);
 }
 
+void VulkanGraphicsController::draw_clear_depth(int x_offset, int y_offset, uint32_t width, uint32_t height, float depth) {
+	VkClearAttachment attachment{
+		.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+		.clearValue = { .depthStencil = { depth, 0 } }
+	};
+
+	VkClearRect rect{
+		.rect = {
+			.offset = { x_offset, y_offset },
+			.extent = { width, height }
+		},
+		.baseArrayLayer = 0,
+		.layerCount = 1
+	};
+
+	vkCmdClearAttachments(m_frames[m_frame_index].draw_buffer, 1, &attachment, 1, &rect);
+}
+
 void VulkanGraphicsController::draw_set_stencil_reference(StencilFaces faces, uint32_t reference) {
 	vkCmdSetStencilReference(m_frames[m_frame_index].draw_buffer, (VkStencilFaceFlags)faces, reference);
 }
@@ -535,9 +763,10 @@ void VulkanGraphicsController::draw_push_constants(ShaderId shader, ShaderStageF
 }
 
 void VulkanGraphicsController::draw_bind_pipeline(PipelineId pipeline_id) {
-	const Pipeline& pipeline = m_pipelines.at(pipeline_id);
+	Pipeline& pipeline = m_pipelines.at(pipeline_id);
+	pipeline_wait(pipeline);
 
-	vkCmdBindPipeline(m_frames[m_frame_index].draw_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipeline);
+	vkCmdBindPipeline(m_frames[m_frame_index].draw_buffer, pipeline.bind_point, pipeline.pipeline);
 }
 
 void VulkanGraphicsController::draw_bind_vertex_buffer(BufferId buffer_id) {
@@ -560,29 +789,111 @@ void VulkanGraphicsController::draw_bind_uniform_sets(PipelineId pipeline_id, ui
 	for (uint32_t i = 0; i < count; i++) {
 		UniformSet& set = m_uniform_sets.at(set_ids[i]);
 
-		for (ImageId id : set.images)
-			image_should_have_layout(m_images.at(id), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		for (ImageId id : set.images) {
+			Image& image = m_images.at(id);
+
+			// Depth bound as a read-only attachment is sampled in place
+			if (image.current_layout != VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL)
+				image_should_have_layout(image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		}
+		for (ImageId id : set.storage_images)
+			image_should_have_layout(m_images.at(id), VK_IMAGE_LAYOUT_GENERAL);
 	
 		descriptor_sets.push_back(set.descriptor_set);
+		set.bound_frame = m_frame_count;
 	}
 
+	const Pipeline& pipeline = m_pipelines.at(pipeline_id);
+
 	vkCmdBindDescriptorSets(
 		m_frames[m_frame_index].draw_buffer,
-		VK_PIPELINE_BIND_POINT_GRAPHICS,
-		m_pipelines.at(pipeline_id).layout,
+		pipeline.bind_point,
+		pipeline.layout,
 		first_set, count, descriptor_sets.data(),
 		0, nullptr
 	);
 }
 
-void VulkanGraphicsController::draw_draw_indexed(uint32_t index_count, uint32_t first_index) {
-	vkCmdDrawIndexed(m_frames[m_frame_index].draw_buffer, index_count, 1, first_index, 0, 0);
+void VulkanGraphicsController::draw_draw_indexed(uint32_t index_count, uint32_t first_index, uint32_t instance_count, uint32_t first_instance) {
+	barriers_flush();
+	vkCmdDrawIndexed(m_frames[m_frame_index].draw_buffer, index_count, instance_count, first_index, 0, first_instance);
 }
 
 void VulkanGraphicsController::draw_draw(uint32_t vertex_count, uint32_t first_vertex) {
+	barriers_flush();
 	vkCmdDraw(m_frames[m_frame_index].draw_buffer, vertex_count, 1, first_vertex, 0);
 }
 
+void VulkanGraphicsController::draw_draw_indexed_indirect(BufferId buffer_id, size_t offset, uint32_t draw_count) {
+	static_assert(sizeof(DrawIndexedIndirectCommand) == sizeof(VkDrawIndexedIndirectCommand));
+
+	const Buffer& buffer = m_buffers.at(buffer_id);
+	constexpr uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+
+	barriers_flush();
+
+	if (m_context->enabled_features().multiDrawIndirect)
+		vkCmdDrawIndexedIndirect(m_frames[m_frame_index].draw_buffer, buffer.buffer, offset, draw_count, stride);
+	else {
+		for (uint32_t i = 0; i < draw_count; i++)
+			vkCmdDrawIndexedIndirect(m_frames[m_frame_index].draw_buffer, buffer.buffer, offset + i * stride, 1, stride);
+	}
+}
+
+void VulkanGraphicsController::draw_image_barriers(const ImageBarrier* barriers, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		const ImageBarrier& barrier = barriers[i];
+		Image& image = m_images.at(barrier.image);
+
+		auto [prev_stages, prev_access] = image_layout_to_pipeline_stages_and_access(image.current_layout);
+		auto [wait_stages, wait_access] = image_usage_to_pipeline_stages_and_access(barrier.wait_usage);
+		auto [next_stages, next_access] = image_usage_to_pipeline_stages_and_access(barrier.usage);
+		VkImageLayout new_layout = image_usage_to_optimal_image_layout(barrier.usage);
+
+		// Each image waits only for its own stages, batch is issued before the next command using them
+		barrier_add(VkImageMemoryBarrier2KHR{
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR,
+			.srcStageMask = prev_stages | wait_stages,
+			.srcAccessMask = prev_access | wait_access,
+			.dstStageMask = next_stages,
+			.dstAccessMask = next_access,
+			.oldLayout = barrier.discard ? VK_IMAGE_LAYOUT_UNDEFINED : image.current_layout,
+			.newLayout = new_layout,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = image.image,
+			.subresourceRange = {
+				.aspectMask = image.full_aspect,
+				.baseMipLevel = 0,
+				.levelCount = image.info.mip_levels,
+				.baseArrayLayer = 0,
+				.layerCount = image.info.array_layers
+			}
+		});
+
+		image.current_layout = new_layout;
+	}
+}
+
+void VulkanGraphicsController::draw_dispatch(uint32_t group_count_x, uint32_t group_count_y, uint32_t group_count_z) {
+	barriers_flush();
+	vkCmdDispatch(m_frames[m_frame_index].draw_buffer, group_count_x, group_count_y, group_count_z);
+}
+
+void VulkanGraphicsController::draw_compute_barrier() {
+	barrier_add(VkMemoryBarrier2KHR{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2_KHR,
+		.srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT
+	});
+}
+
+const BarrierStats& VulkanGraphicsController::barrier_stats() const {
+	return m_barrier_stats;
+}
+
 RenderPassId VulkanGraphicsController::render_pass_create(const RenderPassAttachment* attachments, RenderId count) {
 	RenderPass render_pass;
 	render_pass.attachments.reserve(count);
@@ -646,11 +957,17 @@ RenderPassId VulkanGraphicsController::render_pass_create(const RenderPassAttach
 		else
 			color_attachments.push_back(reference);
 
-		render_pass.attachments.emplace_back(attachment, prev_layout, next_layout);
+		render_pass.attachments.emplace_back(attachment, prev_layout, next_layout, curr_layout);
 	}
 
 	if (depth_stencil_attachments.size() > 1) throw std::runtime_error("Render pass supports only one depth stencil attachment");
 
+	// Attachments are given to draw_begin, so no render pass object is needed
+	if (m_context->dynamic_rendering()) {
+		m_render_passes[m_render_id] = std::move(render_pass);
+		return m_render_id++;
+	}
+
 	VkSubpassDescription subpass{
 		.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
 		.colorAttachmentCount = (uint32_t)color_attachments.size(),
@@ -674,19 +991,27 @@ RenderPassId VulkanGraphicsController::render_pass_create(const RenderPassAttach
 	if (vkCreateRenderPass(m_context->device(), &render_pass_info, nullptr, &render_pass.render_pass) != VK_SUCCESS)
 		throw std::runtime_error("Failed to create framebuffer render pass");
 
+	VkDevice device = m_context->device();
+	render_pass.owner = std::shared_ptr<const VkRenderPass>(new VkRenderPass(render_pass.render_pass), [device](const VkRenderPass* handle) {
+		vkDestroyRenderPass(device, *handle, nullptr);
+		delete handle;
+	});
+
 	m_render_passes[m_render_id] = std::move(render_pass);
 	return m_render_id++;
 }
 
 void VulkanGraphicsController::render_pass_destroy(RenderPassId render_pass_id) {
+	// Pipelines which may still be compiled against the render pass keep it alive
 	m_actions_after_next_frame->push_back([&, render_pass_id = render_pass_id]() {
-		vkDestroyRenderPass(m_context->device(), m_render_passes.at(render_pass_id).render_pass, nullptr);
 		m_render_passes.erase(render_pass_id);
 	});
 }
 
 FramebufferId VulkanGraphicsController::framebuffer_create(RenderPassId render_pass_id, const ImageId* ids, uint32_t count) {
 	RenderPass& render_pass = m_render_passes.at(render_pass_id);
+	if (render_pass.render_pass == VK_NULL_HANDLE)
+		throw std::runtime_error("Render pass of dynamic rendering has no framebuffers, attachments are given to draw_begin");
 
 	uint32_t width = m_images.at(ids[0]).info.extent.width;
 	uint32_t height = m_images.at(ids[0]).info.extent.height;
@@ -698,28 +1023,23 @@ FramebufferId VulkanGraphicsController::framebuffer_create(RenderPassId render_p
 	};
 	framebuffer.image_views.reserve(count);
 
+	std::vector<VkImageView> views;
+	views.reserve(count);
+
 	framebuffer.attachments.reserve(count);
 	for (uint32_t i = 0; i < count; i++) {
 		framebuffer.attachments.push_back(ids[i]);
-		
-		const Image& image = m_images.at(ids[i]);
-		
-		VkImageSubresourceRange subresource_range{
-			.aspectMask = image.full_aspect,
-			.baseMipLevel = 0,
-			.levelCount = 1,
-			.baseArrayLayer = 0,
-			.layerCount = 1
-		};
 
-		framebuffer.image_views.push_back(vulkan_image_view_create(image.image, (VkImageViewType)image.info.view_type, (VkFormat)image.info.format, subresource_range));
+		ImageViewKey view_key = attachment_view_key(ids[i]);
+		views.push_back(image_view_acquire(view_key));
+		framebuffer.image_views.push_back(view_key);
 	}
 
 	VkFramebufferCreateInfo framebuffer_info{
 		.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
 		.renderPass = framebuffer.render_pass,
 		.attachmentCount = count,
-		.pAttachments = framebuffer.image_views.data(),
+		.pAttachments = views.data(),
 		.width = width,
 		.height = height,
 		.layers = 1
@@ -736,25 +1056,86 @@ void VulkanGraphicsController::framebuffer_destroy(FramebufferId framebuffer_id)
 	m_actions_after_next_frame->push_back([&, framebuffer_id = framebuffer_id]() {
 		Framebuffer& framebuffer = m_framebuffers.at(framebuffer_id);
 
-		for (VkImageView view : framebuffer.image_views)
-			vkDestroyImageView(m_context->device(), view, nullptr);
+		for (const ImageViewKey& view_key : framebuffer.image_views)
+			image_view_release(view_key);
 		vkDestroyFramebuffer(m_context->device(), framebuffer.framebuffer, nullptr);
 	
 		m_framebuffers.erase(framebuffer_id);
 	});
 }
 
+#if defined(SHADER_REFLECTION_ENABLE)
+ShaderStageReflection VulkanGraphicsController::shader_stage_reflect(const void* spv, size_t size) {
+	MY_PROFILE_FUNCTION();
+
+	spv_reflect::ShaderModule shader_module(size, spv);
+
+	ShaderStageReflection reflection{
+		.stage = (ShaderStageFlags)shader_module.GetShaderStage(),
+		.entry = shader_module.GetEntryPointName()
+	};
+
+	// Reflect Input Variables
+	if (reflection.stage == ShaderStageVertex) {
+		uint32_t input_var_count = 0;
+		shader_module.EnumerateInputVariables(&input_var_count, nullptr);
+		std::vector<SpvReflectInterfaceVariable*> input_vars(input_var_count);
+		shader_module.EnumerateInputVariables(&input_var_count, input_vars.data());
+
+		std::sort(input_vars.begin(), input_vars.end(), [](const auto& var1, const auto& var2) {
+			return var1->location < var2->location;
+		});
+
+		reflection.vertex_inputs.reserve(input_var_count);
+		for (SpvReflectInterfaceVariable* input_var : input_vars) {
+			reflection.vertex_inputs.push_back({
+				.location = input_var->location,
+				.format = (uint32_t)input_var->format
+			});
+		}
+	}
+
+	// Relfect Uniforms
+	uint32_t binding_count = 0;
+	shader_module.EnumerateDescriptorBindings(&binding_count, nullptr);
+	std::vector<SpvReflectDescriptorBinding*> bindings(binding_count);
+	shader_module.EnumerateDescriptorBindings(&binding_count, bindings.data());
+
+	reflection.bindings.reserve(binding_count);
+	for (SpvReflectDescriptorBinding* descriptor_binding : bindings) {
+		reflection.bindings.push_back({
+			.set = descriptor_binding->set,
+			.binding = descriptor_binding->binding,
+			.descriptor_type = (uint32_t)descriptor_binding->descriptor_type,
+			.count = descriptor_binding->count
+		});
+	}
+
+	// Reflect Push Constants
+	uint32_t push_constant_count = 0;
+	shader_module.EnumeratePushConstantBlocks(&push_constant_count, nullptr);
+	
+	if (push_constant_count) { // Only one push constant is supported per shader stage
+		std::vector<SpvReflectBlockVariable*> push_constants(push_constant_count);
+		shader_module.EnumeratePushConstantBlocks(&push_constant_count, push_constants.data());
+
+		reflection.push_constant_offset = push_constants[0]->members->offset;
+		reflection.push_constant_size = push_constants[0]->size;
+	}
+
+	return reflection;
+}
+#endif
+
 ShaderId VulkanGraphicsController::shader_create(const ShaderStage* stages, RenderId stage_count) {
 	MY_PROFILE_FUNCTION(); 
 	
 	m_shaders[m_render_id] = {};
 	Shader& shader = m_shaders.at(m_render_id);
 	
-	auto reflect_shader_stage = [&, this](const void* spv, size_t size) {
-		spv_reflect::ShaderModule shader_module(size, spv);
-
+	auto create_shader_stage = [&, this](const void* spv, size_t size, const ShaderStageReflection& reflection) {
 		shader.stages.push_back({
-			.entry = const_char_to_vector(shader_module.GetEntryPointName())
+			.entry = const_char_to_vector(reflection.entry.c_str())
 		});
 		StageInfo& stage_info = shader.stages.back();
 
@@ -769,37 +1150,26 @@ ShaderId VulkanGraphicsController::shader_create(const ShaderStage* stages, Rend
 
 		shader.stage_create_infos.push_back({
 			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-			.stage = (VkShaderStageFlagBits)shader_module.GetShaderStage(),
+			.stage = (VkShaderStageFlagBits)reflection.stage,
 			.module = stage_info.module,
 			.pName = stage_info.entry.data()
 		});
 		VkPipelineShaderStageCreateInfo& stage_create_info = shader.stage_create_infos.back();
 
-		// Reflect Input Variables
+		// Vertex attributes are tightly packed in location order
 		if (stage_create_info.stage == VK_SHADER_STAGE_VERTEX_BIT) {
-			uint32_t input_var_count = 0;
-			shader_module.EnumerateInputVariables(&input_var_count, nullptr);
-			std::vector<SpvReflectInterfaceVariable*> input_vars(input_var_count);
-			shader_module.EnumerateInputVariables(&input_var_count, input_vars.data());
-
-			std::sort(input_vars.begin(), input_vars.end(), [](const auto& var1, const auto& var2) {
-				return var1->location < var2->location;
-			});
-
-			shader.input_vars_info.attribute_descriptions.reserve(input_var_count);
+			shader.input_vars_info.attribute_descriptions.reserve(reflection.vertex_inputs.size());
 
 			uint32_t stride = 0;
-			for (uint32_t i = 0; i < input_var_count; i++) {
-				SpvReflectInterfaceVariable* input_var = input_vars[i];
-
+			for (const ShaderVertexInputReflection& input_var : reflection.vertex_inputs) {
 				VkVertexInputAttributeDescription attribute_description{
-					.location = input_var->location,
+					.location = input_var.location,
 					.binding = 0,
-					.format = (VkFormat)input_var->format,
+					.format = (VkFormat)input_var.format,
 					.offset = stride
 				};
 
-				stride += vk_format_to_size((VkFormat)input_var->format);
+				stride += vk_format_to_size((VkFormat)input_var.format);
 
 				shader.input_vars_info.attribute_descriptions.push_back(attribute_description);
 			}
@@ -808,17 +1178,16 @@ ShaderId VulkanGraphicsController::shader_create(const ShaderStage* stages, Rend
 			shader.input_vars_info.binding_description.stride = stride;
 		}
 
-		// Relfect Uniforms
-		uint32_t binding_count = 0;
-		shader_module.EnumerateDescriptorBindings(&binding_count, nullptr);
-		std::vector<SpvReflectDescriptorBinding*> bindings(binding_count);
-		shader_module.EnumerateDescriptorBindings(&binding_count, bindings.data());
+		for (const ShaderBindingReflection& descriptor_binding : reflection.bindings) {
+			uint32_t set_idx = descriptor_binding.set;
+			uint32_t binding_idx = descriptor_binding.binding;
+			VkDescriptorType type = (VkDescriptorType)descriptor_binding.descriptor_type;
+			uint32_t count = descriptor_binding.count;
 
-		for (SpvReflectDescriptorBinding* descriptor_binding : bindings) {
-			uint32_t set_idx = descriptor_binding->set;
-			uint32_t binding_idx = descriptor_binding->binding;
-			VkDescriptorType type = (VkDescriptorType)descriptor_binding->descriptor_type;
-			uint32_t count = descriptor_binding->count;
+			// Runtime sized arrays are reflected with zero count
+			bool is_runtime_array = count == 0;
+			if (is_runtime_array)
+				count = MAX_BINDLESS_DESCRIPTORS;
 
 			auto set_it = shader.find_set(set_idx);
 			if (set_it == shader.sets.end()) {
@@ -840,6 +1209,9 @@ ShaderId VulkanGraphicsController::shader_create(const ShaderStage* stages, Rend
 				};
 				
 				set_it->bindings.push_back(layout_binding);
+
+				if (is_runtime_array)
+					set_it->runtime_array_bindings.push_back(binding_idx);
 			} else { // Update binding stage and verify bindings are the same
 				binding_it->stageFlags |= (VkShaderStageFlags)stage_create_info.stage;
 
@@ -850,26 +1222,29 @@ ShaderId VulkanGraphicsController::shader_create(const ShaderStage* stages, Rend
 			}
 		}
 
-		// Reflect Push Constants
-		uint32_t push_constant_count = 0;
-		shader_module.EnumeratePushConstantBlocks(&push_constant_count, nullptr);
-		
-		if (push_constant_count) { // Only one push constant is supported per shader stage
-			std::vector<SpvReflectBlockVariable*> push_constants(push_constant_count);
-			shader_module.EnumeratePushConstantBlocks(&push_constant_count, push_constants.data());
-
+		if (reflection.push_constant_size) {
 			VkPushConstantRange pc_range{
 				.stageFlags = (VkShaderStageFlags)stage_create_info.stage,
-				.offset = push_constants[0]->members->offset,
-				.size = push_constants[0]->size
+				.offset = reflection.push_constant_offset,
+				.size = reflection.push_constant_size
 			};
 
 			shader.push_constants.push_back(pc_range);
 		}
 	};
 
-	for (uint32_t i = 0; i < stage_count; i++)
-		reflect_shader_stage(stages[i].spv, stages[i].spv_size);
+	for (uint32_t i = 0; i < stage_count; i++) {
+		if (stages[i].reflection) {
+			create_shader_stage(stages[i].spv, stages[i].spv_size, *stages[i].reflection);
+			continue;
+		}
+
+#if defined(SHADER_REFLECTION_ENABLE)
+		create_shader_stage(stages[i].spv, stages[i].spv_size, shader_stage_reflect(stages[i].spv, stages[i].spv_size));
+#else
+		throw std::runtime_error("Shader stage has no baked reflection");
+#endif
+	}
 
 	std::sort(shader.sets.begin(), shader.sets.end(), [](const auto& set_0, const auto& set_1) {
 		return set_0.set < set_1.set;
@@ -893,11 +1268,33 @@ ShaderId VulkanGraphicsController::shader_create(const ShaderStage* stages, Rend
 			return bind_0.binding < bind_1.binding;
 		});
 
+		std::vector<VkDescriptorBindingFlags> binding_flags;
+		binding_flags.reserve(set_info.bindings.size());
+		for (const VkDescriptorSetLayoutBinding& binding : set_info.bindings) {
+			auto runtime_array_it = std::find(set_info.runtime_array_bindings.begin(), set_info.runtime_array_bindings.end(), binding.binding);
+
+			if (runtime_array_it != set_info.runtime_array_bindings.end())
+				binding_flags.push_back(VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT);
+			else
+				binding_flags.push_back(0);
+		}
+
+		VkDescriptorSetLayoutBindingFlagsCreateInfo binding_flags_info{
+			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+			.bindingCount = (uint32_t)binding_flags.size(),
+			.pBindingFlags = binding_flags.data()
+		};
+
 		VkDescriptorSetLayoutCreateInfo set_layout_info{
 			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
 			.bindingCount = (uint32_t)set_info.bindings.size(),
 			.pBindings = set_info.bindings.data()
 		};
+
+		if (!set_info.runtime_array_bindings.empty()) {
+			set_layout_info.pNext = &binding_flags_info;
+			set_layout_info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+		}
 	
 		VkDescriptorSetLayout set_layout;
 		if (vkCreateDescriptorSetLayout(m_context->device(), &set_layout_info, nullptr, &set_layout) != VK_SUCCESS)
@@ -925,6 +1322,16 @@ void VulkanGraphicsController::shader_destroy(ShaderId shader_id) {
 	m_actions_after_next_frame->push_back([&, shader_id = shader_id]() {
 		Shader& shader = m_shaders.at(shader_id);
 
+		// Workers read the shader modules, lazy pipelines which never started can't be compiled anymore
+		for (auto& pipeline : m_pipelines) {
+			if (pipeline.second.info.shader_id != shader_id)
+				continue;
+
+			if (pipeline.second.compiled.valid())
+				pipeline_wait(pipeline.second);
+			pipeline.second.create_state.reset();
+		}
+
 		for (VkDescriptorSetLayout set_layout : shader.set_layouts)
 			vkDestroyDescriptorSetLayout(m_context->device(), set_layout, nullptr);
 
@@ -937,24 +1344,34 @@ void VulkanGraphicsController::shader_destroy(ShaderId shader_id) {
 	});
 }
 
-PipelineId VulkanGraphicsController::pipeline_create(const PipelineInfo& pipeline_info) {
+PipelineId VulkanGraphicsController::pipeline_create(const PipelineInfo& pipeline_info, PipelineCompile compile) {
 	MY_PROFILE_FUNCTION(); 
 	
-	m_pipelines[m_render_id] = {};
-	Pipeline& pipeline = m_pipelines.at(m_render_id);
+	Pipeline pipeline;
 	pipeline.info = pipeline_info;
 
 	const Shader& shader = m_shaders.at(pipeline.info.shader_id);
 	
 	pipeline.layout = shader.pipeline_layout;
 
-	VkPipelineInputAssemblyStateCreateInfo assembly_state{
+	pipeline.create_state = std::make_unique<PipelineCreateState>();
+	PipelineCreateState& state = *pipeline.create_state;
+
+	state.bind_point = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	state.stages = shader.stage_create_infos;
+	for (const StageInfo& stage_info : shader.stages)
+		state.entries.push_back(stage_info.entry);
+	state.vertex_attributes = shader.input_vars_info.attribute_descriptions;
+	state.vertex_binding = shader.input_vars_info.binding_description;
+	state.vertex_input_state = shader.vertex_input_create_info;
+
+	state.assembly_state = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
 		.topology = (VkPrimitiveTopology)pipeline_info.assembly.topology,
 		.primitiveRestartEnable = pipeline_info.assembly.restart_enable
 	};
 
-	VkViewport viewport{
+	state.viewport = {
 		.x = 0,
 		.y = 0,
 		.width = (float)m_context->swapchain_extent().width,
@@ -963,20 +1380,18 @@ PipelineId VulkanGraphicsController::pipeline_create(const PipelineInfo& pipelin
 		.maxDepth = 1.0f
 	};
 
-	VkRect2D scissor{
+	state.scissor = {
 		.offset = { 0, 0 },
 		.extent = m_context->swapchain_extent()
 	};
 
-	VkPipelineViewportStateCreateInfo viewport_state{
+	state.viewport_state = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
 		.viewportCount = 1,
-		.pViewports = &viewport,
-		.scissorCount = 1,
-		.pScissors = &scissor
+		.scissorCount = 1
 	};
 
-	VkPipelineRasterizationStateCreateInfo rasterization_state{
+	state.rasterization_state = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
 		.depthClampEnable = pipeline_info.raster.depth_clamp_enable,
 		.rasterizerDiscardEnable = pipeline_info.raster.rasterizer_discard_enable,
@@ -990,13 +1405,13 @@ PipelineId VulkanGraphicsController::pipeline_create(const PipelineInfo& pipelin
 		.lineWidth = pipeline_info.raster.line_width
 	};
 
-	VkPipelineMultisampleStateCreateInfo multisample_state{
+	state.multisample_state = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
 		.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
 		.sampleShadingEnable = VK_FALSE
 	};
 
-	VkPipelineDepthStencilStateCreateInfo depth_stencil_state{
+	state.depth_stencil_state = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
 		.depthTestEnable = pipeline_info.depth_stencil.depth_test_enable,
 		.depthWriteEnable = pipeline_info.depth_stencil.depth_write_enable,
@@ -1025,12 +1440,14 @@ PipelineId VulkanGraphicsController::pipeline_create(const PipelineInfo& pipelin
 		.maxDepthBounds = pipeline_info.depth_stencil.max_depth_bounds
 	};
 
-	VkPipelineColorBlendStateCreateInfo color_blend_state{
+	const VkPipelineColorBlendAttachmentState* blend_attachments = (VkPipelineColorBlendAttachmentState*)pipeline_info.color_blend.attachments;
+	state.blend_attachments.assign(blend_attachments, blend_attachments + pipeline_info.color_blend.attachment_count);
+
+	state.color_blend_state = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
 		.logicOpEnable = pipeline_info.color_blend.logic_op_enable,
 		.logicOp = (VkLogicOp)pipeline_info.color_blend.logic_op,
 		.attachmentCount = pipeline_info.color_blend.attachment_count,
-		.pAttachments = (VkPipelineColorBlendAttachmentState*)pipeline_info.color_blend.attachments,
 		.blendConstants = {
 			pipeline_info.color_blend.blend_constants[0],
 			pipeline_info.color_blend.blend_constants[1],
@@ -1039,114 +1456,591 @@ PipelineId VulkanGraphicsController::pipeline_create(const PipelineInfo& pipelin
 		}
 	};
 
-	VkPipelineDynamicStateCreateInfo dynamic_state{
+	const VkDynamicState* dynamic_states = (VkDynamicState*)pipeline_info.dynamic_states.dynamic_states;
+	state.dynamic_states.assign(dynamic_states, dynamic_states + pipeline_info.dynamic_states.dynamic_state_count);
+
+	state.dynamic_state = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
-		.dynamicStateCount = pipeline_info.dynamic_states.dynamic_state_count,
-		.pDynamicStates = (VkDynamicState*)pipeline_info.dynamic_states.dynamic_states
+		.dynamicStateCount = pipeline_info.dynamic_states.dynamic_state_count
 	};
 
-	VkGraphicsPipelineCreateInfo pipeline_create_info{
-		.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-		.stageCount = (uint32_t)shader.stage_create_infos.size(),
-		.pStages = shader.stage_create_infos.data(),
-		.pVertexInputState = &shader.vertex_input_create_info,
-		.pInputAssemblyState = &assembly_state,
-		.pTessellationState = nullptr,
-		.pViewportState = &viewport_state,
-		.pRasterizationState = &rasterization_state,
-		.pMultisampleState = &multisample_state,
-		.pDepthStencilState = &depth_stencil_state,
-		.pColorBlendState = &color_blend_state,
-		.pDynamicState = &dynamic_state,
-		.layout = shader.pipeline_layout,
-		.renderPass = pipeline_info.render_pass_id
-			? m_render_passes.at(pipeline_info.render_pass_id.value()).render_pass
-			: m_context->swapchain_render_pass(),
-		.subpass = 0
-	};
-	
-	if (vkCreateGraphicsPipelines(m_context->device(), VK_NULL_HANDLE, 1, &pipeline_create_info, nullptr, &pipeline.pipeline) != VK_SUCCESS)
-		throw std::runtime_error("Failed to create graphics pipeline");
+	state.layout = shader.pipeline_layout;
+	state.render_pass = m_context->swapchain_render_pass();
+	if (pipeline_info.render_pass_id) {
+		const RenderPass& render_pass = m_render_passes.at(pipeline_info.render_pass_id.value());
+		state.render_pass = render_pass.render_pass;
+		state.render_pass_owner = render_pass.owner;
+	}
 
-	return m_render_id++;
-}
+	// Dynamic rendering pipelines are created against attachment formats instead of a render pass
+	if (state.render_pass == VK_NULL_HANDLE) {
+		for (const RenderPassAttachmentInfo& attachment : m_render_passes.at(pipeline_info.render_pass_id.value()).attachments) {
+			VkFormat format = (VkFormat)attachment.attachment.format;
 
-void VulkanGraphicsController::pipeline_destroy(PipelineId pipeline_id) {
-	m_actions_after_next_frame->push_back([&, pipeline_id = pipeline_id]() {
-		vkDestroyPipeline(m_context->device(), m_pipelines.at(pipeline_id).pipeline, nullptr);
-		
-		m_pipelines.erase(pipeline_id);
-	});
-}
+			if (!format_has_depth(format)) {
+				state.color_formats.push_back(format);
+				continue;
+			}
 
-BufferId VulkanGraphicsController::vertex_buffer_create(const void* data, size_t size) {
-	MY_PROFILE_FUNCTION(); 
-	
-	Buffer buffer{
-		.size = size,
-		.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
-	};
-	
-	buffer.buffer = buffer_create(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, size);
-	buffer.memory = buffer_allocate(buffer.buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			state.depth_format = format;
+			if (format_has_stencil(format))
+				state.stencil_format = format;
+		}
+	}
 
-	buffer_copy(buffer.buffer, data, size);
+	// Caller's arrays aren't kept alive past this call
+	pipeline.info.color_blend.attachments = nullptr;
+	pipeline.info.dynamic_states.dynamic_states = nullptr;
 
-	buffer_memory_barrier(buffer.buffer, buffer.usage, 0, size);
+	pipeline.state_key = pipeline_state_key(pipeline_info.shader_id, state, pipeline_info.render_pass_id);
+	std::vector<uint32_t> lookup_key = pipeline_lookup_key(pipeline.state_key, state.specialization_constants);
 
-	m_buffers[m_render_id] = std::move(buffer);
-	return m_render_id++;;
+	return pipeline_insert(std::move(pipeline), lookup_key, compile);
 }
 
-BufferId VulkanGraphicsController::index_buffer_create(const void* data, size_t size, IndexType index_type) {
-	MY_PROFILE_FUNCTION(); 
-	
-	Buffer buffer{
-		.size = size,
-		.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT
-	};
-	buffer.index.index_type = (VkIndexType)index_type;
-	buffer.index.index_count = index_type == IndexType::Uint16 ? (uint32_t)size / 2 : (uint32_t)size / 4;
+PipelineId VulkanGraphicsController::compute_pipeline_create(ShaderId shader_id, PipelineCompile compile) {
+	MY_PROFILE_FUNCTION();
 
-	buffer.buffer = buffer_create(VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, size);
-	buffer.memory = buffer_allocate(buffer.buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	const Shader& shader = m_shaders.at(shader_id);
 
-	buffer_copy(buffer.buffer, data, size);
+	if (shader.stage_create_infos.size() != 1 || shader.stage_create_infos[0].stage != VK_SHADER_STAGE_COMPUTE_BIT)
+		throw std::runtime_error("Compute pipeline needs a shader with only compute stage");
 
-	buffer_memory_barrier(buffer.buffer, buffer.usage, 0, size);
+	Pipeline pipeline;
+	pipeline.info.shader_id = shader_id;
+	pipeline.bind_point = VK_PIPELINE_BIND_POINT_COMPUTE;
+	pipeline.layout = shader.pipeline_layout;
 
-	m_buffers[m_render_id] = std::move(buffer);
-	return m_render_id++;
-}
+	pipeline.create_state = std::make_unique<PipelineCreateState>();
+	PipelineCreateState& state = *pipeline.create_state;
 
-BufferId VulkanGraphicsController::uniform_buffer_create(const void* data, size_t size) {
-	MY_PROFILE_FUNCTION(); 
-	
-	Buffer buffer{
-		.size = size,
-		.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
-	};
+	state.bind_point = VK_PIPELINE_BIND_POINT_COMPUTE;
+	state.stages = shader.stage_create_infos;
+	state.entries.push_back(shader.stages[0].entry);
+	state.layout = shader.pipeline_layout;
 
-	buffer.buffer = buffer_create(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, size);
-	buffer.memory = buffer_allocate(buffer.buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	pipeline.state_key = pipeline_state_key(shader_id, state, std::nullopt);
+	std::vector<uint32_t> lookup_key = pipeline_lookup_key(pipeline.state_key, state.specialization_constants);
 
-	if (data) {
-		buffer_copy(buffer.buffer, data, size);
-		buffer_memory_barrier(buffer.buffer, buffer.usage, 0, size);
-	}
+	return pipeline_insert(std::move(pipeline), lookup_key, compile);
+}
 
-	m_buffers[m_render_id] = std::move(buffer);
-	return m_render_id++;
+void VulkanGraphicsController::pipeline_destroy(PipelineId pipeline_id) {
+	pipeline_release(pipeline_id);
 }
 
-void VulkanGraphicsController::buffer_destroy(BufferId buffer_id) {
-	m_actions_after_next_frame->push_back([&, buffer_id = buffer_id] {
-		Buffer& buffer = m_buffers.at(buffer_id);
+bool VulkanGraphicsController::pipeline_ready(PipelineId pipeline_id) {
+	Pipeline& pipeline = m_pipelines.at(pipeline_id);
 
-		vkDestroyBuffer(m_context->device(), buffer.buffer, nullptr);
-		vkFreeMemory(m_context->device(), buffer.memory, nullptr);
+	if (pipeline.pipeline != VK_NULL_HANDLE)
+		return true;
 
-		m_buffers.erase(buffer_id);
+	if (!pipeline.compiled.valid())
+		pipeline_compile_start(pipeline);
+
+	if (pipeline.compiled.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		return false;
+
+	pipeline_wait(pipeline);
+	return true;
+}
+
+PipelineId VulkanGraphicsController::pipeline_variant(PipelineId pipeline_id, const uint32_t* constants, uint32_t count, PipelineCompile compile) {
+	Pipeline& pipeline = m_pipelines.at(pipeline_id);
+
+	std::vector<uint32_t> specialization_constants(constants, constants + count);
+	std::vector<uint32_t> lookup_key = pipeline_lookup_key(pipeline.state_key, specialization_constants);
+
+	// Looked up every time a variant is needed, so finding an existing one stays cheap
+	auto lookup_it = m_pipeline_lookup.find(lookup_key);
+	if (lookup_it != m_pipeline_lookup.end()) {
+		PipelineId variant_id = lookup_it->second;
+		if (variant_id != pipeline_id && std::find(pipeline.variants.begin(), pipeline.variants.end(), variant_id) == pipeline.variants.end()) {
+			// Counted once per pipeline adopting it, repeated lookups of known variants aren't create requests
+			m_pipeline_lookup_stats.hits++;
+			m_pipelines.at(variant_id).ref_count++;
+			pipeline.variants.push_back(variant_id);
+		}
+
+		return variant_id;
+	}
+
+	if (!pipeline.create_state)
+		throw std::runtime_error("Pipeline's shader was destroyed, its variants can't be created");
+
+	Pipeline variant{
+		.info = pipeline.info,
+		.bind_point = pipeline.bind_point,
+		.layout = pipeline.layout,
+		.create_state = std::make_unique<PipelineCreateState>(*pipeline.create_state),
+		.state_key = pipeline.state_key
+	};
+	variant.create_state->specialization_constants = std::move(specialization_constants);
+
+	PipelineId variant_id = pipeline_insert(std::move(variant), lookup_key, compile);
+	m_pipelines.at(pipeline_id).variants.push_back(variant_id);
+
+	return variant_id;
+}
+
+const PipelineLookupStats& VulkanGraphicsController::pipeline_lookup_stats() const {
+	return m_pipeline_lookup_stats;
+}
+
+size_t VulkanGraphicsController::PipelineKeyHash::operator()(const std::vector<uint32_t>& key) const {
+	return (size_t)hash_bytes((const uint8_t*)key.data(), key.size() * sizeof(uint32_t));
+}
+
+std::vector<uint32_t> VulkanGraphicsController::pipeline_state_key(ShaderId shader_id, const PipelineCreateState& state, std::optional<RenderPassId> render_pass_id) const {
+	std::vector<uint32_t> key;
+	key.reserve(128);
+
+	auto push = [&key](auto value) {
+		if constexpr (std::is_same_v<decltype(value), float>)
+			key.push_back(std::bit_cast<uint32_t>(value));
+		else
+			key.push_back((uint32_t)value);
+	};
+	auto push_64 = [&key](uint64_t value) {
+		key.push_back((uint32_t)value);
+		key.push_back((uint32_t)(value >> 32));
+	};
+
+	push(state.bind_point);
+	push_64(shader_id);
+
+	if (state.bind_point == VK_PIPELINE_BIND_POINT_COMPUTE)
+		return key;
+
+	push(state.assembly_state.topology);
+	push(state.assembly_state.primitiveRestartEnable);
+
+	// Viewport is baked with swapchain extent unless it's dynamic
+	push(state.scissor.extent.width);
+	push(state.scissor.extent.height);
+
+	const VkPipelineRasterizationStateCreateInfo& raster = state.rasterization_state;
+	push(raster.depthClampEnable);
+	push(raster.rasterizerDiscardEnable);
+	push(raster.polygonMode);
+	push(raster.cullMode);
+	push(raster.frontFace);
+	push(raster.depthBiasEnable);
+	push(raster.depthBiasConstantFactor);
+	push(raster.depthBiasClamp);
+	push(raster.depthBiasSlopeFactor);
+	push(raster.lineWidth);
+
+	const VkPipelineDepthStencilStateCreateInfo& depth_stencil = state.depth_stencil_state;
+	push(depth_stencil.depthTestEnable);
+	push(depth_stencil.depthWriteEnable);
+	push(depth_stencil.depthCompareOp);
+	push(depth_stencil.depthBoundsTestEnable);
+	push(depth_stencil.stencilTestEnable);
+	for (const VkStencilOpState& stencil : { depth_stencil.front, depth_stencil.back }) {
+		push(stencil.failOp);
+		push(stencil.passOp);
+		push(stencil.depthFailOp);
+		push(stencil.compareOp);
+		push(stencil.compareMask);
+		push(stencil.writeMask);
+		push(stencil.reference);
+	}
+	push(depth_stencil.minDepthBounds);
+	push(depth_stencil.maxDepthBounds);
+
+	push(state.color_blend_state.logicOpEnable);
+	push(state.color_blend_state.logicOp);
+	for (float blend_constant : state.color_blend_state.blendConstants)
+		push(blend_constant);
+
+	push(state.blend_attachments.size());
+	for (const VkPipelineColorBlendAttachmentState& attachment : state.blend_attachments) {
+		push(attachment.blendEnable != VK_FALSE);
+		push(attachment.srcColorBlendFactor);
+		push(attachment.dstColorBlendFactor);
+		push(attachment.colorBlendOp);
+		push(attachment.srcAlphaBlendFactor);
+		push(attachment.dstAlphaBlendFactor);
+		push(attachment.alphaBlendOp);
+		push(attachment.colorWriteMask);
+	}
+
+	push(state.dynamic_states.size());
+	for (VkDynamicState dynamic_state : state.dynamic_states)
+		push(dynamic_state);
+
+	// Pipelines are interchangeable between compatible render passes, which have the same attachment formats
+	if (render_pass_id.has_value()) {
+		const RenderPass& render_pass = m_render_passes.at(render_pass_id.value());
+
+		push(render_pass.attachments.size());
+		for (const RenderPassAttachmentInfo& attachment : render_pass.attachments)
+			push(attachment.attachment.format);
+	} else {
+		push(UINT32_MAX);
+		push(m_context->swapchain_format());
+	}
+
+	return key;
+}
+
+std::vector<uint32_t> VulkanGraphicsController::pipeline_lookup_key(const std::vector<uint32_t>& state_key, const std::vector<uint32_t>& constants) {
+	std::vector<uint32_t> key;
+	key.reserve(state_key.size() + 1 + constants.size());
+
+	key.insert(key.end(), state_key.begin(), state_key.end());
+	key.push_back((uint32_t)constants.size());
+	key.insert(key.end(), constants.begin(), constants.end());
+
+	return key;
+}
+
+PipelineId VulkanGraphicsController::pipeline_insert(Pipeline&& pipeline, const std::vector<uint32_t>& lookup_key, PipelineCompile compile) {
+	auto lookup_it = m_pipeline_lookup.find(lookup_key);
+	if (lookup_it != m_pipeline_lookup.end()) {
+		m_pipeline_lookup_stats.hits++;
+
+		Pipeline& existing = m_pipelines.at(lookup_it->second);
+		existing.ref_count++;
+
+		// Lazy pipeline requested to compile right away now
+		if (compile == PipelineCompile::Async && existing.pipeline == VK_NULL_HANDLE && !existing.compiled.valid() && existing.create_state)
+			pipeline_compile_start(existing);
+
+		return lookup_it->second;
+	}
+
+	m_pipeline_lookup_stats.misses++;
+
+	pipeline.lookup_key = lookup_key;
+
+	PipelineId pipeline_id = m_render_id++;
+	m_pipelines[pipeline_id] = std::move(pipeline);
+	m_pipeline_lookup[lookup_key] = pipeline_id;
+
+	if (compile == PipelineCompile::Async)
+		pipeline_compile_start(m_pipelines.at(pipeline_id));
+
+	return pipeline_id;
+}
+
+void VulkanGraphicsController::pipeline_release(PipelineId pipeline_id) {
+	Pipeline& pipeline = m_pipelines.at(pipeline_id);
+	if (--pipeline.ref_count > 0)
+		return;
+
+	// Identical requests create a new pipeline from now on, variants lose the reference the pipeline held
+	m_pipeline_lookup.erase(pipeline.lookup_key);
+
+	std::vector<PipelineId> variants = std::move(pipeline.variants);
+	for (PipelineId variant_id : variants)
+		pipeline_release(variant_id);
+
+	m_actions_after_next_frame->push_back([&, pipeline_id = pipeline_id]() {
+		Pipeline& pipeline = m_pipelines.at(pipeline_id);
+
+		// Compilation has to finish before the pipeline can be destroyed, lazy one which never started has nothing to destroy
+		if (pipeline.compiled.valid())
+			pipeline_wait(pipeline);
+
+		vkDestroyPipeline(m_context->device(), pipeline.pipeline, nullptr);
+		
+		m_pipelines.erase(pipeline_id);
+	});
+}
+
+VkPipeline VulkanGraphicsController::pipeline_compile(VkDevice device, VkPipelineCache cache, const PipelineCreateState* state, bool warm_cache) {
+	// State is only read here, so it can be copied for variants while compiling. Create infos pointing into it are local
+	std::vector<VkSpecializationMapEntry> specialization_entries;
+	for (uint32_t i = 0; i < (uint32_t)state->specialization_constants.size(); i++) {
+		specialization_entries.push_back({
+			.constantID = i,
+			.offset = i * (uint32_t)sizeof(uint32_t),
+			.size = sizeof(uint32_t)
+		});
+	}
+
+	VkSpecializationInfo specialization_info{
+		.mapEntryCount = (uint32_t)specialization_entries.size(),
+		.pMapEntries = specialization_entries.data(),
+		.dataSize = state->specialization_constants.size() * sizeof(uint32_t),
+		.pData = state->specialization_constants.data()
+	};
+
+	std::vector<VkPipelineShaderStageCreateInfo> stages = state->stages;
+	for (size_t i = 0; i < stages.size(); i++) {
+		stages[i].pName = state->entries[i].data();
+		stages[i].pSpecializationInfo = specialization_entries.empty() ? nullptr : &specialization_info;
+	}
+
+	VkPipeline pipeline;
+
+	if (state->bind_point == VK_PIPELINE_BIND_POINT_COMPUTE) {
+		VkComputePipelineCreateInfo pipeline_create_info{
+			.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+			.stage = stages[0],
+			.layout = state->layout
+		};
+
+		MY_PROFILE_SCOPE(warm_cache ? "vkCreateComputePipelines (warm cache)" : "vkCreateComputePipelines (cold cache)");
+
+		if (vkCreateComputePipelines(device, cache, 1, &pipeline_create_info, nullptr, &pipeline) != VK_SUCCESS)
+			throw std::runtime_error("Failed to create compute pipeline");
+
+		return pipeline;
+	}
+
+	VkPipelineVertexInputStateCreateInfo vertex_input_state = state->vertex_input_state;
+	vertex_input_state.vertexAttributeDescriptionCount = (uint32_t)state->vertex_attributes.size();
+	vertex_input_state.pVertexAttributeDescriptions = state->vertex_attributes.data();
+	vertex_input_state.pVertexBindingDescriptions = &state->vertex_binding;
+
+	VkPipelineViewportStateCreateInfo viewport_state = state->viewport_state;
+	viewport_state.pViewports = &state->viewport;
+	viewport_state.pScissors = &state->scissor;
+
+	VkPipelineColorBlendStateCreateInfo color_blend_state = state->color_blend_state;
+	color_blend_state.pAttachments = state->blend_attachments.data();
+
+	VkPipelineDynamicStateCreateInfo dynamic_state = state->dynamic_state;
+	dynamic_state.pDynamicStates = state->dynamic_states.data();
+
+	VkPipelineRenderingCreateInfoKHR rendering_create_info{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR,
+		.colorAttachmentCount = (uint32_t)state->color_formats.size(),
+		.pColorAttachmentFormats = state->color_formats.data(),
+		.depthAttachmentFormat = state->depth_format,
+		.stencilAttachmentFormat = state->stencil_format
+	};
+
+	VkGraphicsPipelineCreateInfo pipeline_create_info{
+		.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+		.pNext = state->render_pass == VK_NULL_HANDLE ? &rendering_create_info : nullptr,
+		.stageCount = (uint32_t)stages.size(),
+		.pStages = stages.data(),
+		.pVertexInputState = &vertex_input_state,
+		.pInputAssemblyState = &state->assembly_state,
+		.pTessellationState = nullptr,
+		.pViewportState = &viewport_state,
+		.pRasterizationState = &state->rasterization_state,
+		.pMultisampleState = &state->multisample_state,
+		.pDepthStencilState = &state->depth_stencil_state,
+		.pColorBlendState = &color_blend_state,
+		.pDynamicState = &dynamic_state,
+		.layout = state->layout,
+		.renderPass = state->render_pass,
+		.subpass = 0
+	};
+
+	MY_PROFILE_SCOPE(warm_cache ? "vkCreateGraphicsPipelines (warm cache)" : "vkCreateGraphicsPipelines (cold cache)");
+
+	if (vkCreateGraphicsPipelines(device, cache, 1, &pipeline_create_info, nullptr, &pipeline) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create graphics pipeline");
+
+	return pipeline;
+}
+
+void VulkanGraphicsController::pipeline_compile_start(Pipeline& pipeline) {
+	if (!pipeline.create_state)
+		throw std::runtime_error("Pipeline's shader was destroyed before the pipeline was compiled");
+
+	// Pipeline cache is internally synchronized, so workers share it
+	PipelineCompileJob job{
+		.state = pipeline.create_state.get(),
+		.task = std::packaged_task<VkPipeline()>([device = m_context->device(), cache = m_pipeline_cache, state = pipeline.create_state.get(), warm_cache = m_pipeline_cache_warm]() {
+			return pipeline_compile(device, cache, state, warm_cache);
+		})
+	};
+	pipeline.compiled = job.task.get_future();
+
+	{
+		std::lock_guard<std::mutex> lock(m_compile_mutex);
+		m_compile_jobs.push_back(std::move(job));
+	}
+	m_compile_condition.notify_one();
+}
+
+void VulkanGraphicsController::pipeline_wait(Pipeline& pipeline) {
+	if (pipeline.pipeline != VK_NULL_HANDLE)
+		return;
+
+	if (!pipeline.compiled.valid())
+		pipeline_compile_start(pipeline);
+
+	// Job no worker has taken yet is compiled right here instead of waiting behind the rest of the queue
+	std::optional<PipelineCompileJob> queued_job;
+	{
+		std::lock_guard<std::mutex> lock(m_compile_mutex);
+
+		auto job_it = std::find_if(m_compile_jobs.begin(), m_compile_jobs.end(), [&](const PipelineCompileJob& job) {
+			return job.state == pipeline.create_state.get();
+		});
+		if (job_it != m_compile_jobs.end()) {
+			queued_job = std::move(*job_it);
+			m_compile_jobs.erase(job_it);
+		}
+	}
+
+	if (queued_job)
+		queued_job->task();
+
+	{
+		MY_PROFILE_SCOPE("Waiting for pipeline compilation");
+
+		// Rethrows the exception of a failed compilation
+		pipeline.pipeline = pipeline.compiled.get();
+	}
+}
+
+void VulkanGraphicsController::compile_workers_start() {
+	// One core is left to the thread recording frames
+	uint32_t worker_count = std::clamp(std::thread::hardware_concurrency(), 2u, 9u) - 1;
+
+	m_compile_workers_stop = false;
+	for (uint32_t i = 0; i < worker_count; i++)
+		m_compile_workers.emplace_back(&VulkanGraphicsController::compile_worker_run, this);
+}
+
+void VulkanGraphicsController::compile_workers_stop() {
+	{
+		std::lock_guard<std::mutex> lock(m_compile_mutex);
+		m_compile_workers_stop = true;
+	}
+	m_compile_condition.notify_all();
+
+	for (std::thread& worker : m_compile_workers)
+		worker.join();
+	m_compile_workers.clear();
+}
+
+void VulkanGraphicsController::compile_worker_run() {
+	while (true) {
+		PipelineCompileJob job;
+		{
+			std::unique_lock<std::mutex> lock(m_compile_mutex);
+			m_compile_condition.wait(lock, [this]() { return m_compile_workers_stop || !m_compile_jobs.empty(); });
+
+			if (m_compile_jobs.empty())
+				return;
+
+			job = std::move(m_compile_jobs.front());
+			m_compile_jobs.pop_front();
+		}
+
+		// Exceptions are stored in the future and rethrown by pipeline_wait
+		job.task();
+	}
+}
+
+BufferId VulkanGraphicsController::vertex_buffer_create(const void* data, size_t size) {
+	MY_PROFILE_FUNCTION(); 
+	
+	Buffer buffer{
+		.size = size,
+		.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
+	};
+	
+	buffer.buffer = buffer_create(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, size);
+	buffer.memory = buffer_allocate(buffer.buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	buffer_copy(buffer.buffer, data, 0, size);
+
+	buffer_memory_barrier(buffer.buffer, VK_BUFFER_USAGE_TRANSFER_DST_BIT, buffer.usage, 0, size);
+
+	m_buffers[m_render_id] = std::move(buffer);
+	return m_render_id++;;
+}
+
+BufferId VulkanGraphicsController::index_buffer_create(const void* data, size_t size, IndexType index_type) {
+	MY_PROFILE_FUNCTION(); 
+	
+	Buffer buffer{
+		.size = size,
+		.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+	};
+	buffer.index.index_type = (VkIndexType)index_type;
+	buffer.index.index_count = index_type == IndexType::Uint16 ? (uint32_t)size / 2 : (uint32_t)size / 4;
+
+	buffer.buffer = buffer_create(VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, size);
+	buffer.memory = buffer_allocate(buffer.buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	buffer_copy(buffer.buffer, data, 0, size);
+
+	buffer_memory_barrier(buffer.buffer, VK_BUFFER_USAGE_TRANSFER_DST_BIT, buffer.usage, 0, size);
+
+	m_buffers[m_render_id] = std::move(buffer);
+	return m_render_id++;
+}
+
+BufferId VulkanGraphicsController::uniform_buffer_create(const void* data, size_t size) {
+	MY_PROFILE_FUNCTION(); 
+	
+	Buffer buffer{
+		.size = size,
+		.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
+	};
+
+	buffer.buffer = buffer_create(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, size);
+	buffer.memory = buffer_allocate(buffer.buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (data) {
+		buffer_copy(buffer.buffer, data, 0, size);
+		buffer_memory_barrier(buffer.buffer, VK_BUFFER_USAGE_TRANSFER_DST_BIT, buffer.usage, 0, size);
+	}
+
+	m_buffers[m_render_id] = std::move(buffer);
+	return m_render_id++;
+}
+
+BufferId VulkanGraphicsController::storage_buffer_create(const void* data, size_t size) {
+	MY_PROFILE_FUNCTION();
+
+	Buffer buffer{
+		.size = size,
+		.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+	};
+
+	buffer.buffer = buffer_create(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, size);
+	buffer.memory = buffer_allocate(buffer.buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (data) {
+		buffer_copy(buffer.buffer, data, 0, size);
+		buffer_memory_barrier(buffer.buffer, VK_BUFFER_USAGE_TRANSFER_DST_BIT, buffer.usage, 0, size);
+	}
+
+	m_buffers[m_render_id] = std::move(buffer);
+	return m_render_id++;
+}
+
+BufferId VulkanGraphicsController::indirect_buffer_create(const void* data, size_t size) {
+	MY_PROFILE_FUNCTION();
+
+	Buffer buffer{
+		.size = size,
+		.usage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+	};
+
+	buffer.buffer = buffer_create(VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, size);
+	buffer.memory = buffer_allocate(buffer.buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (data) {
+		buffer_copy(buffer.buffer, data, 0, size);
+		buffer_memory_barrier(buffer.buffer, VK_BUFFER_USAGE_TRANSFER_DST_BIT, buffer.usage, 0, size);
+	}
+
+	m_buffers[m_render_id] = std::move(buffer);
+	return m_render_id++;
+}
+
+void VulkanGraphicsController::buffer_destroy(BufferId buffer_id) {
+	m_actions_after_next_frame->push_back([&, buffer_id = buffer_id] {
+		Buffer& buffer = m_buffers.at(buffer_id);
+
+		vkDestroyBuffer(m_context->device(), buffer.buffer, nullptr);
+		vkFreeMemory(m_context->device(), buffer.memory, nullptr);
+
+		m_buffers.erase(buffer_id);
 	});
 }
 
@@ -1155,11 +2049,76 @@ void VulkanGraphicsController::buffer_update(BufferId buffer_id, const void* dat
 	
 	Buffer& buffer = m_buffers.at(buffer_id);
 
-	buffer_memory_barrier(buffer.buffer, buffer.usage, 0, buffer.size);
+	buffer_memory_barrier(buffer.buffer, buffer.usage, VK_BUFFER_USAGE_TRANSFER_DST_BIT, 0, buffer.size);
 
-	buffer_copy(buffer.buffer, data, buffer.size);
+	buffer_copy(buffer.buffer, data, 0, buffer.size);
 
-	buffer_memory_barrier(buffer.buffer, buffer.usage, 0, buffer.size);
+	buffer_memory_barrier(buffer.buffer, VK_BUFFER_USAGE_TRANSFER_DST_BIT, buffer.usage, 0, buffer.size);
+}
+
+void VulkanGraphicsController::buffer_update(BufferId buffer_id, const void* data, size_t offset, size_t size) {
+	MY_PROFILE_FUNCTION();
+
+	Buffer& buffer = m_buffers.at(buffer_id);
+
+	if (offset + size > buffer.size)
+		throw std::runtime_error("Buffer update is out of range");
+
+	if (size == 0)
+		return;
+
+	buffer_memory_barrier(buffer.buffer, buffer.usage, VK_BUFFER_USAGE_TRANSFER_DST_BIT, offset, size);
+
+	buffer_copy(buffer.buffer, data, offset, size);
+
+	buffer_memory_barrier(buffer.buffer, VK_BUFFER_USAGE_TRANSFER_DST_BIT, buffer.usage, offset, size);
+}
+
+void VulkanGraphicsController::buffer_update(BufferId buffer_id, const void* data, const BufferRegion* regions, uint32_t region_count) {
+	MY_PROFILE_FUNCTION();
+
+	Buffer& buffer = m_buffers.at(buffer_id);
+
+	// Regions are read from the same offsets of data and packed into a single staging buffer
+	std::vector<VkBufferCopy> copy_regions;
+	copy_regions.reserve(region_count);
+
+	VkDeviceSize staging_size = 0;
+	VkDeviceSize first_byte = buffer.size;
+	VkDeviceSize last_byte = 0;
+	for (uint32_t i = 0; i < region_count; i++) {
+		if (regions[i].offset + regions[i].size > buffer.size)
+			throw std::runtime_error("Buffer update is out of range");
+
+		if (regions[i].size == 0)
+			continue;
+
+		copy_regions.push_back({
+			.srcOffset = staging_size,
+			.dstOffset = regions[i].offset,
+			.size = regions[i].size
+		});
+
+		staging_size += regions[i].size;
+		first_byte = std::min<VkDeviceSize>(first_byte, regions[i].offset);
+		last_byte = std::max<VkDeviceSize>(last_byte, regions[i].offset + regions[i].size);
+	}
+
+	if (copy_regions.empty())
+		return;
+
+	StagingAllocation staging = staging_allocate(staging_size);
+	for (VkBufferCopy& region : copy_regions) {
+		memcpy(staging.data + region.srcOffset, (const uint8_t*)data + region.dstOffset, region.size);
+		region.srcOffset += staging.offset;
+	}
+
+	buffer_memory_barrier(buffer.buffer, buffer.usage, VK_BUFFER_USAGE_TRANSFER_DST_BIT, first_byte, last_byte - first_byte);
+
+	barriers_flush();
+	vkCmdCopyBuffer(m_frames[m_frame_index].draw_buffer, staging.buffer, buffer.buffer, (uint32_t)copy_regions.size(), copy_regions.data());
+
+	buffer_memory_barrier(buffer.buffer, VK_BUFFER_USAGE_TRANSFER_DST_BIT, buffer.usage, first_byte, last_byte - first_byte);
 }
 
 ImageId VulkanGraphicsController::image_create(const ImageInfo& info) {
@@ -1191,6 +2150,44 @@ ImageId VulkanGraphicsController::image_create(const ImageInfo& info) {
 	return m_render_id++;
 }
 
+ImageId VulkanGraphicsController::image_create(const ImageInfo& info, MemoryId memory_id, size_t offset) {
+	MY_PROFILE_FUNCTION();
+
+	VkFormat vk_format = (VkFormat)info.format;
+	VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL;
+
+	Image image{
+		.info = info,
+		.image = vulkan_image_create(info.view_type, vk_format, { info.extent.width, info.extent.height, info.extent.depth }, info.mip_levels, info.array_layers, tiling, image_usage_to_vk_image_usage(info.usage)),
+		.memory = m_memories.at(memory_id),
+		.current_layout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.full_aspect = vk_format_to_aspect(vk_format),
+		.tiling = tiling,
+		.owns_memory = false
+	};
+
+	if (vkBindImageMemory(m_context->device(), image.image, image.memory, offset) != VK_SUCCESS)
+		throw std::runtime_error("Failed to bind image memory");
+
+	m_images[m_render_id] = std::move(image);
+	return m_render_id++;
+}
+
+MemoryRequirements VulkanGraphicsController::image_memory_requirements(const ImageInfo& info) {
+	VkImage image = vulkan_image_create(info.view_type, (VkFormat)info.format, { info.extent.width, info.extent.height, info.extent.depth }, info.mip_levels, info.array_layers, VK_IMAGE_TILING_OPTIMAL, image_usage_to_vk_image_usage(info.usage));
+
+	VkMemoryRequirements mem_reqs;
+	vkGetImageMemoryRequirements(m_context->device(), image, &mem_reqs);
+
+	vkDestroyImage(m_context->device(), image, nullptr);
+
+	return {
+		.size = mem_reqs.size,
+		.alignment = mem_reqs.alignment,
+		.memory_type_bits = mem_reqs.memoryTypeBits
+	};
+}
+
 void VulkanGraphicsController::image_update(ImageId image_id, const ImageSubresourceLayers& image_subresource, Offset3D image_offset, Extent3D image_extent, const ImageDataInfo& image_data_info) {
 	MY_PROFILE_FUNCTION(); 
 	
@@ -1248,6 +2245,7 @@ void VulkanGraphicsController::image_update(ImageId image_id, const ImageSubreso
 			.dstOffsets = { offset, iextent }
 		};
 
+		barriers_flush();
 		vkCmdBlitImage(m_frames[m_frame_index].draw_buffer, staging_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, VkFilter::VK_FILTER_LINEAR);
 	
 		staging_image_destroy(staging_image, staging_image_memory);
@@ -1307,15 +2305,50 @@ void VulkanGraphicsController::image_destroy(ImageId image_id) {
 	m_actions_after_next_frame->push_back([&, image_id = image_id]() {
 		Image& image = m_images.at(image_id);
 		vkDestroyImage(m_context->device(), image.image, nullptr);
-		vkFreeMemory(m_context->device(), image.memory, nullptr);
+		if (image.owns_memory)
+			vkFreeMemory(m_context->device(), image.memory, nullptr);
 
 		m_images.erase(image_id);
 	});
 }
 
+MemoryId VulkanGraphicsController::memory_allocate(size_t size, uint32_t memory_type_bits) {
+	VkMemoryAllocateInfo allocate_info{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.allocationSize = size,
+		.memoryTypeIndex = find_memory_type(memory_type_bits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+	};
+
+	VkDeviceMemory memory;
+	if (vkAllocateMemory(m_context->device(), &allocate_info, nullptr, &memory) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate memory");
+
+	m_memories[m_render_id] = memory;
+	return m_render_id++;
+}
+
+void VulkanGraphicsController::memory_free(MemoryId memory_id) {
+	m_actions_after_next_frame->push_back([&, memory_id = memory_id]() {
+		vkFreeMemory(m_context->device(), m_memories.at(memory_id), nullptr);
+		m_memories.erase(memory_id);
+	});
+}
+
 SamplerId VulkanGraphicsController::sampler_create(const SamplerInfo& info) {
 	MY_PROFILE_FUNCTION();
 
+	SamplerKey key = sampler_key(info);
+
+	auto lookup_it = m_sampler_lookup.find(key);
+	if (lookup_it != m_sampler_lookup.end()) {
+		m_sampler_lookup_stats.hits++;
+		m_samplers.at(lookup_it->second).ref_count++;
+
+		return lookup_it->second;
+	}
+
+	m_sampler_lookup_stats.misses++;
+
 	VkSamplerCreateInfo sampler_info{
 		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
 		.magFilter = (VkFilter)info.mag_filter,
@@ -1336,17 +2369,26 @@ SamplerId VulkanGraphicsController::sampler_create(const SamplerInfo& info) {
 	};
 
 	Sampler sampler{
-		.info = info
+		.info = info,
+		.key = key
 	};
 
 	if (vkCreateSampler(m_context->device(), &sampler_info, nullptr, &sampler.sampler) != VK_SUCCESS)
 		throw std::runtime_error("Failed to create sampler");
 
 	m_samplers[m_render_id] = std::move(sampler);
+	m_sampler_lookup[key] = m_render_id;
 	return m_render_id++;
 }
 
 void VulkanGraphicsController::sampler_destroy(SamplerId sampler_id) {
+	Sampler& sampler = m_samplers.at(sampler_id);
+	if (--sampler.ref_count > 0)
+		return;
+
+	// Identical requests create a new sampler from now on
+	m_sampler_lookup.erase(sampler.key);
+
 	m_actions_after_next_frame->push_back([&, sampler_id = sampler_id]() {
 		vkDestroySampler(m_context->device(), m_samplers.at(sampler_id).sampler, nullptr);
 
@@ -1354,207 +2396,475 @@ void VulkanGraphicsController::sampler_destroy(SamplerId sampler_id) {
 	});
 }
 
+const SamplerLookupStats& VulkanGraphicsController::sampler_lookup_stats() const {
+	return m_sampler_lookup_stats;
+}
+
+size_t VulkanGraphicsController::sampler_count() const {
+	return m_sampler_lookup.size();
+}
+
+size_t VulkanGraphicsController::SamplerKeyHash::operator()(const SamplerKey& key) const {
+	return (size_t)hash_bytes((const uint8_t*)key.data(), key.size() * sizeof(uint32_t));
+}
+
+VulkanGraphicsController::SamplerKey VulkanGraphicsController::sampler_key(const SamplerInfo& info) {
+	return {
+		(uint32_t)info.mag_filter,
+		(uint32_t)info.min_filter,
+		(uint32_t)info.mip_map_mode,
+		(uint32_t)info.address_mode_u,
+		(uint32_t)info.address_mode_v,
+		(uint32_t)info.address_mode_w,
+		std::bit_cast<uint32_t>(info.mip_lod_bias),
+		(uint32_t)info.anisotropy_enable,
+		std::bit_cast<uint32_t>(info.max_anisotropy),
+		(uint32_t)info.compare_enable,
+		(uint32_t)info.comapare_op,
+		std::bit_cast<uint32_t>(info.min_lod),
+		std::bit_cast<uint32_t>(info.max_lod),
+		(uint32_t)info.border_color,
+		(uint32_t)info.unnormalized_coordinates
+	};
+}
+
 UniformSetId VulkanGraphicsController::uniform_set_create(ShaderId shader_id, uint32_t set_idx, const UniformInfo* uniforms, size_t uniform_count) {
+	UniformSetId uniform_set_id;
+	uniform_sets_create(shader_id, set_idx, uniforms, uniform_count, 1, &uniform_set_id);
+
+	return uniform_set_id;
+}
+
+void VulkanGraphicsController::uniform_sets_create(ShaderId shader_id, uint32_t set_idx, const UniformInfo* uniforms, size_t uniform_count, uint32_t set_count, UniformSetId* set_ids) {
 	MY_PROFILE_FUNCTION(); 
+
+	if (set_count == 0)
+		return;
 	
 	SetInfo& set = *m_shaders.at(shader_id).find_set(set_idx);
 
-	std::vector<ImageId> images;
-	std::vector<VkImageView> image_views;
+	std::vector<UniformWrites> set_writes;
+	set_writes.reserve(set_count);
+	for (uint32_t i = 0; i < set_count; i++) {
+		set_writes.push_back(uniform_writes_create(set, uniforms + i * uniform_count, uniform_count));
 
-	std::vector<std::vector<VkDescriptorImageInfo>> image_infos_collector;
-	std::vector<std::vector<VkDescriptorBufferInfo>> buffer_infos_collector;
-	std::vector<VkWriteDescriptorSet> writes;
+		const DescriptorPoolKey& pool_key = set_writes[i].pool_key;
+		if (memcmp(pool_key.uniform_type_counts, set_writes[0].pool_key.uniform_type_counts, sizeof(pool_key.uniform_type_counts)) != 0)
+			throw std::runtime_error("Uniform sets created together need the same descriptor counts");
+	}
 
-	DescriptorPoolKey pool_key;
-	for (uint32_t i = 0; i < uniform_count; i++) {
-		const auto& uniform = uniforms[i];
-		auto binding_it = set.find_binding(uniform.binding);
-		
-		if (binding_it == set.bindings.end())
-			throw std::runtime_error("No binding found");
+	const DescriptorPoolKey& pool_key = set_writes[0].pool_key;
 
-		VkWriteDescriptorSet write{
-			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-			.dstBinding = binding_it->binding,
-			.dstArrayElement = 0
-		};
+	std::vector<VkDescriptorSet> descriptor_sets(set_count);
+	std::vector<VkDescriptorPool> update_after_bind_pools(set_count, VK_NULL_HANDLE);
+	std::vector<VkDescriptorSetLayout> set_layouts(set_count, m_shaders.at(shader_id).set_layouts[set_idx]);
 
-		switch (uniform.type) {
-		case UniformType::Sampler: {
-			throw std::runtime_error("UniformType not supported");
+	VkDescriptorSetAllocateInfo set_allocate_info{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.descriptorSetCount = set_count,
+		.pSetLayouts = set_layouts.data()
+	};
+
+	// Sets with runtime arrays are rare and large, each gets its own update-after-bind pool
+	size_t pool_idx = 0;
+	if (set.runtime_array_bindings.empty()) {
+		pool_idx = descriptor_pool_allocate(pool_key, set_count);
+		set_allocate_info.descriptorPool = m_descriptor_pools.at(pool_key).pools.at(pool_idx).pool;
+
+		if (vkAllocateDescriptorSets(m_context->device(), &set_allocate_info, descriptor_sets.data()) != VK_SUCCESS)
+			throw std::runtime_error("Failed to allocate descriptor set");
+	} else {
+		set_allocate_info.descriptorSetCount = 1;
+
+		for (uint32_t i = 0; i < set_count; i++) {
+			update_after_bind_pools[i] = update_after_bind_pool_create(set);
+			set_allocate_info.descriptorPool = update_after_bind_pools[i];
+
+			if (vkAllocateDescriptorSets(m_context->device(), &set_allocate_info, &descriptor_sets[i]) != VK_SUCCESS)
+				throw std::runtime_error("Failed to allocate descriptor set");
 		}
-		case UniformType::CombinedImageSampler: {
-			std::vector<VkDescriptorImageInfo> image_infos;
+	}
 
-			for (size_t j = 0; j < uniform.id_count; j += 2) {
-				Image& image = m_images.at(uniform.ids[j]);
+	std::vector<VkWriteDescriptorSet> writes;
+	for (uint32_t i = 0; i < set_count; i++) {
+		for (VkWriteDescriptorSet write : set_writes[i].writes) {
+			write.dstSet = descriptor_sets[i];
+			writes.push_back(write);
+		}
+
+		UniformSet uniform_set{
+			.binding_images = std::move(set_writes[i].binding_images),
+			.update_after_bind_pool = update_after_bind_pools[i],
+			.pool_key = pool_key,
+			.pool_idx = pool_idx,
+			.shader = shader_id,
+			.set_idx = set_idx,
+			.descriptor_set = descriptor_sets[i]
+		};
+
+		uniform_set_track_images(uniform_set);
+
+		set_ids[i] = m_render_id;
+		m_uniform_sets[m_render_id++] = std::move(uniform_set);
+	}
+
+	// Image and buffer infos stay in set_writes until here
+	vkUpdateDescriptorSets(m_context->device(), (uint32_t)writes.size(), writes.data(), 0, nullptr);
+}
+
+UniformSetId VulkanGraphicsController::uniform_set_create_transient(ShaderId shader_id, uint32_t set_idx, const UniformInfo* uniforms, size_t uniform_count) {
+	MY_PROFILE_FUNCTION();
+
+	SetInfo& set = *m_shaders.at(shader_id).find_set(set_idx);
+	if (!set.runtime_array_bindings.empty())
+		throw std::runtime_error("Uniform set with runtime arrays can't be transient");
+
+	UniformWrites uniform_writes = uniform_writes_create(set, uniforms, uniform_count);
+	Frame& frame = m_frames[m_frame_index];
+
+	VkDescriptorSetAllocateInfo set_allocate_info{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.descriptorSetCount = 1,
+		.pSetLayouts = &m_shaders.at(shader_id).set_layouts[set_idx]
+	};
 
-				VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
-				if (uniform.subresource_range.aspect == ImageAspectColor)
-					layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-				else
-					layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
-				
-				VkImageView view = vulkan_image_view_create(image.image, (VkImageViewType)image.info.view_type, (VkFormat)image.info.format, ImageSubresourceRange_to_VkImageSubresourceRange(uniform.subresource_range));
-				image_views.push_back(view);
+	// Pools are used up one after another, allocation moves to the next pool once one is full
+	VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+	while (descriptor_set == VK_NULL_HANDLE) {
+		bool new_pool = frame.transient_pool_idx == frame.transient_pools.size();
+		if (new_pool)
+			frame.transient_pools.push_back(transient_pool_create());
+
+		set_allocate_info.descriptorPool = frame.transient_pools[frame.transient_pool_idx];
+
+		VkResult result = vkAllocateDescriptorSets(m_context->device(), &set_allocate_info, &descriptor_set);
+		if ((result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) && !new_pool) {
+			descriptor_set = VK_NULL_HANDLE;
+			frame.transient_pool_idx++;
+		} else if (result != VK_SUCCESS)
+			throw std::runtime_error("Failed to allocate transient descriptor set");
+	}
 
-				VkDescriptorImageInfo image_info{
-					.sampler = m_samplers[uniform.ids[j + 1]].sampler,
-					.imageView = view,
-					.imageLayout = layout
-				};
+	UniformSet uniform_set{
+		.binding_images = std::move(uniform_writes.binding_images),
+		.shader = shader_id,
+		.set_idx = set_idx,
+		.descriptor_set = descriptor_set,
+		.transient = true
+	};
 
-				image_infos.push_back(image_info);
-				images.push_back(uniform.ids[j]);
-			}
+	uniform_set_track_images(uniform_set);
 
-			write.descriptorCount = uniform.id_count / 2;
-			write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-			write.pImageInfo = image_infos.data();
+	for (VkWriteDescriptorSet& write : uniform_writes.writes)
+		write.dstSet = descriptor_set;
+	vkUpdateDescriptorSets(m_context->device(), (uint32_t)uniform_writes.writes.size(), uniform_writes.writes.data(), 0, nullptr);
 
-			image_infos_collector.push_back(std::move(image_infos));
+	frame.transient_sets.push_back(m_render_id);
+	m_uniform_sets[m_render_id] = std::move(uniform_set);
+	return m_render_id++;
+}
 
-			break;
-		}
-		case UniformType::SampledImage: {
-			throw std::runtime_error("UniformType not supported");
-		}
-		case UniformType::UniformBuffer: {
-			std::vector<VkDescriptorBufferInfo> buffer_infos;
+void VulkanGraphicsController::uniform_set_update(UniformSetId uniform_set_id, const UniformInfo* uniforms, size_t uniform_count) {
+	MY_PROFILE_FUNCTION();
 
-			for (size_t j = 0; j < uniform.id_count; j++) {
-				Buffer& buffer = m_buffers.at(uniform.ids[j]);
+	UniformSet& uniform_set = m_uniform_sets.at(uniform_set_id);
+	if (uniform_set.bound_frame == m_frame_count)
+		throw std::runtime_error("Uniform set can't be updated in the frame it's bound");
 
-				VkDescriptorBufferInfo buffer_info{
-					.buffer = buffer.buffer,
-					.offset = 0,
-					.range = VK_WHOLE_SIZE
-				};
+	SetInfo& set = *m_shaders.at(uniform_set.shader).find_set((uint32_t)uniform_set.set_idx);
+	UniformWrites uniform_writes = uniform_writes_create(set, uniforms, uniform_count);
 
-				buffer_infos.push_back(buffer_info);
-			}
+	// Descriptors read by frames in flight can't be rewritten
+	if (uniform_set.bound_frame.has_value() && m_frame_count - uniform_set.bound_frame.value() <= m_frames.size())
+		uniform_set_rename(uniform_set, set, uniform_writes);
 
-			write.descriptorCount = uniform.id_count;
-			write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-			write.pBufferInfo = buffer_infos.data();
-			
-			buffer_infos_collector.push_back(std::move(buffer_infos));
+	for (VkWriteDescriptorSet& write : uniform_writes.writes)
+		write.dstSet = uniform_set.descriptor_set;
+	vkUpdateDescriptorSets(m_context->device(), (uint32_t)uniform_writes.writes.size(), uniform_writes.writes.data(), 0, nullptr);
 
-			break;
-		}
+	// New views are acquired first, so views of images which stay in the binding are kept
+	for (auto& binding_images : uniform_writes.binding_images) {
+		auto old_it = uniform_set.binding_images.find(binding_images.first);
+		if (old_it != uniform_set.binding_images.end()) {
+			m_actions_after_next_frame->push_back([&, views = std::move(old_it->second.views)]() {
+				for (const ImageViewKey& view_key : views)
+					image_view_release(view_key);
+			});
 		}
 
-		pool_key.uniform_type_counts[(uint32_t)uniform.type] += write.descriptorCount;
-
-		writes.push_back(write);
+		uniform_set.binding_images[binding_images.first] = std::move(binding_images.second);
 	}
 
-	size_t pool_idx = descriptor_pool_allocate(pool_key);
-	const DescriptorPool& pool = m_descriptor_pools.at(pool_key).at(pool_idx);
+	uniform_set_track_images(uniform_set);
+}
 
+void VulkanGraphicsController::uniform_set_rename(UniformSet& uniform_set, SetInfo& set, const UniformWrites& uniform_writes) {
 	VkDescriptorSetAllocateInfo set_allocate_info{
 		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-		.descriptorPool = pool.pool,
 		.descriptorSetCount = 1,
-		.pSetLayouts = &m_shaders.at(shader_id).set_layouts[set_idx]
+		.pSetLayouts = &m_shaders.at(uniform_set.shader).set_layouts[uniform_set.set_idx]
 	};
-	
+
+	VkDescriptorPool update_after_bind_pool = VK_NULL_HANDLE;
+	size_t pool_idx = 0;
+	if (uniform_set.update_after_bind_pool != VK_NULL_HANDLE) {
+		update_after_bind_pool = update_after_bind_pool_create(set);
+		set_allocate_info.descriptorPool = update_after_bind_pool;
+	} else {
+		pool_idx = descriptor_pool_allocate(uniform_set.pool_key, 1);
+		set_allocate_info.descriptorPool = m_descriptor_pools.at(uniform_set.pool_key).pools.at(pool_idx).pool;
+	}
+
 	VkDescriptorSet descriptor_set;
 	if (vkAllocateDescriptorSets(m_context->device(), &set_allocate_info, &descriptor_set) != VK_SUCCESS)
 		throw std::runtime_error("Failed to allocate descriptor set");
 
-	UniformSet uniform_set{
-		.images = std::move(images),
-		.image_views = std::move(image_views),
-		.pool_key = pool_key,
-		.pool_idx = pool_idx,
-		.shader = shader_id,
-		.set_idx= set_idx,
-		.descriptor_set = descriptor_set
-	};
+	// Bindings which aren't written are copied, runtime arrays only have their written elements
+	std::vector<VkCopyDescriptorSet> copies;
+	for (const VkDescriptorSetLayoutBinding& binding : set.bindings) {
+		bool written = std::any_of(uniform_writes.writes.begin(), uniform_writes.writes.end(), [&](const VkWriteDescriptorSet& write) {
+			return write.dstBinding == binding.binding;
+		});
+		if (written)
+			continue;
+
+		VkCopyDescriptorSet copy{
+			.sType = VK_STRUCTURE_TYPE_COPY_DESCRIPTOR_SET,
+			.srcSet = uniform_set.descriptor_set,
+			.srcBinding = binding.binding,
+			.dstSet = descriptor_set,
+			.dstBinding = binding.binding,
+			.descriptorCount = binding.descriptorCount
+		};
 
-	for (VkWriteDescriptorSet& write : writes) {
-		write.dstSet = descriptor_set;
+		if (std::find(set.runtime_array_bindings.begin(), set.runtime_array_bindings.end(), binding.binding) == set.runtime_array_bindings.end()) {
+			copies.push_back(copy);
+			continue;
+		}
+
+		for (const auto& array_image_view : uniform_set.array_image_views) {
+			if (array_image_view.first >> 32 != binding.binding)
+				continue;
+
+			copy.srcArrayElement = (uint32_t)array_image_view.first;
+			copy.dstArrayElement = copy.srcArrayElement;
+			copy.descriptorCount = 1;
+			copies.push_back(copy);
+		}
 	}
-	vkUpdateDescriptorSets(m_context->device(), (uint32_t)writes.size(), writes.data(), 0, nullptr);
+	vkUpdateDescriptorSets(m_context->device(), 0, nullptr, (uint32_t)copies.size(), copies.data());
 
-	m_uniform_sets[m_render_id] = std::move(uniform_set);
-	return m_render_id++;
+	// Old set is freed once the frames which bound it complete
+	m_actions_after_next_frame->push_back([&, old_set = uniform_set.descriptor_set, old_pool = uniform_set.update_after_bind_pool,
+		pool_key = uniform_set.pool_key, old_pool_idx = uniform_set.pool_idx]() {
+		VkDevice device = m_context->device();
+
+		if (old_pool != VK_NULL_HANDLE)
+			vkDestroyDescriptorPool(device, old_pool, nullptr);
+		else {
+			vkFreeDescriptorSets(device, m_descriptor_pools.at(pool_key).pools.at(old_pool_idx).pool, 1, &old_set);
+			descriptor_pool_free(pool_key, old_pool_idx);
+		}
+	});
+
+	uniform_set.descriptor_set = descriptor_set;
+	uniform_set.update_after_bind_pool = update_after_bind_pool;
+	uniform_set.pool_idx = pool_idx;
+	uniform_set.bound_frame.reset();
 }
 
 void VulkanGraphicsController::uniform_set_destroy(UniformSetId uniform_set_id) {
+	if (m_uniform_sets.at(uniform_set_id).transient)
+		throw std::runtime_error("Transient uniform sets are freed with their frame");
+
 	m_actions_after_next_frame->push_back([&, uniform_set_id = uniform_set_id]() {
 		UniformSet& uniform_set = m_uniform_sets.at(uniform_set_id);
 
-		VkDescriptorPool descriptor_pool = m_descriptor_pools.at(uniform_set.pool_key).at(uniform_set.pool_idx).pool;
+		for (const auto& binding_images : uniform_set.binding_images) {
+			for (const ImageViewKey& view_key : binding_images.second.views)
+				image_view_release(view_key);
+		}
+		for (const auto& array_image_view : uniform_set.array_image_views)
+			image_view_release(array_image_view.second);
 
 		VkDevice device = m_context->device();
-		for (VkImageView image_view : uniform_set.image_views)
-			vkDestroyImageView(device, image_view, nullptr);
-		vkFreeDescriptorSets(device, descriptor_pool, 1, &uniform_set.descriptor_set);
-		
-		descriptor_pool_free(uniform_set.pool_key, uniform_set.pool_idx);
+
+		if (uniform_set.update_after_bind_pool != VK_NULL_HANDLE)
+			vkDestroyDescriptorPool(device, uniform_set.update_after_bind_pool, nullptr);
+		else {
+			VkDescriptorPool descriptor_pool = m_descriptor_pools.at(uniform_set.pool_key).pools.at(uniform_set.pool_idx).pool;
+			vkFreeDescriptorSets(device, descriptor_pool, 1, &uniform_set.descriptor_set);
+
+			descriptor_pool_free(uniform_set.pool_key, uniform_set.pool_idx);
+		}
 
 		m_uniform_sets.erase(uniform_set_id);
 	});
 }
 
+void VulkanGraphicsController::uniform_set_update_array(UniformSetId uniform_set_id, const UniformInfo& uniform, uint32_t first_element) {
+	MY_PROFILE_FUNCTION();
+
+	UniformSet& uniform_set = m_uniform_sets.at(uniform_set_id);
+	SetInfo& set = *m_shaders.at(uniform_set.shader).find_set((uint32_t)uniform_set.set_idx);
+
+	auto runtime_array_it = std::find(set.runtime_array_bindings.begin(), set.runtime_array_bindings.end(), uniform.binding);
+	if (runtime_array_it == set.runtime_array_bindings.end())
+		throw std::runtime_error("Binding is not a runtime array");
+	if (uniform.type != UniformType::CombinedImageSampler)
+		throw std::runtime_error("UniformType not supported");
+
+	uint32_t element_count = uniform.id_count / 2;
+	if (first_element + element_count > MAX_BINDLESS_DESCRIPTORS)
+		throw std::runtime_error("Runtime array update is out of range");
+
+	std::vector<VkDescriptorImageInfo> image_infos;
+	image_infos.reserve(element_count);
+
+	for (uint32_t i = 0; i < element_count; i++) {
+		Image& image = m_images.at(uniform.ids[2 * i]);
+
+		ImageViewKey view_key{
+			.image = uniform.ids[2 * i],
+			.view_type = (VkImageViewType)image.info.view_type,
+			.format = (VkFormat)image.info.format,
+			.subresource_range = ImageSubresourceRange_to_VkImageSubresourceRange(uniform.subresource_range)
+		};
+		VkImageView view = image_view_acquire(view_key);
+
+		// Descriptor may be used by the frame in flight, so the old view is released later
+		uint64_t key = (uint64_t)uniform.binding << 32 | (first_element + i);
+		auto view_it = uniform_set.array_image_views.find(key);
+		if (view_it != uniform_set.array_image_views.end()) {
+			m_actions_after_next_frame->push_back([&, old_view_key = view_it->second]() {
+				image_view_release(old_view_key);
+			});
+		}
+
+		uniform_set.array_image_views[key] = view_key;
+
+		// Array elements aren't tracked on bind, they have to be in shader read layout from now on
+		image_should_have_layout(image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+		VkDescriptorImageInfo image_info{
+			.sampler = m_samplers.at(uniform.ids[2 * i + 1]).sampler,
+			.imageView = view,
+			.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+		};
+
+		image_infos.push_back(image_info);
+	}
+
+	VkWriteDescriptorSet write{
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.dstSet = uniform_set.descriptor_set,
+		.dstBinding = uniform.binding,
+		.dstArrayElement = first_element,
+		.descriptorCount = element_count,
+		.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+		.pImageInfo = image_infos.data()
+	};
+
+	vkUpdateDescriptorSets(m_context->device(), 1, &write, 0, nullptr);
+}
+
 ScreenResolution VulkanGraphicsController::screen_resolution() const {
 	return { m_context->swapchain_extent().width, m_context->swapchain_extent().height };
 }
 
+// Indirect draws rely on first_instance to index per-instance data
+bool VulkanGraphicsController::draw_indirect_supported() const {
+	return m_context->enabled_features().drawIndirectFirstInstance;
+}
+
+bool VulkanGraphicsController::pipeline_statistics_supported() const {
+	return m_context->enabled_features().pipelineStatisticsQuery;
+}
+
 void VulkanGraphicsController::sync() {
 	m_context->sync();
 }
 
-void VulkanGraphicsController::timestamp_query_begin() {
-	m_frames[m_frame_index].timestamp_query_pool.timestamps_written = 0;
-	
-	vkCmdResetQueryPool(m_frames[m_frame_index].setup_buffer, m_frames[m_frame_index].timestamp_query_pool.pool, 0, 64);
+uint32_t VulkanGraphicsController::gpu_scope_begin(std::string_view name) {
+	TimestampQueryPool& query_pool = m_frames[m_frame_index].timestamp_query_pool;
+	query_pool.required_query_count += 2;
+
+	// Scope is dropped for this frame, the pool grows before the frame slot is reused
+	if (query_pool.query_count + 2 > query_pool.capacity)
+		return UINT32_MAX;
+
+	uint32_t scope = (uint32_t)query_pool.scope_names.size();
+	query_pool.scope_names.emplace_back(name);
+
+	vkCmdWriteTimestamp(m_frames[m_frame_index].draw_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool.pool, scope * 2);
+	query_pool.query_count += 2;
+
+	return scope;
 }
 
-void VulkanGraphicsController::timestamp_query_end() {
-	vkGetQueryPoolResults(
-		m_context->device(),
-		m_frames[m_frame_index].timestamp_query_pool.pool,
-		0,
-		64,
-		128 * sizeof(uint64_t),
-		m_frames[m_frame_index].timestamp_query_pool.query_data.data(),
-		0,
-		VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
-	);
+void VulkanGraphicsController::gpu_scope_end(uint32_t scope) {
+	if (scope == UINT32_MAX)
+		return;
+
+	vkCmdWriteTimestamp(m_frames[m_frame_index].draw_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_frames[m_frame_index].timestamp_query_pool.pool, scope * 2 + 1);
+}
+
+const std::vector<GPUScopeTiming>& VulkanGraphicsController::gpu_scope_timings() const {
+	return m_gpu_scope_timings;
 }
 
-void VulkanGraphicsController::timestamp_query_write_timestamp() {
-	if (m_frames[m_frame_index].timestamp_query_pool.timestamps_written >= 64) {
-		std::cout << "Warning: Writing more timestamps than 64\n";
+void VulkanGraphicsController::pipeline_statistics_query_begin(uint32_t query) {
+	StatisticsQueryPool& query_pool = m_frames[m_frame_index].statistics_query_pool;
+	if (query_pool.pool == VK_NULL_HANDLE || query >= StatisticsQueryPool::QUERY_COUNT)
 		return;
-	}
 
-	vkCmdWriteTimestamp(
-		m_frames[m_frame_index].draw_buffer,
-		VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-		m_frames[m_frame_index].timestamp_query_pool.pool,
-		m_frames[m_frame_index].timestamp_query_pool.timestamps_written
-	);
+	// Setup buffer is submitted before draw buffer, so the query is reset by the time it begins
+	vkCmdResetQueryPool(m_frames[m_frame_index].setup_buffer, query_pool.pool, query, 1);
+	vkCmdBeginQuery(m_frames[m_frame_index].draw_buffer, query_pool.pool, query, 0);
+
+	query_pool.used_queries |= 1u << query;
+}
+
+void VulkanGraphicsController::pipeline_statistics_query_end(uint32_t query) {
+	StatisticsQueryPool& query_pool = m_frames[m_frame_index].statistics_query_pool;
+	if (query_pool.pool == VK_NULL_HANDLE || query >= StatisticsQueryPool::QUERY_COUNT)
+		return;
 
-	m_frames[m_frame_index].timestamp_query_pool.timestamps_written++;
+	vkCmdEndQuery(m_frames[m_frame_index].draw_buffer, query_pool.pool, query);
 }
 
-bool VulkanGraphicsController::timestamp_query_get_results(uint64_t* data, uint32_t count) {
-	if (m_frame_count < m_frames.size())
+bool VulkanGraphicsController::pipeline_statistics_query_get_results(uint64_t* data, uint32_t count) {
+	StatisticsQueryPool& query_pool = m_frames[m_frame_index].statistics_query_pool;
+	if (query_pool.pool == VK_NULL_HANDLE || count > StatisticsQueryPool::QUERY_COUNT || m_frame_count < m_frames.size())
 		return false;
 
-	if (count > 64)
-		std::cout << "Warning: Quering timestamps more than max (64): " << count << '\n';
+	uint32_t requested_queries = (1u << count) - 1;
+	if ((query_pool.used_queries & requested_queries) != requested_queries)
+		return false;
+
+	// Value and availability of every query
+	std::array<uint64_t, StatisticsQueryPool::QUERY_COUNT * 2> results;
+	VkResult result = vkGetQueryPoolResults(
+		m_context->device(),
+		query_pool.pool,
+		0,
+		count,
+		results.size() * sizeof(uint64_t),
+		results.data(),
+		2 * sizeof(uint64_t),
+		VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
+	);
 
-	uint64_t multiplier = (uint64_t)m_context->physical_device_props().limits.timestampPeriod;
+	if (result != VK_SUCCESS && result != VK_NOT_READY)
+		return false;
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (results[i * 2 + 1] == 0)
+			return false;
+
+		data[i] = results[i * 2];
+	}
 
-	for (uint32_t i = 0; i < count; i++)
-		data[i] = m_frames[m_frame_index].timestamp_query_pool.query_data[i * 2] * multiplier;
-	
 	return true;
 }
 
@@ -1593,47 +2903,36 @@ VkDeviceMemory VulkanGraphicsController::buffer_allocate(VkBuffer buffer, VkMemo
 	return memory;
 }
 
-void VulkanGraphicsController::buffer_copy(VkBuffer buffer, const void* data, VkDeviceSize size) {
-	VkBuffer staging_buffer = buffer_create(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, size);
-	VkDeviceMemory staging_buffer_memory = buffer_allocate(staging_buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-	void* staging_data = nullptr;
-	vkMapMemory(m_context->device(), staging_buffer_memory, 0, size, 0, &staging_data);
-	memcpy(staging_data, data, size);
-	vkUnmapMemory(m_context->device(), staging_buffer_memory);
+void VulkanGraphicsController::buffer_copy(VkBuffer buffer, const void* data, VkDeviceSize offset, VkDeviceSize size) {
+	StagingAllocation staging = staging_allocate(size);
+	memcpy(staging.data, data, size);
 
 	VkBufferCopy region{
+		.srcOffset = staging.offset,
+		.dstOffset = offset,
 		.size = size
 	};
 
-	vkCmdCopyBuffer(m_frames[m_frame_index].draw_buffer, staging_buffer, buffer, 1, &region);
-
-	staging_buffer_destroy(staging_buffer, staging_buffer_memory);
+	barriers_flush();
+	vkCmdCopyBuffer(m_frames[m_frame_index].draw_buffer, staging.buffer, buffer, 1, &region);
 }
 
-void VulkanGraphicsController::buffer_memory_barrier(VkBuffer& buffer, VkBufferUsageFlags usage, VkDeviceSize offset, VkDeviceSize size) {
-	auto [src_stages, src_access] = buffer_usage_to_pipeline_stages_and_access(usage);
-	auto [dst_stages, dst_access] = buffer_usage_to_pipeline_stages_and_access(usage);
+void VulkanGraphicsController::buffer_memory_barrier(VkBuffer buffer, VkBufferUsageFlags src_usage, VkBufferUsageFlags dst_usage, VkDeviceSize offset, VkDeviceSize size) {
+	auto [src_stages, src_access] = buffer_usage_to_pipeline_stages_and_access(src_usage);
+	auto [dst_stages, dst_access] = buffer_usage_to_pipeline_stages_and_access(dst_usage);
 	
-	VkBufferMemoryBarrier barrier{
-		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+	barrier_add(VkBufferMemoryBarrier2KHR{
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2_KHR,
+		.srcStageMask = src_stages,
 		.srcAccessMask = src_access,
+		.dstStageMask = dst_stages,
 		.dstAccessMask = dst_access,
 		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
 		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
 		.buffer = buffer,
 		.offset = offset,
 		.size = size
-	};
-
-	vkCmdPipelineBarrier(
-		m_frames[m_frame_index].draw_buffer,
-		src_stages, dst_stages,
-		0,
-		0, nullptr,
-		1, &barrier,
-		0, nullptr
-	);
+	});
 }
 
 std::pair<VkBuffer, VkDeviceMemory> VulkanGraphicsController::staging_buffer_create(const void* data, size_t size) {
@@ -1657,6 +2956,60 @@ void VulkanGraphicsController::staging_buffer_destroy(VkBuffer buffer, VkDeviceM
 	});
 }
 
+void VulkanGraphicsController::staging_ring_create(StagingRing& ring, VkDeviceSize capacity) {
+	ring.buffer = buffer_create(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, capacity);
+	ring.memory = buffer_allocate(ring.buffer, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+	if (vkMapMemory(m_context->device(), ring.memory, 0, capacity, 0, (void**)&ring.data) != VK_SUCCESS)
+		throw std::runtime_error("Failed to map staging ring");
+
+	ring.capacity = capacity;
+	ring.offset = 0;
+}
+
+void VulkanGraphicsController::staging_ring_destroy(StagingRing& ring) {
+	VkDevice device = m_context->device();
+
+	// Freeing the memory unmaps it
+	vkDestroyBuffer(device, ring.buffer, nullptr);
+	vkFreeMemory(device, ring.memory, nullptr);
+	ring = {};
+}
+
+void VulkanGraphicsController::staging_ring_reset(Frame& frame) {
+	StagingRing& ring = frame.staging_ring;
+	if (ring.offset > ring.capacity) {
+		VkDeviceSize capacity = ring.capacity;
+		while (capacity < ring.offset)
+			capacity *= 2;
+
+		staging_ring_destroy(ring);
+		staging_ring_create(ring, capacity);
+	}
+
+	ring.offset = 0;
+}
+
+VulkanGraphicsController::StagingAllocation VulkanGraphicsController::staging_allocate(VkDeviceSize size) {
+	StagingRing& ring = m_frames[m_frame_index].staging_ring;
+
+	VkDeviceSize offset = (ring.offset + StagingRing::ALIGNMENT - 1) & ~(StagingRing::ALIGNMENT - 1);
+	ring.offset = offset + size;
+	if (ring.offset <= ring.capacity)
+		return { ring.buffer, offset, ring.data + offset };
+
+	// Ring stays full for the rest of the frame, the offset tells how large it has to grow
+	VkBuffer staging_buffer = buffer_create(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, size);
+	VkDeviceMemory staging_memory = buffer_allocate(staging_buffer, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+
+	uint8_t* staging_data = nullptr;
+	if (vkMapMemory(m_context->device(), staging_memory, 0, size, 0, (void**)&staging_data) != VK_SUCCESS)
+		throw std::runtime_error("Failed to map staging buffer");
+
+	staging_buffer_destroy(staging_buffer, staging_memory);
+
+	return { staging_buffer, 0, staging_data };
+}
+
 VkImage VulkanGraphicsController::vulkan_image_create(ImageViewType view_type, VkFormat format, VkExtent3D extent, uint32_t mip_levels, uint32_t layer_count, VkImageTiling tiling, VkImageUsageFlags usage) {
 	VkImageCreateInfo image_info{
 		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
@@ -1715,6 +3068,45 @@ VkImageView VulkanGraphicsController::vulkan_image_view_create(VkImage image, Vk
 	return image_view;
 }
 
+VkImageView VulkanGraphicsController::image_view_acquire(const ImageViewKey& key) {
+	auto view_it = m_image_views.find(key);
+	if (view_it != m_image_views.end()) {
+		view_it->second.ref_count++;
+		return view_it->second.view;
+	}
+
+	VkImageView view = vulkan_image_view_create(m_images.at(key.image).image, key.view_type, key.format, key.subresource_range);
+	m_image_views[key] = { .view = view, .ref_count = 1 };
+
+	return view;
+}
+
+void VulkanGraphicsController::image_view_release(const ImageViewKey& key) {
+	auto view_it = m_image_views.find(key);
+	if (--view_it->second.ref_count > 0)
+		return;
+
+	vkDestroyImageView(m_context->device(), view_it->second.view, nullptr);
+	m_image_views.erase(view_it);
+}
+
+VulkanGraphicsController::ImageViewKey VulkanGraphicsController::attachment_view_key(ImageId image_id) const {
+	const Image& image = m_images.at(image_id);
+
+	return {
+		.image = image_id,
+		.view_type = (VkImageViewType)image.info.view_type,
+		.format = (VkFormat)image.info.format,
+		.subresource_range = {
+			.aspectMask = image.full_aspect,
+			.baseMipLevel = 0,
+			.levelCount = 1,
+			.baseArrayLayer = 0,
+			.layerCount = 1
+		}
+	};
+}
+
 void VulkanGraphicsController::vulkan_copy_buffer_to_image(VkBuffer buffer, VkImage image, VkImageLayout layout, const VkImageSubresourceLayers& image_subresource, VkOffset3D offset, VkExtent3D extent) {
 	VkBufferImageCopy region{
 		.bufferOffset = 0,
@@ -1725,6 +3117,7 @@ void VulkanGraphicsController::vulkan_copy_buffer_to_image(VkBuffer buffer, VkIm
 		.imageExtent = extent
 	};
 
+	barriers_flush();
 	vkCmdCopyBufferToImage(m_frames[m_frame_index].draw_buffer, buffer, image, layout, 1, &region);
 }
 
@@ -1737,6 +3130,7 @@ void VulkanGraphicsController::vulkan_copy_image_to_image(VkImage src_image, VkI
 		.extent = extent
 	};
 	
+	barriers_flush();
 	vkCmdCopyImage(m_frames[m_frame_index].draw_buffer, src_image, src_image_layout, dst_image, dst_image_layout, 1, &region);
 }
 
@@ -1750,35 +3144,298 @@ void VulkanGraphicsController::image_should_have_layout(Image& image, VkImageLay
 			.layerCount = image.info.array_layers
 		};
 
-		vulkan_image_memory_barrier(image.image, image.current_layout, layout, subresource_range);
-		image.current_layout = layout;
+		vulkan_image_memory_barrier(image.image, image.current_layout, layout, subresource_range);
+		image.current_layout = layout;
+	}
+}
+
+VkQueryPool VulkanGraphicsController::timestamp_query_pool_create(uint32_t query_count) {
+	VkQueryPoolCreateInfo query_pool_create_info{
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.queryType = VK_QUERY_TYPE_TIMESTAMP,
+		.queryCount = query_count
+	};
+
+	VkQueryPool pool;
+	if (vkCreateQueryPool(m_context->device(), &query_pool_create_info, nullptr, &pool) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create timestamp query pool");
+
+	return pool;
+}
+
+void VulkanGraphicsController::timestamp_queries_read(Frame& frame) {
+	MY_PROFILE_FUNCTION();
+
+	TimestampQueryPool& query_pool = frame.timestamp_query_pool;
+	VkDevice device = m_context->device();
+
+	if (query_pool.query_count > 0) {
+		// Value and availability of every query, scopes which were never ended stay unavailable
+		std::vector<uint64_t> results(query_pool.query_count * 2);
+		VkResult result = vkGetQueryPoolResults(
+			device,
+			query_pool.pool,
+			0,
+			query_pool.query_count,
+			results.size() * sizeof(uint64_t),
+			results.data(),
+			2 * sizeof(uint64_t),
+			VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
+		);
+
+		if (result == VK_SUCCESS || result == VK_NOT_READY) {
+			auto available = [&](uint32_t query) { return results[query * 2 + 1] != 0; };
+			auto timestamp = [&](uint32_t query) { return results[query * 2]; };
+
+			std::optional<uint64_t> frame_begin;
+			for (uint32_t scope = 0; scope < query_pool.scope_names.size(); scope++) {
+				if (available(scope * 2))
+					frame_begin = std::min(frame_begin.value_or(UINT64_MAX), timestamp(scope * 2));
+			}
+
+			// Nanoseconds per tick, it isn't a whole number on some GPUs
+			double period = (double)m_context->physical_device_props().limits.timestampPeriod;
+
+			// GPU timestamp and CPU trace time of the same moment. Without calibration the GPU can't have
+			// started before the frame was submitted, so its first timestamp is placed there
+			uint64_t gpu_base = frame_begin.value_or(0);
+			double cpu_base = (double)query_pool.submit_time;
+			if (m_context->calibrated_timestamps()) {
+				std::array<VkCalibratedTimestampInfoEXT, 2> timestamp_infos{};
+				timestamp_infos[0] = {
+					.sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT,
+					.timeDomain = VK_TIME_DOMAIN_DEVICE_EXT
+				};
+				timestamp_infos[1] = {
+					.sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT,
+					.timeDomain = VulkanContext::HOST_TIME_DOMAIN
+				};
+
+				// Falls back to the submit time when every sample deviates too much
+				for (uint32_t attempt = 0; attempt < TimestampQueryPool::CALIBRATION_ATTEMPTS; attempt++) {
+					std::array<uint64_t, 2> timestamps;
+					uint64_t max_deviation;
+					if (m_context->get_calibrated_timestamps()(device, (uint32_t)timestamp_infos.size(), timestamp_infos.data(), timestamps.data(), &max_deviation) != VK_SUCCESS)
+						break;
+
+					if (max_deviation <= TimestampQueryPool::MAX_CALIBRATION_DEVIATION) {
+						gpu_base = timestamps[0];
+						cpu_base = m_context->host_timestamp_to_us(timestamps[1]);
+						break;
+					}
+				}
+			}
+
+			m_gpu_scope_timings.clear();
+			for (uint32_t scope = 0; scope < query_pool.scope_names.size(); scope++) {
+				if (!available(scope * 2) || !available(scope * 2 + 1))
+					continue;
+
+				uint64_t begin = timestamp(scope * 2);
+				uint64_t end = timestamp(scope * 2 + 1);
+				double duration = (double)(end - begin) * period;
+
+				m_gpu_scope_timings.push_back({
+					.name = query_pool.scope_names[scope],
+					.start = (double)(begin - frame_begin.value()) * period / 1'000'000,
+					.duration = duration / 1'000'000
+				});
+
+#if defined(PROFILE_ENABLE)
+				// Trace is in microseconds
+				double trace_start = cpu_base + (double)(int64_t)(begin - gpu_base) * period / 1'000;
+				CPUProfiler::write_gpu_event(query_pool.scope_names[scope], trace_start, duration / 1'000);
+#endif
+			}
+		}
+	}
+
+	// Fence of the frame was waited for, so the pool can be replaced right away
+	if (query_pool.required_query_count > query_pool.capacity) {
+		uint32_t capacity = query_pool.capacity;
+		while (capacity < query_pool.required_query_count)
+			capacity *= 2;
+
+		vkDestroyQueryPool(device, query_pool.pool, nullptr);
+		query_pool.pool = timestamp_query_pool_create(capacity);
+		query_pool.capacity = capacity;
+	}
+
+	// Setup buffer is submitted before draw buffer, so queries are reset by the time they are written
+	vkCmdResetQueryPool(frame.setup_buffer, query_pool.pool, 0, query_pool.capacity);
+
+	query_pool.query_count = 0;
+	query_pool.required_query_count = 0;
+	query_pool.scope_names.clear();
+}
+
+void VulkanGraphicsController::vulkan_image_memory_barrier(VkImage image, VkImageLayout old_layout, VkImageLayout new_layout, const VkImageSubresourceRange& image_subresource) {
+	auto [src_stages, src_access] = image_layout_to_pipeline_stages_and_access(old_layout);
+	auto [dst_stages, dst_access] = image_layout_to_pipeline_stages_and_access(new_layout);
+
+	barrier_add(VkImageMemoryBarrier2KHR{
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR,
+		.srcStageMask = src_stages,
+		.srcAccessMask = src_access,
+		.dstStageMask = dst_stages,
+		.dstAccessMask = dst_access,
+		.oldLayout = old_layout,
+		.newLayout = new_layout,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = image,
+		.subresourceRange = image_subresource
+	});
+}
+
+void VulkanGraphicsController::barrier_add(const VkMemoryBarrier2KHR& barrier) {
+	m_barriers.memory_barriers.push_back(barrier);
+}
+
+// Barriers of one batch aren't ordered with each other, so another barrier of the same range is chained
+// into the pending one. Nothing used the range in between, otherwise the batch would have been flushed
+void VulkanGraphicsController::barrier_add(const VkBufferMemoryBarrier2KHR& barrier) {
+	for (VkBufferMemoryBarrier2KHR& pending : m_barriers.buffer_barriers) {
+		if (pending.buffer != barrier.buffer)
+			continue;
+
+		// Different range of the same buffer can't be chained, pending barriers are issued first
+		if (pending.offset != barrier.offset || pending.size != barrier.size) {
+			barriers_flush();
+			break;
+		}
+
+		pending.srcStageMask |= barrier.srcStageMask;
+		pending.srcAccessMask |= barrier.srcAccessMask;
+		pending.dstStageMask = barrier.dstStageMask;
+		pending.dstAccessMask = barrier.dstAccessMask;
+		return;
+	}
+
+	m_barriers.buffer_barriers.push_back(barrier);
+}
+
+void VulkanGraphicsController::barrier_add(const VkImageMemoryBarrier2KHR& barrier) {
+	auto same_range = [](const VkImageSubresourceRange& a, const VkImageSubresourceRange& b) {
+		return a.aspectMask == b.aspectMask && a.baseMipLevel == b.baseMipLevel && a.levelCount == b.levelCount &&
+			a.baseArrayLayer == b.baseArrayLayer && a.layerCount == b.layerCount;
+	};
+
+	for (VkImageMemoryBarrier2KHR& pending : m_barriers.image_barriers) {
+		if (pending.image != barrier.image)
+			continue;
+
+		if (!same_range(pending.subresourceRange, barrier.subresourceRange)) {
+			barriers_flush();
+			break;
+		}
+
+		pending.srcStageMask |= barrier.srcStageMask;
+		pending.srcAccessMask |= barrier.srcAccessMask;
+		pending.dstStageMask = barrier.dstStageMask;
+		pending.dstAccessMask = barrier.dstAccessMask;
+		pending.newLayout = barrier.newLayout;
+		// Discarding transition stays discarding
+		if (barrier.oldLayout == VK_IMAGE_LAYOUT_UNDEFINED)
+			pending.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		return;
 	}
+
+	m_barriers.image_barriers.push_back(barrier);
 }
 
-void VulkanGraphicsController::vulkan_image_memory_barrier(VkImage image, VkImageLayout old_layout, VkImageLayout new_layout, const VkImageSubresourceRange& image_subresource) {
-	auto [src_stages, src_access] = image_layout_to_pipeline_stages_and_access(old_layout);
-	auto [dst_stages, dst_access] = image_layout_to_pipeline_stages_and_access(new_layout);
+void VulkanGraphicsController::barriers_flush() {
+	BarrierBatch& batch = m_barriers;
+	if (batch.memory_barriers.empty() && batch.buffer_barriers.empty() && batch.image_barriers.empty())
+		return;
 
-	VkImageMemoryBarrier barrier{
-		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-		.srcAccessMask = src_access,
-		.dstAccessMask = dst_access,
-		.oldLayout = old_layout,
-		.newLayout = new_layout,
-		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-		.image = image,
-		.subresourceRange = image_subresource
-	};
+	VkCommandBuffer command_buffer = m_frames[m_frame_index].draw_buffer;
 
-	vkCmdPipelineBarrier(
-		m_frames[m_frame_index].draw_buffer,
-		src_stages, dst_stages,
-		0,
-		0, nullptr,
-		0, nullptr,
-		1, &barrier
-	);
+	m_frame_barrier_stats.barriers += (uint32_t)(batch.memory_barriers.size() + batch.buffer_barriers.size() + batch.image_barriers.size());
+	m_frame_barrier_stats.batches++;
+
+	if (m_context->synchronization2()) {
+		VkDependencyInfoKHR dependency_info{
+			.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR,
+			.memoryBarrierCount = (uint32_t)batch.memory_barriers.size(),
+			.pMemoryBarriers = batch.memory_barriers.data(),
+			.bufferMemoryBarrierCount = (uint32_t)batch.buffer_barriers.size(),
+			.pBufferMemoryBarriers = batch.buffer_barriers.data(),
+			.imageMemoryBarrierCount = (uint32_t)batch.image_barriers.size(),
+			.pImageMemoryBarriers = batch.image_barriers.data()
+		};
+
+		m_context->cmd_pipeline_barrier_2()(command_buffer, &dependency_info);
+	} else {
+		// One barrier command has one pair of stage masks, so barriers share the union of their stages.
+		// Masks are built from Vulkan 1.0 bits, which keep their values in synchronization2
+		VkPipelineStageFlags src_stages = 0;
+		VkPipelineStageFlags dst_stages = 0;
+
+		std::vector<VkMemoryBarrier> memory_barriers;
+		memory_barriers.reserve(batch.memory_barriers.size());
+		for (const VkMemoryBarrier2KHR& barrier : batch.memory_barriers) {
+			src_stages |= (VkPipelineStageFlags)barrier.srcStageMask;
+			dst_stages |= (VkPipelineStageFlags)barrier.dstStageMask;
+
+			memory_barriers.push_back({
+				.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+				.srcAccessMask = (VkAccessFlags)barrier.srcAccessMask,
+				.dstAccessMask = (VkAccessFlags)barrier.dstAccessMask
+			});
+		}
+
+		std::vector<VkBufferMemoryBarrier> buffer_barriers;
+		buffer_barriers.reserve(batch.buffer_barriers.size());
+		for (const VkBufferMemoryBarrier2KHR& barrier : batch.buffer_barriers) {
+			src_stages |= (VkPipelineStageFlags)barrier.srcStageMask;
+			dst_stages |= (VkPipelineStageFlags)barrier.dstStageMask;
+
+			buffer_barriers.push_back({
+				.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+				.srcAccessMask = (VkAccessFlags)barrier.srcAccessMask,
+				.dstAccessMask = (VkAccessFlags)barrier.dstAccessMask,
+				.srcQueueFamilyIndex = barrier.srcQueueFamilyIndex,
+				.dstQueueFamilyIndex = barrier.dstQueueFamilyIndex,
+				.buffer = barrier.buffer,
+				.offset = barrier.offset,
+				.size = barrier.size
+			});
+		}
+
+		std::vector<VkImageMemoryBarrier> image_barriers;
+		image_barriers.reserve(batch.image_barriers.size());
+		for (const VkImageMemoryBarrier2KHR& barrier : batch.image_barriers) {
+			src_stages |= (VkPipelineStageFlags)barrier.srcStageMask;
+			dst_stages |= (VkPipelineStageFlags)barrier.dstStageMask;
+
+			image_barriers.push_back({
+				.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+				.srcAccessMask = (VkAccessFlags)barrier.srcAccessMask,
+				.dstAccessMask = (VkAccessFlags)barrier.dstAccessMask,
+				.oldLayout = barrier.oldLayout,
+				.newLayout = barrier.newLayout,
+				.srcQueueFamilyIndex = barrier.srcQueueFamilyIndex,
+				.dstQueueFamilyIndex = barrier.dstQueueFamilyIndex,
+				.image = barrier.image,
+				.subresourceRange = barrier.subresourceRange
+			});
+		}
+
+		vkCmdPipelineBarrier(
+			command_buffer,
+			src_stages != 0 ? src_stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			dst_stages != 0 ? dst_stages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			0,
+			(uint32_t)memory_barriers.size(), memory_barriers.data(),
+			(uint32_t)buffer_barriers.size(), buffer_barriers.data(),
+			(uint32_t)image_barriers.size(), image_barriers.data()
+		);
+	}
+
+	batch.memory_barriers.clear();
+	batch.buffer_barriers.clear();
+	batch.image_barriers.clear();
 }
 
 void VulkanGraphicsController::staging_image_destroy(VkImage image, VkDeviceMemory memory) {
@@ -1802,26 +3459,321 @@ uint32_t VulkanGraphicsController::find_memory_type(uint32_t type_filter, VkMemo
 	throw std::runtime_error("Failed to find suitable memory type");
 }
 
-size_t VulkanGraphicsController::descriptor_pool_allocate(const DescriptorPoolKey& key) {
-	if (!m_descriptor_pools.contains(key)) {
-		m_descriptor_pools[key] = {};
+VulkanGraphicsController::PipelineCacheFileHeader VulkanGraphicsController::pipeline_cache_file_header() const {
+	const VkPhysicalDeviceProperties& props = m_context->physical_device_props();
+
+	PipelineCacheFileHeader header{
+		.magic = PipelineCacheFileHeader::MAGIC,
+		.vendor_id = props.vendorID,
+		.device_id = props.deviceID,
+		.driver_version = props.driverVersion,
+		.data_size = 0,
+		.data_hash = 0
+	};
+	memcpy(header.pipeline_cache_uuid, props.pipelineCacheUUID, VK_UUID_SIZE);
+
+	return header;
+}
+
+void VulkanGraphicsController::pipeline_cache_create() {
+	MY_PROFILE_FUNCTION();
+
+	PipelineCacheFileHeader expected_header = pipeline_cache_file_header();
+	std::vector<uint8_t> data;
+
+	std::ifstream file;
+	if (!m_pipeline_cache_path.empty())
+		file.open(m_pipeline_cache_path, std::ios::binary | std::ios::ate);
+
+	if (file.is_open()) {
+		size_t file_size = (size_t)file.tellg();
+		file.seekg(0);
+
+		// Everything up to data size identifies the device and driver the cache was written by
+		PipelineCacheFileHeader header;
+		bool header_valid =
+			file_size >= sizeof(header) &&
+			file.read((char*)&header, sizeof(header)) &&
+			memcmp(&header, &expected_header, offsetof(PipelineCacheFileHeader, data_size)) == 0 &&
+			header.data_size == file_size - sizeof(header);
+
+		if (header_valid) {
+			data.resize(header.data_size);
+			file.read((char*)data.data(), data.size());
+
+			if (!file || hash_bytes(data.data(), data.size()) != header.data_hash)
+				data.clear();
+		}
+
+		// Driver header in the blob has to agree too
+		VkPipelineCacheHeaderVersionOne vk_header;
+		if (data.size() >= sizeof(vk_header)) {
+			memcpy(&vk_header, data.data(), sizeof(vk_header));
+
+			if (vk_header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+				vk_header.vendorID != expected_header.vendor_id ||
+				vk_header.deviceID != expected_header.device_id ||
+				memcmp(vk_header.pipelineCacheUUID, expected_header.pipeline_cache_uuid, VK_UUID_SIZE) != 0)
+				data.clear();
+		} else
+			data.clear();
+
+		if (data.empty())
+			std::cout << "Pipeline cache " << m_pipeline_cache_path << " doesn't match the device, pipelines are compiled from scratch\n";
+	}
+
+	VkPipelineCacheCreateInfo cache_info{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+		.initialDataSize = data.size(),
+		.pInitialData = data.empty() ? nullptr : data.data()
+	};
+
+	if (vkCreatePipelineCache(m_context->device(), &cache_info, nullptr, &m_pipeline_cache) != VK_SUCCESS) {
+		// Driver may still reject the data, start empty then
+		cache_info.initialDataSize = 0;
+		cache_info.pInitialData = nullptr;
+		data.clear();
+
+		if (vkCreatePipelineCache(m_context->device(), &cache_info, nullptr, &m_pipeline_cache) != VK_SUCCESS)
+			throw std::runtime_error("Failed to create pipeline cache");
+	}
+
+	m_pipeline_cache_warm = !data.empty();
+}
+
+void VulkanGraphicsController::pipeline_cache_save() {
+	MY_PROFILE_FUNCTION();
+
+	if (m_pipeline_cache_path.empty())
+		return;
+
+	VkDevice device = m_context->device();
+
+	size_t data_size = 0;
+	if (vkGetPipelineCacheData(device, m_pipeline_cache, &data_size, nullptr) != VK_SUCCESS)
+		return;
+
+	std::vector<uint8_t> data(data_size);
+	if (vkGetPipelineCacheData(device, m_pipeline_cache, &data_size, data.data()) != VK_SUCCESS)
+		return;
+	data.resize(data_size);
+
+	PipelineCacheFileHeader header = pipeline_cache_file_header();
+	header.data_size = data.size();
+	header.data_hash = hash_bytes(data.data(), data.size());
+
+	// Written beside and renamed over, so an interrupted save never leaves a half written cache
+	std::filesystem::path path = m_pipeline_cache_path;
+	std::filesystem::path temp_path = path;
+	temp_path += ".tmp";
+
+	{
+		std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)data.data(), data.size());
+
+		if (!file) {
+			std::cout << "Failed to write pipeline cache " << temp_path << "\n";
+			return;
+		}
 	}
 
-	std::unordered_map<RenderId, DescriptorPool>& pools = m_descriptor_pools.at(key);
+	std::error_code error;
+	std::filesystem::rename(temp_path, path, error);
+	if (error)
+		std::cout << "Failed to save pipeline cache " << path << ": " << error.message() << "\n";
+}
+
+VulkanGraphicsController::UniformWrites VulkanGraphicsController::uniform_writes_create(SetInfo& set, const UniformInfo* uniforms, size_t uniform_count) {
+	UniformWrites uniform_writes;
+
+	for (uint32_t i = 0; i < uniform_count; i++) {
+		const auto& uniform = uniforms[i];
+		auto binding_it = set.find_binding(uniform.binding);
+		
+		if (binding_it == set.bindings.end())
+			throw std::runtime_error("No binding found");
+
+		VkWriteDescriptorSet write{
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstBinding = binding_it->binding,
+			.dstArrayElement = 0
+		};
+
+		switch (uniform.type) {
+		case UniformType::Sampler: {
+			throw std::runtime_error("UniformType not supported");
+		}
+		case UniformType::CombinedImageSampler: {
+			std::vector<VkDescriptorImageInfo> image_infos;
+			UniformSetImages binding_images{ .storage = false };
+
+			for (size_t j = 0; j < uniform.id_count; j += 2) {
+				Image& image = m_images.at(uniform.ids[j]);
+
+				VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+				if (uniform.subresource_range.aspect == ImageAspectColor)
+					layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+				else
+					layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+				
+				ImageViewKey view_key{
+					.image = uniform.ids[j],
+					.view_type = (VkImageViewType)image.info.view_type,
+					.format = (VkFormat)image.info.format,
+					.subresource_range = ImageSubresourceRange_to_VkImageSubresourceRange(uniform.subresource_range)
+				};
+				VkImageView view = image_view_acquire(view_key);
+				binding_images.views.push_back(view_key);
+
+				VkDescriptorImageInfo image_info{
+					.sampler = m_samplers[uniform.ids[j + 1]].sampler,
+					.imageView = view,
+					.imageLayout = layout
+				};
+
+				image_infos.push_back(image_info);
+			}
+
+			write.descriptorCount = uniform.id_count / 2;
+			write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			write.pImageInfo = image_infos.data();
+
+			uniform_writes.image_infos.push_back(std::move(image_infos));
+			uniform_writes.binding_images[uniform.binding] = std::move(binding_images);
+
+			break;
+		}
+		case UniformType::SampledImage: {
+			throw std::runtime_error("UniformType not supported");
+		}
+		case UniformType::StorageImage: {
+			std::vector<VkDescriptorImageInfo> image_infos;
+			UniformSetImages binding_images{ .storage = true };
+
+			for (size_t j = 0; j < uniform.id_count; j++) {
+				Image& image = m_images.at(uniform.ids[j]);
+
+				ImageViewKey view_key{
+					.image = uniform.ids[j],
+					.view_type = image.info.view_type == ImageViewType::Cube ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : (VkImageViewType)image.info.view_type,
+					.format = (VkFormat)image.info.format,
+					.subresource_range = ImageSubresourceRange_to_VkImageSubresourceRange(uniform.subresource_range)
+				};
+				VkImageView view = image_view_acquire(view_key);
+				binding_images.views.push_back(view_key);
+
+				VkDescriptorImageInfo image_info{
+					.sampler = VK_NULL_HANDLE,
+					.imageView = view,
+					.imageLayout = VK_IMAGE_LAYOUT_GENERAL
+				};
+
+				image_infos.push_back(image_info);
+			}
+
+			write.descriptorCount = uniform.id_count;
+			write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			write.pImageInfo = image_infos.data();
+
+			uniform_writes.image_infos.push_back(std::move(image_infos));
+			uniform_writes.binding_images[uniform.binding] = std::move(binding_images);
+
+			break;
+		}
+		case UniformType::UniformBuffer: {
+			std::vector<VkDescriptorBufferInfo> buffer_infos;
+
+			for (size_t j = 0; j < uniform.id_count; j++) {
+				Buffer& buffer = m_buffers.at(uniform.ids[j]);
+
+				VkDescriptorBufferInfo buffer_info{
+					.buffer = buffer.buffer,
+					.offset = 0,
+					.range = VK_WHOLE_SIZE
+				};
+
+				buffer_infos.push_back(buffer_info);
+			}
+
+			write.descriptorCount = uniform.id_count;
+			write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			write.pBufferInfo = buffer_infos.data();
+			
+			uniform_writes.buffer_infos.push_back(std::move(buffer_infos));
+
+			break;
+		}
+		case UniformType::StorageBuffer: {
+			std::vector<VkDescriptorBufferInfo> buffer_infos;
+
+			for (size_t j = 0; j < uniform.id_count; j++) {
+				Buffer& buffer = m_buffers.at(uniform.ids[j]);
+
+				VkDescriptorBufferInfo buffer_info{
+					.buffer = buffer.buffer,
+					.offset = 0,
+					.range = VK_WHOLE_SIZE
+				};
+
+				buffer_infos.push_back(buffer_info);
+			}
 
-	for (auto& pool : pools) {
-		if (pool.second.usage_count < MAX_SETS_PER_DESCRIPTOR_POOL) {
-			pool.second.usage_count++;
-			return pool.first;
+			write.descriptorCount = uniform.id_count;
+			write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			write.pBufferInfo = buffer_infos.data();
+
+			uniform_writes.buffer_infos.push_back(std::move(buffer_infos));
+
+			break;
+		}
 		}
+
+		uniform_writes.pool_key.uniform_type_counts[(uint32_t)uniform.type] += write.descriptorCount;
+
+		uniform_writes.writes.push_back(write);
 	}
 
+	return uniform_writes;
+}
+
+void VulkanGraphicsController::uniform_set_track_images(UniformSet& uniform_set) {
+	uniform_set.images.clear();
+	uniform_set.storage_images.clear();
+
+	for (const auto& binding_images : uniform_set.binding_images) {
+		std::vector<ImageId>& images = binding_images.second.storage ? uniform_set.storage_images : uniform_set.images;
+		for (const ImageViewKey& view_key : binding_images.second.views)
+			images.push_back(view_key.image);
+	}
+}
+
+size_t VulkanGraphicsController::descriptor_pool_allocate(const DescriptorPoolKey& key, size_t set_count) {
+	DescriptorPools& key_pools = m_descriptor_pools[key];
+
+	// Only pools with free sets are searched, the newest first
+	for (auto it = key_pools.available.rbegin(); it != key_pools.available.rend(); it++) {
+		DescriptorPool& pool = key_pools.pools.at(*it);
+		if (pool.capacity - pool.usage_count < set_count)
+			continue;
+
+		RenderId pool_id = *it;
+		pool.usage_count += set_count;
+		if (pool.usage_count == pool.capacity)
+			key_pools.available.erase(std::next(it).base());
+
+		return pool_id;
+	}
+
+	size_t capacity = std::max(key_pools.next_capacity, set_count);
+	key_pools.next_capacity = std::min(key_pools.next_capacity * 2, MAX_SETS_PER_DESCRIPTOR_POOL);
+
 	std::vector<VkDescriptorPoolSize> sizes;
 
 	if (key.uniform_type_counts[(uint32_t)UniformType::Sampler]) {
 		VkDescriptorPoolSize size{
 			.type = VK_DESCRIPTOR_TYPE_SAMPLER,
-			.descriptorCount = key.uniform_type_counts[(uint32_t)UniformType::Sampler] * MAX_SETS_PER_DESCRIPTOR_POOL
+			.descriptorCount = key.uniform_type_counts[(uint32_t)UniformType::Sampler] * (uint32_t)capacity
 		};
 
 		sizes.push_back(size);
@@ -1829,7 +3781,7 @@ size_t VulkanGraphicsController::descriptor_pool_allocate(const DescriptorPoolKe
 	if (key.uniform_type_counts[(uint32_t)UniformType::CombinedImageSampler]) {
 		VkDescriptorPoolSize size{
 			.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-			.descriptorCount = key.uniform_type_counts[(uint32_t)UniformType::CombinedImageSampler] * MAX_SETS_PER_DESCRIPTOR_POOL
+			.descriptorCount = key.uniform_type_counts[(uint32_t)UniformType::CombinedImageSampler] * (uint32_t)capacity
 		};
 
 		sizes.push_back(size);
@@ -1837,7 +3789,15 @@ size_t VulkanGraphicsController::descriptor_pool_allocate(const DescriptorPoolKe
 	if (key.uniform_type_counts[(uint32_t)UniformType::SampledImage]) {
 		VkDescriptorPoolSize size{
 			.type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
-			.descriptorCount = key.uniform_type_counts[(uint32_t)UniformType::SampledImage] * MAX_SETS_PER_DESCRIPTOR_POOL
+			.descriptorCount = key.uniform_type_counts[(uint32_t)UniformType::SampledImage] * (uint32_t)capacity
+		};
+
+		sizes.push_back(size);
+	}
+	if (key.uniform_type_counts[(uint32_t)UniformType::StorageImage]) {
+		VkDescriptorPoolSize size{
+			.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+			.descriptorCount = key.uniform_type_counts[(uint32_t)UniformType::StorageImage] * (uint32_t)capacity
 		};
 
 		sizes.push_back(size);
@@ -1845,7 +3805,15 @@ size_t VulkanGraphicsController::descriptor_pool_allocate(const DescriptorPoolKe
 	if (key.uniform_type_counts[(uint32_t)UniformType::UniformBuffer]) {
 		VkDescriptorPoolSize size{
 			.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-			.descriptorCount = key.uniform_type_counts[(uint32_t)UniformType::UniformBuffer] * MAX_SETS_PER_DESCRIPTOR_POOL
+			.descriptorCount = key.uniform_type_counts[(uint32_t)UniformType::UniformBuffer] * (uint32_t)capacity
+		};
+
+		sizes.push_back(size);
+	}
+	if (key.uniform_type_counts[(uint32_t)UniformType::StorageBuffer]) {
+		VkDescriptorPoolSize size{
+			.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = key.uniform_type_counts[(uint32_t)UniformType::StorageBuffer] * (uint32_t)capacity
 		};
 
 		sizes.push_back(size);
@@ -1854,7 +3822,7 @@ size_t VulkanGraphicsController::descriptor_pool_allocate(const DescriptorPoolKe
 	VkDescriptorPoolCreateInfo pool_info{
 		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
 		.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
-		.maxSets = MAX_SETS_PER_DESCRIPTOR_POOL,
+		.maxSets = (uint32_t)capacity,
 		.poolSizeCount = (uint32_t)sizes.size(),
 		.pPoolSizes = sizes.data()
 	};
@@ -1865,24 +3833,100 @@ size_t VulkanGraphicsController::descriptor_pool_allocate(const DescriptorPoolKe
 
 	DescriptorPool desc_pool{
 		.pool = pool,
-		.usage_count = 1
+		.usage_count = set_count,
+		.capacity = capacity
 	};
 
-	pools[m_render_id] = std::move(desc_pool);
+	key_pools.pools[m_render_id] = std::move(desc_pool);
+	if (set_count < capacity)
+		key_pools.available.push_back(m_render_id);
+
 	return m_render_id++;
 }
 
+VkDescriptorPool VulkanGraphicsController::update_after_bind_pool_create(const SetInfo& set) {
+	std::vector<VkDescriptorPoolSize> sizes;
+	sizes.reserve(set.bindings.size());
+
+	for (const VkDescriptorSetLayoutBinding& binding : set.bindings) {
+		VkDescriptorPoolSize size{
+			.type = binding.descriptorType,
+			.descriptorCount = binding.descriptorCount
+		};
+
+		sizes.push_back(size);
+	}
+
+	VkDescriptorPoolCreateInfo pool_info{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+		.maxSets = 1,
+		.poolSizeCount = (uint32_t)sizes.size(),
+		.pPoolSizes = sizes.data()
+	};
+
+	VkDescriptorPool pool;
+	if (vkCreateDescriptorPool(m_context->device(), &pool_info, nullptr, &pool) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create descriptor pool");
+
+	return pool;
+}
+
 void VulkanGraphicsController::descriptor_pool_free(const DescriptorPoolKey& pool_key, RenderId pool_id) {
-	auto& pools = m_descriptor_pools.at(pool_key);
-	DescriptorPool& pool = pools.at(pool_id);
+	DescriptorPools& key_pools = m_descriptor_pools.at(pool_key);
+	DescriptorPool& pool = key_pools.pools.at(pool_id);
 
+	if (pool.usage_count == pool.capacity)
+		key_pools.available.push_back(pool_id);
 	pool.usage_count--;
 
 	if (pool.usage_count <= 0) {
 		vkDestroyDescriptorPool(m_context->device(), pool.pool, nullptr);
-		pools.erase(pool_id);
+		key_pools.available.erase(std::find(key_pools.available.begin(), key_pools.available.end(), pool_id));
+		key_pools.pools.erase(pool_id);
 	}
 
-	if (pools.empty())
+	if (key_pools.pools.empty())
 		m_descriptor_pools.erase(pool_key);
+}
+
+VkDescriptorPool VulkanGraphicsController::transient_pool_create() {
+	std::array<VkDescriptorPoolSize, 4> sizes = { {
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, TRANSIENT_DESCRIPTORS_PER_POOL },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, TRANSIENT_DESCRIPTORS_PER_POOL },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, TRANSIENT_DESCRIPTORS_PER_POOL },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, TRANSIENT_DESCRIPTORS_PER_POOL }
+	} };
+
+	// Sets are never freed one by one, the whole pool is reset
+	VkDescriptorPoolCreateInfo pool_info{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.maxSets = TRANSIENT_SETS_PER_POOL,
+		.poolSizeCount = (uint32_t)sizes.size(),
+		.pPoolSizes = sizes.data()
+	};
+
+	VkDescriptorPool pool;
+	if (vkCreateDescriptorPool(m_context->device(), &pool_info, nullptr, &pool) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create descriptor pool");
+
+	return pool;
+}
+
+void VulkanGraphicsController::transient_sets_reset(Frame& frame) {
+	for (UniformSetId uniform_set_id : frame.transient_sets) {
+		UniformSet& uniform_set = m_uniform_sets.at(uniform_set_id);
+		for (const auto& binding_images : uniform_set.binding_images) {
+			for (const ImageViewKey& view_key : binding_images.second.views)
+				image_view_release(view_key);
+		}
+
+		m_uniform_sets.erase(uniform_set_id);
+	}
+	frame.transient_sets.clear();
+
+	size_t used_pool_count = std::min(frame.transient_pool_idx + 1, frame.transient_pools.size());
+	for (size_t i = 0; i < used_pool_count; i++)
+		vkResetDescriptorPool(m_context->device(), frame.transient_pools[i], 0);
+	frame.transient_pool_idx = 0;
 }
\ No newline at end of file
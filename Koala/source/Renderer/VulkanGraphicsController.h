@@ -3,16 +3,35 @@
 #include "Common.h"
 #include "VulkanContext.h"
 
+#include <array>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <future>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <utility>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
 #include <vector>
 #include <unordered_map>
 
 #include <glm/glm.hpp>
 
+// Reflects SPIR-V at runtime, without it shaders need reflection baked into a shader bundle.
+// Release builds leave SPIRV-Reflect out and only load the bundle baked by compile.bat
+#if defined(NDEBUG) && !defined(SHADER_REFLECTION_DISABLE)
+#define SHADER_REFLECTION_DISABLE
+#endif
+
+#if !defined(SHADER_REFLECTION_DISABLE)
+#define SHADER_REFLECTION_ENABLE
+#endif
+
 using RenderPassId = RenderId;
 using FramebufferId = RenderId;
 using ImageId = RenderId;
@@ -21,12 +40,14 @@ using ShaderId = RenderId;
 using PipelineId = RenderId;
 using SamplerId = RenderId;
 using UniformSetId = RenderId;
+using MemoryId = RenderId;
 
 enum ImageUsageFlagBits {
 	ImageUsageNone = 0,
 	ImageUsageTransferSrc = 1,
 	ImageUsageTransferDst = 2,
 	//ImageUsageSampled = 4,
+	ImageUsageStorage = 8, // Written and read by compute shaders in general layout
 	ImageUsageColorSampled = 0x100000,
 	ImageUsageDepthSampled = 0x200000,
 	//ImageUsageStencliSampled = 0x400000,
@@ -252,6 +273,32 @@ struct ColorBlendState {
 	float blend_constants[4];
 };
 
+enum class PipelineCompile {
+	Async, // Compilation starts on a worker thread right away
+	Lazy // Compilation starts on a worker thread when the pipeline is first queried or bound
+};
+
+struct PipelineLookupStats {
+	uint32_t hits = 0; // Requests given an existing pipeline
+	uint32_t misses = 0; // Requests which created a pipeline
+};
+
+struct SamplerLookupStats {
+	uint32_t hits = 0; // Requests given an existing sampler
+	uint32_t misses = 0; // Requests which created a sampler
+};
+
+struct GPUScopeTiming {
+	std::string name;
+	double start; // Milliseconds since the first scope of the frame began
+	double duration; // Milliseconds
+};
+
+struct BarrierStats {
+	uint32_t barriers = 0; // Image, buffer and memory barriers after chaining
+	uint32_t batches = 0; // Barrier commands they were issued with
+};
+
 struct PipelineInfo {
 	ShaderId shader_id;
 	PipelineAssembly assembly;
@@ -319,6 +366,20 @@ struct ImageInfo {
 	uint32_t array_layers = 1;
 };
 
+struct MemoryRequirements {
+	size_t size;
+	size_t alignment;
+	uint32_t memory_type_bits;
+};
+
+// Transition of a whole image to a new usage, recorded together with other barriers
+struct ImageBarrier {
+	ImageId image;
+	ImageUsageFlags usage;
+	bool discard = false; // Previous contents are not needed
+	ImageUsageFlags wait_usage = ImageUsageNone; // Usage of another image sharing the memory which has to finish first
+};
+
 struct ImageDataInfo {
 	Format format;
 	const void* data;
@@ -332,7 +393,9 @@ enum class IndexType : uint32_t {
 enum class BufferType : uint32_t {
 	Vertex,
 	Index,
-	Uniform
+	Uniform,
+	Storage,
+	Indirect
 };
 
 struct BufferInfo {
@@ -346,7 +409,9 @@ enum class UniformType : uint32_t {
 	Sampler = 0,
 	CombinedImageSampler = 1,
 	SampledImage = 2,
-	UniformBuffer = 6
+	StorageImage = 3, // Cube images are bound as 2D arrays with face per layer
+	UniformBuffer = 6,
+	StorageBuffer = 7
 };
 
 struct UniformInfo {
@@ -411,14 +476,53 @@ typedef union ClearValue {
 
 enum ShaderStageBits {
 	ShaderStageVertex = 1,
-	ShaderStageFragment = 16
+	ShaderStageFragment = 16,
+	ShaderStageCompute = 32
 };
 using ShaderStageFlags = uint32_t;
 
+struct ShaderVertexInputReflection {
+	uint32_t location;
+	uint32_t format; // VkFormat
+};
+
+struct ShaderBindingReflection {
+	uint32_t set;
+	uint32_t binding;
+	uint32_t descriptor_type; // VkDescriptorType
+	uint32_t count; // Zero for runtime sized arrays
+};
+
+// Everything shader_create needs from a stage besides its code
+struct ShaderStageReflection {
+	ShaderStageFlags stage;
+	std::string entry;
+	std::vector<ShaderVertexInputReflection> vertex_inputs; // Sorted by location
+	std::vector<ShaderBindingReflection> bindings;
+	uint32_t push_constant_offset = 0;
+	uint32_t push_constant_size = 0; // Zero when the stage has no push constants
+};
+
 struct ShaderStage {
 	ShaderStageFlags stage;
 	const void* spv;
 	size_t spv_size;
+	const ShaderStageReflection* reflection = nullptr; // Baked reflection, spv is reflected when null
+};
+
+// Same layout as VkDrawIndexedIndirectCommand
+struct DrawIndexedIndirectCommand {
+	uint32_t index_count;
+	uint32_t instance_count;
+	uint32_t first_index;
+	int32_t vertex_offset;
+	uint32_t first_instance;
+};
+
+// Byte range of a buffer, used for partial updates
+struct BufferRegion {
+	size_t offset;
+	size_t size;
 };
 
 struct ScreenResolution {
@@ -428,12 +532,19 @@ struct ScreenResolution {
 
 class VulkanGraphicsController {
 public:
-	void create(VulkanContext* context);
+	// Descriptor count of runtime sized arrays, e.g. sampler2D textures[]
+	static constexpr uint32_t MAX_BINDLESS_DESCRIPTORS = 4096;
+
+	// Pipeline cache is loaded from the file and saved back on destroy, empty path keeps it in memory only
+	void create(VulkanContext* context, const std::string& pipeline_cache_path = "");
 	void destroy();
 
 	void end_frame();
 	
-	void draw_begin(FramebufferId framebuffer_id, const ClearValue* clear_values, uint32_t count);
+	// Render area of zero size covers the whole framebuffer
+	void draw_begin(FramebufferId framebuffer_id, const ClearValue* clear_values, uint32_t count, uint32_t render_width = 0, uint32_t render_height = 0);
+	// Dynamic rendering only, attachments are given directly in the order of the render pass, one clear value each
+	void draw_begin(RenderPassId render_pass_id, const ImageId* attachments, const ClearValue* clear_values, uint32_t count, uint32_t render_width = 0, uint32_t render_height = 0);
 	void draw_end();
 
 	void draw_begin_for_screen(const glm::vec4& clear_color);
@@ -442,6 +553,8 @@ public:
 	void draw_set_viewport(float x, float y, float width, float height, float min_depth, float max_depth);
 	void draw_set_scissor(int x_offset, int y_offset, uint32_t width, uint32_t height);
 	void draw_set_line_width(float width);
+	// Clears part of the depth attachment of the current render pass
+	void draw_clear_depth(int x_offset, int y_offset, uint32_t width, uint32_t height, float depth);
 	void draw_set_stencil_reference(StencilFaces faces, uint32_t reference);
 
 	void draw_push_constants(ShaderId shader, ShaderStageFlags stage, uint32_t offset, uint32_t size, const void* data);
@@ -451,9 +564,22 @@ public:
 	void draw_bind_index_buffer(BufferId buffer_id, IndexType index_type);
 	void draw_bind_uniform_sets(PipelineId pipeline_id, uint32_t first_set, const UniformSetId* set_ids, uint32_t count);
 
-	void draw_draw_indexed(uint32_t index_count, uint32_t first_index);
+	void draw_draw_indexed(uint32_t index_count, uint32_t first_index, uint32_t instance_count = 1, uint32_t first_instance = 0);
 	void draw_draw(uint32_t vertex_count, uint32_t first_vertex);
+	void draw_draw_indexed_indirect(BufferId buffer_id, size_t offset, uint32_t draw_count);
+	void draw_image_barriers(const ImageBarrier* barriers, uint32_t count);
+
+	// Recorded outside of render passes, pipeline has to be a compute pipeline
+	void draw_dispatch(uint32_t group_count_x, uint32_t group_count_y, uint32_t group_count_z);
+	// Makes storage image writes of previous dispatches visible to following dispatches
+	void draw_compute_barrier();
+	// Barriers are collected and issued together before the next command which depends on them
+	const BarrierStats& barrier_stats() const; // Of the last recorded frame
+
+	// Without VkRenderPass and VkFramebuffer objects passes take attachments in draw_begin, otherwise they need framebuffers
+	bool dynamic_rendering_supported() const { return m_context->dynamic_rendering(); }
 
+	// Under dynamic rendering only attachment formats and usages are kept, pipelines take formats from them
 	RenderPassId render_pass_create(const RenderPassAttachment* attachments, RenderId count);
 	void render_pass_destroy(RenderPassId render_pass_id);
 
@@ -461,52 +587,118 @@ public:
 	void framebuffer_destroy(FramebufferId framebuffer_id);
 
 	ShaderId shader_create(const ShaderStage* stages, RenderId stage_count);
+#if defined(SHADER_REFLECTION_ENABLE)
+	static ShaderStageReflection shader_stage_reflect(const void* spv, size_t size);
+#endif
 	void shader_destroy(ShaderId shader_id);
 
-	PipelineId pipeline_create(const PipelineInfo& pipeline_info);
+	// Pipelines are compiled on worker threads, binding a pipeline waits for its compilation to finish.
+	// Requests with identical state share one pipeline, which is destroyed once every request is destroyed
+	PipelineId pipeline_create(const PipelineInfo& pipeline_info, PipelineCompile compile = PipelineCompile::Async);
+	PipelineId compute_pipeline_create(ShaderId shader_id, PipelineCompile compile = PipelineCompile::Async);
 	void pipeline_destroy(PipelineId pipeline_id);
+	// Doesn't block, starts compilation of a lazy pipeline, so draws can be skipped until it returns true
+	bool pipeline_ready(PipelineId pipeline_id);
+	// Copy of the pipeline with specialization constants set, created once per constants and destroyed with the pipeline.
+	// Constant i is 32 bit with constant_id i, stages ignore constants they don't declare
+	PipelineId pipeline_variant(PipelineId pipeline_id, const uint32_t* constants, uint32_t count, PipelineCompile compile = PipelineCompile::Lazy);
+	const PipelineLookupStats& pipeline_lookup_stats() const;
 
 	BufferId vertex_buffer_create(const void* data, size_t size);
 	BufferId index_buffer_create(const void* data, size_t size, IndexType index_type);
 	BufferId uniform_buffer_create(const void* data, size_t size);
+	BufferId storage_buffer_create(const void* data, size_t size);
+	BufferId indirect_buffer_create(const void* data, size_t size);
 	void buffer_update(BufferId buffer_id, const void* data);
+	void buffer_update(BufferId buffer_id, const void* data, size_t offset, size_t size);
+	void buffer_update(BufferId buffer_id, const void* data, const BufferRegion* regions, uint32_t region_count);
 	void buffer_destroy(BufferId buffer_id);
 
 	ImageId image_create(const ImageInfo& info);
+	ImageId image_create(const ImageInfo& info, MemoryId memory_id, size_t offset);
+	MemoryRequirements image_memory_requirements(const ImageInfo& info);
 	void image_update(ImageId image_id, const ImageSubresourceLayers& image_subresource, Offset3D image_offset, Extent3D image_extent, const ImageDataInfo& image_data_info);
 	void image_copy(ImageId src_image_id, ImageId dst_image_id, const ImageCopy& image_copy);
 	void image_blit();
 	void image_destroy(ImageId image_id);
 
+	MemoryId memory_allocate(size_t size, uint32_t memory_type_bits);
+	void memory_free(MemoryId memory_id);
+
+	// Requests with identical info share one sampler, which is destroyed once every request is destroyed
 	SamplerId sampler_create(const SamplerInfo& info);
 	void sampler_destroy(SamplerId sampler_id);
+	const SamplerLookupStats& sampler_lookup_stats() const;
+	size_t sampler_count() const; // Unique samplers alive
 
 	UniformSetId uniform_set_create(ShaderId shader_id, uint32_t set_idx, const UniformInfo* uniforms, size_t uniform_count);
+	// Sets of one layout with one allocation and one update call, set i is written by uniforms [i * uniform_count, (i + 1) * uniform_count)
+	void uniform_sets_create(ShaderId shader_id, uint32_t set_idx, const UniformInfo* uniforms, size_t uniform_count, uint32_t set_count, UniformSetId* set_ids);
+	// Valid only for the frame being recorded, it's freed with the other transient sets of the frame once the frame completes
+	UniformSetId uniform_set_create_transient(ShaderId shader_id, uint32_t set_idx, const UniformInfo* uniforms, size_t uniform_count);
+	// Rewrites given bindings in place, the set can't be bound in the frame being recorded.
+	// Waits for frames in flight that bound the set
+	void uniform_set_update(UniformSetId uniform_set_id, const UniformInfo* uniforms, size_t uniform_count);
+	void uniform_set_update_array(UniformSetId uniform_set_id, const UniformInfo& uniform, uint32_t first_element);
 	void uniform_set_destroy(UniformSetId uniform_set_id);
 
 	ScreenResolution screen_resolution() const;
+	bool draw_indirect_supported() const;
+	bool pipeline_statistics_supported() const;
 	void sync();
 
-	void timestamp_query_begin();
-	void timestamp_query_end();
-	void timestamp_query_write_timestamp();
-	bool timestamp_query_get_results(uint64_t *data, uint32_t count);
+	// Named scope of draw buffer commands timed on the GPU, scopes may nest.
+	// Timestamps are read back once the frame slot is reused, so nothing waits for them
+	uint32_t gpu_scope_begin(std::string_view name);
+	void gpu_scope_end(uint32_t scope);
+	// Scopes of the latest frame read back, in the order they began
+	const std::vector<GPUScopeTiming>& gpu_scope_timings() const;
+
+	// Fragment shader invocations between begin and end, results are from the last frame which used the same frame slot
+	void pipeline_statistics_query_begin(uint32_t query);
+	void pipeline_statistics_query_end(uint32_t query);
+	bool pipeline_statistics_query_get_results(uint64_t* data, uint32_t count);
 
 private:
+	// Image View
+	// Views are shared by every uniform set and framebuffer using the same range of an image
+	struct ImageViewKey {
+		ImageId image;
+		VkImageViewType view_type;
+		VkFormat format;
+		VkImageSubresourceRange subresource_range;
+
+		bool operator<(const ImageViewKey& other) const {
+			const VkImageSubresourceRange& range = subresource_range;
+			const VkImageSubresourceRange& other_range = other.subresource_range;
+
+			return std::tie(image, view_type, format, range.aspectMask, range.baseMipLevel, range.levelCount, range.baseArrayLayer, range.layerCount) <
+				std::tie(other.image, other.view_type, other.format, other_range.aspectMask, other_range.baseMipLevel, other_range.levelCount, other_range.baseArrayLayer, other_range.layerCount);
+		}
+	};
+
+	struct ImageView {
+		VkImageView view;
+		uint32_t ref_count;
+	};
+
 	struct RenderPassAttachmentInfo {
 		RenderPassAttachment attachment;
 		VkImageLayout initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
 		VkImageLayout final_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED; // During the pass
 	};
 
 	struct RenderPass {
 		std::vector<RenderPassAttachmentInfo> attachments;
-		VkRenderPass render_pass;
+		VkRenderPass render_pass = VK_NULL_HANDLE; // Null under dynamic rendering
+		// Shared with create states of pipelines which can still be compiled against it, the last owner destroys it
+		std::shared_ptr<const VkRenderPass> owner;
 	};
 
 	struct Framebuffer {
 		std::vector<ImageId> attachments;
-		std::vector<VkImageView> image_views;
+		std::vector<ImageViewKey> image_views;
 		RenderPassId render_pass_id;
 		VkRenderPass render_pass;
 		VkFramebuffer framebuffer = VK_NULL_HANDLE;
@@ -517,6 +709,7 @@ private:
 	struct SetInfo {
 		uint32_t set;
 		std::vector<VkDescriptorSetLayoutBinding> bindings;
+		std::vector<uint32_t> runtime_array_bindings; // Partially bound and updatable after bind
 
 		std::vector<VkDescriptorSetLayoutBinding>::iterator find_binding(uint32_t binding_idx) {
 			return std::find_if(bindings.begin(), bindings.end(), [binding_idx](const auto& binding) {
@@ -554,10 +747,56 @@ private:
 	};
 
 	// Pipeline
+	// Copy of everything pipeline creation reads, so workers don't touch the controller and caller's arrays
+	struct PipelineCreateState {
+		VkPipelineBindPoint bind_point;
+		std::vector<VkPipelineShaderStageCreateInfo> stages;
+		std::vector<std::vector<char>> entries;
+		std::vector<VkVertexInputAttributeDescription> vertex_attributes;
+		VkVertexInputBindingDescription vertex_binding;
+		VkPipelineVertexInputStateCreateInfo vertex_input_state;
+		VkPipelineInputAssemblyStateCreateInfo assembly_state;
+		VkViewport viewport;
+		VkRect2D scissor;
+		VkPipelineViewportStateCreateInfo viewport_state;
+		VkPipelineRasterizationStateCreateInfo rasterization_state;
+		VkPipelineMultisampleStateCreateInfo multisample_state;
+		VkPipelineDepthStencilStateCreateInfo depth_stencil_state;
+		std::vector<VkPipelineColorBlendAttachmentState> blend_attachments;
+		VkPipelineColorBlendStateCreateInfo color_blend_state;
+		std::vector<VkDynamicState> dynamic_states;
+		VkPipelineDynamicStateCreateInfo dynamic_state;
+		VkPipelineLayout layout;
+		VkRenderPass render_pass;
+		std::shared_ptr<const VkRenderPass> render_pass_owner; // Null for swapchain render pass and dynamic rendering
+		// Attachment formats of dynamic rendering, used when there is no render pass
+		std::vector<VkFormat> color_formats;
+		VkFormat depth_format = VK_FORMAT_UNDEFINED;
+		VkFormat stencil_format = VK_FORMAT_UNDEFINED;
+		std::vector<uint32_t> specialization_constants;
+	};
+
 	struct Pipeline {
 		PipelineInfo info;
+		VkPipelineBindPoint bind_point = VK_PIPELINE_BIND_POINT_GRAPHICS;
 		VkPipelineLayout layout; // Not owned
-		VkPipeline pipeline;
+		VkPipeline pipeline = VK_NULL_HANDLE; // Null while the pipeline is pending
+
+		std::unique_ptr<PipelineCreateState> create_state; // Kept for variants, released when the shader is destroyed
+		std::future<VkPipeline> compiled; // Valid while a worker compiles the pipeline
+		std::vector<PipelineId> variants; // Each holds one reference of its variant
+		std::vector<uint32_t> state_key; // Canonical state without specialization constants
+		std::vector<uint32_t> lookup_key;
+		uint32_t ref_count = 1;
+	};
+
+	struct PipelineKeyHash {
+		size_t operator()(const std::vector<uint32_t>& key) const;
+	};
+
+	struct PipelineCompileJob {
+		const PipelineCreateState* state; // Identifies the job when its pipeline is waited for before a worker takes it
+		std::packaged_task<VkPipeline()> task;
 	};
 
 	// Buffers
@@ -574,6 +813,14 @@ private:
 
 	};
 
+	struct StorageBuffer {
+
+	};
+
+	struct IndirectBuffer {
+
+	};
+
 	struct Buffer {
 		VkBuffer buffer;
 		VkDeviceSize size;
@@ -583,6 +830,8 @@ private:
 			VertexBuffer vertex;
 			IndexBuffer index;
 			UniformBuffer uniform;
+			StorageBuffer storage;
+			IndirectBuffer indirect;
 		};
 	};
 
@@ -608,12 +857,22 @@ private:
 		VkImageLayout current_layout;
 		VkImageAspectFlags full_aspect;
 		VkImageTiling tiling;
+		bool owns_memory = true; // Aliased images are bound to memory allocated with memory_allocate
 	};
 
 	// Sampler
+	// Every field of SamplerInfo as 32 bits, floats by their bits
+	using SamplerKey = std::array<uint32_t, 15>;
+
 	struct Sampler {
 		SamplerInfo info;
 		VkSampler sampler;
+		SamplerKey key;
+		uint32_t ref_count = 1;
+	};
+
+	struct SamplerKeyHash {
+		size_t operator()(const SamplerKey& key) const;
 	};
 
 	// Descriptor Pool
@@ -629,29 +888,120 @@ private:
 		}
 	};
 
-	static constexpr size_t MAX_SETS_PER_DESCRIPTOR_POOL = 64;
+	// Every new pool of a key holds twice the sets of the previous one, up to the max
+	static constexpr size_t MIN_SETS_PER_DESCRIPTOR_POOL = 16;
+	static constexpr size_t MAX_SETS_PER_DESCRIPTOR_POOL = 1024;
 
 	struct DescriptorPool {
 		VkDescriptorPool pool;
 		size_t usage_count;
+		size_t capacity;
+	};
+
+	struct DescriptorPools {
+		std::unordered_map<RenderId, DescriptorPool> pools;
+		std::vector<RenderId> available; // Pools with free sets, newest last
+		size_t next_capacity = MIN_SETS_PER_DESCRIPTOR_POOL;
 	};
 
+	// Transient sets are allocated linearly from pools of their frame, which are reset once the frame completes
+	static constexpr uint32_t TRANSIENT_SETS_PER_POOL = 256;
+	static constexpr uint32_t TRANSIENT_DESCRIPTORS_PER_POOL = 1024; // Of each descriptor type
+
 	// Uniform Set
+	struct UniformSetImages {
+		bool storage;
+		std::vector<ImageViewKey> views;
+	};
+
 	struct UniformSet {
 		std::vector<ImageId> images; // Used to check out if image is in proper layout before descriptor binding operation
-		std::vector<VkImageView> image_views;
+		std::vector<ImageId> storage_images; // Same for storage images, which are kept in general layout
+		std::unordered_map<uint32_t, UniformSetImages> binding_images; // Views written into each image binding
+		std::unordered_map<uint64_t, ImageViewKey> array_image_views; // Views of runtime array elements, key is (binding << 32 | element)
+		VkDescriptorPool update_after_bind_pool = VK_NULL_HANDLE; // Owned by the set if it has runtime arrays
 		DescriptorPoolKey pool_key;
 		size_t pool_idx;
 		ShaderId shader;
 		size_t set_idx;
 		VkDescriptorSet descriptor_set;
+		bool transient = false; // Allocated from a transient pool of the frame
+		std::optional<size_t> bound_frame; // Frame count when the set was last bound
+	};
+
+	// Descriptor writes of uniforms, image and buffer infos are kept alive until the writes are submitted
+	struct UniformWrites {
+		std::vector<VkWriteDescriptorSet> writes;
+		std::vector<std::vector<VkDescriptorImageInfo>> image_infos;
+		std::vector<std::vector<VkDescriptorBufferInfo>> buffer_infos;
+		std::unordered_map<uint32_t, UniformSetImages> binding_images;
+		DescriptorPoolKey pool_key;
 	};
 
 	// Timestamp Query
+	// Scope takes two queries, the pool is recreated larger when a frame runs out of them
 	struct TimestampQueryPool {
-		VkQueryPool pool;
-		std::array<uint64_t, 128> query_data;
-		uint32_t timestamps_written;
+		static constexpr uint32_t MIN_QUERY_COUNT = 64;
+		// Calibration is sampled again when device and host timestamps may be further apart, in nanoseconds
+		static constexpr uint64_t MAX_CALIBRATION_DEVIATION = 50'000;
+		static constexpr uint32_t CALIBRATION_ATTEMPTS = 3;
+
+		VkQueryPool pool = VK_NULL_HANDLE;
+		uint32_t capacity = 0;
+		uint32_t query_count = 0; // Written in the frame
+		uint32_t required_query_count = 0; // Including scopes dropped for lack of queries
+		std::vector<std::string> scope_names; // Scope i has queries 2 * i and 2 * i + 1
+		long long submit_time = 0; // CPU trace time, first timestamp is placed there without calibration
+	};
+
+	// Pipeline Statistics Query
+	struct StatisticsQueryPool {
+		static constexpr uint32_t QUERY_COUNT = 8;
+
+		VkQueryPool pool = VK_NULL_HANDLE;
+		uint32_t used_queries = 0; // Bit per query which was begun at least once, others have no results
+	};
+
+	// Pipeline Cache
+	// Precedes vkGetPipelineCacheData blob in the file, the cache is discarded when any field doesn't match
+	struct PipelineCacheFileHeader {
+		static constexpr uint32_t MAGIC = 0x4B504343; // KPCC
+
+		uint32_t magic;
+		uint32_t vendor_id;
+		uint32_t device_id;
+		uint32_t driver_version;
+		uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+		uint64_t data_size;
+		uint64_t data_hash;
+	};
+
+	// Barriers
+	// Kept in synchronization2 form, converted to one vkCmdPipelineBarrier when the extension is missing
+	struct BarrierBatch {
+		std::vector<VkMemoryBarrier2KHR> memory_barriers;
+		std::vector<VkBufferMemoryBarrier2KHR> buffer_barriers;
+		std::vector<VkImageMemoryBarrier2KHR> image_barriers;
+	};
+
+	// Staging Ring
+	// Persistently mapped, uploads of the frame are suballocated from it and it's rewound once the frame completes
+	struct StagingRing {
+		static constexpr VkDeviceSize MIN_SIZE = 4 * 1024 * 1024;
+		static constexpr VkDeviceSize ALIGNMENT = 16;
+
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		uint8_t* data = nullptr;
+		VkDeviceSize capacity = 0;
+		VkDeviceSize offset = 0; // Requested in the frame, past the capacity when uploads didn't fit
+	};
+
+	// Suballocation of the staging ring, or of a one-off buffer when the ring is full
+	struct StagingAllocation {
+		VkBuffer buffer;
+		VkDeviceSize offset;
+		uint8_t* data;
 	};
 
 	// Frame
@@ -660,29 +1010,82 @@ private:
 		VkCommandBuffer setup_buffer;
 		VkCommandBuffer draw_buffer;
 		TimestampQueryPool timestamp_query_pool;
+		StatisticsQueryPool statistics_query_pool;
+		StagingRing staging_ring;
+		std::vector<VkDescriptorPool> transient_pools; // Another pool is added when the frame runs out of transient sets
+		size_t transient_pool_idx = 0; // Pool allocations go into
+		std::vector<UniformSetId> transient_sets;
+		std::vector<ImageViewKey> rendering_views; // Attachment views of dynamic rendering, released once the frame completes
 	};
 
 private:
 	VkBuffer buffer_create(VkBufferUsageFlags usage, VkDeviceSize size);
 	VkDeviceMemory buffer_allocate(VkBuffer buffer, VkMemoryPropertyFlags mem_props);
-	void buffer_copy(VkBuffer buffer, const void* data, VkDeviceSize size);
-	void buffer_memory_barrier(VkBuffer& buffer, VkBufferUsageFlags usage, VkDeviceSize offset, VkDeviceSize size);
+	void buffer_copy(VkBuffer buffer, const void* data, VkDeviceSize offset, VkDeviceSize size);
+	void buffer_memory_barrier(VkBuffer buffer, VkBufferUsageFlags src_usage, VkBufferUsageFlags dst_usage, VkDeviceSize offset, VkDeviceSize size);
 	std::pair<VkBuffer, VkDeviceMemory> staging_buffer_create(const void* data, size_t size);
 	void staging_buffer_destroy(VkBuffer buffer, VkDeviceMemory memory);
+	void staging_ring_create(StagingRing& ring, VkDeviceSize capacity);
+	void staging_ring_destroy(StagingRing& ring);
+	// Rewinds the ring of the completed frame, it's recreated larger when the frame didn't fit
+	void staging_ring_reset(Frame& frame);
+	StagingAllocation staging_allocate(VkDeviceSize size);
 
 	VkImage vulkan_image_create(ImageViewType view_type, VkFormat format, VkExtent3D extent, uint32_t mip_levels, uint32_t layer_count, VkImageTiling tiling, VkImageUsageFlags usage);
 	VkDeviceMemory vulkan_image_allocate(VkImage image, VkMemoryPropertyFlags mem_props);
 	VkImageView vulkan_image_view_create(VkImage image, VkImageViewType view_type, VkFormat format, const VkImageSubresourceRange& subresource_range);
+	// Takes a reference of the cached view, the view is created on first use
+	VkImageView image_view_acquire(const ImageViewKey& key);
+	// Last reference destroys the view, so callers release it only after frames using it
+	void image_view_release(const ImageViewKey& key);
+	ImageViewKey attachment_view_key(ImageId image_id) const;
 	void vulkan_copy_buffer_to_image(VkBuffer buffer, VkImage image, VkImageLayout layout, const VkImageSubresourceLayers& image_subresource, VkOffset3D offset, VkExtent3D extent);
 	void vulkan_copy_image_to_image(VkImage src_image, VkImageLayout src_image_layout, const VkImageSubresourceLayers& src_subres, const VkOffset3D& src_offset, VkImage dst_image, VkImageLayout dst_image_layout, const VkImageSubresourceLayers& dst_subres, const VkOffset3D& dst_offset, const VkExtent3D& extent);
 	void image_should_have_layout(Image& image, VkImageLayout layout);
 	void vulkan_image_memory_barrier(VkImage image, VkImageLayout old_layout, VkImageLayout new_layout, const VkImageSubresourceRange& image_subresource);
+	void barrier_add(const VkMemoryBarrier2KHR& barrier);
+	void barrier_add(const VkBufferMemoryBarrier2KHR& barrier);
+	void barrier_add(const VkImageMemoryBarrier2KHR& barrier);
+	// Issues pending barriers with one barrier command, called before every command reading or writing resources
+	void barriers_flush();
+
+	VkQueryPool timestamp_query_pool_create(uint32_t query_count);
+	// Reads timestamps of the completed frame into the timings and the trace, then resets the pool for the next frame
+	void timestamp_queries_read(Frame& frame);
+
 	void staging_image_destroy(VkImage image, VkDeviceMemory memory);
 
 	uint32_t find_memory_type(uint32_t type_filter, VkMemoryPropertyFlags properties);
 
-	size_t descriptor_pool_allocate(const DescriptorPoolKey& key);
+	static SamplerKey sampler_key(const SamplerInfo& info);
+
+	std::vector<uint32_t> pipeline_state_key(ShaderId shader_id, const PipelineCreateState& state, std::optional<RenderPassId> render_pass_id) const;
+	static std::vector<uint32_t> pipeline_lookup_key(const std::vector<uint32_t>& state_key, const std::vector<uint32_t>& constants);
+	// Returns existing pipeline with the key and takes a reference of it, or inserts the new one
+	PipelineId pipeline_insert(Pipeline&& pipeline, const std::vector<uint32_t>& lookup_key, PipelineCompile compile);
+	void pipeline_release(PipelineId pipeline_id);
+	static VkPipeline pipeline_compile(VkDevice device, VkPipelineCache cache, const PipelineCreateState* state, bool warm_cache);
+	void pipeline_compile_start(Pipeline& pipeline);
+	void pipeline_wait(Pipeline& pipeline);
+	void compile_workers_start();
+	void compile_workers_stop();
+	void compile_worker_run();
+
+	PipelineCacheFileHeader pipeline_cache_file_header() const;
+	void pipeline_cache_create();
+	void pipeline_cache_save();
+
+	UniformWrites uniform_writes_create(SetInfo& set, const UniformInfo* uniforms, size_t uniform_count);
+	void uniform_set_track_images(UniformSet& uniform_set);
+	// Moves the set to a new descriptor set when frames in flight still read the current one
+	void uniform_set_rename(UniformSet& uniform_set, SetInfo& set, const UniformWrites& uniform_writes);
+
+	// Returns pool with set_count sets taken
+	size_t descriptor_pool_allocate(const DescriptorPoolKey& key, size_t set_count);
+	VkDescriptorPool update_after_bind_pool_create(const SetInfo& set);
 	void descriptor_pool_free(const DescriptorPoolKey& pool_key, RenderId pool_id);
+	VkDescriptorPool transient_pool_create();
+	void transient_sets_reset(Frame& frame);
 
 private:
 	VulkanContext* m_context;
@@ -690,19 +1093,58 @@ private:
 	size_t m_frame_index;
 	size_t m_frame_count;
 
+	BarrierBatch m_barriers;
+	BarrierStats m_frame_barrier_stats; // Of the frame being recorded
+	BarrierStats m_barrier_stats;
+	std::vector<GPUScopeTiming> m_gpu_scope_timings;
+
 	RenderId m_render_id;
 	std::unordered_map<RenderPassId, RenderPass> m_render_passes;
 	std::unordered_map<FramebufferId, Framebuffer> m_framebuffers;
+	// Dynamic rendering being recorded, draw_end moves attachments to their final layouts
+	std::optional<RenderPassId> m_rendering_render_pass;
+	std::vector<ImageId> m_rendering_attachments;
 	std::unordered_map<ShaderId, Shader> m_shaders;
 	std::unordered_map<PipelineId, Pipeline> m_pipelines;
+	std::unordered_map<std::vector<uint32_t>, PipelineId, PipelineKeyHash> m_pipeline_lookup; // Canonical state and constants to pipeline
+	PipelineLookupStats m_pipeline_lookup_stats;
 	std::unordered_map<BufferId, Buffer> m_buffers;
 	std::unordered_map<ImageId, Image> m_images;
+	std::map<ImageViewKey, ImageView> m_image_views;
+	std::unordered_map<MemoryId, VkDeviceMemory> m_memories;
 	std::unordered_map<SamplerId, Sampler> m_samplers;
-	std::map<DescriptorPoolKey, std::unordered_map<RenderId, DescriptorPool>> m_descriptor_pools;
+	std::unordered_map<SamplerKey, SamplerId, SamplerKeyHash> m_sampler_lookup;
+	SamplerLookupStats m_sampler_lookup_stats;
+	std::map<DescriptorPoolKey, DescriptorPools> m_descriptor_pools;
 	std::unordered_map<UniformSetId, UniformSet> m_uniform_sets;
 
+	VkPipelineCache m_pipeline_cache = VK_NULL_HANDLE; // Shared by all pipeline creations
+	std::string m_pipeline_cache_path;
+	bool m_pipeline_cache_warm = false; // Loaded from a file written for the same device and driver
+
+	// Fixed number of workers compile queued pipelines, so a burst of requests doesn't start a thread for each
+	std::vector<std::thread> m_compile_workers;
+	std::deque<PipelineCompileJob> m_compile_jobs;
+	std::mutex m_compile_mutex;
+	std::condition_variable m_compile_condition;
+	bool m_compile_workers_stop = false;
+
 	std::vector<std::function<void()>> m_actions_1;
 	std::vector<std::function<void()>> m_actions_2;
 	decltype(m_actions_1)* m_actions_after_current_frame;
 	decltype(m_actions_1)* m_actions_after_next_frame;
-};
\ No newline at end of file
+};
+
+// Times the commands recorded in its lifetime, result shows in gpu_scope_timings and the trace once the frame slot is reused
+class GPUProfileScope {
+public:
+	GPUProfileScope(VulkanGraphicsController& controller, std::string_view name)
+		: m_controller(controller), m_scope(controller.gpu_scope_begin(name)) {}
+	~GPUProfileScope() { m_controller.gpu_scope_end(m_scope); }
+
+private:
+	VulkanGraphicsController& m_controller;
+	uint32_t m_scope;
+};
+
+#define GPU_PROFILE_SCOPE(controller, name) GPUProfileScope gpu_profiler##__LINE__(controller, name);
\ No newline at end of file
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
 #include <fstream>
+#include <mutex>
 #include <string>
 #include <string_view>
 
@@ -16,12 +18,21 @@ public:
 	static void end_session();
 	static void write_footer();
 
+	// Trace clock in microseconds, GPU timestamps are mapped onto it
+	static long long now();
+	// Event on the GPU track, written once its timestamps are read back
+	static void write_gpu_event(std::string_view name, double start, double duration);
+
 private:
 	std::string m_scope_name;
 	long long m_start_point;
 
 	static std::ofstream s_output_file;
 	static size_t s_count;
+	static std::mutex s_mutex; // Scopes may end on worker threads
+
+	static std::atomic<size_t> s_thread_count;
+	static thread_local size_t s_thread_id; // Trace track of the thread, first thread to profile gets 0
 };
 
 #if defined(PROFILE_ENABLE)
@@ -1,15 +1,27 @@
 #include "Include/Profile.h"
 
+#include <iomanip>
+
 std::ofstream CPUProfiler::s_output_file;
 size_t CPUProfiler::s_count;
+std::mutex CPUProfiler::s_mutex;
+
+std::atomic<size_t> CPUProfiler::s_thread_count = 0;
+thread_local size_t CPUProfiler::s_thread_id = CPUProfiler::s_thread_count++;
+
+// Trace tracks are processes, CPU threads are threads of the first one
+static constexpr int CPU_TRACK = 0;
+static constexpr int GPU_TRACK = 1;
 
 CPUProfiler::CPUProfiler(std::string_view name)
-	: m_scope_name(name), m_start_point(std::chrono::steady_clock::now().time_since_epoch().count() / 1000) {}
+	: m_scope_name(name), m_start_point(now()) {}
 
 CPUProfiler::~CPUProfiler() {
-	long long end_point = std::chrono::steady_clock::now().time_since_epoch().count() / 1000;
+	long long end_point = now();
 	long long duration = end_point - m_start_point;
 
+	std::lock_guard lock(s_mutex);
+
 	if (s_count > 0)
 		s_output_file << ",";
 
@@ -19,26 +31,60 @@ CPUProfiler::~CPUProfiler() {
 	s_output_file << "\"name\":\"" << m_scope_name << "\",";
 	s_output_file << "\"ts\":" << m_start_point << ",";
 	s_output_file << "\"ph\":\"X\",";
-	s_output_file << "\"pid\":0,";
-	s_output_file << "\"tid\":0";
+	s_output_file << "\"pid\":" << CPU_TRACK << ",";
+	s_output_file << "\"tid\":" << s_thread_id;
 	s_output_file << "}";
 
 	s_count++;
 }
 
 void CPUProfiler::start_session(std::string_view filename) {
+	std::lock_guard lock(s_mutex);
+
 	if (s_output_file.is_open())
 		write_footer();
 
 	s_output_file.open(filename.data());
 	s_output_file << "{\"otherData\":{},\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+	s_output_file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << CPU_TRACK << ",\"args\":{\"name\":\"CPU\"}},";
+	s_output_file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << GPU_TRACK << ",\"args\":{\"name\":\"GPU\"}}";
+	s_count = 2;
 }
 
 void CPUProfiler::end_session() {
+	std::lock_guard lock(s_mutex);
+
 	write_footer();
 	s_output_file.close();
 }
 
+long long CPUProfiler::now() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void CPUProfiler::write_gpu_event(std::string_view name, double start, double duration) {
+	std::lock_guard lock(s_mutex);
+
+	if (s_count > 0)
+		s_output_file << ",";
+
+	// Fractions of microseconds, default precision would round trace times
+	s_output_file << std::fixed << std::setprecision(3);
+
+	s_output_file << "{";
+	s_output_file << "\"cat\":\"gpu\",";
+	s_output_file << "\"dur\":" << duration << ",";
+	s_output_file << "\"name\":\"" << name << "\",";
+	s_output_file << "\"ts\":" << start << ",";
+	s_output_file << "\"ph\":\"X\",";
+	s_output_file << "\"pid\":" << GPU_TRACK << ",";
+	s_output_file << "\"tid\":0";
+	s_output_file << "}";
+
+	s_count++;
+}
+
 void CPUProfiler::write_footer() {
 	s_output_file << "]}";
 }
\ No newline at end of file
@@ -1,7 +1,31 @@
 #include "Core/Application.h"
 #include <Profile.h>
 
-int main() {
+#include <Renderer/ShaderBundle.h>
+
+#include <string_view>
+
+// koala --bake-shaders <shader dir> <bundle path> reflects the compiled shaders into a bundle, called by compile.bat
+static int bake_shaders(const char* shader_dir, const char* bundle_path) {
+#if defined(SHADER_REFLECTION_ENABLE)
+	try {
+		ShaderBundle::build(shader_dir, bundle_path);
+	} catch (std::exception& e) {
+		std::cout << e.what() << '\n';
+		return 1;
+	}
+
+	return 0;
+#else
+	std::cout << "Shaders are baked by builds with shader reflection\n";
+	return 1;
+#endif
+}
+
+int main(int argc, char** argv) {
+	if (argc == 4 && std::string_view(argv[1]) == "--bake-shaders")
+		return bake_shaders(argv[2], argv[3]);
+
 	MY_PROFILE_START("profiling.json");
 
 	ApplicationProperties props{};
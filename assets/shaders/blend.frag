@@ -1,27 +1,15 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(location = 0) in vec2 in_uv0;
 layout(location = 1) in vec2 in_uv1;
 layout(location = 2) in vec3 in_world_pos;
 layout(location = 3) in mat3 in_TBN;
+layout(location = 6) flat in uint in_material_index;
 
 layout(location = 0) out vec4 out_color;
 
-layout(set = 1, binding = 0) uniform sampler2D albedo_map;
-layout(set = 1, binding = 1) uniform sampler2D ao_rough_met_map;
-layout(set = 1, binding = 2) uniform sampler2D normal_map;
-layout(set = 1, binding = 3) uniform sampler2D emmisive_map;
-
-layout(set = 0, binding = 1) uniform SceneInfo {
-	vec3 camera_pos;
-	vec3 light_dir;
-	vec3 light_color;
-	vec3 ambient_color;
-};
-
-layout(push_constant) uniform Material {
-	layout(offset = 64)
-
+struct Material {
 	vec4 base_color_factor;
 	vec4 emissive_factor;
 	float metallic_factor;
@@ -33,32 +21,88 @@ layout(push_constant) uniform Material {
 	float alpha_mask;
 	float alpha_cutoff;
 	float is_ao_in_rough_met;
+	uint albedo_map;
+	uint ao_rough_met_map;
+	uint normal_map;
+	uint emissive_map;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer Materials {
+	Material materials[];
+};
+
+layout(set = 1, binding = 1) uniform sampler2D textures[];
+
+Material material;
+
+vec4 sample_texture(uint texture_index, vec2 uv) {
+	return texture(textures[nonuniformEXT(texture_index)], uv);
+}
+
+struct Light {
+	vec3 pos;
+	float range;
+	vec3 color;
+	uint type;
+	vec3 dir;
+	float cos_outer_cone;
+	float cos_inner_cone;
+};
+
+const uint LIGHT_TYPE_SPOT = 2;
+
+layout(set = 2, binding = 0) uniform ClusterInfo {
+	mat4 view;
+	uvec4 grid_size;
+	vec4 depth_params; // Near, far, slice scale, slice bias
+	vec4 target_size; // Render resolution and its reciprocal
+	vec4 irradiance_sh[9]; // Skybox irradiance divided by PI, basis constants are folded in
+} cluster_info;
+
+layout(std430, set = 2, binding = 1) readonly buffer Lights {
+	Light lights[];
+};
+
+// Offset and count of light list of every cluster
+layout(std430, set = 2, binding = 2) readonly buffer Clusters {
+	uvec2 clusters[];
+};
+
+layout(std430, set = 2, binding = 3) readonly buffer LightIndices {
+	uint light_indices[];
+};
+
+layout(set = 0, binding = 1) uniform SceneInfo {
+	vec3 camera_pos;
+	vec3 light_dir;
+	vec3 light_color;
+	vec3 ambient_color;
 };
 
 vec4 get_albedo() {
-	vec4 albedo = base_color_factor;
+	vec4 albedo = material.base_color_factor;
 	
-	if (base_color_uv_set == 0)
-		albedo *= texture(albedo_map, in_uv0);
-	else if (base_color_uv_set == 1)
-		albedo *= texture(albedo_map, in_uv1);
+	if (material.base_color_uv_set == 0)
+		albedo *= sample_texture(material.albedo_map, in_uv0);
+	else if (material.base_color_uv_set == 1)
+		albedo *= sample_texture(material.albedo_map, in_uv1);
 
 	return albedo;
 }
 
 vec3 get_ao_rough_met() {
-	vec3 ao_rough_met = vec3(1.0f, roughness_factor, metallic_factor);
+	vec3 ao_rough_met = vec3(1.0f, material.roughness_factor, material.metallic_factor);
 	
-	if (ao_rough_met_uv_set == 0)
-		ao_rough_met *= texture(ao_rough_met_map, in_uv0).rgb;
-	else if (ao_rough_met_uv_set == 1)
-		ao_rough_met *= texture(ao_rough_met_map, in_uv1).rgb;
+	if (material.ao_rough_met_uv_set == 0)
+		ao_rough_met *= sample_texture(material.ao_rough_met_map, in_uv0).rgb;
+	else if (material.ao_rough_met_uv_set == 1)
+		ao_rough_met *= sample_texture(material.ao_rough_met_map, in_uv1).rgb;
 
 	return ao_rough_met;
 }
 
 vec3 get_normal() {
-	return normalize(in_TBN * texture(normal_map, normals_uv_set == 0 ? in_uv0 : in_uv1).xyz);
+	return normalize(in_TBN * sample_texture(material.normal_map, material.normals_uv_set == 0 ? in_uv0 : in_uv1).xyz);
 }
 
 const float PI = 3.1415926535;
@@ -83,22 +127,7 @@ vec3 fresnelSchlick(float HdotV, vec3 F0) {
 	return F0 + (1.0 - F0) * pow(max(1.0 - HdotV, 0.0), 5.0);
 }
 
-void main() {
-	vec3 world_pos = in_world_pos;
-	vec4 albedo = get_albedo();
-	vec3 ao_rough_met = get_ao_rough_met();
-	vec3 normal = get_normal();
-
-	float roughness = ao_rough_met.g;
-	float metallic = ao_rough_met.b;
-
-	vec3 F0 = vec3(0.04);
-	F0 = mix(F0, albedo.rgb, metallic);
-	vec3 radiance = light_color;
-
-	vec3 N = normalize(normal);
-	vec3 V = normalize(camera_pos - world_pos);
-	vec3 L = normalize(light_dir);
+vec3 brdf(vec3 N, vec3 V, vec3 L, vec3 albedo, float roughness, float metallic, vec3 F0) {
 	vec3 H = normalize(V + L);
 
 	float NdotV = max(dot(N, V), 0.0000001);
@@ -115,8 +144,78 @@ void main() {
 
 	vec3 kD = (vec3(1.0) - F) * (1 - metallic);
 
-	vec3 Lo = (kD * albedo.rgb / PI + specular) * radiance * NdotL;
+	return (kD * albedo / PI + specular) * NdotL;
+}
+
+// Second order spherical harmonics polynomial of the world space normal
+vec3 sh_irradiance(vec3 n) {
+	vec3 irradiance =
+		cluster_info.irradiance_sh[0].rgb +
+		cluster_info.irradiance_sh[1].rgb * n.y +
+		cluster_info.irradiance_sh[2].rgb * n.z +
+		cluster_info.irradiance_sh[3].rgb * n.x +
+		cluster_info.irradiance_sh[4].rgb * (n.x * n.y) +
+		cluster_info.irradiance_sh[5].rgb * (n.y * n.z) +
+		cluster_info.irradiance_sh[6].rgb * (3.0f * n.z * n.z - 1.0f) +
+		cluster_info.irradiance_sh[7].rgb * (n.x * n.z) +
+		cluster_info.irradiance_sh[8].rgb * (n.x * n.x - n.y * n.y);
+
+	return max(irradiance, vec3(0.0f));
+}
+
+uint find_cluster(vec2 screen_uv, vec3 world_pos) {
+	float depth = -(cluster_info.view * vec4(world_pos, 1.0f)).z;
+	uint slice = uint(clamp(log(depth) * cluster_info.depth_params.z + cluster_info.depth_params.w, 0.0f, float(cluster_info.grid_size.z - 1)));
+	uvec2 tile = min(uvec2(screen_uv * vec2(cluster_info.grid_size.xy)), cluster_info.grid_size.xy - uvec2(1));
+
+	return (slice * cluster_info.grid_size.y + tile.y) * cluster_info.grid_size.x + tile.x;
+}
+
+// Point and spot lights of the cluster the pixel is in
+vec3 clustered_lights(vec2 screen_uv, vec3 world_pos, vec3 N, vec3 V, vec3 albedo, float roughness, float metallic, vec3 F0) {
+	uvec2 cluster = clusters[find_cluster(screen_uv, world_pos)];
+
+	vec3 Lo = vec3(0.0f);
+	for (uint i = 0; i < cluster.y; i++) {
+		Light light = lights[light_indices[cluster.x + i]];
+
+		vec3 to_light = light.pos - world_pos;
+		float dist = length(to_light);
+		vec3 L = to_light / dist;
+
+		float window = clamp(1.0f - pow(dist / light.range, 4.0f), 0.0f, 1.0f);
+		float attenuation = window * window / (dist * dist + 1.0f);
+
+		if (light.type == LIGHT_TYPE_SPOT)
+			attenuation *= smoothstep(light.cos_outer_cone, light.cos_inner_cone, dot(-L, light.dir));
+
+		if (attenuation > 0.0f)
+			Lo += brdf(N, V, L, albedo, roughness, metallic, F0) * light.color * attenuation;
+	}
+
+	return Lo;
+}
+
+void main() {
+	material = materials[in_material_index];
+
+	vec3 world_pos = in_world_pos;
+	vec4 albedo = get_albedo();
+	vec3 ao_rough_met = get_ao_rough_met();
+	vec3 normal = get_normal();
+
+	float roughness = ao_rough_met.g;
+	float metallic = ao_rough_met.b;
+
+	vec3 F0 = vec3(0.04);
+	F0 = mix(F0, albedo.rgb, metallic);
+
+	vec3 N = normalize(normal);
+	vec3 V = normalize(camera_pos - world_pos);
+
+	vec3 Lo = brdf(N, V, normalize(light_dir), albedo.rgb, roughness, metallic, F0) * light_color;
+	Lo += clustered_lights(gl_FragCoord.xy * cluster_info.target_size.zw, world_pos, N, V, albedo.rgb, roughness, metallic, F0);
 
-	vec3 ambient = vec3(0.35, 0.35, 0.35) * albedo.rgb;
+	vec3 ambient = sh_irradiance(N) * albedo.rgb;
 	out_color = vec4(Lo + ambient, albedo.a);
 }
\ No newline at end of file
@@ -10,29 +10,46 @@ layout(location = 0) out vec2 out_uv0;
 layout(location = 1) out vec2 out_uv1;
 layout(location = 2) out vec3 out_world_pos;
 layout(location = 3) out mat3 out_TBN;
-
-layout(push_constant) uniform ModelMatrix {
-	layout(offset = 0)
-	
-	mat4 model;
-} primitive;
+layout(location = 6) flat out uint out_material_index;
 
 layout(set = 0, binding = 0) uniform WorldMatrix {
 	mat4 proj_view;	
 } world;
 
+struct Instance {
+	uint transform_index;
+	uint material_index;
+};
+
+layout(std430, set = 0, binding = 2) readonly buffer Instances {
+	Instance instances[];
+};
+
+struct Transform {
+	mat4 model;
+	mat4 prev_model;
+	mat3 normal;
+};
+
+layout(std430, set = 0, binding = 3) readonly buffer Transforms {
+	Transform transforms[];
+};
+
 void main() {
+	Instance instance = instances[gl_InstanceIndex];
+	mat4 model_matrix = transforms[instance.transform_index].model;
+	mat3 normal_matrix = transforms[instance.transform_index].normal;
 	vec3 bitangent = cross(in_normal, in_tangent.xyz) * in_tangent.w;
 
-	mat3 model = mat3(transpose(inverse(primitive.model)));
-	vec3 T = normalize(model * in_tangent.xyz);
-	vec3 N = normalize(model * in_normal);
-	vec3 B = normalize(model * bitangent);
+	vec3 T = normalize(normal_matrix * in_tangent.xyz);
+	vec3 N = normalize(normal_matrix * in_normal);
+	vec3 B = normalize(normal_matrix * bitangent);
 	
-	vec4 world_pos = primitive.model * vec4(in_pos, 1.0f);
+	vec4 world_pos = model_matrix * vec4(in_pos, 1.0f);
 	out_world_pos = world_pos.xyz / world_pos.w;
 	gl_Position = world.proj_view * world_pos;
 	out_uv0 = in_uv0;
 	out_TBN = mat3(T, B, N);
 	out_uv1 = in_uv1;
+	out_material_index = instance.material_index;
 }
\ No newline at end of file
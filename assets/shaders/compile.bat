@@ -1,15 +1,35 @@
 glslc g_pass.vert -o g_pass.vert.spv
+glslc -DMOTION_VECTORS g_pass.vert -o g_pass_motion.vert.spv
 glslc g_pass.frag -o g_pass.frag.spv
+glslc -DPACKED_G_BUFFER g_pass.frag -o g_pass_packed.frag.spv
+glslc -DALPHA_MASK g_pass.frag -o g_pass_masked.frag.spv
+glslc -DPACKED_G_BUFFER -DALPHA_MASK g_pass.frag -o g_pass_packed_masked.frag.spv
+glslc -DMOTION_VECTORS g_pass.frag -o g_pass_motion.frag.spv
+glslc -DPACKED_G_BUFFER -DMOTION_VECTORS g_pass.frag -o g_pass_packed_motion.frag.spv
+glslc -DALPHA_MASK -DMOTION_VECTORS g_pass.frag -o g_pass_masked_motion.frag.spv
+glslc -DPACKED_G_BUFFER -DALPHA_MASK -DMOTION_VECTORS g_pass.frag -o g_pass_packed_masked_motion.frag.spv
+glslc depth_prepass.vert -o depth_prepass.vert.spv
 glslc depth_copy.frag -o depth_copy.frag.spv
 glslc lightning.frag -o lightning.frag.spv
+glslc -DPACKED_G_BUFFER lightning.frag -o lightning_packed.frag.spv
 glslc blend.frag -o blend.frag.spv
 glslc blend.vert -o blend.vert.spv
 glslc coord_system.vert -o coord_system.vert.spv
 glslc coord_system.frag -o coord_system.frag.spv
 glslc present.vert -o present.vert.spv
 glslc present.frag -o present.frag.spv
+glslc temporal_resolve.frag -o temporal_resolve.frag.spv
 glslc skybox.vert -o skybox.vert.spv
 glslc skybox.frag -o skybox.frag.spv
 glslc shadow_map.vert -o shadow_map.vert.spv
-glslc equirect_to_cubemap.vert -o equirect_to_cubemap.vert.spv
-glslc equirect_to_cubemap.frag -o equirect_to_cubemap.frag.spv
\ No newline at end of file
+glslc -DALPHA_MASK shadow_map.vert -o shadow_map_masked.vert.spv
+glslc shadow_map.frag -o shadow_map_masked.frag.spv
+glslc equirect_to_cubemap.comp -o equirect_to_cubemap.comp.spv
+glslc cubemap_downsample.comp -o cubemap_downsample.comp.spv
+glslc cubemap_prefilter.comp -o cubemap_prefilter.comp.spv
+glslc brdf_lut.comp -o brdf_lut.comp.spv
+
+rem Bake the compiled shaders with their reflection into shaders.bundle, which the renderer loads.
+rem Needs a build with shader reflection (Debug), set KOALA_EXE when it lives somewhere else
+if not defined KOALA_EXE set KOALA_EXE=..\..\Koala\x64\Debug\Koala.exe
+"%KOALA_EXE%" --bake-shaders . shaders.bundle || (echo Failed to bake shaders.bundle & exit /b 1)
@@ -2,10 +2,14 @@
 
 layout(location = 0) in vec2 in_tex_pos;
 
-layout(location = 0) out float out_color;
-
 layout(set = 0, binding = 0) uniform sampler2D depth_map;
 
+// Region of depth map copied into the viewport, offset and size in uv
+layout(push_constant) uniform Region {
+	vec2 region_offset;
+	vec2 region_size;
+};
+
 void main() {
-	out_color = texture(depth_map, in_tex_pos).r;
+	gl_FragDepth = texture(depth_map, region_offset + in_tex_pos * region_size).r;
 }
\ No newline at end of file
@@ -0,0 +1,36 @@
+#version 450
+
+layout(location = 0) in vec3 in_pos;
+
+layout(set = 0, binding = 0) uniform WorldMatrix {
+	mat4 proj_view;	
+} world;
+
+struct Instance {
+	uint transform_index;
+	uint material_index;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer Instances {
+	Instance instances[];
+};
+
+struct Transform {
+	mat4 model;
+	mat4 prev_model;
+	mat3 normal;
+};
+
+layout(std430, set = 0, binding = 2) readonly buffer Transforms {
+	Transform transforms[];
+};
+
+// Same computation as in G pass, so G pass can test for equal depth
+invariant gl_Position;
+
+void main() {
+	Instance instance = instances[gl_InstanceIndex];
+	mat4 model_matrix = transforms[instance.transform_index].model;
+
+	gl_Position = world.proj_view * model_matrix * vec4(in_pos, 1.0f);
+}
\ No newline at end of file
@@ -1,22 +1,35 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(location = 0) in vec2 in_uv0;
 layout(location = 1) in vec2 in_uv1;
 layout(location = 2) in mat3 in_TBN;
-
+layout(location = 5) flat in uint in_material_index;
+#ifdef MOTION_VECTORS
+layout(location = 6) in vec4 in_pos;
+layout(location = 7) in vec4 in_prev_pos;
+#endif
+
+#ifdef PACKED_G_BUFFER
+layout(location = 0) out vec4 out_albedo_met;
+layout(location = 1) out vec4 out_normal_rough;
+layout(location = 2) out vec4 out_emissive; // Composition target, lightning is added on top
+#else
 layout(location = 0) out vec4 out_albedo;
 layout(location = 1) out vec3 out_ao_rough_met;
 layout(location = 2) out vec4 out_normal;
 layout(location = 3) out vec4 out_emissive;
+#endif
 
-layout(set = 1, binding = 0) uniform sampler2D albedo_map;
-layout(set = 1, binding = 1) uniform sampler2D ao_rough_met_map;
-layout(set = 1, binding = 2) uniform sampler2D normal_map;
-layout(set = 1, binding = 3) uniform sampler2D emissive_map;
-
-layout(push_constant) uniform Material {
-	layout(offset = 64)
+#ifdef MOTION_VECTORS
+#ifdef PACKED_G_BUFFER
+layout(location = 3) out vec2 out_velocity;
+#else
+layout(location = 4) out vec2 out_velocity;
+#endif
+#endif
 
+struct Material {
 	vec4 base_color_factor;
 	vec4 emissive_factor;
 	float metallic_factor;
@@ -28,52 +41,124 @@ layout(push_constant) uniform Material {
 	float alpha_mask;
 	float alpha_cutoff;
 	float is_ao_in_rough_met;
+	uint albedo_map;
+	uint ao_rough_met_map;
+	uint normal_map;
+	uint emissive_map;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer Materials {
+	Material materials[];
 };
 
+layout(set = 1, binding = 1) uniform sampler2D textures[];
+
+// Material permutation. UV set constants are 0 or 1, 2 skips the map and -1 reads the set from the material.
+// Defaults handle every material, so the pipeline without specialization is the fallback while permutations compile
+layout(constant_id = 0) const int ALBEDO_UV_SET = -1;
+layout(constant_id = 1) const int AO_ROUGH_MET_UV_SET = -1;
+layout(constant_id = 2) const int NORMALS_UV_SET = -1;
+layout(constant_id = 3) const int EMISSIVE_UV_SET = -1;
+layout(constant_id = 4) const bool ALPHA_TEST = true; // Material may be alpha masked
+layout(constant_id = 5) const int TANGENTS = -1; // 0 - none, 1 - present, -1 - checked per pixel
+
+Material material;
+
+vec4 sample_texture(uint texture_index, vec2 uv) {
+	return texture(textures[nonuniformEXT(texture_index)], uv);
+}
+
+// UV set of a map, -1 when the material has none
+int uv_set(int specialized_uv_set, int material_uv_set) {
+	if (specialized_uv_set == -1)
+		return material_uv_set == 0 || material_uv_set == 1 ? material_uv_set : -1;
+
+	return specialized_uv_set == 2 ? -1 : specialized_uv_set;
+}
+
+vec2 uv(int set) {
+	return set == 0 ? in_uv0 : in_uv1;
+}
+
 vec4 get_albedo() {
-	vec4 albedo = base_color_factor * texture(albedo_map, base_color_uv_set == 0 ? in_uv0 : in_uv1);
+	vec4 albedo = material.base_color_factor;
+
+	int set = uv_set(ALBEDO_UV_SET, material.base_color_uv_set);
+	if (set != -1)
+		albedo *= sample_texture(material.albedo_map, uv(set));
 
 	return albedo;
 }
 
 vec3 get_ao_rough_met() {
-	vec3 ao_rough_met = vec3(1.0f, roughness_factor, metallic_factor);
+	vec3 ao_rough_met = vec3(1.0f, material.roughness_factor, material.metallic_factor);
 	
-	ao_rough_met *= texture(ao_rough_met_map, ao_rough_met_uv_set == 0 ? in_uv0 : in_uv1).rgb;
+	int set = uv_set(AO_ROUGH_MET_UV_SET, material.ao_rough_met_uv_set);
+	if (set != -1)
+		ao_rough_met *= sample_texture(material.ao_rough_met_map, uv(set)).rgb;
 
 	return ao_rough_met;
 }
 
 vec4 get_normal() {
-	vec3 tangent_normal = texture(normal_map, normals_uv_set == 0 ? in_uv0 : in_uv1).xyz * 2.0f - 1.0f;
+	int set = uv_set(NORMALS_UV_SET, material.normals_uv_set);
+	bool has_tangents = TANGENTS == -1 ? !isnan(in_TBN[0].x) : TANGENTS == 1;
 
-	vec4 normal;
-	if (isnan(in_TBN[0].x))
-		normal = vec4(normalize(in_TBN[2]), 1.0f);
-	else
-		normal = vec4(normalize(in_TBN * tangent_normal), 1.0f);
+	if (set == -1 || !has_tangents)
+		return vec4(normalize(in_TBN[2]), 1.0f);
 
-	return normal;
+	vec3 tangent_normal = sample_texture(material.normal_map, uv(set)).xyz * 2.0f - 1.0f;
+
+	return vec4(normalize(in_TBN * tangent_normal), 1.0f);
 }
 
 vec4 get_emissive() {
-	vec4 emissive = vec4(emissive_factor.rgb, 1.0f);
+	vec4 emissive = vec4(material.emissive_factor.rgb, 1.0f);
 
-	if (emissive_uv_set == 0)
-		emissive *= vec4(texture(emissive_map, in_uv0).rgb, 1.0f);
-	else if (emissive_uv_set == 1)
-		emissive *= vec4(texture(emissive_map, in_uv1).rgb, 1.0f);
+	int set = uv_set(EMISSIVE_UV_SET, material.emissive_uv_set);
+	if (set != -1)
+		emissive *= vec4(sample_texture(material.emissive_map, uv(set)).rgb, 1.0f);
 
 	return emissive;
 }
 
+// Unit vector folded onto an octahedron and unwrapped into [0, 1] square
+vec2 octahedral_encode(vec3 n) {
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+
+	vec2 signs = vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+	vec2 wrapped = (1.0f - abs(n.yx)) * signs;
+
+	return (n.z >= 0.0f ? n.xy : wrapped) * 0.5f + 0.5f;
+}
+
 void main() {
-	out_albedo = get_albedo();
+	material = materials[in_material_index];
+
+	vec4 albedo = get_albedo();
 	
-	if (alpha_cutoff == 1.0f && out_albedo.a < alpha_mask)
+#ifdef ALPHA_MASK
+	if (ALPHA_TEST && material.alpha_cutoff == 1.0f && albedo.a < material.alpha_mask)
 		discard;
+#endif
 
+#ifdef PACKED_G_BUFFER
+	vec3 ao_rough_met = get_ao_rough_met();
+
+	// Metallic keeps 8 bits in albedo alpha, 2 alpha bits of the normal target would band it.
+	// Lightning doesn't apply ambient occlusion, so it isn't stored
+	out_albedo_met = vec4(albedo.rgb, ao_rough_met.b);
+	out_normal_rough = vec4(octahedral_encode(get_normal().xyz), ao_rough_met.g, 1.0f);
+	out_emissive = get_emissive();
+#else
+	out_albedo = albedo;
 	out_ao_rough_met = get_ao_rough_met();
 	out_normal = get_normal();
 	out_emissive = get_emissive();
+#endif
+
+#ifdef MOTION_VECTORS
+	// Screen UV offset since previous frame, without jitter
+	out_velocity = (in_pos.xy / in_pos.w - in_prev_pos.xy / in_prev_pos.w) * 0.5f;
+#endif
 }
\ No newline at end of file
@@ -9,27 +9,60 @@ layout(location = 4) in vec2 in_uv1;
 layout(location = 0) out vec2 out_uv0;
 layout(location = 1) out vec2 out_uv1;
 layout(location = 2) out mat3 out_TBN;
+layout(location = 5) flat out uint out_material_index;
+#ifdef MOTION_VECTORS
+layout(location = 6) out vec4 out_pos;
+layout(location = 7) out vec4 out_prev_pos;
+#endif
 
-layout(push_constant) uniform ModelMatrix {
-	layout(offset = 0)
-	
-	mat4 model;
-} primitive;
+// Depth has to match depth prepass exactly
+invariant gl_Position;
 
 layout(set = 0, binding = 0) uniform WorldMatrix {
 	mat4 proj_view;	
+#ifdef MOTION_VECTORS
+	mat4 unjittered_proj_view;
+	mat4 prev_unjittered_proj_view;
+#endif
 } world;
 
+struct Instance {
+	uint transform_index;
+	uint material_index;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer Instances {
+	Instance instances[];
+};
+
+struct Transform {
+	mat4 model;
+	mat4 prev_model;
+	mat3 normal;
+};
+
+layout(std430, set = 0, binding = 2) readonly buffer Transforms {
+	Transform transforms[];
+};
+
 void main() {
+	Instance instance = instances[gl_InstanceIndex];
+	mat4 model_matrix = transforms[instance.transform_index].model;
+	mat3 normal_matrix = transforms[instance.transform_index].normal;
 	vec3 bitangent = cross(in_normal, in_tangent.xyz) * in_tangent.w;
 
-	mat3 model = mat3(transpose(inverse(primitive.model)));
-	vec3 T = normalize(model * in_tangent.xyz);
-	vec3 N = normalize(model * in_normal);
-	vec3 B = normalize(model * bitangent);
+	vec3 T = normalize(normal_matrix * in_tangent.xyz);
+	vec3 N = normalize(normal_matrix * in_normal);
+	vec3 B = normalize(normal_matrix * bitangent);
 	
-	gl_Position = world.proj_view * primitive.model * vec4(in_pos, 1.0f);
+	gl_Position = world.proj_view * model_matrix * vec4(in_pos, 1.0f);
 	out_uv0 = in_uv0;
 	out_TBN = mat3(T, B, N);
 	out_uv1 = in_uv1;
+	out_material_index = instance.material_index;
+
+#ifdef MOTION_VECTORS
+	out_pos = world.unjittered_proj_view * model_matrix * vec4(in_pos, 1.0f);
+	out_prev_pos = world.prev_unjittered_proj_view * transforms[instance.transform_index].prev_model * vec4(in_pos, 1.0f);
+#endif
 }
\ No newline at end of file
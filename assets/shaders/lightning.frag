@@ -4,11 +4,62 @@ layout(location = 0) in vec2 in_uv;
 
 layout(location = 0) out vec4 out_color;
 
+#ifdef PACKED_G_BUFFER
+layout(set = 0, binding = 0) uniform sampler2D albedo_met_map;
+layout(set = 0, binding = 1) uniform sampler2D normal_rough_map;
+layout(set = 0, binding = 2) uniform sampler2D depth_map;
+#else
 layout(set = 0, binding = 0) uniform sampler2D albedo_map;
 layout(set = 0, binding = 1) uniform sampler2D ao_rough_met_map;
 layout(set = 0, binding = 2) uniform sampler2D normal_map;
 layout(set = 0, binding = 3) uniform sampler2D emissive_map;
 layout(set = 0, binding = 4) uniform sampler2D depth_map;
+#endif
+
+struct Light {
+	vec3 pos;
+	float range;
+	vec3 color;
+	uint type;
+	vec3 dir;
+	float cos_outer_cone;
+	float cos_inner_cone;
+};
+
+const uint LIGHT_TYPE_SPOT = 2;
+
+layout(set = 1, binding = 0) uniform ClusterInfo {
+	mat4 view;
+	uvec4 grid_size;
+	vec4 depth_params; // Near, far, slice scale, slice bias
+	vec4 target_size; // Render resolution and its reciprocal
+	vec4 irradiance_sh[9]; // Skybox irradiance divided by PI, basis constants are folded in
+} cluster_info;
+
+layout(std430, set = 1, binding = 1) readonly buffer Lights {
+	Light lights[];
+};
+
+// Offset and count of light list of every cluster
+layout(std430, set = 1, binding = 2) readonly buffer Clusters {
+	uvec2 clusters[];
+};
+
+layout(std430, set = 1, binding = 3) readonly buffer LightIndices {
+	uint light_indices[];
+};
+
+layout(set = 2, binding = 0) uniform CascadeInfo {
+	mat4 view_proj[4];
+	vec4 split_depths; // View depth every cascade ends at
+	vec2 texel_size;
+	uint cascade_count;
+} cascade_info;
+
+// Cascades are quadrants of one atlas
+layout(set = 2, binding = 1) uniform sampler2DShadow shadow_map;
+
+const uint SHADOW_ATLAS_TILES = 2;
 
 layout(push_constant) uniform Info {
 	mat4 view_proj_inv;
@@ -20,8 +71,8 @@ layout(push_constant) uniform Info {
 
 const float PI = 3.1415926535;
 
-vec3 calculate_world_space_position() {
-	float depth = texture(depth_map, in_uv).r;
+vec3 calculate_world_space_position(vec2 g_buffer_uv) {
+	float depth = texture(depth_map, g_buffer_uv).r;
 
 	vec4 clip_space_pos = vec4(in_uv * 2.0f - 1.0f, depth, 1.0f);
 	vec4 world_space_pos = view_proj_inv * clip_space_pos;
@@ -49,22 +100,7 @@ vec3 fresnelSchlick(float HdotV, vec3 F0) {
 	return F0 + (1.0 - F0) * pow(max(1.0 - HdotV, 0.0), 5.0);
 }
 
-void main() {
-	vec3 world_pos = calculate_world_space_position();
-	vec3 albedo = texture(albedo_map, in_uv).rgb;
-	vec3 ao_rough_met = texture(ao_rough_met_map, in_uv).rgb;
-	vec3 normal = texture(normal_map, in_uv).xyz;
-
-	float roughness = ao_rough_met.g;
-	float metallic = ao_rough_met.b;
-
-	vec3 F0 = vec3(0.04);
-	F0 = mix(F0, albedo, metallic);
-	vec3 radiance = light_color;
-
-	vec3 N = normalize(normal);
-	vec3 V = normalize(camera_pos - world_pos);
-	vec3 L = normalize(light_dir);
+vec3 brdf(vec3 N, vec3 V, vec3 L, vec3 albedo, float roughness, float metallic, vec3 F0) {
 	vec3 H = normalize(V + L);
 
 	float NdotV = max(dot(N, V), 0.0000001);
@@ -81,8 +117,135 @@ void main() {
 
 	vec3 kD = (vec3(1.0) - F) * (1 - metallic);
 
-	vec3 Lo = (kD * albedo / PI + specular) * radiance * NdotL;
+	return (kD * albedo / PI + specular) * NdotL;
+}
+
+// Second order spherical harmonics polynomial of the world space normal
+vec3 sh_irradiance(vec3 n) {
+	vec3 irradiance =
+		cluster_info.irradiance_sh[0].rgb +
+		cluster_info.irradiance_sh[1].rgb * n.y +
+		cluster_info.irradiance_sh[2].rgb * n.z +
+		cluster_info.irradiance_sh[3].rgb * n.x +
+		cluster_info.irradiance_sh[4].rgb * (n.x * n.y) +
+		cluster_info.irradiance_sh[5].rgb * (n.y * n.z) +
+		cluster_info.irradiance_sh[6].rgb * (3.0f * n.z * n.z - 1.0f) +
+		cluster_info.irradiance_sh[7].rgb * (n.x * n.z) +
+		cluster_info.irradiance_sh[8].rgb * (n.x * n.x - n.y * n.y);
+
+	return max(irradiance, vec3(0.0f));
+}
+
+uint find_cluster(vec2 screen_uv, vec3 world_pos) {
+	float depth = -(cluster_info.view * vec4(world_pos, 1.0f)).z;
+	uint slice = uint(clamp(log(depth) * cluster_info.depth_params.z + cluster_info.depth_params.w, 0.0f, float(cluster_info.grid_size.z - 1)));
+	uvec2 tile = min(uvec2(screen_uv * vec2(cluster_info.grid_size.xy)), cluster_info.grid_size.xy - uvec2(1));
+
+	return (slice * cluster_info.grid_size.y + tile.y) * cluster_info.grid_size.x + tile.x;
+}
+
+// Point and spot lights of the cluster the pixel is in
+vec3 clustered_lights(vec2 screen_uv, vec3 world_pos, vec3 N, vec3 V, vec3 albedo, float roughness, float metallic, vec3 F0) {
+	uvec2 cluster = clusters[find_cluster(screen_uv, world_pos)];
+
+	vec3 Lo = vec3(0.0f);
+	for (uint i = 0; i < cluster.y; i++) {
+		Light light = lights[light_indices[cluster.x + i]];
+
+		vec3 to_light = light.pos - world_pos;
+		float dist = length(to_light);
+		vec3 L = to_light / dist;
+
+		float window = clamp(1.0f - pow(dist / light.range, 4.0f), 0.0f, 1.0f);
+		float attenuation = window * window / (dist * dist + 1.0f);
+
+		if (light.type == LIGHT_TYPE_SPOT)
+			attenuation *= smoothstep(light.cos_outer_cone, light.cos_inner_cone, dot(-L, light.dir));
+
+		if (attenuation > 0.0f)
+			Lo += brdf(N, V, L, albedo, roughness, metallic, F0) * light.color * attenuation;
+	}
+
+	return Lo;
+}
+
+// 3x3 taps of hardware 2x2 PCF in the cascade picked by view depth
+float directional_shadow(vec3 world_pos) {
+	float depth = -(cluster_info.view * vec4(world_pos, 1.0f)).z;
+
+	uint cascade = 0;
+	while (cascade < cascade_info.cascade_count && depth > cascade_info.split_depths[cascade])
+		cascade++;
+
+	if (cascade == cascade_info.cascade_count)
+		return 1.0f;
+
+	vec4 shadow_pos = cascade_info.view_proj[cascade] * vec4(world_pos, 1.0f);
+	vec2 tile = vec2(cascade % SHADOW_ATLAS_TILES, cascade / SHADOW_ATLAS_TILES);
+	float tile_size = 1.0f / SHADOW_ATLAS_TILES;
+
+	// Taps must not reach into neighbouring cascades
+	vec2 tile_min = tile * tile_size + cascade_info.texel_size * 0.5f;
+	vec2 tile_max = (tile + 1.0f) * tile_size - cascade_info.texel_size * 0.5f;
+	vec2 uv = (tile + clamp(shadow_pos.xy * 0.5f + 0.5f, 0.0f, 1.0f)) * tile_size;
+
+	float shadow = 0.0f;
+	for (int y = -1; y <= 1; y++) {
+		for (int x = -1; x <= 1; x++) {
+			vec2 tap_uv = clamp(uv + vec2(x, y) * cascade_info.texel_size, tile_min, tile_max);
+			shadow += texture(shadow_map, vec3(tap_uv, shadow_pos.z));
+		}
+	}
+
+	return shadow / 9.0f;
+}
+
+vec3 octahedral_decode(vec2 e) {
+	e = e * 2.0f - 1.0f;
+
+	vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+
+	return normalize(n);
+}
+
+void main() {
+	// Render area can be smaller than G buffer images with dynamic resolution
+	vec2 g_buffer_uv = gl_FragCoord.xy / vec2(textureSize(depth_map, 0));
+
+	vec3 world_pos = calculate_world_space_position(g_buffer_uv);
+#ifdef PACKED_G_BUFFER
+	vec4 albedo_met = texture(albedo_met_map, g_buffer_uv);
+	vec4 normal_rough = texture(normal_rough_map, g_buffer_uv);
+
+	vec3 albedo = albedo_met.rgb;
+	vec3 ao_rough_met = vec3(1.0f, normal_rough.b, albedo_met.a);
+	vec3 normal = octahedral_decode(normal_rough.rg);
+#else
+	vec3 albedo = texture(albedo_map, g_buffer_uv).rgb;
+	vec3 ao_rough_met = texture(ao_rough_met_map, g_buffer_uv).rgb;
+	vec3 normal = texture(normal_map, g_buffer_uv).xyz;
+#endif
+
+	float roughness = ao_rough_met.g;
+	float metallic = ao_rough_met.b;
+
+	vec3 F0 = vec3(0.04);
+	F0 = mix(F0, albedo, metallic);
+
+	vec3 N = normalize(normal);
+	vec3 V = normalize(camera_pos - world_pos);
+
+	vec3 Lo = brdf(N, V, normalize(light_dir), albedo, roughness, metallic, F0) * light_color * directional_shadow(world_pos);
+	Lo += clustered_lights(in_uv, world_pos, N, V, albedo, roughness, metallic, F0);
 
-	vec3 ambient = vec3(0.35, 0.35, 0.35) * albedo;
-	out_color = vec4(Lo + ambient, 1.0f) + texture(emissive_map, in_uv);
+	vec3 ambient = sh_irradiance(N) * albedo;
+#ifdef PACKED_G_BUFFER
+	// Blended additively onto emissive written by G pass
+	out_color = vec4(Lo + ambient, 0.0f);
+#else
+	out_color = vec4(Lo + ambient, 1.0f) + texture(emissive_map, g_buffer_uv);
+#endif
 }
\ No newline at end of file
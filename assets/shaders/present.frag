@@ -9,6 +9,8 @@ layout(set = 0, binding = 0) uniform sampler2D tex_sampler;
 layout(push_constant) uniform ImageInfo {
 	float exposure;
 	float gamma;
+	vec2 uv_scale; // Part of the image rendered into
+	vec2 uv_max; // Keeps bilinear filtering inside that part
 };
 
 const float A = 0.15;
@@ -30,7 +32,7 @@ vec3 tonemap(vec3 color) {
 }
 
 void main() {
-	vec4 color = texture(tex_sampler, in_tex_pos);
+	vec4 color = texture(tex_sampler, min(in_tex_pos * uv_scale, uv_max));
 	
 	out_color = vec4(tonemap(color.rgb), 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,44 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Alpha test of masked shadow casters, opaque ones are drawn without a fragment shader
+
+layout(location = 0) in vec2 in_uv0;
+layout(location = 1) in vec2 in_uv1;
+layout(location = 2) flat in uint in_material_index;
+
+struct Material {
+	vec4 base_color_factor;
+	vec4 emissive_factor;
+	float metallic_factor;
+	float roughness_factor;
+	int base_color_uv_set;
+	int ao_rough_met_uv_set;
+	int normals_uv_set;
+	int emissive_uv_set;
+	float alpha_mask;
+	float alpha_cutoff;
+	float is_ao_in_rough_met;
+	uint albedo_map;
+	uint ao_rough_met_map;
+	uint normal_map;
+	uint emissive_map;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer Materials {
+	Material materials[];
+};
+
+layout(set = 1, binding = 1) uniform sampler2D textures[];
+
+void main() {
+	Material material = materials[in_material_index];
+
+	// Same test as masked G pass
+	float alpha = material.base_color_factor.a;
+	if (material.base_color_uv_set == 0 || material.base_color_uv_set == 1)
+		alpha *= texture(textures[nonuniformEXT(material.albedo_map)], material.base_color_uv_set == 0 ? in_uv0 : in_uv1).a;
+
+	if (material.alpha_cutoff == 1.0f && alpha < material.alpha_mask)
+		discard;
+}
\ No newline at end of file
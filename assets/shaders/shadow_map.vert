@@ -1,15 +1,50 @@
 #version 450
 
-layout(location = 0) in vec3 in_position;
-layout(location = 1) in vec2 in_tex_pos;
+layout(location = 0) in vec3 in_pos;
+#ifdef ALPHA_MASK
+// Whole vertex is declared, so attribute offsets match the interleaved vertex buffer
+layout(location = 1) in vec3 in_normal;
+layout(location = 2) in vec4 in_tangent;
+layout(location = 3) in vec2 in_uv0;
+layout(location = 4) in vec2 in_uv1;
 
-layout(set = 0, binding = 0) uniform ProjectionView {
-	mat4 proj_view;	
-} pv;
-layout(set = 1, binding = 0) uniform Model {
+layout(location = 0) out vec2 out_uv0;
+layout(location = 1) out vec2 out_uv1;
+layout(location = 2) flat out uint out_material_index;
+#endif
+
+struct Instance {
+	uint transform_index;
+	uint material_index;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer Instances {
+	Instance instances[];
+};
+
+struct Transform {
 	mat4 model;
-} m;
+	mat4 prev_model;
+	mat3 normal;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer Transforms {
+	Transform transforms[];
+};
+
+// Cascade being rendered
+layout(push_constant) uniform Cascade {
+	mat4 view_proj;
+};
 
 void main() {
-	gl_Position = pv.proj_view * m.model * vec4(in_position, 1.0f);
+	Instance instance = instances[gl_InstanceIndex];
+
+	gl_Position = view_proj * transforms[instance.transform_index].model * vec4(in_pos, 1.0f);
+
+#ifdef ALPHA_MASK
+	out_uv0 = in_uv0;
+	out_uv1 = in_uv1;
+	out_material_index = instance.material_index;
+#endif
 }
\ No newline at end of file
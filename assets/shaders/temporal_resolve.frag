@@ -0,0 +1,90 @@
+#version 450
+
+layout(location = 0) in vec2 in_uv; // Output pixel, same position in render area
+
+layout(location = 0) out vec4 out_color;
+
+layout(set = 0, binding = 0) uniform sampler2D composition_map;
+layout(set = 0, binding = 1) uniform sampler2D velocity_map;
+layout(set = 0, binding = 2) uniform sampler2D depth_map;
+layout(set = 0, binding = 3) uniform sampler2D history_map;
+
+layout(push_constant) uniform Info {
+	mat4 reprojection; // Unjittered NDC of this frame to previous frame
+	vec2 render_scale; // Render area over render target size
+	vec2 jitter; // Projection offset in UV
+	float current_weight; // One when history is invalid
+};
+
+vec3 rgb_to_ycocg(vec3 color) {
+	return vec3(
+		 0.25f * color.r + 0.5f * color.g + 0.25f * color.b,
+		 0.5f  * color.r                  - 0.5f  * color.b,
+		-0.25f * color.r + 0.5f * color.g - 0.25f * color.b
+	);
+}
+
+vec3 ycocg_to_rgb(vec3 color) {
+	return vec3(
+		color.x + color.y - color.z,
+		color.x           + color.z,
+		color.x - color.y - color.z
+	);
+}
+
+void main() {
+	vec2 target_size = vec2(textureSize(composition_map, 0));
+	vec2 render_area = target_size * render_scale;
+
+	// Jittered image is shifted by jitter, so unjittered position of this pixel is sampled there
+	vec2 render_pos = (in_uv + jitter) * render_area;
+	ivec2 center = ivec2(render_pos);
+	ivec2 max_texel = ivec2(render_area) - 1;
+
+	// Neighbourhood bounds the history and its closest depth gives velocity, so edges move with the foreground
+	vec3 color_min = vec3(1e10f);
+	vec3 color_max = vec3(-1e10f);
+	float closest_depth = 1.0f;
+	ivec2 closest_texel = clamp(center, ivec2(0), max_texel);
+	for (int y = -1; y <= 1; y++) {
+		for (int x = -1; x <= 1; x++) {
+			ivec2 texel = clamp(center + ivec2(x, y), ivec2(0), max_texel);
+
+			vec3 color = rgb_to_ycocg(texelFetch(composition_map, texel, 0).rgb);
+			color_min = min(color_min, color);
+			color_max = max(color_max, color);
+
+			float depth = texelFetch(depth_map, texel, 0).r;
+			if (depth < closest_depth) {
+				closest_depth = depth;
+				closest_texel = texel;
+			}
+		}
+	}
+
+	vec2 current_uv = clamp(render_pos, vec2(0.5f), render_area - 0.5f) / target_size;
+	vec3 current = rgb_to_ycocg(texture(composition_map, current_uv).rgb);
+
+	// Background has no velocity written, its motion comes from the camera only
+	vec2 velocity;
+	if (closest_depth == 1.0f) {
+		vec4 prev_pos = reprojection * vec4(in_uv * 2.0f - 1.0f, 1.0f, 1.0f);
+		velocity = in_uv - (prev_pos.xy / prev_pos.w * 0.5f + 0.5f);
+	} else
+		velocity = texelFetch(velocity_map, closest_texel, 0).rg;
+
+	vec2 prev_uv = in_uv - velocity;
+	float weight = current_weight;
+	if (any(lessThan(prev_uv, vec2(0.0f))) || any(greaterThan(prev_uv, vec2(1.0f))))
+		weight = 1.0f;
+
+	vec3 history = rgb_to_ycocg(texture(history_map, prev_uv).rgb);
+	history = clamp(history, color_min, color_max);
+
+	// Weights divided by luminance, so single bright samples don't flicker
+	float current_lum_weight = weight / (1.0f + current.x);
+	float history_lum_weight = (1.0f - weight) / (1.0f + history.x);
+	vec3 result = (current * current_lum_weight + history * history_lum_weight) / (current_lum_weight + history_lum_weight);
+
+	out_color = vec4(ycocg_to_rgb(result), 1.0f);
+}
\ No newline at end of file